@@ -2,41 +2,168 @@
 #define COMMON_H
 
 #include <string>
-#include <map>
+#include <string_view>
 #include <cstdint> // For int32_t, int8_t
 
+// How an instruction's 24-bit operand is written in the source
+enum OperandKind : uint8_t {
+    OPERAND_NONE,
+    OPERAND_VALUE,  // A number or label used as is
+    OPERAND_TARGET  // A label, encoded relative to the next instruction
+};
+
+// Opcodes, named after their mnemonics (OP_LDC, OP_HALT, ...)
+enum Opcode : int8_t {
+#define INSTRUCTION(NAME, mnemonic, opcode, operand, isBranch) OP_##NAME = opcode,
+#define PSEUDO(NAME, mnemonic, id, operand) OP_##NAME = id,
+#include "Isa.def"
+#undef INSTRUCTION
+#undef PSEUDO
+};
+
 // Structure to hold information about each instruction mnemonic
 struct OpcodeInfo {
-    int8_t opcode;        // The 8-bit numeric opcode
-    bool expectsOperand;  // True if the instruction takes an operand
+    const char* mnemonic;
+    int8_t opcode;        // The 8-bit numeric opcode; negative for directives
+    OperandKind operand;
+    bool isBranch;        // Transfers control (call, return, br, brz, brlz)
+
+    constexpr bool expectsOperand() const { return operand != OPERAND_NONE; }
+};
+
+// Every mnemonic. Real instructions come first, in opcode order, so
+// opcodeTable[opcode] describes any opcode below OPCODE_COUNT.
+inline constexpr OpcodeInfo opcodeTable[] = {
+#define INSTRUCTION(NAME, mnemonic, opcode, operand, isBranch) { mnemonic, opcode, operand, isBranch },
+#define PSEUDO(NAME, mnemonic, id, operand) { mnemonic, id, operand, false },
+#include "Isa.def"
+#undef INSTRUCTION
+#undef PSEUDO
 };
 
-// This map will be used in Pass 1 and Pass 2
-static std::map<std::string, OpcodeInfo> opcodeTable = {
-    // Instructions with operands
-    {"data", {-1, true}},  // Special case for assembler, not a real opcode
-    {"ldc",  {0,  true}},
-    {"adc",  {1,  true}},
-    {"ldl",  {2,  true}},
-    {"stl",  {3,  true}},
-    {"ldnl", {4,  true}},
-    {"stnl", {5,  true}},
-    {"adj",  {10, true}},
-    {"call", {13, true}},
-    {"brz",  {15, true}},
-    {"brlz", {16, true}},
-    {"br",   {17, true}},
-    {"SET",  {-2, true}},  // Special case for assembler pseudo-instruction
-
-    // Instructions without operands
-    {"add",  {6,  false}},
-    {"sub",  {7,  false}},
-    {"shl",  {8,  false}},
-    {"shr",  {9,  false}},
-    {"a2sp", {11, false}},
-    {"sp2a", {12, false}},
-    {"return",{14, false}},
-    {"HALT", {18, false}}
+inline constexpr int OPCODE_COUNT = 0
+#define INSTRUCTION(NAME, mnemonic, opcode, operand, isBranch) + 1
+#define PSEUDO(NAME, mnemonic, id, operand)
+#include "Isa.def"
+#undef INSTRUCTION
+#undef PSEUDO
+    ;
+
+inline constexpr int MNEMONIC_COUNT = sizeof(opcodeTable) / sizeof(opcodeTable[0]);
+
+// The block instructions, bcopy to bsort
+constexpr bool isBlockOpcode(int opcode) {
+    return opcode >= OP_BCOPY && opcode <= OP_BSORT;
+}
+
+// The core instructions, spawn to fence
+constexpr bool isCoreOpcode(int opcode) {
+    return opcode >= OP_SPAWN && opcode <= OP_FENCE;
+}
+
+namespace isa {
+
+constexpr bool opcodesInOrder() {
+    for (int i = 0; i < OPCODE_COUNT; i++) {
+        if (opcodeTable[i].opcode != i) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(opcodesInOrder(), "Isa.def must list instructions in opcode order");
+
+// Perfect hash of the mnemonics: FNV-1a with a seed searched for at compile
+// time, so that every mnemonic lands in its own slot
+const int HASH_BITS = 7;
+const int HASH_SLOTS = 1 << HASH_BITS;
+
+constexpr uint32_t hashSlot(std::string_view name, uint32_t seed) {
+    uint32_t value = 2166136261u ^ seed;
+    for (char c : name) {
+        value = (value ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return value >> (32 - HASH_BITS); // The low bits mix poorly
+}
+
+constexpr bool isPerfectSeed(uint32_t seed) {
+    bool used[HASH_SLOTS] = {};
+    for (int i = 0; i < MNEMONIC_COUNT; i++) {
+        uint32_t slot = hashSlot(opcodeTable[i].mnemonic, seed);
+        if (used[slot]) {
+            return false;
+        }
+        used[slot] = true;
+    }
+    return true;
+}
+
+constexpr uint32_t findPerfectSeed() {
+    uint32_t seed = 0;
+    while (!isPerfectSeed(seed)) {
+        seed++;
+    }
+    return seed;
+}
+
+inline constexpr uint32_t HASH_SEED = findPerfectSeed();
+
+// Slot -> index into opcodeTable, or -1
+struct HashSlots {
+    int8_t index[HASH_SLOTS];
 };
 
-#endif // COMMON_H
\ No newline at end of file
+constexpr HashSlots buildHashSlots() {
+    HashSlots slots = {};
+    for (int i = 0; i < HASH_SLOTS; i++) {
+        slots.index[i] = -1;
+    }
+    for (int i = 0; i < MNEMONIC_COUNT; i++) {
+        slots.index[hashSlot(opcodeTable[i].mnemonic, HASH_SEED)] = static_cast<int8_t>(i);
+    }
+    return slots;
+}
+
+inline constexpr HashSlots hashSlots = buildHashSlots();
+
+} // namespace isa
+
+// Index into opcodeTable of a mnemonic, or -1 if there is no such mnemonic
+constexpr int findMnemonic(std::string_view name) {
+    int index = isa::hashSlots.index[isa::hashSlot(name, isa::HASH_SEED)];
+    return index >= 0 && name == opcodeTable[index].mnemonic ? index : -1;
+}
+
+static_assert(findMnemonic("HALT") == OP_HALT && findMnemonic("halt") == -1, "mnemonic hash");
+
+// Reverse lookup used by the emulator's tools: the mnemonic for a real
+// opcode, or an empty string if there is none
+inline std::string mnemonicFor(int opcode) {
+    return opcode >= 0 && opcode < OPCODE_COUNT ? opcodeTable[opcode].mnemonic : "";
+}
+
+// One word as "mnemonic operand", or an empty string for an unknown opcode
+inline std::string disassemble(int32_t word) {
+    int32_t opcode = word & 0xFF;
+    if (opcode >= OPCODE_COUNT) {
+        return "";
+    }
+    const OpcodeInfo& info = opcodeTable[opcode];
+    if (info.expectsOperand()) {
+        return std::string(info.mnemonic) + " " + std::to_string(word >> 8);
+    }
+    return info.mnemonic;
+}
+
+// Writes 'value' as 8 lowercase hex digits, like "%08x" but much cheaper
+// than snprintf, and returns the end. No terminator is written.
+inline char* formatHex32(uint32_t value, char* out) {
+    static constexpr char digits[] = "0123456789abcdef";
+    for (int i = 7; i >= 0; i--) {
+        out[i] = digits[value & 0xF];
+        value >>= 4;
+    }
+    return out + 8;
+}
+
+#endif // COMMON_H
@@ -0,0 +1,92 @@
+#ifndef OBJECT_FORMAT_H
+#define OBJECT_FORMAT_H
+
+#include <cstdint>
+
+// Relocatable object files, written by `asm -c` and combined by `link`
+// into a flat (version 1) executable.
+//
+// On-disk layout: this header, the module's code words (addresses start at
+// zero), the symbols, the relocations, then the symbol names as
+// NUL-terminated strings referenced by offset.
+struct ObjectHeader {
+    char magic[8];            // "VMOBJ"
+    uint32_t version;
+    uint32_t wordCount;
+    uint32_t symbolCount;
+    uint32_t relocationCount;
+    uint32_t nameBytes;
+    uint32_t reserved;
+};
+
+const char OBJECT_MAGIC[8] = "VMOBJ";
+const uint32_t OBJECT_VERSION = 1;
+
+enum ObjectSymbolFlags : uint32_t {
+    SYMBOL_EXPORTED = 1,  // Declared global: other modules may import it
+    SYMBOL_CONSTANT = 2,  // A SET value rather than an address
+    SYMBOL_IMPORTED = 4   // Declared extern: defined by another module
+};
+
+struct ObjectSymbol {
+    uint32_t nameOffset;
+    int32_t value;        // Module-relative address or constant; 0 if imported
+    uint32_t flags;
+};
+
+enum RelocationKind : uint32_t {
+    RELOC_OPERAND,  // Add the symbol's address to the 24-bit operand
+    RELOC_WORD,     // Add the symbol's address to the whole word (data)
+    RELOC_BRANCH    // Operand becomes target - (address + 1)
+};
+
+// Uses of addresses the module cannot know on its own. 'symbol' indexes
+// the module's symbols, or is RELOC_MODULE_BASE for a reference into the
+// module itself, which only moves by the module's load address. Branches
+// within a module are PC-relative and need no relocation.
+struct ObjectRelocation {
+    uint32_t address;
+    uint32_t kind;
+    uint32_t symbol;
+};
+
+const uint32_t RELOC_MODULE_BASE = UINT32_MAX;
+
+// Executables, written by `asm` and loaded by the emulator.
+//
+// Version 1 is a headerless stream of words loaded at address 0, as `link`
+// and `asm --flat` still write. Version 2 starts with this header. The
+// stored words follow it, in address order from 0, so a loader can read
+// them into guest memory with one read; the zero-filled words after them
+// take no file space. Then come the segment table, the symbols (as
+// ObjectSymbols, sorted by name) and their NUL-terminated names.
+struct ExecutableHeader {
+    char magic[8];            // "VMEXE"
+    uint32_t version;
+    int32_t entry;            // Initial PC
+    uint32_t storedWords;     // Words in the file: addresses [0, storedWords)
+    uint32_t zeroWords;       // Zero-filled words after them
+    uint32_t segmentCount;
+    uint32_t symbolCount;
+    uint32_t nameBytes;
+    uint32_t reserved;
+};
+
+const char EXECUTABLE_MAGIC[8] = "VMEXE";
+const uint32_t EXECUTABLE_VERSION = 2;
+
+enum SegmentKind : uint32_t {
+    SEGMENT_CODE,  // Instructions
+    SEGMENT_DATA,  // 'data' words
+    SEGMENT_ZERO   // Trailing 'data 0' words, not stored
+};
+
+// A run of words of one kind. The segments are in address order and cover
+// [0, storedWords + zeroWords) without gaps.
+struct ExecutableSegment {
+    uint32_t address;
+    uint32_t wordCount;
+    uint32_t kind;
+};
+
+#endif // OBJECT_FORMAT_H
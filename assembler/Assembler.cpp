@@ -1,116 +1,413 @@
 #include "Assembler.h"
 #include <iostream>
 #include <fstream>
-#include <sstream>
-#include <iomanip>   // For formatting the listing file
-#include <algorithm> // For std::find
+#include <cstring>   // For memcpy
+#include <algorithm> // For std::find, std::sort
 #include <cctype>    // For isspace
 #include <cstdlib>   // For strtol
+#include <fcntl.h>   // For open (backpatching)
+#include <unistd.h>  // For pwrite
+#include <atomic>
+#include <functional>
+#include <thread>
+
+namespace {
 
 // Helper function to trim whitespace from both ends of a string
-std::string trim(const std::string& str) {
+std::string_view trim(std::string_view str) {
     size_t first = str.find_first_not_of(" \t\n\r");
-    if (std::string::npos == first) {
-        return "";
+    if (std::string_view::npos == first) {
+        return std::string_view();
     }
     size_t last = str.find_last_not_of(" \t\n\r");
     return str.substr(first, (last - first + 1));
 }
 
-Assembler::Assembler() {
+} // namespace
+
+void Assembler::ProgramIR::clear() {
+    address.clear();
+    mnemonic.clear();
+    symbol.clear();
+    number.clear();
+    operandOffset.clear();
+    operandLength.clear();
+    lineNumber.clear();
+}
+
+Assembler::Assembler() : numericLabels(false), singlePass(false), threads(0), relocatable(false), flat(false),
+                         listing(true), optimize(false), verbose(true), entryLabel(SymbolTable::NONE), entryLine(0),
+                         wordsOffset(0), zeroFrom(0) {
     // Constructor. The opcodeTable is already initialized in Common.h.
 }
 
+void Assembler::setSinglePass(bool enabled) {
+    singlePass = enabled;
+}
+
+void Assembler::setThreads(unsigned count) {
+    threads = count;
+}
+
+void Assembler::setRelocatable(bool enabled) {
+    relocatable = enabled;
+}
+
+void Assembler::setFlat(bool enabled) {
+    flat = enabled;
+}
+
+void Assembler::setListing(bool enabled) {
+    listing = enabled;
+}
+
+void Assembler::setOptimize(bool enabled) {
+    optimize = enabled;
+}
+
+void Assembler::setVerbose(bool enabled) {
+    verbose = enabled;
+}
+
 bool Assembler::assemble(const std::string& inputFilename, 
                          const std::string& outputObjectFilename, 
                          const std::string& outputListFilename) {
-    
-    std::cout << "Starting Pass 1..." << std::endl;
+    messages.clear();
+
+    if (singlePass) {
+        progress("Starting single pass...");
+        if (!performSinglePass(inputFilename, outputObjectFilename, outputListFilename)) {
+            logError("Single pass failed.");
+            return false;
+        }
+        progress("Single pass complete. Object and listing files generated.");
+        return true;
+    }
+
+    progress("Starting Pass 1...");
     if (!performPass1(inputFilename)) {
         logError("Pass 1 failed.");
         return false;
     }
-    std::cout << "Pass 1 complete. Symbol table built." << std::endl;
+    progress("Pass 1 complete. Symbol table built.");
+
+    originalMnemonic.clear();
+    if (optimize) {
+        performOptimization();
+    }
 
-    std::cout << "Starting Pass 2..." << std::endl;
+    progress("Starting Pass 2...");
     if (!performPass2(outputObjectFilename, outputListFilename)) {
         logError("Pass 2 failed.");
         return false;
     }
-    std::cout << "Pass 2 complete. Object and listing files generated." << std::endl;
-    
+    progress("Pass 2 complete. Object and listing files generated.");
+
     return true;
 }
 
 bool Assembler::performPass1(const std::string& inputFilename) {
-    std::ifstream inFile(inputFilename);
-    if (!inFile) {
+    if (!source.open(inputFilename)) {
         logError("Could not open input file: " + inputFilename);
         return false;
     }
 
-    std::string line;
+    program.clear(); // Clear any previous assembly
+    symbols.clear();
+    globals.clear();
+    entryLabel = SymbolTable::NONE;
+    numericLabels = false;
+
+    // Split the text at line boundaries and parse the pieces in parallel.
+    // Only word and line counts and label definitions cross chunks.
+    std::string_view text = source.text();
+    size_t chunkSize = std::max(PASS1_MIN_CHUNK, text.size() / (threadCount() * 4) + 1);
+    std::vector<SourceChunk> chunks;
+    for (size_t begin = 0; begin < text.size(); ) {
+        size_t end = text.size();
+        if (text.size() - begin > chunkSize) {
+            end = text.find('\n', begin + chunkSize);
+            end = end == std::string_view::npos ? text.size() : end + 1;
+        }
+        chunks.emplace_back();
+        chunks.back().begin = begin;
+        chunks.back().end = end;
+        begin = end;
+    }
+    runParallel(chunks.size(), [&](size_t c) {
+        parseChunk(chunks[c]);
+    });
+
+    // In source order: base addresses and line numbers from a prefix sum,
+    // then the labels and SET constants, with the same errors a
+    // line-by-line pass would stop at
     int32_t locationCounter = 0; // Code starts at address zero
-    int lineNumber = 0;
+    uint32_t lineBase = 0;
+    size_t entryBase = 0;
+    for (SourceChunk& chunk : chunks) {
+        chunk.wordBase = locationCounter;
+        chunk.lineBase = lineBase;
+        chunk.entryBase = entryBase;
 
-    programLines.clear(); // Clear any previous assembly
-    symbolTable.clear();
+        for (const SymbolDefinition& definition : chunk.definitions) {
+            int lineNumber = static_cast<int>(lineBase + definition.lineNumber);
+            SymbolTable::Id label = symbols.intern(definition.name);
+            if (definition.kind == SymbolDefinition::GLOBAL) {
+                symbols.exportSymbol(label);
+                globals.push_back(std::make_pair(label, lineNumber));
+                continue;
+            }
+            if (definition.kind == SymbolDefinition::ENTRY) {
+                if (relocatable || flat) {
+                    logError("entry needs a version 2 executable (not -c or --flat): " + std::string(definition.name),
+                             lineNumber);
+                    return false;
+                }
+                if (entryLabel != SymbolTable::NONE) {
+                    logError("Duplicate entry point: " + std::string(definition.name), lineNumber);
+                    return false;
+                }
+                entryLabel = label;
+                entryLine = lineNumber;
+                continue;
+            }
+            if (definition.kind == SymbolDefinition::EXTERN) {
+                if (!relocatable) {
+                    logError("extern needs a relocatable object (asm -c): " + std::string(definition.name),
+                             lineNumber);
+                    return false;
+                }
+                if (symbols.isDefined(label) && !symbols.isExternal(label)) {
+                    logError("Label declared extern is defined here: " + std::string(definition.name), lineNumber);
+                    return false;
+                }
+                symbols.declareExternal(label);
+                continue;
+            }
+            if (symbols.isExternal(label)) {
+                logError("Label declared extern is defined here: " + std::string(definition.name), lineNumber);
+                return false;
+            }
+            if (symbols.isDefined(label)) {
+                logError("Duplicate label definition: " + std::string(definition.name), lineNumber);
+                return false;
+            }
+            symbols.define(label, locationCounter + definition.address);
+            long number;
+            numericLabels = numericLabels || parseNumber(definition.name, number);
 
-    while (std::getline(inFile, line)) {
+            if (definition.kind == SymbolDefinition::SET) {
+                // A SET operand must be a number; it can't be a forward ref
+                SymbolTable::Id named = symbols.find(definition.setOperand);
+                long value = 0;
+                if ((named != SymbolTable::NONE && symbols.isDefined(named)) ||
+                    !parseNumber(definition.setOperand, value)) {
+                     logError("Invalid operand for SET. Must be a number.", lineNumber);
+                     return false;
+                }
+                checkOperandRange(value, false);
+                // Update the symbol table with the SET value
+                symbols.define(label, static_cast<int32_t>(value), true);
+            } else if (definition.entry != NO_ENTRY) {
+                chunk.program.symbol[definition.entry] = label;
+            }
+        }
+        if (chunk.failed) {
+            logError(chunk.error.message, static_cast<int>(lineBase + chunk.error.lineNumber));
+            return false;
+        }
+
+        locationCounter += chunk.words;
+        lineBase += chunk.lines;
+        entryBase += chunk.program.size();
+    }
+
+    for (const auto& global : globals) {
+        if (!symbols.isDefined(global.first) || symbols.isExternal(global.first)) {
+            logError("Global symbol is not defined in this file: " + std::string(symbols.name(global.first)),
+                     global.second);
+            return false;
+        }
+    }
+    if (entryLabel != SymbolTable::NONE &&
+        (!symbols.isDefined(entryLabel) || symbols.isConstant(entryLabel))) {
+        logError("Entry point is not a label in this file: " + std::string(symbols.name(entryLabel)), entryLine);
+        return false;
+    }
+
+    // Every label is defined now: copy the chunks into place and resolve
+    // operand names, again in parallel
+    program.address.resize(entryBase);
+    program.mnemonic.resize(entryBase);
+    program.symbol.resize(entryBase);
+    program.number.resize(entryBase);
+    program.operandOffset.resize(entryBase);
+    program.operandLength.resize(entryBase);
+    program.lineNumber.resize(entryBase);
+    runParallel(chunks.size(), [&](size_t c) {
+        SourceChunk& chunk = chunks[c];
+        const ProgramIR& local = chunk.program;
+        for (size_t i = 0; i < local.size(); i++) {
+            size_t entry = chunk.entryBase + i;
+            program.address[entry] = chunk.wordBase + local.address[i];
+            program.mnemonic[entry] = local.mnemonic[i];
+            program.number[entry] = local.number[i];
+            program.operandOffset[entry] = local.operandOffset[i];
+            program.operandLength[entry] = local.operandLength[i];
+            program.lineNumber[entry] = chunk.lineBase + local.lineNumber[i];
+
+            SymbolTable::Id symbol = local.symbol[i];
+            if (symbol == UNRESOLVED) {
+                symbol = symbols.find(operandText(entry));
+                if (symbol == SymbolTable::NONE) {
+                    chunk.undefined.push_back(entry); // Interned below
+                }
+            }
+            program.symbol[entry] = symbol;
+        }
+        chunk.program.clear();
+    });
+
+    // Names that are never defined still get Ids (Pass 2 reports them)
+    for (const SourceChunk& chunk : chunks) {
+        for (size_t entry : chunk.undefined) {
+            program.symbol[entry] = symbols.intern(operandText(entry));
+        }
+    }
+
+    return true;
+}
+
+void Assembler::parseChunk(SourceChunk& chunk) const {
+    std::string_view line;
+    size_t position = chunk.begin;
+    int32_t locationCounter = 0; // Relative to the chunk
+    uint32_t lineNumber = 0;
+    chunk.lines = 0;
+    chunk.words = 0;
+    chunk.failed = false;
+
+    while (position < chunk.end && source.nextLine(position, line)) {
         lineNumber++;
         
         ParsedLine pLine = parseLine(line);
-        pLine.originalLine = line; // Store original for listing
 
         // Ignore empty lines (comments/whitespace only)
         if (pLine.mnemonic.empty() && pLine.label.empty()) {
             continue;
         }
 
-        pLine.address = locationCounter;
-        
-        // If there's a label, add it to the symbol table
+        // If there's a label, record it for the symbol table
+        SymbolDefinition::Kind kind = SymbolDefinition::LABEL;
+        if (pLine.mnemonic == "SET") {
+            kind = SymbolDefinition::SET;
+        } else if (pLine.mnemonic == "global") {
+            kind = SymbolDefinition::GLOBAL;
+        } else if (pLine.mnemonic == "extern") {
+            kind = SymbolDefinition::EXTERN;
+        } else if (pLine.mnemonic == "entry") {
+            kind = SymbolDefinition::ENTRY;
+        }
+        bool isSet = kind == SymbolDefinition::SET;
+        uint32_t entry = NO_ENTRY;
         if (!pLine.label.empty()) {
-            if (symbolTable.count(pLine.label)) {
-                logError("Duplicate label definition: " + pLine.label, lineNumber);
-                return false;
+            if (pLine.mnemonic.empty()) {
+                entry = static_cast<uint32_t>(chunk.program.size());
             }
-            symbolTable[pLine.label] = locationCounter;
+            SymbolDefinition definition = { pLine.label, lineNumber, locationCounter, entry,
+                                            isSet ? SymbolDefinition::SET : SymbolDefinition::LABEL,
+                                            pLine.operandStr };
+            chunk.definitions.push_back(definition);
         }
 
-        // If it's a 'SET' pseudo-instruction, handle it
-        if (pLine.mnemonic == "SET") {
-            if (pLine.label.empty()) {
-                logError("SET instruction requires a label", lineNumber);
-                return false;
+        // 'global name', 'extern name' and 'entry name' declare symbols;
+        // like SET they generate no code
+        if (kind == SymbolDefinition::GLOBAL || kind == SymbolDefinition::EXTERN ||
+            kind == SymbolDefinition::ENTRY) {
+            if (pLine.operandStr.empty()) {
+                chunk.error = Diagnostic{ "Missing operand for: " + std::string(pLine.mnemonic),
+                                          static_cast<int>(lineNumber) };
+                chunk.failed = true;
+                break;
             }
-            // Resolve its operand *now* (it can't be a forward ref).
-            bool isValid = true;
-            // SET operands cannot be labels, so isBranch=false, currentPC=0 are fine
-            int32_t value = resolveOperand(pLine.operandStr, 0, false, isValid);
-            
-            if (!isValid || symbolTable.count(pLine.operandStr)) {
-                 logError("Invalid operand for SET. Must be a number.", lineNumber);
-                 return false;
+            SymbolDefinition declaration = { pLine.operandStr, lineNumber, locationCounter, NO_ENTRY, kind,
+                                             std::string_view() };
+            chunk.definitions.push_back(declaration);
+            continue;
+        }
+
+        // If it's a 'SET' pseudo-instruction, its value is checked once
+        // earlier labels are known
+        if (isSet) {
+            if (pLine.label.empty()) {
+                chunk.error = Diagnostic{ "SET instruction requires a label", static_cast<int>(lineNumber) };
+                chunk.failed = true;
+                break;
             }
-            // Update the symbol table with the SET value
-            symbolTable[pLine.label] = value;
-            // Do NOT increment locationCounter and do NOT store in programLines.
+            // Do NOT increment locationCounter and do NOT store in the IR.
             // A 'SET' instruction does not generate code.
+            continue;
+        }
+
+        uint8_t mnemonic = LABEL_LINE;
+        SymbolTable::Id symbol = SymbolTable::NONE; // Labels are filled in later
+        long number = 0;
+        if (!pLine.mnemonic.empty()) {
+            int index = findMnemonic(pLine.mnemonic);
+            if (index < 0) {
+                chunk.error = Diagnostic{ "Unknown instruction: " + std::string(pLine.mnemonic),
+                                          static_cast<int>(lineNumber) };
+                chunk.failed = true;
+                break;
+            }
+            mnemonic = static_cast<uint8_t>(index);
+            // Operands that are not numbers name symbols, defined or not yet
+            if (!pLine.operandStr.empty() && !parseNumber(pLine.operandStr, number)) {
+                symbol = UNRESOLVED;
+            }
         }
+
+        chunk.program.address.push_back(locationCounter);
+        chunk.program.mnemonic.push_back(mnemonic);
+        chunk.program.symbol.push_back(symbol);
+        chunk.program.number.push_back(number);
+        chunk.program.operandOffset.push_back(pLine.operandStr.data() - source.text().data());
+        chunk.program.operandLength.push_back(static_cast<uint32_t>(pLine.operandStr.size()));
+        chunk.program.lineNumber.push_back(lineNumber);
+
         // If there's an instruction or 'data', it takes up one 32-bit word.
-        else if (!pLine.mnemonic.empty()) {
-            programLines.push_back(pLine);
-            locationCounter++; // Each instruction/data takes one 32-bit location
-        } else {
-            // This case is just a label on its own line.
-            // The label is already processed, but we store the line for the listing file.
-            programLines.push_back(pLine);
+        // A label on its own is kept for the listing file only.
+        if (mnemonic != LABEL_LINE) {
+            locationCounter++;
         }
     }
+    chunk.lines = lineNumber;
+    chunk.words = locationCounter;
+}
 
-    inFile.close();
-    return true;
+std::string_view Assembler::operandText(size_t entry) const {
+    return source.text().substr(program.operandOffset[entry], program.operandLength[entry]);
+}
+
+unsigned Assembler::threadCount() const {
+    return threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+void Assembler::runParallel(size_t taskCount, const std::function<void(size_t)>& task) const {
+    std::atomic<size_t> nextTask(0);
+    auto worker = [&]() {
+        for (size_t t = nextTask++; t < taskCount; t = nextTask++) {
+            task(t);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threadCount() && t < taskCount; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
 }
 
 bool Assembler::performPass2(const std::string& outputObjectFilename, 
@@ -122,125 +419,697 @@ bool Assembler::performPass2(const std::string& outputObjectFilename,
         return false;
     }
 
-    std::ofstream lstFile(outputListFilename);
-    if (!lstFile) {
-        logError("Could not open listing file for writing: " + outputListFilename);
-        return false;
+    std::ofstream lstFile;
+    if (listing) {
+        lstFile.open(outputListFilename);
+        if (!lstFile) {
+            logError("Could not open listing file for writing: " + outputListFilename);
+            return false;
+        }
     }
 
-    // Set up formatting for the listing file
-    lstFile << std::hex << std::setfill('0');
+    // Every address is fixed, so each chunk of lines can be encoded on its
+    // own thread, straight into its place in the object image
+    size_t wordCount = program.size() ? program.address.back() + (program.mnemonic.back() < REMOVED_LINE) : 0;
+    std::vector<int32_t> words(wordCount);
 
-    for (const auto& pLine : programLines) {
+    size_t chunkSize = std::max(PASS2_MIN_CHUNK, program.size() / (threadCount() * 4) + 1);
+    std::vector<CodeChunk> chunks;
+    for (size_t begin = 0; begin < program.size(); begin += chunkSize) {
+        CodeChunk chunk;
+        chunk.begin = begin;
+        chunk.end = std::min(program.size(), begin + chunkSize);
+        chunk.stoppedAt = chunk.end;
+        chunks.push_back(chunk);
+    }
+
+    runParallel(chunks.size(), [&](size_t c) {
+        generateCode(chunks[c], words.data());
+    });
+
+    // Report and write out in source order, stopping at the first error
+    // just as a sequential pass would
+    for (const CodeChunk& chunk : chunks) {
+        for (const Diagnostic& diagnostic : chunk.diagnostics) {
+            logError(diagnostic.message, diagnostic.lineNumber);
+        }
+        lstFile.write(chunk.listing.data(), chunk.listing.size());
+        if (chunk.stoppedAt != chunk.end) {
+            objFile.write(reinterpret_cast<const char*>(words.data()),
+                          program.address[chunk.stoppedAt] * sizeof(int32_t));
+            return false;
+        }
+    }
+    if (relocatable) {
+        writeObject(objFile, words, chunks);
+    } else if (flat) {
+        objFile.write(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(int32_t));
+    } else {
+        writeExecutable(objFile, words);
+    }
+
+    if (listing) {
+        std::string symbolTable;
+        writeSymbolTable(symbolTable);
+        lstFile.write(symbolTable.data(), symbolTable.size());
+    }
+
+    objFile.close();
+    lstFile.close();
+    return true;
+}
+
+void Assembler::writeObject(std::ostream& objFile, const std::vector<int32_t>& words,
+                            const std::vector<CodeChunk>& chunks) const {
+    // Every defined symbol goes out, so the linker can also produce a full
+    // map; uses only ever refer to imported ones
+    std::vector<ObjectSymbol> objectSymbols;
+    std::vector<uint32_t> index;
+    std::string names;
+    collectSymbols(objectSymbols, names, index);
+
+    std::vector<ObjectRelocation> relocations;
+    for (const CodeChunk& chunk : chunks) {
+        for (ObjectRelocation relocation : chunk.relocations) {
+            if (relocation.symbol != RELOC_MODULE_BASE) {
+                relocation.symbol = index[relocation.symbol];
+            }
+            relocations.push_back(relocation);
+        }
+    }
+
+    ObjectHeader header = {};
+    std::memcpy(header.magic, OBJECT_MAGIC, sizeof(header.magic));
+    header.version = OBJECT_VERSION;
+    header.wordCount = static_cast<uint32_t>(words.size());
+    header.symbolCount = static_cast<uint32_t>(objectSymbols.size());
+    header.relocationCount = static_cast<uint32_t>(relocations.size());
+    header.nameBytes = static_cast<uint32_t>(names.size());
+    objFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    objFile.write(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(int32_t));
+    objFile.write(reinterpret_cast<const char*>(objectSymbols.data()), objectSymbols.size() * sizeof(ObjectSymbol));
+    objFile.write(reinterpret_cast<const char*>(relocations.data()), relocations.size() * sizeof(ObjectRelocation));
+    objFile.write(names.data(), names.size());
+}
+
+void Assembler::writeExecutable(std::ostream& objFile, const std::vector<int32_t>& words) const {
+    std::vector<ExecutableSegment> segments;
+    for (size_t i = 0; i < program.size(); i++) {
+        if (program.mnemonic[i] < REMOVED_LINE) {
+            bool isData = opcodeTable[program.mnemonic[i]].opcode == OP_DATA;
+            addSegmentWord(segments, isData ? SEGMENT_DATA : SEGMENT_CODE);
+        }
+    }
+
+    // Zero data at the very end need not be stored
+    uint32_t zeroFrom = static_cast<uint32_t>(words.size());
+    if (!segments.empty() && segments.back().kind == SEGMENT_DATA) {
+        while (zeroFrom > segments.back().address && words[zeroFrom - 1] == 0) {
+            zeroFrom--;
+        }
+    }
+
+    ExecutableHeader header;
+    std::string trailer;
+    finishExecutable(segments, zeroFrom, header, trailer);
+    objFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    objFile.write(reinterpret_cast<const char*>(words.data()), zeroFrom * sizeof(int32_t));
+    objFile.write(trailer.data(), trailer.size());
+}
+
+void Assembler::collectSymbols(std::vector<ObjectSymbol>& objectSymbols, std::string& names,
+                               std::vector<uint32_t>& index, bool sortByName) const {
+    std::vector<SymbolTable::Id> order(symbols.size());
+    for (SymbolTable::Id id = 0; id < symbols.size(); id++) {
+        order[id] = id;
+    }
+    if (sortByName) {
+        std::sort(order.begin(), order.end(), [&](SymbolTable::Id a, SymbolTable::Id b) {
+            return symbols.name(a) < symbols.name(b);
+        });
+    }
+
+    index.assign(symbols.size(), RELOC_MODULE_BASE);
+    for (SymbolTable::Id id : order) {
+        if (!symbols.isDefined(id)) {
+            continue;
+        }
+        uint32_t flags = 0;
+        if (symbols.isExported(id)) {
+            flags |= SYMBOL_EXPORTED;
+        }
+        if (symbols.isConstant(id)) {
+            flags |= SYMBOL_CONSTANT;
+        }
+        if (symbols.isExternal(id)) {
+            flags |= SYMBOL_IMPORTED;
+        }
+        index[id] = static_cast<uint32_t>(objectSymbols.size());
+        objectSymbols.push_back(ObjectSymbol{ static_cast<uint32_t>(names.size()), symbols.value(id), flags });
+        names.append(symbols.name(id)).push_back('\0');
+    }
+}
+
+void Assembler::addSegmentWord(std::vector<ExecutableSegment>& segments, SegmentKind kind) {
+    if (!segments.empty() && segments.back().kind == kind) {
+        segments.back().wordCount++;
+        return;
+    }
+    uint32_t address = segments.empty() ? 0 : segments.back().address + segments.back().wordCount;
+    segments.push_back(ExecutableSegment{ address, 1, kind });
+}
+
+void Assembler::finishExecutable(std::vector<ExecutableSegment>& segments, uint32_t zeroFrom,
+                                 ExecutableHeader& header, std::string& trailer) const {
+    uint32_t wordCount = segments.empty() ? 0 : segments.back().address + segments.back().wordCount;
+    while (!segments.empty() && segments.back().address >= zeroFrom) {
+        segments.pop_back();
+    }
+    if (!segments.empty()) {
+        segments.back().wordCount = zeroFrom - segments.back().address;
+    }
+    if (zeroFrom < wordCount) {
+        segments.push_back(ExecutableSegment{ zeroFrom, wordCount - zeroFrom, SEGMENT_ZERO });
+    }
+
+    // Sorted, so that the output does not depend on the order names were
+    // first seen in, and loaders can search the table
+    std::vector<ObjectSymbol> objectSymbols;
+    std::vector<uint32_t> index;
+    std::string names;
+    collectSymbols(objectSymbols, names, index, true);
+
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, EXECUTABLE_MAGIC, sizeof(header.magic));
+    header.version = EXECUTABLE_VERSION;
+    header.entry = entryLabel != SymbolTable::NONE ? symbols.value(entryLabel) : 0;
+    header.storedWords = zeroFrom;
+    header.zeroWords = wordCount - zeroFrom;
+    header.segmentCount = static_cast<uint32_t>(segments.size());
+    header.symbolCount = static_cast<uint32_t>(objectSymbols.size());
+    header.nameBytes = static_cast<uint32_t>(names.size());
+
+    trailer.assign(reinterpret_cast<const char*>(segments.data()), segments.size() * sizeof(ExecutableSegment));
+    trailer.append(reinterpret_cast<const char*>(objectSymbols.data()), objectSymbols.size() * sizeof(ObjectSymbol));
+    trailer.append(names);
+}
+
+void Assembler::generateCode(CodeChunk& chunk, int32_t* words) const {
+    const char* text = source.text().data();
+    if (listing) {
+        chunk.listing.reserve((chunk.end - chunk.begin) * 40); // About one line per entry
+    }
+    for (size_t i = chunk.begin; i < chunk.end; i++) {
         // Handle lines that are just labels
-        if (pLine.mnemonic.empty()) {
-            if (!pLine.label.empty()) {
-                // Format: "start:"
-                lstFile << "\n" << pLine.label << ":" << std::endl;
+        if (program.mnemonic[i] == LABEL_LINE) {
+            // Format: "start:"
+            if (listing) {
+                chunk.listing.append("\n").append(symbols.name(program.symbol[i])).append(":\n");
             }
             continue; // Nothing to write to object file
         }
 
-        // Find the instruction in the opcode table
-        auto it = opcodeTable.find(pLine.mnemonic);
-        if (it == opcodeTable.end()) {
-            logError("Unknown instruction: " + pLine.mnemonic);
-            return false;
+        // The listing keeps what the optimizer removed or rewrote (the
+        // operand of a rewritten instruction is always a plain number)
+        bool optimized = !originalMnemonic.empty() && originalMnemonic[i] != LABEL_LINE;
+        std::string_view originalText(text + program.operandOffset[i], program.operandLength[i]);
+        if (program.mnemonic[i] == REMOVED_LINE) {
+            if (listing) {
+                chunk.listing.append(21, ' ').append(opcodeTable[originalMnemonic[i]].mnemonic).append(" ")
+                             .append(originalText).append(" ; removed by -O\n");
+            }
+            continue;
         }
 
-        const OpcodeInfo& opInfo = it->second;
+        const OpcodeInfo& opInfo = opcodeTable[program.mnemonic[i]];
+        const char* mnemonic = opInfo.mnemonic;
+        std::string_view operandStr = originalText;
+        std::string rewrittenOperand;
+        if (optimized) {
+            rewrittenOperand = std::to_string(program.number[i]);
+            operandStr = rewrittenOperand;
+        }
+        int lineNumber = static_cast<int>(program.lineNumber[i]);
+        int32_t address = program.address[i];
         int32_t operandValue = 0;
-        bool operandValid = true;
+        std::string error;
 
         // Handle operand
-        if (opInfo.expectsOperand) {
-            if (pLine.operandStr.empty()) {
-                logError("Missing operand for: " + pLine.mnemonic);
-                return false;
+        if (opInfo.expectsOperand()) {
+            bool isBranch = opInfo.operand == OPERAND_TARGET;
+            SymbolTable::Id symbol = program.symbol[i];
+            if (symbol == SymbolTable::NONE && numericLabels) {
+                symbol = symbols.find(operandStr); // A label spelled like a number
             }
-            
-            bool isBranch = (pLine.mnemonic == "br" || pLine.mnemonic == "brz" || pLine.mnemonic == "brlz" || pLine.mnemonic == "call");
-            operandValue = resolveOperand(pLine.operandStr, pLine.address, isBranch, operandValid);
+            if (operandStr.empty()) {
+                error = "Missing operand for: " + std::string(mnemonic);
+            } else if (symbol != SymbolTable::NONE && symbols.isDefined(symbol)) {
+                // Branch instructions use a PC-relative offset
+                int32_t labelAddress = symbols.value(symbol);
+                operandValue = isBranch ? labelAddress - (address + 1) : labelAddress;
 
-            if (!operandValid) {
-                logError("No such label or invalid operand: " + pLine.operandStr);
-                return false;
-            }
-        } else {
-            if (!pLine.operandStr.empty()) {
-                logError("Unexpected operand for: " + pLine.mnemonic);
-                return false;
+                // The linker fixes up imported symbols and, when the module
+                // moves, absolute uses of its own labels
+                uint32_t kind = opInfo.opcode == OP_DATA ? RELOC_WORD : isBranch ? RELOC_BRANCH : RELOC_OPERAND;
+                if (relocatable && symbols.isExternal(symbol)) {
+                    operandValue = 0;
+                    chunk.relocations.push_back(ObjectRelocation{ static_cast<uint32_t>(address), kind, symbol });
+                } else if (relocatable && !isBranch && !symbols.isConstant(symbol)) {
+                    chunk.relocations.push_back(ObjectRelocation{ static_cast<uint32_t>(address), kind,
+                                                                  RELOC_MODULE_BASE });
+                }
+            } else if (program.symbol[i] == SymbolTable::NONE) {
+                if (!operandInRange(program.number[i], isBranch)) {
+                    chunk.diagnostics.push_back(Diagnostic{ rangeWarning(program.number[i]), -1 });
+                }
+                operandValue = static_cast<int32_t>(program.number[i]);
+            } else {
+                error = "No such label or invalid operand: " + std::string(operandStr);
             }
+        } else if (!operandStr.empty()) {
+            error = "Unexpected operand for: " + std::string(mnemonic);
+        }
+        if (!error.empty()) {
+            chunk.diagnostics.push_back(Diagnostic{ error, lineNumber });
+            chunk.stoppedAt = i;
+            return;
         }
 
         // Build the 32-bit machine word
         int32_t machineWord = 0;
-        if (pLine.mnemonic == "data") {
+        if (opInfo.opcode == OP_DATA) {
             machineWord = operandValue;
         } else {
             // [operand] is upper 24 bits, [opcode] is bottom 8 bits
             machineWord = (operandValue << 8) | (opInfo.opcode & 0xFF);
         }
+        words[address] = machineWord;
 
-        // Write to object file (binary)
-        objFile.write(reinterpret_cast<const char*>(&machineWord), sizeof(machineWord));
+        if (listing) {
+            appendListingLine(chunk.listing, address, machineWord, mnemonic, operandStr);
+            if (optimized) {
+                chunk.listing.pop_back();
+                chunk.listing.append(" ; -O: was ").append(opcodeTable[originalMnemonic[i]].mnemonic).append(" ")
+                             .append(originalText).append("\n");
+            }
+        }
+    }
+}
 
-        // Write to listing file (text)
-        // Format: 00000002 00006500 ldc 0x65
-        lstFile << std::setw(8) << pLine.address << " "
-                << std::setw(8) << machineWord << "    "
-                << pLine.mnemonic << " " << pLine.operandStr << std::endl;
+void Assembler::appendListingLine(std::string& listing, int32_t address, int32_t word,
+                                  std::string_view mnemonic, std::string_view operand) {
+    size_t start = listing.size();
+    listing.resize(start + 23 + mnemonic.size() + operand.size());
+    char* out = &listing[start];
+    out = formatHex32(static_cast<uint32_t>(address), out);
+    *out++ = ' ';
+    out = formatHex32(static_cast<uint32_t>(word), out);
+    std::memcpy(out, "    ", 4);
+    out += 4;
+    std::memcpy(out, mnemonic.data(), mnemonic.size());
+    out += mnemonic.size();
+    *out++ = ' ';
+    std::memcpy(out, operand.data(), operand.size());
+    out[operand.size()] = '\n';
+}
+
+// An output file written front to back whose unflushed tail stays in
+// memory. Backpatches usually land in that tail and cost nothing; older
+// bytes are patched in place on disk.
+class Assembler::OutputFile {
+public:
+    OutputFile() : fd(-1), flushed(0), ok(true) {}
+    ~OutputFile() { close(); }
+
+    bool open(const std::string& filename) {
+        fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        return fd >= 0;
     }
 
-    objFile.close();
-    lstFile.close();
+    // Bytes written so far, flushed or not
+    int64_t size() const { return flushed + static_cast<int64_t>(pending.size()); }
+
+    void append(const char* data, size_t length) {
+        pending.append(data, length);
+        if (pending.size() >= FLUSH_BYTES) {
+            flush();
+        }
+    }
+
+    void patch(int64_t offset, const char* data, size_t length) {
+        if (offset >= flushed) {
+            pending.replace(static_cast<size_t>(offset - flushed), length, data, length);
+        } else {
+            ok = ok && pwrite(fd, data, length, offset) == static_cast<ssize_t>(length);
+        }
+    }
+
+    // Drops everything after the first 'length' bytes
+    void truncate(int64_t length) {
+        if (length >= flushed) {
+            pending.resize(static_cast<size_t>(length - flushed));
+            return;
+        }
+        pending.clear();
+        ok = ok && ftruncate(fd, length) == 0 && lseek(fd, length, SEEK_SET) == length;
+        flushed = length;
+    }
+
+    bool close() {
+        if (fd >= 0) {
+            flush();
+            ok = ::close(fd) == 0 && ok;
+            fd = -1;
+        }
+        return ok;
+    }
+
+private:
+    static const size_t FLUSH_BYTES = 1 << 16;
+
+    int fd;
+    int64_t flushed;     // Bytes already in the file
+    std::string pending; // Bytes after that, not yet written
+    bool ok;
+
+    void flush() {
+        for (size_t done = 0; ok && done < pending.size(); ) {
+            ssize_t written = write(fd, pending.data() + done, pending.size() - done);
+            ok = written > 0;
+            done += ok ? written : 0;
+        }
+        flushed += pending.size();
+        pending.clear();
+    }
+};
+
+bool Assembler::performSinglePass(const std::string& inputFilename,
+                                  const std::string& outputObjectFilename,
+                                  const std::string& outputListFilename) {
+    if (!source.open(inputFilename)) {
+        logError("Could not open input file: " + inputFilename);
+        return false;
+    }
+
+    OutputFile objFile;
+    if (!objFile.open(outputObjectFilename)) {
+        logError("Could not open object file for writing: " + outputObjectFilename);
+        return false;
+    }
+
+    OutputFile lstFile;
+    if (listing && !lstFile.open(outputListFilename)) {
+        logError("Could not open listing file for writing: " + outputListFilename);
+        return false;
+    }
+
+    std::string_view line;
+    size_t position = 0;
+    std::string text;
+    int32_t locationCounter = 0;
+    int lineNumber = 0;
+
+    program.clear();
+    symbols.clear();
+    globals.clear();
+    fixups.clear();
+    entryLabel = SymbolTable::NONE;
+
+    // A version 2 header goes in front of the words once they are known
+    std::vector<ExecutableSegment> segments;
+    wordsOffset = flat ? 0 : sizeof(ExecutableHeader);
+    zeroFrom = 0;
+    text.assign(static_cast<size_t>(wordsOffset), '\0');
+    objFile.append(text.data(), text.size());
+
+    while (source.nextLine(position, line)) {
+        lineNumber++;
+
+        ParsedLine pLine = parseLine(line);
+        if (pLine.mnemonic.empty() && pLine.label.empty()) {
+            continue;
+        }
+
+        // Define the label (or SET constant) as Pass 1 would
+        SymbolTable::Id label = SymbolTable::NONE;
+        if (!pLine.label.empty()) {
+            label = symbols.intern(pLine.label);
+            if (symbols.isDefined(label)) {
+                logError("Duplicate label definition: " + std::string(pLine.label), lineNumber);
+                return false;
+            }
+            symbols.define(label, locationCounter);
+        }
+        if (pLine.mnemonic == "SET") {
+            if (pLine.label.empty()) {
+                logError("SET instruction requires a label", lineNumber);
+                return false;
+            }
+            bool isValid = true;
+            int32_t value = resolveOperand(pLine.operandStr, 0, false, isValid);
+            SymbolTable::Id named = symbols.find(pLine.operandStr);
+            if (!isValid || (named != SymbolTable::NONE && symbols.isDefined(named))) {
+                 logError("Invalid operand for SET. Must be a number.", lineNumber);
+                 return false;
+            }
+            symbols.define(label, value, true);
+        }
+        if (label != SymbolTable::NONE && !resolveFixups(label, objFile, lstFile)) {
+            logError("Could not update the output files");
+            return false;
+        }
+
+        // Then emit the word as Pass 2 would
+        if (pLine.mnemonic == "SET") {
+            continue;
+        }
+        // Imports need the linker
+        if (pLine.mnemonic == "global" || pLine.mnemonic == "extern" || pLine.mnemonic == "entry") {
+            if (pLine.operandStr.empty()) {
+                logError("Missing operand for: " + std::string(pLine.mnemonic), lineNumber);
+                return false;
+            }
+            if (pLine.mnemonic == "extern") {
+                logError("extern needs a relocatable object (asm -c): " + std::string(pLine.operandStr),
+                         lineNumber);
+                return false;
+            }
+            if (pLine.mnemonic == "global") {
+                SymbolTable::Id global = symbols.intern(pLine.operandStr);
+                symbols.exportSymbol(global);
+                globals.push_back(std::make_pair(global, lineNumber));
+                continue;
+            }
+            if (flat) {
+                logError("entry needs a version 2 executable (not -c or --flat): " + std::string(pLine.operandStr),
+                         lineNumber);
+                return false;
+            }
+            if (entryLabel != SymbolTable::NONE) {
+                logError("Duplicate entry point: " + std::string(pLine.operandStr), lineNumber);
+                return false;
+            }
+            entryLabel = symbols.intern(pLine.operandStr);
+            entryLine = lineNumber;
+            continue;
+        }
+        if (pLine.mnemonic.empty()) {
+            if (listing) {
+                text.assign("\n").append(pLine.label).append(":\n");
+                lstFile.append(text.data(), text.size());
+            }
+            continue;
+        }
+
+        int index = findMnemonic(pLine.mnemonic);
+        if (index < 0) {
+            logError("Unknown instruction: " + std::string(pLine.mnemonic), lineNumber);
+            return false;
+        }
+        const OpcodeInfo& opInfo = opcodeTable[index];
+        bool isData = opInfo.opcode == OP_DATA;
+        bool isBranch = opInfo.operand == OPERAND_TARGET;
+        SymbolTable::Id operandSymbol = SymbolTable::NONE;
+        int32_t operandValue = 0;
+        bool forward = false;
+
+        if (opInfo.expectsOperand()) {
+            if (pLine.operandStr.empty()) {
+                logError("Missing operand for: " + std::string(pLine.mnemonic), lineNumber);
+                return false;
+            }
+            // Anything that is neither a known symbol nor a number may be
+            // a label defined further down
+            SymbolTable::Id symbol = symbols.find(pLine.operandStr);
+            long number;
+            if (symbol != SymbolTable::NONE && symbols.isDefined(symbol)) {
+                operandValue = isBranch ? symbols.value(symbol) - (locationCounter + 1) : symbols.value(symbol);
+            } else if (parseNumber(pLine.operandStr, number)) {
+                checkOperandRange(number, isBranch);
+                operandValue = static_cast<int32_t>(number);
+            } else {
+                forward = true;
+                operandSymbol = symbols.intern(pLine.operandStr);
+            }
+        } else if (!pLine.operandStr.empty()) {
+            logError("Unexpected operand for: " + std::string(pLine.mnemonic), lineNumber);
+            return false;
+        }
+
+        int32_t machineWord = isData ? operandValue : (operandValue << 8) | (opInfo.opcode & 0xFF);
+        if (forward) {
+            Fixup fixup = { locationCounter, lstFile.size() + 9, opInfo.opcode, isData, isBranch, lineNumber };
+            fixups[operandSymbol].push_back(fixup);
+        }
+        objFile.append(reinterpret_cast<const char*>(&machineWord), sizeof(machineWord));
+        addSegmentWord(segments, isData ? SEGMENT_DATA : SEGMENT_CODE);
+        if (!isData || machineWord != 0) {
+            zeroFrom = locationCounter + 1; // A forward reference may still become zero
+        }
+
+        if (listing) {
+            text.clear();
+            appendListingLine(text, locationCounter, machineWord, pLine.mnemonic, pLine.operandStr);
+            lstFile.append(text.data(), text.size());
+        }
+        locationCounter++;
+    }
+
+    // Labels still pending were never defined; report the earliest use
+    const Fixup* unresolved = nullptr;
+    SymbolTable::Id unresolvedLabel = SymbolTable::NONE;
+    for (const auto& pending : fixups) {
+        const Fixup& first = pending.second.front();
+        if (!unresolved || first.lineNumber < unresolved->lineNumber) {
+            unresolved = &first;
+            unresolvedLabel = pending.first;
+        }
+    }
+    if (unresolved) {
+        logError("No such label or invalid operand: " + std::string(symbols.name(unresolvedLabel)),
+                 unresolved->lineNumber);
+        return false;
+    }
+    for (const auto& global : globals) {
+        if (!symbols.isDefined(global.first)) {
+            logError("Global symbol is not defined in this file: " + std::string(symbols.name(global.first)),
+                     global.second);
+            return false;
+        }
+    }
+    if (entryLabel != SymbolTable::NONE &&
+        (!symbols.isDefined(entryLabel) || symbols.isConstant(entryLabel))) {
+        logError("Entry point is not a label in this file: " + std::string(symbols.name(entryLabel)), entryLine);
+        return false;
+    }
+
+    if (!flat) {
+        ExecutableHeader header;
+        finishExecutable(segments, static_cast<uint32_t>(zeroFrom), header, text);
+        objFile.truncate(wordsOffset + static_cast<int64_t>(zeroFrom) * sizeof(int32_t));
+        objFile.append(text.data(), text.size());
+        objFile.patch(0, reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+    if (listing) {
+        writeSymbolTable(text.erase());
+        lstFile.append(text.data(), text.size());
+    }
+    if (!objFile.close() || !lstFile.close()) {
+        logError("Could not write the output files");
+        return false;
+    }
+    return true;
+}
+
+bool Assembler::resolveFixups(SymbolTable::Id label, OutputFile& objFile, OutputFile& lstFile) {
+    auto pending = fixups.find(label);
+    if (pending == fixups.end()) {
+        return true;
+    }
+    int32_t value = symbols.value(label);
+    char digits[8];
+    for (const Fixup& fixup : pending->second) {
+        int32_t operandValue = fixup.isBranch ? value - (fixup.address + 1) : value;
+        int32_t machineWord = fixup.isData ? operandValue : (operandValue << 8) | (fixup.opcode & 0xFF);
+        objFile.patch(wordsOffset + static_cast<int64_t>(fixup.address) * sizeof(int32_t),
+                      reinterpret_cast<const char*>(&machineWord), sizeof(machineWord));
+        if (fixup.isData && machineWord != 0 && fixup.address >= zeroFrom) {
+            zeroFrom = fixup.address + 1;
+        }
+        if (listing) {
+            formatHex32(static_cast<uint32_t>(machineWord), digits);
+            lstFile.patch(fixup.listingOffset, digits, sizeof(digits));
+        }
+    }
+    fixups.erase(pending);
     return true;
 }
 
-Assembler::ParsedLine Assembler::parseLine(const std::string& line) {
-    ParsedLine pLine = {0, "", "", "", ""};
-    std::string processedLine = line;
+void Assembler::writeSymbolTable(std::string& listing) const {
+    // Finish the listing with the label addresses, sorted by address, so
+    // tools such as the emulator's profiler can symbolize addresses
+    std::vector<std::pair<int32_t, std::string_view> > labels;
+    for (SymbolTable::Id id = 0; id < symbols.size(); id++) {
+        if (symbols.isDefined(id) && !symbols.isConstant(id) && !symbols.isExternal(id)) {
+            labels.push_back(std::make_pair(symbols.value(id), symbols.name(id)));
+        }
+    }
+    std::sort(labels.begin(), labels.end());
+
+    listing.append("\nSymbol table:\n");
+    char address[8];
+    for (const auto& label : labels) {
+        formatHex32(static_cast<uint32_t>(label.first), address);
+        listing.append(address, sizeof(address)).append(" ").append(label.second).append("\n");
+    }
+}
+
+Assembler::ParsedLine Assembler::parseLine(std::string_view line) {
+    ParsedLine pLine;
 
     // 1. Find and strip comments (anything after ';')
-    size_t commentPos = processedLine.find(';');
-    if (commentPos != std::string::npos) {
-        processedLine = processedLine.substr(0, commentPos);
+    size_t commentPos = line.find(';');
+    if (commentPos != std::string_view::npos) {
+        line = line.substr(0, commentPos);
     }
 
     // 2. Trim leading/trailing whitespace
-    processedLine = trim(processedLine);
-    if (processedLine.empty()) {
+    line = trim(line);
+    if (line.empty()) {
         return pLine; // Line was just whitespace or a comment
     }
 
     // 3. Check for a label (ends with ':')
-    size_t labelPos = processedLine.find(':');
-    if (labelPos != std::string::npos) {
-        pLine.label = trim(processedLine.substr(0, labelPos));
-        processedLine = trim(processedLine.substr(labelPos + 1));
+    size_t labelPos = line.find(':');
+    if (labelPos != std::string_view::npos) {
+        pLine.label = trim(line.substr(0, labelPos));
+        line = trim(line.substr(labelPos + 1));
     }
 
-    // 4. Use a stringstream to read mnemonic and operand
-    std::stringstream ss(processedLine);
-    std::string mnemonic;
-    
-    ss >> mnemonic;
-    pLine.mnemonic = mnemonic;
+    // 4. The mnemonic is the first whitespace-separated word
+    size_t start = 0;
+    while (start < line.size() && isspace(static_cast<unsigned char>(line[start]))) {
+        start++;
+    }
+    size_t end = start;
+    while (end < line.size() && !isspace(static_cast<unsigned char>(line[end]))) {
+        end++;
+    }
+    pLine.mnemonic = line.substr(start, end - start);
 
-    // 5. Read the rest of the line. This is the operand.
-    std::string operand;
-    std::getline(ss, operand); // Read the rest of the stringstream
-    pLine.operandStr = trim(operand);
+    // 5. The rest of the line is the operand
+    pLine.operandStr = trim(line.substr(end));
     
     return pLine;
 }
 
-int32_t Assembler::resolveOperand(const std::string& operandStr, int32_t currentPC, bool isBranch, bool& operandValid) {
+int32_t Assembler::resolveOperand(std::string_view operandStr, int32_t currentPC, bool isBranch, bool& operandValid) {
     operandValid = true;
     
-    // 1. Check if operandStr is a label (check if it's in symbolTable)
-    if (symbolTable.count(operandStr)) {
-        int32_t labelAddress = symbolTable.at(operandStr);
+    // 1. Check if operandStr is a label (check if it's in the symbol table)
+    SymbolTable::Id symbol = symbols.find(operandStr);
+    if (symbol != SymbolTable::NONE && symbols.isDefined(symbol)) {
+        int32_t labelAddress = symbols.value(symbol);
         
         if (isBranch) {
             // Branch instructions use a PC-relative offset
@@ -253,41 +1122,70 @@ int32_t Assembler::resolveOperand(const std::string& operandStr, int32_t current
     }
 
     // 2. If not a label, try to parse it as a number
-    // Use strtol, which handles decimal, hex (0x..), and octal (0..)
-    try {
-        char* end = nullptr;
-        // 0 base auto-detects hex/octal/decimal
-        long value = std::strtol(operandStr.c_str(), &end, 0); 
-        
-        // Check if strtol parsed the whole string. If not, error.
-        if (end == operandStr.c_str() || (*end != '\0' && !isspace(*end))) {
-             operandValid = false;
-             return 0; // Not a valid number
-        }
+    long value;
+    if (!parseNumber(operandStr, value)) {
+         operandValid = false;
+         return 0; // Not a valid number
+    }
+    checkOperandRange(value, isBranch);
+    return static_cast<int32_t>(value);
+}
 
-        // Check if the value fits in our 24-bit signed operand
-        const int32_t min_op = -(1 << 23); // -8388608
-        const int32_t max_op = (1 << 23) - 1;  // 8388607
-        
-        if (!isBranch && (value < min_op || value > max_op)) {
-             // For non-branch, warn if it's out of 24-bit range
-             logError("Warning: Operand " + std::to_string(value) + " out of 24-bit range.", -1);
-        }
-        // For 'data', it's a 32-bit value, so this check is not needed,
-        // but truncation to 24-bits for other instructions is handled by the shift.
+void Assembler::checkOperandRange(long value, bool isBranch) {
+    if (!operandInRange(value, isBranch)) {
+         logError(rangeWarning(value), -1);
+    }
+}
 
-        return static_cast<int32_t>(value);
+bool Assembler::operandInRange(long value, bool isBranch) {
+    // Check if the value fits in our 24-bit signed operand
+    const int32_t min_op = -(1 << 23); // -8388608
+    const int32_t max_op = (1 << 23) - 1;  // 8388607
+    
+    // For non-branch, warn if it's out of 24-bit range.
+    // For 'data', it's a 32-bit value, so this check is not needed,
+    // but truncation to 24-bits for other instructions is handled by the shift.
+    return isBranch || (value >= min_op && value <= max_op);
+}
+
+std::string Assembler::rangeWarning(long value) {
+    return "Warning: Operand " + std::to_string(value) + " out of 24-bit range.";
+}
+
+bool Assembler::parseNumber(std::string_view text, long& value) {
+    // strtol needs a terminated string; operands are short
+    char buffer[64];
+    std::string longText;
+    const char* start = buffer;
+    if (text.size() < sizeof(buffer)) {
+        std::memcpy(buffer, text.data(), text.size());
+        buffer[text.size()] = '\0';
+    } else {
+        longText.assign(text);
+        start = longText.c_str();
+    }
+
+    // Use strtol, which handles decimal, hex (0x..), and octal (0..)
+    char* end = nullptr;
+    // 0 base auto-detects hex/octal/decimal
+    value = std::strtol(start, &end, 0);
+
+    // Check if strtol parsed the whole string. If not, error.
+    return end != start && (*end == '\0' || isspace(static_cast<unsigned char>(*end)));
+}
 
-    } catch (...) {
-        operandValid = false;
-        return 0;
+void Assembler::progress(const char* message) const {
+    if (verbose) {
+        std::cout << message << std::endl;
     }
 }
 
 void Assembler::logError(const std::string& message, int lineNumber) {
-    std::cerr << "Error";
+    std::string text = "Error";
     if (lineNumber != -1) {
-        std::cerr << " (line " << lineNumber << ")";
+        text += " (line " + std::to_string(lineNumber) + ")";
     }
-    std::cerr << ": " << message << std::endl;
+    text += ": " + message + "\n";
+    std::cerr << text << std::flush;
+    messages += text;
 }
\ No newline at end of file
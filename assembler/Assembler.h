@@ -2,10 +2,15 @@
 #define ASSEMBLER_H
 
 #include <string>
-#include <map>
+#include <string_view>
+#include <unordered_map>
+#include <functional>
 #include <vector>
 #include <cstdint>
 #include "../Common.h"
+#include "../ObjectFormat.h"
+#include "SourceFile.h"
+#include "SymbolTable.h"
 
 class Assembler {
 public:
@@ -18,43 +23,274 @@ public:
                   const std::string& outputObjectFilename, 
                   const std::string& outputListFilename);
 
+    // Assembles in one streaming pass instead of two (default off). The
+    // output is identical, but memory grows with the number of unresolved
+    // forward references rather than with the size of the program.
+    void setSinglePass(bool enabled);
+
+    // Threads Pass 1 and Pass 2 run on (default 0: one per hardware thread)
+    void setThreads(unsigned count);
+
+    // Writes a relocatable object (see ObjectFormat.h) for the linker
+    // instead of an executable (default off). 'global' and 'extern'
+    // declarations then export and import symbols.
+    void setRelocatable(bool enabled);
+
+    // Writes a headerless version 1 executable instead of version 2
+    // (default off). It has no entry point, segments or symbols.
+    void setFlat(bool enabled);
+
+    // Writes the listing file (default on). Without it Pass 2 only
+    // encodes words, and the listing filename is ignored.
+    void setListing(bool enabled);
+
+    // Runs the peephole optimizer (Peephole.cpp) between Pass 1 and
+    // Pass 2 (default off). Not available in single-pass mode.
+    void setOptimize(bool enabled);
+
+    // Prints the progress of each pass to stdout (default on)
+    void setVerbose(bool enabled);
+
+    // Every error and warning the last assemble() printed, one per line
+    const std::string& getMessages() const { return messages; }
+
 private:
-    // The Symbol Table: maps label strings to their 32-bit address
-    std::map<std::string, int32_t> symbolTable;
+    // Source being assembled; tokens and the IR refer into it
+    SourceFile source;
+
+    // The Symbol Table: label names interned to Ids, with their values
+    SymbolTable symbols;
 
-    // Helper struct to store a parsed line from the source
-    // This makes Pass 2 much easier
+    // Set when some label looks like a number, which Pass 2 must then
+    // check for before reading a numeric operand (labels take precedence)
+    bool numericLabels;
+
+    // The tokens of one source line, as views into 'source'
     struct ParsedLine {
-        int32_t address;
-        std::string label;
-        std::string mnemonic;
-        std::string operandStr;
-        std::string originalLine; // For the listing file
+        std::string_view label;
+        std::string_view mnemonic;
+        std::string_view operandStr;
+    };
+
+    // Mnemonic index used in the IR for a label on a line of its own
+    static constexpr uint8_t LABEL_LINE = 0xFF;
+
+    // Mnemonic index of an instruction the optimizer removed; it is still
+    // listed, and its address is that of the next word
+    static constexpr uint8_t REMOVED_LINE = 0xFE;
+
+    // Pass 1 output: one entry per listed line (instructions and lone
+    // labels), stored as parallel arrays of small integers
+    struct ProgramIR {
+        std::vector<int32_t> address;
+        std::vector<uint8_t> mnemonic;          // Index into opcodeTable, or LABEL_LINE
+        std::vector<SymbolTable::Id> symbol;    // Operand symbol, the label of a LABEL_LINE, or NONE
+        std::vector<int64_t> number;            // Operand value when it is a number
+        std::vector<size_t> operandOffset;      // Operand text in the source, for the listing
+        std::vector<uint32_t> operandLength;
+        std::vector<uint32_t> lineNumber;
+
+        void clear();
+        size_t size() const { return address.size(); }
+    };
+
+    // This will hold the entire program, parsed
+    ProgramIR program;
+
+    bool singlePass;
+    unsigned threads;
+    bool relocatable;
+    bool flat;
+    bool listing;
+    bool optimize;
+    bool verbose;
+
+    // Per IR entry, the mnemonic it had before the optimizer changed it,
+    // or LABEL_LINE if unchanged. Empty unless the optimizer ran.
+    std::vector<uint8_t> originalMnemonic;
+    std::string messages;
+
+    // Names declared global, with the line of the declaration
+    std::vector<std::pair<SymbolTable::Id, int> > globals;
+
+    // The label named by 'entry', or NONE to start at address 0
+    SymbolTable::Id entryLabel;
+    int entryLine;
+
+    // A message held back so that messages come out in source order
+    struct Diagnostic {
+        std::string message;
+        int lineNumber;
+    };
+
+    // Operand symbol of a chunk's IR entry, not looked up yet
+    static constexpr SymbolTable::Id UNRESOLVED = SymbolTable::NONE - 1;
+    static constexpr uint32_t NO_ENTRY = UINT32_MAX;
+
+    // A label, SET constant, global, extern or entry found while parsing a chunk
+    struct SymbolDefinition {
+        enum Kind : uint8_t { LABEL, SET, GLOBAL, EXTERN, ENTRY };
+
+        std::string_view name;       // The label, or the name a global/extern/entry declares
+        uint32_t lineNumber;         // Relative to the chunk
+        int32_t address;             // Relative to the chunk
+        uint32_t entry;              // Chunk IR entry of a label on its own line, or NO_ENTRY
+        Kind kind;
+        std::string_view setOperand;
+    };
+
+    // Pass 1 output for the source bytes [begin, end), which start and end
+    // at line boundaries. Addresses and line numbers in 'program' are
+    // relative to the chunk until the bases are known.
+    struct SourceChunk {
+        size_t begin;
+        size_t end;
+        ProgramIR program;
+        std::vector<SymbolDefinition> definitions;
+        uint32_t lines;
+        int32_t words;
+        bool failed;                 // Parsing stopped at 'error'
+        Diagnostic error;
+        int32_t wordBase;            // Set from the prefix sums
+        uint32_t lineBase;
+        size_t entryBase;
+        std::vector<size_t> undefined; // Entries naming a symbol no line defines
     };
 
-    // This vector will hold the entire program, parsed
-    std::vector<ParsedLine> programLines;
+    // Smallest source chunk worth handing to another thread
+    static constexpr size_t PASS1_MIN_CHUNK = 1 << 20;
+
+    // Pass 2 output for the IR entries [begin, end)
+    struct CodeChunk {
+        size_t begin;
+        size_t end;
+        size_t stoppedAt;  // Entry with an error (its message is last), or end
+        std::string listing;
+        std::vector<Diagnostic> diagnostics;
+        std::vector<ObjectRelocation> relocations; // 'symbol' holds a SymbolTable::Id
+    };
+
+    // Smallest chunk worth handing to another thread
+    static constexpr size_t PASS2_MIN_CHUNK = 16384;
+
+    // A use of a label that was not yet defined when its word was emitted
+    struct Fixup {
+        int32_t address;        // Word to patch (also its byte offset / 4)
+        int64_t listingOffset;  // Where the word's hex digits are in the listing
+        int8_t opcode;
+        bool isData;
+        bool isBranch;
+        int lineNumber;
+    };
+
+    // Single pass: unresolved uses per label
+    std::unordered_map<SymbolTable::Id, std::vector<Fixup> > fixups;
+
+    // Single pass: file offset of address 0, and the first word of the
+    // trailing run of zero 'data' words
+    int64_t wordsOffset;
+    int32_t zeroFrom;
+
+    // Output file of the single pass (defined in Assembler.cpp)
+    class OutputFile;
 
     // --- Pass 1 ---
     // Reads the file, parses lines, and builds the symbol table
     // Returns true on success, false on error
     bool performPass1(const std::string& inputFilename);
 
+    // Parses one chunk of the source without touching shared state
+    void parseChunk(SourceChunk& chunk) const;
+
+    // Operand text of an IR entry
+    std::string_view operandText(size_t entry) const;
+
+    // --- Peephole optimizer ---
+    // Rewrites wasteful instruction sequences in 'program', then moves the
+    // labels and numeric branch offsets to the new addresses
+    void performOptimization();
+
+    // The entry's operand if it is a number or SET constant whose value is
+    // known now and fits in 24 bits
+    bool constantOperand(size_t entry, int32_t& value) const;
+
+    // Whether B is overwritten before it is next read, on every path that
+    // leaves 'entry' (branches are assumed to read it)
+    bool registerBDead(size_t entry) const;
+
+    void rewrite(size_t entry, Opcode opcode, int32_t operand);
+    void remove(size_t entry);
+
     // --- Pass 2 ---
     // Generates the object and listing files using the symbol table
     // Returns true on success, false on error
     bool performPass2(const std::string& outputObjectFilename, 
                       const std::string& outputListFilename);
 
+    // Encodes one chunk into 'words' (indexed by address) and its listing
+    void generateCode(CodeChunk& chunk, int32_t* words) const;
+
+    // Writes the words with their symbols and relocations
+    void writeObject(std::ostream& objFile, const std::vector<int32_t>& words,
+                     const std::vector<CodeChunk>& chunks) const;
+
+    // Writes the words as a version 2 executable
+    void writeExecutable(std::ostream& objFile, const std::vector<int32_t>& words) const;
+
+    // Every defined symbol, in Id order or sorted by name, with 'index'
+    // mapping symbol Ids to positions in 'objectSymbols' (RELOC_MODULE_BASE
+    // for undefined ones)
+    void collectSymbols(std::vector<ObjectSymbol>& objectSymbols, std::string& names,
+                        std::vector<uint32_t>& index, bool sortByName = false) const;
+
+    // Extends a segment table by one word of 'kind'
+    static void addSegmentWord(std::vector<ExecutableSegment>& segments, SegmentKind kind);
+
+    // Fills in the version 2 header and builds what follows the stored
+    // words. The words from 'zeroFrom' on become a zero-fill segment.
+    void finishExecutable(std::vector<ExecutableSegment>& segments, uint32_t zeroFrom,
+                          ExecutableHeader& header, std::string& trailer) const;
+
+    // --- Single pass ---
+    // Emits each word as its line is read, backpatching forward references
+    bool performSinglePass(const std::string& inputFilename,
+                           const std::string& outputObjectFilename,
+                           const std::string& outputListFilename);
+
+    // Patches every pending use of a just-defined label
+    bool resolveFixups(SymbolTable::Id label, OutputFile& objFile, OutputFile& lstFile);
+
     // --- Helper Functions ---
 
-    // Parses a single line of assembly code
-    ParsedLine parseLine(const std::string& line);
+    // Runs task(0) ... task(taskCount - 1) on up to threadCount() threads
+    unsigned threadCount() const;
+    void runParallel(size_t taskCount, const std::function<void(size_t)>& task) const;
+
+    // Splits a single line of assembly code into tokens (no copies)
+    static ParsedLine parseLine(std::string_view line);
 
     // Converts an operand string (like "5", "0x10", or "myLabel")
     // into its 32-bit integer value. Uses the symbolTable for labels.
     // 'operandValid' is set to false if a label isn't found.
-    int32_t resolveOperand(const std::string& operandStr, int32_t currentPC, bool isBranch, bool& operandValid);
+    int32_t resolveOperand(std::string_view operandStr, int32_t currentPC, bool isBranch, bool& operandValid);
+
+    // Parses a decimal, hex or octal number; false if 'text' is not one
+    static bool parseNumber(std::string_view text, long& value);
+
+    // Warns about a non-branch operand that does not fit in 24 bits
+    void checkOperandRange(long value, bool isBranch);
+    static bool operandInRange(long value, bool isBranch);
+    static std::string rangeWarning(long value);
+
+    // Appends "00000002 00006500    ldc 0x65" to a listing
+    static void appendListingLine(std::string& listing, int32_t address, int32_t word,
+                                  std::string_view mnemonic, std::string_view operand);
+
+    // Appends the "Symbol table:" section that ends the listing
+    void writeSymbolTable(std::string& listing) const;
+
+    // Prints a progress line unless verbose output is off
+    void progress(const char* message) const;
 
     // Helper to log errors
     void logError(const std::string& message, int lineNumber = -1);
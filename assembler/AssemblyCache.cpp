@@ -0,0 +1,159 @@
+#include "AssemblyCache.h"
+#include "SourceFile.h"
+#include "../Common.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char CACHE_MAGIC[8] = "VMASMC";
+
+// Bump whenever the assembler's output for the same input changes
+const uint32_t CACHE_VERSION = 2;
+
+// FNV-1a, 64-bit
+uint64_t hashBytes(const void* data, size_t size, uint64_t value = 14695981039346656037ull) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        value = (value ^ bytes[i]) * 1099511628211ull;
+    }
+    return value;
+}
+
+bool writeAll(std::FILE* out, const void* data, size_t size) {
+    return size == 0 || std::fwrite(data, 1, size, out) == size;
+}
+
+} // namespace
+
+AssemblyCache::AssemblyCache(const std::string& directory) : directory(directory), stats() {
+    // Every instruction's mnemonic, opcode and operand kind
+    isaFingerprint = hashBytes(&CACHE_VERSION, sizeof(CACHE_VERSION));
+    for (const OpcodeInfo& info : opcodeTable) {
+        isaFingerprint = hashBytes(info.mnemonic, std::strlen(info.mnemonic), isaFingerprint);
+        uint8_t fields[3] = { static_cast<uint8_t>(info.opcode), static_cast<uint8_t>(info.operand),
+                              static_cast<uint8_t>(info.isBranch) };
+        isaFingerprint = hashBytes(fields, sizeof(fields), isaFingerprint);
+    }
+}
+
+std::string AssemblyCache::defaultDirectory() {
+    const char* base = std::getenv("XDG_CACHE_HOME");
+    if (base && *base) {
+        return std::string(base) + "/vmasm";
+    }
+    const char* home = std::getenv("HOME");
+    return std::string(home && *home ? home : ".") + "/.cache/vmasm";
+}
+
+bool AssemblyCache::open() {
+    // mkdir -p
+    for (size_t slash = 1; slash <= directory.size(); slash++) {
+        if (slash == directory.size() || directory[slash] == '/') {
+            std::string prefix = directory.substr(0, slash);
+            if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+                return false;
+            }
+        }
+    }
+    return access(directory.c_str(), R_OK | W_OK | X_OK) == 0;
+}
+
+std::string AssemblyCache::entryPath(std::string_view source, uint32_t options) const {
+    uint64_t key = hashBytes(&isaFingerprint, sizeof(isaFingerprint));
+    key = hashBytes(&options, sizeof(options), key);
+    key = hashBytes(source.data(), source.size(), key);
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.asmc", static_cast<unsigned long long>(key));
+    return directory + name;
+}
+
+bool AssemblyCache::fetch(std::string_view source, uint32_t options, const std::string& objectFilename,
+                          const std::string& listFilename, std::string& messages) {
+    SourceFile entry;
+    EntryHeader header;
+    std::string_view data;
+    if (entry.open(entryPath(source, options))) {
+        data = entry.text();
+    }
+    if (data.size() < sizeof(header)) {
+        stats.misses++;
+        return false;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    data.remove_prefix(sizeof(header));
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != CACHE_VERSION ||
+        header.options != options || header.isaFingerprint != isaFingerprint ||
+        header.sourceBytes != source.size() ||
+        data.size() != header.sourceBytes + header.objectBytes + header.listBytes + header.messageBytes ||
+        data.substr(0, header.sourceBytes) != source) {
+        stats.misses++;
+        return false;
+    }
+    data.remove_prefix(header.sourceBytes);
+
+    std::ofstream objFile(objectFilename, std::ios::binary);
+    objFile.write(data.data(), header.objectBytes);
+    data.remove_prefix(header.objectBytes);
+    bool listed = true;
+    if (!listFilename.empty()) {
+        std::ofstream lstFile(listFilename, std::ios::binary);
+        listed = static_cast<bool>(lstFile.write(data.data(), header.listBytes));
+    }
+    data.remove_prefix(header.listBytes);
+    if (!objFile || !listed) {
+        stats.misses++;
+        return false;
+    }
+    messages.assign(data.data(), header.messageBytes);
+    stats.hits++;
+    return true;
+}
+
+bool AssemblyCache::store(std::string_view source, uint32_t options, const std::string& objectFilename,
+                          const std::string& listFilename, const std::string& messages) {
+    SourceFile objFile, lstFile;
+    if (!objFile.open(objectFilename) || (!listFilename.empty() && !lstFile.open(listFilename))) {
+        stats.storeFailures++;
+        return false;
+    }
+
+    EntryHeader header = {};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.options = options;
+    header.isaFingerprint = isaFingerprint;
+    header.sourceBytes = source.size();
+    header.objectBytes = objFile.text().size();
+    header.listBytes = lstFile.text().size();
+    header.messageBytes = messages.size();
+
+    std::string temporary = directory + "/.entryXXXXXX";
+    int fd = mkstemp(&temporary[0]);
+    std::FILE* out = fd < 0 ? nullptr : fdopen(fd, "wb");
+    if (!out) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(temporary.c_str());
+        }
+        stats.storeFailures++;
+        return false;
+    }
+    bool ok = writeAll(out, &header, sizeof(header)) && writeAll(out, source.data(), source.size()) &&
+              writeAll(out, objFile.text().data(), header.objectBytes) &&
+              writeAll(out, lstFile.text().data(), header.listBytes) &&
+              writeAll(out, messages.data(), messages.size());
+    ok = std::fclose(out) == 0 && ok;
+    if (!ok || std::rename(temporary.c_str(), entryPath(source, options).c_str()) != 0) {
+        unlink(temporary.c_str());
+        stats.storeFailures++;
+        return false;
+    }
+    stats.stores++;
+    return true;
+}
@@ -0,0 +1,68 @@
+#ifndef ASSEMBLY_CACHE_H
+#define ASSEMBLY_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+struct CacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t storeFailures;
+};
+
+// Content-addressed store of assembler outputs.
+//
+// An entry is keyed by a hash of the source text, the options that change
+// the output and the instruction set, and holds the .obj and .lst bytes
+// plus any warnings the assembly printed. Each entry also keeps its source,
+// so a hash collision is a miss rather than a wrong object. Entries are
+// written to a temporary file and renamed into place, so several builds
+// can share one directory.
+class AssemblyCache {
+public:
+    // Options that are part of the key
+    enum Option : uint32_t { RELOCATABLE = 1, NO_LISTING = 2, OPTIMIZE = 4, FLAT = 8 };
+
+    explicit AssemblyCache(const std::string& directory);
+
+    // $XDG_CACHE_HOME/vmasm, or ~/.cache/vmasm
+    static std::string defaultDirectory();
+
+    // Creates the directory if needed; false if it cannot be used
+    bool open();
+
+    // On a hit, writes the cached outputs to the two files, sets 'messages'
+    // to what the original assembly printed and returns true. An empty
+    // listing filename means there is no listing (NO_LISTING).
+    bool fetch(std::string_view source, uint32_t options, const std::string& objectFilename,
+               const std::string& listFilename, std::string& messages);
+
+    // Records the outputs just assembled from 'source'
+    bool store(std::string_view source, uint32_t options, const std::string& objectFilename,
+               const std::string& listFilename, const std::string& messages);
+
+    const std::string& getDirectory() const { return directory; }
+    const CacheStats& getStats() const { return stats; }
+
+private:
+    struct EntryHeader {
+        char magic[8];          // "VMASMC"
+        uint32_t version;
+        uint32_t options;
+        uint64_t isaFingerprint;
+        uint64_t sourceBytes;
+        uint64_t objectBytes;
+        uint64_t listBytes;
+        uint64_t messageBytes;  // Followed by the four sections in this order
+    };
+
+    std::string directory;
+    uint64_t isaFingerprint;
+    CacheStats stats;
+
+    std::string entryPath(std::string_view source, uint32_t options) const;
+};
+
+#endif // ASSEMBLY_CACHE_H
@@ -0,0 +1,287 @@
+#include "Assembler.h"
+#include <string>
+
+// Peephole optimizer (asm -O).
+//
+// Runs on the Pass 1 IR, once every symbol is known. Each rule replaces a
+// short run of instructions inside one basic block with fewer ones that
+// leave A, SP and memory as they were; rules marked "B dead" may also
+// change B, and only apply where B is overwritten before it is next read:
+//   adc 0, adj 0, br/brz/brlz to the next word   removed
+//   adc a; adc b        -> adc a+b
+//   adj a; adj b        -> adj a+b
+//   ldc a; adc b        -> ldc a+b
+//   ldc k; add          -> adc k        (B dead)
+//   ldc k; sub          -> adc -k       (B dead)
+//   ldc a; ldc b; shl   -> ldc a<<b     (B dead), and likewise shr
+// so that, for example, "ldc a; ldc b; add" becomes "ldc a+b". Operands
+// must be numbers or SET constants. The rules run until nothing changes;
+// then the words are renumbered and every label and numeric branch offset
+// is moved to match. Addresses computed by arithmetic, and code that reads
+// or writes itself, see the new layout.
+
+namespace {
+
+const size_t NO_NEXT = static_cast<size_t>(-1);
+
+// Rounds of rewriting; each can expose new patterns to the next
+const int MAX_ROUNDS = 8;
+
+// How far registerBDead() looks ahead before assuming B is live
+const int LIVENESS_WINDOW = 32;
+
+bool readsB(int8_t opcode) {
+    switch (opcode) {
+        case OP_ADD: case OP_SUB: case OP_SHL: case OP_SHR:
+        case OP_STL: case OP_STNL: case OP_A2SP: case OP_RETURN:
+        case OP_BCOPY: case OP_BFILL: case OP_BCMP: case OP_BSUM: case OP_BSORT:
+        case OP_SPAWN: case OP_CAS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool overwritesB(int8_t opcode) {
+    return opcode == OP_LDC || opcode == OP_LDL || opcode == OP_SP2A || opcode == OP_CALL;
+}
+
+bool fitsOperand(int64_t value) {
+    return value >= -(1 << 23) && value < (1 << 23);
+}
+
+} // namespace
+
+void Assembler::performOptimization() {
+    // A number may then name a label, which Pass 2 resolves by its text
+    if (numericLabels) {
+        progress("Optimizer skipped: a label is spelled like a number.");
+        return;
+    }
+    originalMnemonic.assign(program.size(), LABEL_LINE);
+
+    size_t wordCount = program.size() ? program.address.back() + (program.mnemonic.back() != LABEL_LINE) : 0;
+    auto opcodeOf = [&](size_t entry) { return opcodeTable[program.mnemonic[entry]].opcode; };
+
+    // Real instructions with the operand their mnemonic expects; anything
+    // else is left for Pass 2 to encode or report
+    auto isInstruction = [&](size_t entry) {
+        uint8_t mnemonic = program.mnemonic[entry];
+        return mnemonic < OPCODE_COUNT &&
+               opcodeTable[mnemonic].expectsOperand() == (program.operandLength[entry] != 0);
+    };
+
+    // Branch target as an address, or -1 if it is not known yet
+    auto branchTarget = [&](size_t entry) -> int64_t {
+        SymbolTable::Id symbol = program.symbol[entry];
+        if (symbol == SymbolTable::NONE) {
+            return program.address[entry] + 1 + program.number[entry];
+        }
+        if (symbols.isDefined(symbol) && !symbols.isConstant(symbol) && !symbols.isExternal(symbol)) {
+            return symbols.value(symbol);
+        }
+        return -1;
+    };
+
+    // Control can arrive at labels and numeric branch targets from
+    // elsewhere, so no rule may span them
+    std::vector<bool> blockStart(wordCount + 1, false);
+    for (SymbolTable::Id id = 0; id < symbols.size(); id++) {
+        if (symbols.isDefined(id) && !symbols.isConstant(id) && !symbols.isExternal(id) &&
+            symbols.value(id) >= 0 && static_cast<size_t>(symbols.value(id)) <= wordCount) {
+            blockStart[symbols.value(id)] = true;
+        }
+    }
+    for (size_t i = 0; i < program.size(); i++) {
+        if (isInstruction(i) && opcodeTable[program.mnemonic[i]].operand == OPERAND_TARGET &&
+            program.symbol[i] == SymbolTable::NONE) {
+            int64_t target = branchTarget(i);
+            if (target >= 0 && static_cast<size_t>(target) <= wordCount) {
+                blockStart[target] = true;
+            }
+        }
+    }
+
+    // The next instruction in the same block, skipping removed ones
+    auto nextInBlock = [&](size_t entry) {
+        for (size_t j = entry + 1; j < program.size(); j++) {
+            if (program.mnemonic[j] == LABEL_LINE || blockStart[program.address[j]]) {
+                return NO_NEXT;
+            }
+            if (program.mnemonic[j] != REMOVED_LINE) {
+                return isInstruction(j) ? j : NO_NEXT;
+            }
+        }
+        return NO_NEXT;
+    };
+
+    // Whether a branch lands on the word that follows it anyway
+    auto branchesToNext = [&](size_t entry) {
+        int64_t target = branchTarget(entry);
+        if (target <= program.address[entry] || static_cast<size_t>(target) > wordCount) {
+            return false;
+        }
+        for (size_t j = entry + 1; j < program.size() && program.address[j] < target; j++) {
+            if (program.mnemonic[j] != LABEL_LINE && program.mnemonic[j] != REMOVED_LINE) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    bool changed = true;
+    for (int round = 0; changed && round < MAX_ROUNDS; round++) {
+        changed = false;
+        for (size_t i = 0; i < program.size(); i++) {
+            if (!isInstruction(i)) {
+                continue;
+            }
+            int8_t opcode = opcodeOf(i);
+            int32_t a, b;
+            if (((opcode == OP_ADC || opcode == OP_ADJ) && constantOperand(i, a) && a == 0) ||
+                ((opcode == OP_BR || opcode == OP_BRZ || opcode == OP_BRLZ) && branchesToNext(i))) {
+                remove(i);
+                changed = true;
+                continue;
+            }
+
+            size_t j = nextInBlock(i);
+            if (j == NO_NEXT || (opcode != OP_ADC && opcode != OP_ADJ && opcode != OP_LDC) || !constantOperand(i, a)) {
+                continue;
+            }
+            int8_t second = opcodeOf(j);
+            bool merges = opcode == OP_LDC ? second == OP_ADC : second == opcode;
+            if (merges && constantOperand(j, b) && fitsOperand(static_cast<int64_t>(a) + b)) {
+                rewrite(i, static_cast<Opcode>(opcode), a + b);
+                remove(j);
+                changed = true;
+            } else if (opcode == OP_LDC && (second == OP_ADD || second == OP_SUB) && registerBDead(j) &&
+                       fitsOperand(second == OP_ADD ? a : -static_cast<int64_t>(a))) {
+                rewrite(i, OP_ADC, second == OP_ADD ? a : -a);
+                remove(j);
+                changed = true;
+            } else if (opcode == OP_LDC && second == OP_LDC && constantOperand(j, b) && b >= 0 && b < 32) {
+                size_t k = nextInBlock(j);
+                if (k == NO_NEXT || (opcodeOf(k) != OP_SHL && opcodeOf(k) != OP_SHR) || !registerBDead(k)) {
+                    continue;
+                }
+                // As the VM computes it: a 32-bit shift, arithmetic to the right
+                int32_t value = opcodeOf(k) == OP_SHL ? static_cast<int32_t>(static_cast<uint32_t>(a) << b) : a >> b;
+                if (fitsOperand(value)) {
+                    rewrite(i, OP_LDC, value);
+                    remove(j);
+                    remove(k);
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Renumber: a removed word's old address now means the next word kept
+    std::vector<int32_t> newAddress(wordCount + 1);
+    int32_t next = 0;
+    size_t removed = 0;
+    for (size_t i = 0; i < program.size(); i++) {
+        if (program.mnemonic[i] != LABEL_LINE) {
+            newAddress[program.address[i]] = next;
+            if (program.mnemonic[i] == REMOVED_LINE) {
+                removed++;
+            } else {
+                next++;
+            }
+        }
+    }
+    newAddress[wordCount] = next;
+
+    for (size_t i = 0; i < program.size(); i++) {
+        int32_t oldAddress = program.address[i];
+        program.address[i] = newAddress[oldAddress];
+        if (isInstruction(i) && opcodeTable[program.mnemonic[i]].operand == OPERAND_TARGET &&
+            program.symbol[i] == SymbolTable::NONE) {
+            // Numeric offsets keep their target, inside the program or not
+            int64_t target = oldAddress + 1 + program.number[i];
+            if (target >= 0 && static_cast<size_t>(target) <= wordCount) {
+                target = newAddress[target];
+            }
+            int64_t offset = target - (program.address[i] + 1);
+            if (offset != program.number[i]) {
+                rewrite(i, static_cast<Opcode>(opcodeOf(i)), static_cast<int32_t>(offset));
+            }
+        }
+    }
+    for (SymbolTable::Id id = 0; id < symbols.size(); id++) {
+        if (symbols.isDefined(id) && !symbols.isConstant(id) && !symbols.isExternal(id) &&
+            symbols.value(id) >= 0 && static_cast<size_t>(symbols.value(id)) <= wordCount) {
+            symbols.define(id, newAddress[symbols.value(id)]);
+        }
+    }
+
+    size_t rewritten = 0;
+    for (size_t i = 0; i < program.size(); i++) {
+        rewritten += originalMnemonic[i] != LABEL_LINE && program.mnemonic[i] != REMOVED_LINE;
+    }
+    std::string summary = "Optimizer: " + std::to_string(removed) + " instructions removed, " +
+                          std::to_string(rewritten) + " rewritten.";
+    progress(summary.c_str());
+}
+
+bool Assembler::constantOperand(size_t entry, int32_t& value) const {
+    if (program.operandLength[entry] == 0) {
+        return false;
+    }
+    int64_t number = program.number[entry];
+    SymbolTable::Id symbol = program.symbol[entry];
+    if (symbol != SymbolTable::NONE) {
+        if (!symbols.isDefined(symbol) || !symbols.isConstant(symbol) || symbols.isExternal(symbol)) {
+            return false;
+        }
+        number = symbols.value(symbol);
+    }
+    if (!fitsOperand(number)) {
+        return false;
+    }
+    value = static_cast<int32_t>(number);
+    return true;
+}
+
+bool Assembler::registerBDead(size_t entry) const {
+    int seen = 0;
+    for (size_t j = entry + 1; j < program.size() && seen < LIVENESS_WINDOW; j++) {
+        uint8_t mnemonic = program.mnemonic[j];
+        if (mnemonic == LABEL_LINE || mnemonic == REMOVED_LINE) {
+            continue; // Falling into a label does not change the path
+        }
+        seen++;
+        int8_t opcode = opcodeTable[mnemonic].opcode;
+        if (readsB(opcode)) {
+            return false;
+        }
+        if (overwritesB(opcode)) {
+            return true;
+        }
+        if (opcode != OP_ADC && opcode != OP_LDNL && opcode != OP_ADJ) {
+            return false; // Branches, HALT (B is part of the result) and data
+        }
+    }
+    return false;
+}
+
+void Assembler::rewrite(size_t entry, Opcode opcode, int32_t operand) {
+    if (program.mnemonic[entry] == opcode && program.symbol[entry] == SymbolTable::NONE &&
+        program.number[entry] == operand) {
+        return; // Such as "adc 1" absorbing an "adc 0"
+    }
+    if (originalMnemonic[entry] == LABEL_LINE) {
+        originalMnemonic[entry] = program.mnemonic[entry];
+    }
+    program.mnemonic[entry] = static_cast<uint8_t>(opcode);
+    program.symbol[entry] = SymbolTable::NONE;
+    program.number[entry] = operand;
+}
+
+void Assembler::remove(size_t entry) {
+    if (originalMnemonic[entry] == LABEL_LINE) {
+        originalMnemonic[entry] = program.mnemonic[entry];
+    }
+    program.mnemonic[entry] = REMOVED_LINE;
+}
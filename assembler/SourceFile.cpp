@@ -0,0 +1,69 @@
+#include "SourceFile.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SourceFile::SourceFile() : data(nullptr), size(0), mapped(false) {
+}
+
+SourceFile::~SourceFile() {
+    close();
+}
+
+void SourceFile::close() {
+    if (mapped) {
+        munmap(const_cast<char*>(data), size);
+    }
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    contents.clear();
+}
+
+bool SourceFile::open(const std::string& filename) {
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(mapping);
+            size = info.st_size;
+            mapped = true;
+        }
+    }
+    ::close(fd);
+    if (mapped) {
+        return true;
+    }
+
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    data = contents.data();
+    size = contents.size();
+    return true;
+}
+
+bool SourceFile::nextLine(size_t& position, std::string_view& line) const {
+    if (position >= size) {
+        return false;
+    }
+    const char* start = data + position;
+    const char* end = static_cast<const char*>(std::memchr(start, '\n', size - position));
+    size_t length = end ? static_cast<size_t>(end - start) : size - position;
+    line = std::string_view(start, length);
+    position += length + 1;
+    return true;
+}
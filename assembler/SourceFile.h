@@ -0,0 +1,37 @@
+#ifndef SOURCE_FILE_H
+#define SOURCE_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only view of a whole source file. The file is memory-mapped, so
+// lines and tokens can be string_views into it without any copying; files
+// that cannot be mapped (pipes, empty files) are read into memory instead.
+class SourceFile {
+public:
+    SourceFile();
+    ~SourceFile();
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    // Returns false if the file cannot be opened
+    bool open(const std::string& filename);
+
+    std::string_view text() const { return std::string_view(data, size); }
+
+    // Splits off the next line (without its '\n'); false at the end, like
+    // std::getline, so a final line without a newline is still returned
+    bool nextLine(size_t& position, std::string_view& line) const;
+
+private:
+    const char* data;
+    size_t size;
+    bool mapped;
+    std::string contents; // Used when the file could not be mapped
+
+    void close();
+};
+
+#endif // SOURCE_FILE_H
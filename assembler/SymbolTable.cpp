@@ -0,0 +1,93 @@
+#include "SymbolTable.h"
+#include <algorithm>
+#include <cstring>
+
+SymbolTable::SymbolTable() : blockUsed(0), blockSize(0) {
+    clear();
+}
+
+void SymbolTable::clear() {
+    entries.clear();
+    slots.assign(1024, NONE);
+    blocks.clear();
+    blockUsed = blockSize = 0;
+}
+
+uint32_t SymbolTable::hash(std::string_view name) {
+    // FNV-1a
+    uint32_t value = 2166136261u;
+    for (char c : name) {
+        value = (value ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return value;
+}
+
+const char* SymbolTable::store(std::string_view name) {
+    if (blockSize - blockUsed < name.size()) {
+        // Names longer than a block get a block of their own
+        blockSize = std::max(BLOCK_BYTES, name.size());
+        blocks.emplace_back(new char[blockSize]);
+        blockUsed = 0;
+    }
+    char* copy = blocks.back().get() + blockUsed;
+    std::memcpy(copy, name.data(), name.size());
+    blockUsed += name.size();
+    return copy;
+}
+
+SymbolTable::Id SymbolTable::find(std::string_view name) const {
+    uint32_t h = hash(name);
+    size_t mask = slots.size() - 1;
+    for (size_t slot = h & mask; slots[slot] != NONE; slot = (slot + 1) & mask) {
+        const Entry& entry = entries[slots[slot]];
+        if (entry.hash == h && entry.length == name.size() &&
+            std::memcmp(entry.name, name.data(), name.size()) == 0) {
+            return slots[slot];
+        }
+    }
+    return NONE;
+}
+
+SymbolTable::Id SymbolTable::intern(std::string_view name) {
+    uint32_t h = hash(name);
+    size_t mask = slots.size() - 1;
+    size_t slot = h & mask;
+    for (; slots[slot] != NONE; slot = (slot + 1) & mask) {
+        const Entry& entry = entries[slots[slot]];
+        if (entry.hash == h && entry.length == name.size() &&
+            std::memcmp(entry.name, name.data(), name.size()) == 0) {
+            return slots[slot];
+        }
+    }
+
+    Id id = static_cast<Id>(entries.size());
+    Entry entry = { store(name), static_cast<uint32_t>(name.size()), h, 0, 0 };
+    entries.push_back(entry);
+    slots[slot] = id;
+    if (entries.size() * 2 > slots.size()) {
+        grow(); // Keep the load factor at or below one half
+    }
+    return id;
+}
+
+void SymbolTable::define(Id id, int32_t value, bool constant) {
+    entries[id].value = value;
+    entries[id].flags = DEFINED | (constant ? CONSTANT : 0) | (entries[id].flags & EXPORTED);
+}
+
+void SymbolTable::declareExternal(Id id) {
+    entries[id].value = 0;
+    entries[id].flags |= DEFINED | EXTERNAL;
+}
+
+void SymbolTable::grow() {
+    slots.assign(slots.size() * 2, NONE);
+    size_t mask = slots.size() - 1;
+    for (Id id = 0; id < entries.size(); id++) {
+        size_t slot = entries[id].hash & mask;
+        while (slots[slot] != NONE) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = id;
+    }
+}
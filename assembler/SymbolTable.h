@@ -0,0 +1,73 @@
+#ifndef SYMBOL_TABLE_H
+#define SYMBOL_TABLE_H
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Interned label names with hashed lookup.
+//
+// Every name gets a small integer Id the first time it is seen, whether it
+// is being defined or only referenced, and the rest of the assembler works
+// with Ids. Names are copied into an arena of large blocks, so interning
+// allocates only when a block fills up, and lookups go through an
+// open-addressing table of Ids.
+class SymbolTable {
+public:
+    typedef uint32_t Id;
+    static constexpr Id NONE = UINT32_MAX;
+
+    SymbolTable();
+
+    void clear();
+
+    // The Id of 'name', creating an undefined symbol if it is new
+    Id intern(std::string_view name);
+
+    // The Id of 'name', or NONE if it was never interned
+    Id find(std::string_view name) const;
+
+    // Gives the symbol a value: an address, or a constant defined by SET
+    void define(Id id, int32_t value, bool constant = false);
+
+    // Marks a symbol as defined by another module (extern). It counts as
+    // defined, with value 0 until the linker relocates its uses.
+    void declareExternal(Id id);
+
+    // Marks a symbol as visible to other modules (global)
+    void exportSymbol(Id id) { entries[id].flags |= EXPORTED; }
+
+    std::string_view name(Id id) const { return std::string_view(entries[id].name, entries[id].length); }
+    bool isDefined(Id id) const { return entries[id].flags & DEFINED; }
+    bool isConstant(Id id) const { return entries[id].flags & CONSTANT; }
+    bool isExternal(Id id) const { return entries[id].flags & EXTERNAL; }
+    bool isExported(Id id) const { return entries[id].flags & EXPORTED; }
+    int32_t value(Id id) const { return entries[id].value; }
+    size_t size() const { return entries.size(); }
+
+private:
+    enum Flags : uint8_t { DEFINED = 1, CONSTANT = 2, EXTERNAL = 4, EXPORTED = 8 };
+
+    struct Entry {
+        const char* name; // In the arena
+        uint32_t length;
+        uint32_t hash;
+        int32_t value;
+        uint8_t flags;
+    };
+
+    static constexpr size_t BLOCK_BYTES = 1 << 16;
+
+    std::vector<Entry> entries;
+    std::vector<Id> slots;  // Power-of-two sized; NONE marks an empty slot
+    std::vector<std::unique_ptr<char[]> > blocks;
+    size_t blockUsed;
+    size_t blockSize;
+
+    static uint32_t hash(std::string_view name);
+    const char* store(std::string_view name);
+    void grow();
+};
+
+#endif // SYMBOL_TABLE_H
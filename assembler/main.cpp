@@ -1,26 +1,261 @@
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include "Assembler.h"
+#include "AssemblyCache.h"
+#include "SourceFile.h"
+
+namespace {
+
+const char* const USAGE =
+    "[--cache[=DIR]] [--single-pass | -c] [--flat] [-O] [-jN] <input.asm> <output.obj> <output.lst>\n"
+    "       [--cache[=DIR]] [--single-pass | -c] [--flat] [-O] [-jN] --no-listing <input.asm> <output.obj>\n"
+    "       [--cache[=DIR]] [-jN] --server";
+
+// One assembly, from the command line or a line of server input
+struct Request {
+    bool singlePass = false;
+    bool relocatable = false;
+    bool flat = false;
+    bool listing = true;
+    bool optimize = false;
+    unsigned threads = 0;
+    std::string inputFile;
+    std::string objectFile;
+    std::string listFile;
+};
+
+// Reads "[--single-pass | -c] [--flat] [-O] [-jN] [--no-listing] in obj [lst]";
+// false on a usage error
+bool parseRequest(const std::vector<std::string>& args, Request& request) {
+    size_t arg = 0;
+    for (; arg + 2 < args.size(); arg++) {
+        const std::string& option = args[arg];
+        if (option == "--single-pass") {
+            request.singlePass = true;
+        } else if (option == "-c") {
+            request.relocatable = true;
+        } else if (option == "--flat") {
+            request.flat = true;
+        } else if (option == "--no-listing") {
+            request.listing = false;
+        } else if (option == "-O") {
+            request.optimize = true;
+        } else if (option.compare(0, 2, "-j") == 0 && option.size() > 2) {
+            request.threads = std::strtoul(option.c_str() + 2, nullptr, 10);
+        } else {
+            break;
+        }
+    }
+    if (args.size() - arg != (request.listing ? 3u : 2u)) {
+        return false;
+    }
+    if (request.singlePass && request.relocatable) {
+        std::cerr << "Error: --single-pass cannot write relocatable objects" << std::endl;
+        return false;
+    }
+    if (request.relocatable && request.flat) {
+        std::cerr << "Error: --flat writes executables, not relocatable objects (-c)" << std::endl;
+        return false;
+    }
+    if (request.singlePass && request.optimize) {
+        std::cerr << "Error: --single-pass cannot optimize (-O needs the whole program)" << std::endl;
+        return false;
+    }
+    request.inputFile = args[arg];
+    request.objectFile = args[arg + 1];
+    request.listFile = request.listing ? args[arg + 2] : "";
+    return true;
+}
+
+enum Outcome { FAILED, ASSEMBLED, CACHED };
+
+// Assembles one request, going through the cache when there is one. Only
+// successful assemblies are stored, together with the warnings they printed,
+// which a hit prints again.
+Outcome run(Assembler& assembler, AssemblyCache* cache, const Request& request) {
+    assembler.setSinglePass(request.singlePass);
+    assembler.setThreads(request.threads);
+    assembler.setRelocatable(request.relocatable);
+    assembler.setFlat(request.flat);
+    assembler.setListing(request.listing);
+    assembler.setOptimize(request.optimize);
+
+    SourceFile source;
+    uint32_t options = 0;
+    if (request.relocatable) {
+        options |= AssemblyCache::RELOCATABLE;
+    }
+    if (!request.listing) {
+        options |= AssemblyCache::NO_LISTING;
+    }
+    if (request.optimize) {
+        options |= AssemblyCache::OPTIMIZE;
+    }
+    if (request.flat) {
+        options |= AssemblyCache::FLAT;
+    }
+    bool cacheable = cache && source.open(request.inputFile);
+    std::string messages;
+    if (cacheable && cache->fetch(source.text(), options, request.objectFile, request.listFile, messages)) {
+        std::cerr << messages << std::flush;
+        return CACHED;
+    }
+
+    if (!assembler.assemble(request.inputFile, request.objectFile, request.listFile)) {
+        return FAILED;
+    }
+    if (cacheable) {
+        cache->store(source.text(), options, request.objectFile, request.listFile, assembler.getMessages());
+    }
+    return ASSEMBLED;
+}
+
+double percentile(const std::vector<double>& sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()))];
+}
+
+// Reads one request per line from stdin and answers each on stdout with
+// "<outcome> <milliseconds>", where the outcome is "assembled", "cached",
+// "failed" or "usage". Diagnostics go to stderr as usual. One Assembler
+// serves every request, so its buffers stay allocated between them.
+// At the end of the input, hit rates and latencies go to stderr.
+int serve(Assembler& assembler, AssemblyCache* cache, unsigned threads) {
+    typedef std::chrono::steady_clock Clock;
+    assembler.setVerbose(false);
+
+    std::vector<double> latencies[3]; // Milliseconds, by Outcome
+    uint64_t usageErrors = 0;
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        std::istringstream words(line);
+        std::vector<std::string> args;
+        std::string word;
+        while (words >> word) {
+            args.push_back(word);
+        }
+        if (args.empty()) {
+            continue;
+        }
+
+        Clock::time_point start = Clock::now();
+        Request request;
+        request.threads = threads;
+        const char* answer = "usage";
+        if (parseRequest(args, request)) {
+            Outcome outcome = run(assembler, cache, request);
+            answer = outcome == CACHED ? "cached" : outcome == ASSEMBLED ? "assembled" : "failed";
+            latencies[outcome].push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        } else {
+            usageErrors++;
+        }
+        char timing[32];
+        std::snprintf(timing, sizeof(timing), " %.3f", std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        std::cout << answer << timing << std::endl;
+    }
+
+    std::vector<double> all;
+    for (const auto& times : latencies) {
+        all.insert(all.end(), times.begin(), times.end());
+    }
+    std::sort(all.begin(), all.end());
+    size_t hits = latencies[CACHED].size();
+    size_t lookups = cache ? cache->getStats().hits + cache->getStats().misses : 0;
+
+    char report[160];
+    std::cerr << "--- Server Report ---" << "\n";
+    std::snprintf(report, sizeof(report), "Requests: %zu (%zu assembled, %zu cached, %zu failed, %llu malformed)\n",
+                  all.size() + static_cast<size_t>(usageErrors), latencies[ASSEMBLED].size(), hits, latencies[FAILED].size(),
+                  static_cast<unsigned long long>(usageErrors));
+    std::cerr << report;
+    if (cache) {
+        std::snprintf(report, sizeof(report), "Cache: %s, hit rate %.1f%% (%zu of %zu), %llu stored, %llu store failures\n",
+                      cache->getDirectory().c_str(), lookups ? 100.0 * hits / lookups : 0.0, hits, lookups,
+                      static_cast<unsigned long long>(cache->getStats().stores),
+                      static_cast<unsigned long long>(cache->getStats().storeFailures));
+        std::cerr << report;
+    }
+    std::snprintf(report, sizeof(report), "Latency (ms): p50 %.3f, p95 %.3f, max %.3f\n",
+                  percentile(all, 0.5), percentile(all, 0.95), all.empty() ? 0.0 : all.back());
+    std::cerr << report;
+    const char* names[3] = { "failed", "assembled", "cached" };
+    for (int outcome : { ASSEMBLED, CACHED, FAILED }) {
+        const std::vector<double>& times = latencies[outcome];
+        if (!times.empty()) {
+            double total = 0;
+            for (double time : times) {
+                total += time;
+            }
+            std::snprintf(report, sizeof(report), "  %-9s mean %.3f ms\n", names[outcome], total / times.size());
+            std::cerr << report;
+        }
+    }
+    return 0;
+}
+
+} // namespace
 
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        std::cerr << "Usage: " << argv[0] << " <input.asm> <output.obj> <output.lst>" << std::endl;
+    // Options for the whole process come first
+    bool server = false;
+    bool useCache = false;
+    std::string cacheDirectory;
+    unsigned threads = 0;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--server") {
+            server = true;
+        } else if (option == "--cache") {
+            useCache = true;
+        } else if (option.compare(0, 8, "--cache=") == 0) {
+            useCache = true;
+            cacheDirectory = option.substr(8);
+        } else if (option.compare(0, 2, "-j") == 0 && option.size() > 2) {
+            threads = std::strtoul(option.c_str() + 2, nullptr, 10);
+        } else {
+            args.push_back(option);
+        }
+    }
+
+    Request request;
+    request.threads = threads;
+    if (server ? !args.empty() : !parseRequest(args, request)) {
+        std::cerr << "Usage: " << argv[0] << " " << USAGE << std::endl;
         return 1;
     }
 
-    std::string inputFile = argv[1];
-    std::string objectFile = argv[2];
-    std::string listFile = argv[3];
+    AssemblyCache cache(cacheDirectory.empty() ? AssemblyCache::defaultDirectory() : cacheDirectory);
+    if (useCache && !cache.open()) {
+        std::cerr << "Warning: cache directory " << cache.getDirectory() << " is not usable; not caching" << std::endl;
+        useCache = false;
+    }
 
     Assembler asmInstance;
-    
-    if (asmInstance.assemble(inputFile, objectFile, listFile)) {
-        std::cout << "Assembly successful. Output files: " 
-                  << objectFile << ", " << listFile << std::endl;
-    } else {
+    if (server) {
+        return serve(asmInstance, useCache ? &cache : nullptr, threads);
+    }
+
+    Outcome outcome = run(asmInstance, useCache ? &cache : nullptr, request);
+    if (outcome == FAILED) {
         std::cerr << "Assembly failed." << std::endl;
         return 1;
     }
-
+    if (outcome == CACHED) {
+        std::cout << "Using cached output for " << request.inputFile << "." << std::endl;
+    }
+    std::cout << "Assembly successful. Output files: " << request.objectFile;
+    if (request.listing) {
+        std::cout << ", " << request.listFile;
+    }
+    std::cout << std::endl;
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,811 @@
+#include "Workloads.h"
+#include <sstream>
+
+namespace {
+
+const int32_t RESULT_ADDRESS = 1;
+const int32_t ARRAY_ADDRESS = 2;
+
+// Words copied in total by the memory-copy workload, whatever the block size
+const int COPY_TOTAL_WORDS = 1 << 18;
+
+// Deterministic input data, so every run sees the same branches
+class Lcg {
+public:
+    explicit Lcg(uint32_t seed) : state(seed) {}
+    uint32_t next() {
+        state = state * 1103515245u + 12345u;
+        return state >> 16;
+    }
+private:
+    uint32_t state;
+};
+
+// "br main", the result word, then the data words
+std::string header(const std::vector<int32_t>& data) {
+    std::ostringstream text;
+    text << "        br main\n"
+         << "result: data 0\n";
+    for (size_t i = 0; i < data.size(); i++) {
+        text << (i ? "        " : "array:  ") << "data " << data[i] << "\n";
+    }
+    return text.str();
+}
+
+const char* STACK_SETUP =
+    "main:   ldc 0xF000\n"
+    "        a2sp\n";
+
+// Transition function of the state machine workload; shared with check()
+int nextState(int state, int32_t symbol) {
+    if (symbol == 0) {
+        return 1;
+    }
+    if (state == 1 && symbol == 1) {
+        return 2;
+    }
+    if (state == 2 && symbol == 2) {
+        return 3;
+    }
+    return 0;
+}
+
+// Stacks of the spawned cores lie below core 0's, this far apart
+const int32_t CORE_STACK_WORDS = 0x400;
+
+// Core 0 of a parallel workload: spawns cores 1 ... cores-1 at "child" with
+// their argument on their stack, runs "work" with arguments[0] itself, then
+// joins the others and stores the sum of every core's "work" result. The
+// caller appends "work", which takes its argument and returns its result
+// in A like "fib" below.
+std::string parallelMain(int cores, const std::vector<int32_t>& arguments) {
+    std::ostringstream text;
+    text << STACK_SETUP
+         << "        adj -" << cores << "          ; The spawned cores' numbers, then the total\n";
+    for (int core = 1; core < cores; core++) {
+        int32_t stack = 0xF000 - CORE_STACK_WORDS * core;
+        text << "        ldc " << arguments[core] << "\n"
+             << "        ldc " << stack << "\n"
+             << "        stnl 0\n"
+             << "        ldc " << stack << "\n"
+             << "        ldc child\n"
+             << "        spawn\n"
+             << "        stl " << core - 1 << "\n";
+    }
+    text << "        ldc " << arguments[0] << "\n"
+         << "        call work\n"
+         << "        stl " << cores - 1 << "\n";
+    for (int core = 1; core < cores; core++) {
+        text << "        ldl " << core - 1 << "\n"
+             << "        join\n"
+             << "        ldl " << cores - 1 << "\n"
+             << "        add\n"
+             << "        stl " << cores - 1 << "\n";
+    }
+    text << "        ldl " << cores - 1 << "\n"
+         << "        ldc result\n"
+         << "        stnl 0\n"
+         << "        adj " << cores << "\n"
+         << "        HALT\n"
+         << "child:  ldl 0\n"
+         << "        call work\n"
+         << "        HALT\n";
+    return text.str();
+}
+
+} // namespace
+
+Workload bubbleSortWorkload(int elements, bool block) {
+    std::vector<int32_t> data;
+    for (int i = elements; i > 0; i--) {
+        data.push_back(i);
+    }
+
+    std::ostringstream text;
+    text << header(data) << STACK_SETUP;
+    if (block) {
+        text << "        ldc array\n"
+             << "        ldc " << elements << "\n"
+             << "        bsort\n"
+             << "        HALT\n";
+    } else {
+        text << "        adj -4          ; 0: passes left, 1: j, 2: &array[j], 3: temp\n"
+             << "        ldc " << elements - 1 << "\n"
+             << "        stl 0\n"
+             << "outer:  ldl 0\n"
+             << "        brz done\n"
+             << "        ldc 0\n"
+             << "        stl 1\n"
+             << "inner:  ldl 1\n"
+             << "        ldl 0\n"
+             << "        sub\n"
+             << "        brz next\n"
+             << "        ldc array\n"
+             << "        ldl 1\n"
+             << "        add\n"
+             << "        stl 2\n"
+             << "        ldl 2\n"
+             << "        ldnl 0\n"
+             << "        ldl 2\n"
+             << "        ldnl 1\n"
+             << "        sub             ; array[j] - array[j+1]\n"
+             << "        brlz keep\n"
+             << "        brz keep\n"
+             << "        ldl 2\n"
+             << "        ldnl 0\n"
+             << "        stl 3\n"
+             << "        ldl 2\n"
+             << "        ldnl 1\n"
+             << "        ldl 2\n"
+             << "        stnl 0\n"
+             << "        ldl 3\n"
+             << "        ldl 2\n"
+             << "        stnl 1\n"
+             << "keep:   ldl 1\n"
+             << "        adc 1\n"
+             << "        stl 1\n"
+             << "        br inner\n"
+             << "next:   ldl 0\n"
+             << "        adc -1\n"
+             << "        stl 0\n"
+             << "        br outer\n"
+             << "done:   adj 4\n"
+             << "        HALT\n";
+    }
+
+    Workload workload;
+    workload.name = block ? "bubble_sort_block" : "bubble_sort";
+    workload.size = elements;
+    workload.source = text.str();
+    workload.check = [elements](VirtualMachine& vm) {
+        for (int i = 0; i < elements; i++) {
+            if (vm.readMemory(ARRAY_ADDRESS + i) != i + 1) {
+                return false;
+            }
+        }
+        return true;
+    };
+    return workload;
+}
+
+Workload memoryCopyWorkload(int words, bool block) {
+    int repetitions = COPY_TOTAL_WORDS / words;
+    Lcg random(words);
+    std::vector<int32_t> data;
+    for (int i = 0; i < words; i++) {
+        data.push_back(static_cast<int32_t>(random.next()));
+    }
+    data.resize(2 * words, 0); // Destination follows the source
+
+    std::ostringstream text;
+    text << header(data) << STACK_SETUP;
+    if (block) {
+        text << "        adj -2          ; 0: repetitions left, 1: source\n"
+             << "        ldc " << repetitions << "\n"
+             << "        stl 0\n"
+             << "        ldc array\n"
+             << "        stl 1\n"
+             << "repeat: ldl 0\n"
+             << "        brz done\n"
+             << "        ldc array\n"
+             << "        adc " << words << "\n"
+             << "        ldc " << words << "\n"
+             << "        bcopy 1\n"
+             << "        ldl 0\n"
+             << "        adc -1\n"
+             << "        stl 0\n"
+             << "        br repeat\n"
+             << "done:   adj 2\n"
+             << "        HALT\n";
+    } else {
+        text << "        adj -3          ; 0: repetitions left, 1: words left, 2: source pointer\n"
+             << "        ldc " << repetitions << "\n"
+             << "        stl 0\n"
+             << "repeat: ldl 0\n"
+             << "        brz done\n"
+             << "        ldc array\n"
+             << "        stl 2\n"
+             << "        ldc " << words << "\n"
+             << "        stl 1\n"
+             << "copy:   ldl 1\n"
+             << "        brz copied\n"
+             << "        ldl 2\n"
+             << "        ldnl 0\n"
+             << "        ldl 2\n"
+             << "        stnl " << words << "\n"
+             << "        ldl 2\n"
+             << "        adc 1\n"
+             << "        stl 2\n"
+             << "        ldl 1\n"
+             << "        adc -1\n"
+             << "        stl 1\n"
+             << "        br copy\n"
+             << "copied: ldl 0\n"
+             << "        adc -1\n"
+             << "        stl 0\n"
+             << "        br repeat\n"
+             << "done:   adj 3\n"
+             << "        HALT\n";
+    }
+
+    Workload workload;
+    workload.name = block ? "memory_copy_block" : "memory_copy";
+    workload.size = words;
+    workload.source = text.str();
+    workload.check = [words](VirtualMachine& vm) {
+        for (int i = 0; i < words; i++) {
+            if (vm.readMemory(ARRAY_ADDRESS + words + i) != vm.readMemory(ARRAY_ADDRESS + i)) {
+                return false;
+            }
+        }
+        return true;
+    };
+    return workload;
+}
+
+Workload fillWorkload(int words, bool block) {
+    int repetitions = COPY_TOTAL_WORDS / words;
+
+    // Each pass stores the number of passes left, so the last one leaves 1s
+    std::ostringstream text;
+    text << header(std::vector<int32_t>(words, 0)) << STACK_SETUP;
+    if (block) {
+        text << "        adj -1          ; 0: repetitions left\n"
+             << "        ldc " << repetitions << "\n"
+             << "        stl 0\n"
+             << "repeat: ldl 0\n"
+             << "        brz done\n"
+             << "        ldc array\n"
+             << "        ldc " << words << "\n"
+             << "        bfill 0\n"
+             << "        ldl 0\n"
+             << "        adc -1\n"
+             << "        stl 0\n"
+             << "        br repeat\n"
+             << "done:   adj 1\n"
+             << "        HALT\n";
+    } else {
+        text << "        adj -3          ; 0: repetitions left, 1: words left, 2: pointer\n"
+             << "        ldc " << repetitions << "\n"
+             << "        stl 0\n"
+             << "repeat: ldl 0\n"
+             << "        brz done\n"
+             << "        ldc array\n"
+             << "        stl 2\n"
+             << "        ldc " << words << "\n"
+             << "        stl 1\n"
+             << "fill:   ldl 1\n"
+             << "        brz filled\n"
+             << "        ldl 0\n"
+             << "        ldl 2\n"
+             << "        stnl 0\n"
+             << "        ldl 2\n"
+             << "        adc 1\n"
+             << "        stl 2\n"
+             << "        ldl 1\n"
+             << "        adc -1\n"
+             << "        stl 1\n"
+             << "        br fill\n"
+             << "filled: ldl 0\n"
+             << "        adc -1\n"
+             << "        stl 0\n"
+             << "        br repeat\n"
+             << "done:   adj 3\n"
+             << "        HALT\n";
+    }
+
+    Workload workload;
+    workload.name = block ? "fill_block" : "fill";
+    workload.size = words;
+    workload.source = text.str();
+    workload.check = [words](VirtualMachine& vm) {
+        for (int i = 0; i < words; i++) {
+            if (vm.readMemory(ARRAY_ADDRESS + i) != 1) {
+                return false;
+            }
+        }
+        return true;
+    };
+    return workload;
+}
+
+Workload sumWorkload(int words, bool block) {
+    int repetitions = COPY_TOTAL_WORDS / words;
+    Lcg random(words);
+    std::vector<int32_t> data;
+    uint32_t expected = 0;
+    for (int i = 0; i < words; i++) {
+        data.push_back(static_cast<int32_t>(random.next()));
+        expected += static_cast<uint32_t>(data.back());
+    }
+
+    std::ostringstream text;
+    text << header(data) << STACK_SETUP;
+    if (block) {
+        text << "        adj -1          ; 0: repetitions left\n"
+             << "        ldc " << repetitions << "\n"
+             << "        stl 0\n"
+             << "repeat: ldl 0\n"
+             << "        brz done\n"
+             << "        ldc array\n"
+             << "        ldc " << words << "\n"
+             << "        bsum\n"
+             << "        ldc result\n"
+             << "        stnl 0\n"
+             << "        ldl 0\n"
+             << "        adc -1\n"
+             << "        stl 0\n"
+             << "        br repeat\n"
+             << "done:   adj 1\n"
+             << "        HALT\n";
+    } else {
+        text << "        adj -4          ; 0: repetitions left, 1: words left, 2: pointer, 3: total\n"
+             << "        ldc " << repetitions << "\n"
+             << "        stl 0\n"
+             << "repeat: ldl 0\n"
+             << "        brz done\n"
+             << "        ldc array\n"
+             << "        stl 2\n"
+             << "        ldc " << words << "\n"
+             << "        stl 1\n"
+             << "        ldc 0\n"
+             << "        stl 3\n"
+             << "sum:    ldl 1\n"
+             << "        brz summed\n"
+             << "        ldl 3\n"
+             << "        ldl 2\n"
+             << "        ldnl 0\n"
+             << "        add\n"
+             << "        stl 3\n"
+             << "        ldl 2\n"
+             << "        adc 1\n"
+             << "        stl 2\n"
+             << "        ldl 1\n"
+             << "        adc -1\n"
+             << "        stl 1\n"
+             << "        br sum\n"
+             << "summed: ldl 3\n"
+             << "        ldc result\n"
+             << "        stnl 0\n"
+             << "        ldl 0\n"
+             << "        adc -1\n"
+             << "        stl 0\n"
+             << "        br repeat\n"
+             << "done:   adj 4\n"
+             << "        HALT\n";
+    }
+
+    Workload workload;
+    workload.name = block ? "sum_block" : "sum";
+    workload.size = words;
+    workload.source = text.str();
+    workload.check = [expected](VirtualMachine& vm) {
+        return vm.readMemory(RESULT_ADDRESS) == static_cast<int32_t>(expected);
+    };
+    return workload;
+}
+
+Workload compareWorkload(int words, bool block) {
+    int repetitions = COPY_TOTAL_WORDS / words;
+    Lcg random(words);
+    std::vector<int32_t> data;
+    for (int i = 0; i < words; i++) {
+        data.push_back(static_cast<int32_t>(random.next()));
+    }
+    // The second array only differs, by being greater, in its last word
+    data.insert(data.end(), data.begin(), data.end());
+    data.back()++;
+
+    std::ostringstream text;
+    text << header(data) << STACK_SETUP;
+    if (block) {
+        text << "        adj -2          ; 0: repetitions left, 1: second array\n"
+             << "        ldc " << repetitions << "\n"
+             << "        stl 0\n"
+             << "        ldc array\n"
+             << "        adc " << words << "\n"
+             << "        stl 1\n"
+             << "repeat: ldl 0\n"
+             << "        brz done\n"
+             << "        ldc array\n"
+             << "        ldc " << words << "\n"
+             << "        bcmp 1\n"
+             << "        ldc result\n"
+             << "        stnl 0\n"
+             << "        ldl 0\n"
+             << "        adc -1\n"
+             << "        stl 0\n"
+             << "        br repeat\n"
+             << "done:   adj 2\n"
+             << "        HALT\n";
+    } else {
+        text << "        adj -3          ; 0: repetitions left, 1: words left, 2: pointer\n"
+             << "        ldc " << repetitions << "\n"
+             << "        stl 0\n"
+             << "repeat: ldl 0\n"
+             << "        brz done\n"
+             << "        ldc array\n"
+             << "        stl 2\n"
+             << "        ldc " << words << "\n"
+             << "        stl 1\n"
+             << "cmp:    ldl 1\n"
+             << "        brz equal\n"
+             << "        ldl 2\n"
+             << "        ldnl 0\n"
+             << "        ldl 2\n"
+             << "        ldnl " << words << "\n"
+             << "        sub\n"
+             << "        brz same\n"
+             << "        brlz less\n"
+             << "        ldc 1\n"
+             << "        br found\n"
+             << "less:   ldc -1\n"
+             << "        br found\n"
+             << "same:   ldl 2\n"
+             << "        adc 1\n"
+             << "        stl 2\n"
+             << "        ldl 1\n"
+             << "        adc -1\n"
+             << "        stl 1\n"
+             << "        br cmp\n"
+             << "equal:  ldc 0\n"
+             << "found:  ldc result\n"
+             << "        stnl 0\n"
+             << "        ldl 0\n"
+             << "        adc -1\n"
+             << "        stl 0\n"
+             << "        br repeat\n"
+             << "done:   adj 3\n"
+             << "        HALT\n";
+    }
+
+    Workload workload;
+    workload.name = block ? "compare_block" : "compare";
+    workload.size = words;
+    workload.source = text.str();
+    workload.check = [](VirtualMachine& vm) {
+        return vm.readMemory(RESULT_ADDRESS) == -1;
+    };
+    return workload;
+}
+
+Workload recursionWorkload(int n) {
+    std::ostringstream text;
+    text << header(std::vector<int32_t>()) << STACK_SETUP
+         << "        ldc " << n << "\n"
+         << "        call fib\n"
+         << "        ldc result\n"
+         << "        stnl 0\n"
+         << "        HALT\n"
+         << "fib:    adj -3          ; 0: return address, 1: n, 2: fib(n-1)\n"
+         << "        stl 0\n"
+         << "        stl 1\n"
+         << "        ldl 1\n"
+         << "        adc -2\n"
+         << "        brlz base\n"
+         << "        ldl 1\n"
+         << "        adc -1\n"
+         << "        call fib\n"
+         << "        stl 2\n"
+         << "        ldl 1\n"
+         << "        adc -2\n"
+         << "        call fib\n"
+         << "        ldl 2\n"
+         << "        add\n"
+         << "        ldl 0\n"
+         << "        adj 3\n"
+         << "        return\n"
+         << "base:   ldl 1\n"
+         << "        ldl 0\n"
+         << "        adj 3\n"
+         << "        return\n";
+
+    int32_t expected = 0, next = 1;
+    for (int i = 0; i < n; i++) {
+        int32_t sum = expected + next;
+        expected = next;
+        next = sum;
+    }
+
+    Workload workload;
+    workload.name = "recursion";
+    workload.size = n;
+    workload.source = text.str();
+    workload.check = [expected](VirtualMachine& vm) {
+        return vm.readMemory(RESULT_ADDRESS) == expected;
+    };
+    return workload;
+}
+
+Workload stateMachineWorkload(int symbols) {
+    Lcg random(symbols);
+    std::vector<int32_t> data;
+    int32_t matches = 0;
+    int state = 0;
+    for (int i = 0; i < symbols; i++) {
+        int32_t symbol = static_cast<int32_t>(random.next() % 4);
+        data.push_back(symbol);
+        state = nextState(state, symbol);
+        matches += state == 3;
+    }
+
+    // Counts occurrences of "0 1 2" with a chain of compares per state, so
+    // nearly every instruction between loads is a data-dependent branch
+    std::ostringstream text;
+    text << header(data) << STACK_SETUP
+         << "        adj -5          ; 0: symbols left, 1: input pointer, 2: state, 3: matches, 4: symbol\n"
+         << "        ldc " << symbols << "\n"
+         << "        stl 0\n"
+         << "        ldc array\n"
+         << "        stl 1\n"
+         << "        ldc 0\n"
+         << "        stl 2\n"
+         << "        ldc 0\n"
+         << "        stl 3\n"
+         << "step:   ldl 0\n"
+         << "        brz done\n"
+         << "        ldl 1\n"
+         << "        ldnl 0\n"
+         << "        stl 4\n"
+         << "        ldl 2\n"
+         << "        adc -1\n"
+         << "        brz s1\n"
+         << "        ldl 2\n"
+         << "        adc -2\n"
+         << "        brz s2\n"
+         << "s0:     ldl 4\n"
+         << "        brz to1\n"
+         << "        br to0\n"
+         << "s1:     ldl 4\n"
+         << "        brz to1\n"
+         << "        ldl 4\n"
+         << "        adc -1\n"
+         << "        brz to2\n"
+         << "        br to0\n"
+         << "s2:     ldl 4\n"
+         << "        brz to1\n"
+         << "        ldl 4\n"
+         << "        adc -2\n"
+         << "        brz to3\n"
+         << "to0:    ldc 0\n"
+         << "        br set\n"
+         << "to1:    ldc 1\n"
+         << "        br set\n"
+         << "to2:    ldc 2\n"
+         << "        br set\n"
+         << "to3:    ldl 3\n"
+         << "        adc 1\n"
+         << "        stl 3\n"
+         << "        ldc 3\n"
+         << "set:    stl 2\n"
+         << "        ldl 1\n"
+         << "        adc 1\n"
+         << "        stl 1\n"
+         << "        ldl 0\n"
+         << "        adc -1\n"
+         << "        stl 0\n"
+         << "        br step\n"
+         << "done:   ldl 3\n"
+         << "        ldc result\n"
+         << "        stnl 0\n"
+         << "        adj 5\n"
+         << "        HALT\n";
+
+    Workload workload;
+    workload.name = "state_machine";
+    workload.size = symbols;
+    workload.source = text.str();
+    workload.check = [matches](VirtualMachine& vm) {
+        return vm.readMemory(RESULT_ADDRESS) == matches;
+    };
+    return workload;
+}
+
+Workload casCounterWorkload(int increments, int cores) {
+    int share = increments / cores;
+
+    // Each core adds its share to the counter at "array", retrying when
+    // another core got there between its load and its cas
+    std::ostringstream text;
+    text << header(std::vector<int32_t>(1, 0)) << parallelMain(cores, std::vector<int32_t>(cores, 0))
+         << "work:   adj -4          ; 0: return address, 1: increments left, 2: old count, 3: new count\n"
+         << "        stl 0\n"
+         << "        ldc " << share << "\n"
+         << "        stl 1\n"
+         << "next:   ldl 1\n"
+         << "        brz done\n"
+         << "retry:  ldc array\n"
+         << "        ldnl 0\n"
+         << "        stl 2\n"
+         << "        ldl 2\n"
+         << "        adc 1\n"
+         << "        stl 3\n"
+         << "        ldl 2\n"
+         << "        ldc array\n"
+         << "        cas 3\n"
+         << "        ldl 2\n"
+         << "        sub             ; 0 if the swap happened\n"
+         << "        brz added\n"
+         << "        br retry\n"
+         << "added:  ldl 1\n"
+         << "        adc -1\n"
+         << "        stl 1\n"
+         << "        br next\n"
+         << "done:   ldc " << share << "\n"
+         << "        ldl 0\n"
+         << "        adj 4\n"
+         << "        return\n";
+
+    Workload workload;
+    workload.name = "cas_counter";
+    workload.size = increments;
+    workload.source = text.str();
+    workload.cores = cores;
+    workload.check = [increments](VirtualMachine& vm) {
+        return vm.readMemory(ARRAY_ADDRESS) == increments && vm.readMemory(RESULT_ADDRESS) == increments;
+    };
+    return workload;
+}
+
+Workload spinLockWorkload(int increments, int cores) {
+    int share = increments / cores;
+
+    // The lock is at "array" and the counter after it. The counter is read
+    // and written with plain loads and stores while the lock is held; the
+    // fence makes the new count visible before the lock is seen free.
+    std::vector<int32_t> data(2, 0);
+    std::ostringstream text;
+    text << header(data) << parallelMain(cores, std::vector<int32_t>(cores, 0))
+         << "work:   adj -3          ; 0: return address, 1: increments left, 2: 1 to lock with\n"
+         << "        stl 0\n"
+         << "        ldc 1\n"
+         << "        stl 2\n"
+         << "        ldc " << share << "\n"
+         << "        stl 1\n"
+         << "next:   ldl 1\n"
+         << "        brz done\n"
+         << "lock:   ldc 0\n"
+         << "        ldc array\n"
+         << "        cas 2\n"
+         << "        brz locked      ; The lock was free and is now ours\n"
+         << "        br lock\n"
+         << "locked: ldc array\n"
+         << "        ldnl 1\n"
+         << "        adc 1\n"
+         << "        ldc array\n"
+         << "        stnl 1\n"
+         << "        fence\n"
+         << "        ldc 0\n"
+         << "        ldc array\n"
+         << "        stnl 0\n"
+         << "        ldl 1\n"
+         << "        adc -1\n"
+         << "        stl 1\n"
+         << "        br next\n"
+         << "done:   ldc " << share << "\n"
+         << "        ldl 0\n"
+         << "        adj 3\n"
+         << "        return\n";
+
+    Workload workload;
+    workload.name = "spin_lock";
+    workload.size = increments;
+    workload.source = text.str();
+    workload.cores = cores;
+    workload.check = [increments](VirtualMachine& vm) {
+        return vm.readMemory(ARRAY_ADDRESS) == 0 && vm.readMemory(ARRAY_ADDRESS + 1) == increments &&
+               vm.readMemory(RESULT_ADDRESS) == increments;
+    };
+    return workload;
+}
+
+Workload parallelSumWorkload(int words, int cores) {
+    int repetitions = 4 * COPY_TOTAL_WORDS / words;
+    int slice = words / cores;
+    Lcg random(words);
+    std::vector<int32_t> data;
+    uint32_t expected = 0;
+    for (int i = 0; i < words; i++) {
+        data.push_back(static_cast<int32_t>(random.next()));
+        expected += static_cast<uint32_t>(data.back());
+    }
+    std::vector<int32_t> slices;
+    for (int core = 0; core < cores; core++) {
+        slices.push_back(ARRAY_ADDRESS + core * slice);
+    }
+
+    // The cores only read shared memory, so nothing but join orders them
+    std::ostringstream text;
+    text << header(data) << parallelMain(cores, slices)
+         << "work:   adj -6          ; 0: return address, 1: slice, 2: repetitions left, 3: words left,\n"
+         << "                        ; 4: pointer, 5: total\n"
+         << "        stl 0\n"
+         << "        stl 1\n"
+         << "        ldc " << repetitions << "\n"
+         << "        stl 2\n"
+         << "        ldc 0\n"
+         << "        stl 5\n"
+         << "repeat: ldl 2\n"
+         << "        brz done\n"
+         << "        ldl 1\n"
+         << "        stl 4\n"
+         << "        ldc " << slice << "\n"
+         << "        stl 3\n"
+         << "        ldc 0\n"
+         << "        stl 5\n"
+         << "sum:    ldl 3\n"
+         << "        brz summed\n"
+         << "        ldl 5\n"
+         << "        ldl 4\n"
+         << "        ldnl 0\n"
+         << "        add\n"
+         << "        stl 5\n"
+         << "        ldl 4\n"
+         << "        adc 1\n"
+         << "        stl 4\n"
+         << "        ldl 3\n"
+         << "        adc -1\n"
+         << "        stl 3\n"
+         << "        br sum\n"
+         << "summed: ldl 2\n"
+         << "        adc -1\n"
+         << "        stl 2\n"
+         << "        br repeat\n"
+         << "done:   ldl 5\n"
+         << "        ldl 0\n"
+         << "        adj 6\n"
+         << "        return\n";
+
+    Workload workload;
+    workload.name = "parallel_sum";
+    workload.size = words;
+    workload.source = text.str();
+    workload.cores = cores;
+    workload.check = [expected](VirtualMachine& vm) {
+        return vm.readMemory(RESULT_ADDRESS) == static_cast<int32_t>(expected);
+    };
+    return workload;
+}
+
+std::vector<Workload> standardWorkloads() {
+    std::vector<Workload> workloads;
+    for (int elements : { 64, 256, 512 }) {
+        workloads.push_back(bubbleSortWorkload(elements));
+    }
+    for (int words : { 256, 4096, 16384 }) {
+        workloads.push_back(memoryCopyWorkload(words));
+    }
+    for (int n : { 12, 18, 22 }) {
+        workloads.push_back(recursionWorkload(n));
+    }
+    for (int symbols : { 1024, 16384, 49152 }) {
+        workloads.push_back(stateMachineWorkload(symbols));
+    }
+    return workloads;
+}
+
+std::vector<Workload> bulkWorkloads() {
+    std::vector<Workload> workloads;
+    for (bool block : { false, true }) {
+        for (int elements : { 64, 256, 512 }) {
+            workloads.push_back(bubbleSortWorkload(elements, block));
+        }
+        for (int words : { 256, 4096, 16384 }) {
+            workloads.push_back(memoryCopyWorkload(words, block));
+            workloads.push_back(fillWorkload(words, block));
+            workloads.push_back(sumWorkload(words, block));
+            workloads.push_back(compareWorkload(words, block));
+        }
+    }
+    return workloads;
+}
+
+std::vector<Workload> parallelWorkloads(int maxCores) {
+    std::vector<Workload> workloads;
+    for (int cores = 1; cores <= maxCores; cores *= 2) {
+        workloads.push_back(casCounterWorkload(1 << 18, cores));
+        workloads.push_back(spinLockWorkload(1 << 18, cores));
+        workloads.push_back(parallelSumWorkload(16384, cores));
+    }
+    return workloads;
+}
@@ -0,0 +1,51 @@
+#ifndef WORKLOADS_H
+#define WORKLOADS_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "../emulator/VirtualMachine.h"
+
+// A guest program generated as assembly source for one problem size.
+//
+// Every program starts with "br main" followed by its data, so the result
+// word is always at address 1 and arrays follow it at address 2; check()
+// can then verify the final memory without reading the listing.
+struct Workload {
+    std::string name;
+    int size;
+    std::string source;
+    std::function<bool(VirtualMachine&)> check;
+    int cores = 1; // Above 1, the program spawns cores and runs in a CoreGroup of this size
+};
+
+// Generators for the standard benchmark programs. Those taking 'block' do
+// the same work with one block instruction (see Isa.def) instead of a loop
+// when it is true, and then add "_block" to the workload's name.
+Workload bubbleSortWorkload(int elements, bool block = false); // Worst-case (reversed) input
+Workload memoryCopyWorkload(int words, bool block = false);    // Copies 'words' repeatedly
+Workload fillWorkload(int words, bool block = false);          // Fills 'words' repeatedly
+Workload sumWorkload(int words, bool block = false);           // Sums 'words' repeatedly
+Workload compareWorkload(int words, bool block = false);       // Compares two arrays repeatedly
+Workload recursionWorkload(int n);                             // Naive recursive fib(n)
+Workload stateMachineWorkload(int symbols);                    // DFA over random input
+
+// Parallel generators: core 0 spawns 'cores' - 1 more, each core does its
+// share of the work in the same subroutine, and core 0 joins them all.
+// 'cores' must be a power of two that divides the work.
+Workload casCounterWorkload(int increments, int cores);  // Shared counter bumped with cas
+Workload spinLockWorkload(int increments, int cores);    // Counter under a cas spin lock
+Workload parallelSumWorkload(int words, int cores);      // Sums one slice per core repeatedly
+
+// The default suite: each workload at three sizes
+std::vector<Workload> standardWorkloads();
+
+// The array workloads at three sizes, first as loops and then with block
+// instructions
+std::vector<Workload> bulkWorkloads();
+
+// The parallel workloads on 1, 2, 4 ... up to 'maxCores' cores
+std::vector<Workload> parallelWorkloads(int maxCores);
+
+#endif // WORKLOADS_H
@@ -0,0 +1,412 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "Workloads.h"
+#include "../assembler/Assembler.h"
+#include "../emulator/Trace.h"
+#include "../emulator/CoreGroup.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const int MAX_PARALLEL_CORES = 32;
+
+struct Options {
+    int trials = 5;
+    int warmup = 1;
+    std::vector<VirtualMachine::Engine> engines;
+    bool trace = false; // Also time the switch engine while recording a trace
+    bool csv = false;
+    bool bulk = false;  // Run bulkWorkloads() and compare loops with block instructions
+    int parallel = 0;   // Run parallelWorkloads() up to this many cores and report speedups
+    std::string filter;
+    std::string baselineFile;
+    double threshold = 10.0; // Percent slowdown reported as a regression
+};
+
+// Medians and minimums over the timed trials of one workload on one engine
+struct Result {
+    std::string workload;
+    int size;
+    std::string engine;
+    int cores;
+    uint64_t instructions; // On every core
+    int trials;
+    double startupMicros;
+    double loadMicros;
+    double runMicros;
+    double minRunMicros;
+
+    double nsPerInstruction() const { return instructions ? runMicros * 1000.0 / instructions : 0.0; }
+    double mips() const { return runMicros > 0 ? instructions / runMicros : 0.0; }
+    std::string key() const {
+        return workload + "/" + std::to_string(size) + "/" + engine + (cores > 1 ? "/" + std::to_string(cores) : "");
+    }
+};
+
+const char* engineName(VirtualMachine::Engine engine) {
+    switch (engine) {
+        case VirtualMachine::Engine::Threaded: return "threaded";
+        case VirtualMachine::Engine::Jit: return "jit";
+        default: return "switch";
+    }
+}
+
+double microsBetween(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    size_t middle = values.size() / 2;
+    return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+// Writes the workload's source to 'directory' and assembles it; returns the
+// object file name, or an empty string on failure
+std::string assembleWorkload(const Workload& workload, const std::string& directory) {
+    std::string base = directory + "/" + workload.name + "_" + std::to_string(workload.size);
+    std::ofstream source(base + ".asm");
+    source << workload.source;
+    source.close();
+
+    // The assembler reports progress on stdout, which carries our results
+    std::ostringstream discarded;
+    std::streambuf* saved = std::cout.rdbuf(discarded.rdbuf());
+    Assembler assembler;
+    bool ok = assembler.assemble(base + ".asm", base + ".obj", base + ".lst");
+    std::cout.rdbuf(saved);
+    return ok ? base + ".obj" : std::string();
+}
+
+// Runs one workload on one engine 'warmup + trials' times; returns false if
+// any run fails to halt cleanly with the expected result. With a trace file
+// the run records a trace there instead, on the reference interpreter.
+// Parallel workloads run in a CoreGroup and count every core's instructions.
+bool measure(const Workload& workload, const std::string& objectFile,
+             VirtualMachine::Engine engine, const Options& options, Result& result,
+             const std::string& traceFile = std::string()) {
+    std::vector<double> startup, load, run;
+    uint64_t instructions = 0;
+    TraceRecorder recorder;
+    const char* name = traceFile.empty() ? engineName(engine) : "traced";
+
+    for (int trial = 0; trial < options.warmup + options.trials; trial++) {
+        Clock::time_point start = Clock::now();
+        VirtualMachine vm;
+        Clock::time_point constructed = Clock::now();
+        vm.setVerbose(false);
+        vm.setEngine(engine);
+        if (!vm.loadProgram(objectFile)) {
+            std::cerr << "Error: Could not load " << objectFile << std::endl;
+            return false;
+        }
+        Clock::time_point loaded = Clock::now();
+        uint64_t executed = 0; // By every core, in a CoreGroup
+        bool coreFaulted = false;
+        if (workload.cores > 1) {
+            CoreGroup group(vm, workload.cores);
+            group.run();
+            for (const CoreGroup::CoreReport& report : group.getReports()) {
+                executed += report.instructions;
+                coreFaulted = coreFaulted || report.faulted;
+            }
+        } else if (traceFile.empty()) {
+            vm.execute(UINT64_MAX);
+        } else if (!recorder.record(vm, traceFile)) {
+            std::cerr << "Error: Could not write trace " << traceFile << std::endl;
+            return false;
+        }
+        Clock::time_point finished = Clock::now();
+
+        if (!vm.isHalted() || vm.hasFaulted() || coreFaulted || !workload.check(vm)) {
+            std::cerr << "Error: " << workload.name << " (size " << workload.size << ") on "
+                      << name << " produced a wrong result"
+                      << (vm.hasFaulted() ? ": " + vm.getError() : std::string()) << std::endl;
+            return false;
+        }
+        instructions = workload.cores > 1 ? executed : vm.getInstructionCount();
+
+        if (trial >= options.warmup) {
+            startup.push_back(microsBetween(start, constructed));
+            load.push_back(microsBetween(constructed, loaded));
+            run.push_back(microsBetween(loaded, finished));
+        }
+    }
+
+    result.workload = workload.name;
+    result.size = workload.size;
+    result.engine = name;
+    result.cores = workload.cores;
+    result.instructions = instructions;
+    result.trials = options.trials;
+    result.startupMicros = median(startup);
+    result.loadMicros = median(load);
+    result.runMicros = median(run);
+    result.minRunMicros = *std::min_element(run.begin(), run.end());
+    return true;
+}
+
+const char* CSV_HEADER =
+    "workload,size,engine,instructions,trials,startup_us,load_us,run_us,min_run_us,ns_per_instruction,mips,cores";
+
+void writeResult(std::ostream& out, const Result& result, bool csv) {
+    out << std::fixed << std::setprecision(3);
+    if (csv) {
+        out << result.workload << "," << result.size << "," << result.engine << ","
+            << result.instructions << "," << result.trials << ","
+            << result.startupMicros << "," << result.loadMicros << ","
+            << result.runMicros << "," << result.minRunMicros << ","
+            << result.nsPerInstruction() << "," << result.mips() << "," << result.cores << "\n";
+    } else {
+        out << "{\"workload\":\"" << result.workload << "\",\"size\":" << result.size
+            << ",\"engine\":\"" << result.engine << "\",\"instructions\":" << result.instructions
+            << ",\"trials\":" << result.trials
+            << ",\"startup_us\":" << result.startupMicros << ",\"load_us\":" << result.loadMicros
+            << ",\"run_us\":" << result.runMicros << ",\"min_run_us\":" << result.minRunMicros
+            << ",\"ns_per_instruction\":" << result.nsPerInstruction()
+            << ",\"mips\":" << result.mips() << ",\"cores\":" << result.cores << "}\n";
+    }
+    out.flush();
+}
+
+// Value of "key": in one of our own JSON lines, without quotes
+std::string jsonField(const std::string& line, const std::string& key) {
+    std::string pattern = "\"" + key + "\":";
+    size_t start = line.find(pattern);
+    if (start == std::string::npos) {
+        return std::string();
+    }
+    start += pattern.size();
+    size_t end = line.find_first_of(",}", start);
+    std::string value = line.substr(start, end - start);
+    if (value.size() >= 2 && value[0] == '"') {
+        value = value.substr(1, value.size() - 2);
+    }
+    return value;
+}
+
+// Reads ns_per_instruction per workload/size/engine (and cores, above 1)
+// from an earlier run, in either output format
+bool loadBaseline(const std::string& filename, std::map<std::string, double>& baseline) {
+    std::ifstream in(filename);
+    if (!in) {
+        return false;
+    }
+    std::vector<std::string> columns;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::map<std::string, std::string> fields;
+        if (!line.empty() && line[0] == '{') {
+            for (const char* key : { "workload", "size", "engine", "ns_per_instruction", "cores" }) {
+                fields[key] = jsonField(line, key);
+            }
+        } else {
+            std::vector<std::string> values;
+            std::istringstream cells(line);
+            std::string cell;
+            while (std::getline(cells, cell, ',')) {
+                values.push_back(cell);
+            }
+            if (columns.empty()) {
+                columns = values; // Header row
+                continue;
+            }
+            for (size_t i = 0; i < values.size() && i < columns.size(); i++) {
+                fields[columns[i]] = values[i];
+            }
+        }
+        if (!fields["workload"].empty()) {
+            std::string key = fields["workload"] + "/" + fields["size"] + "/" + fields["engine"];
+            if (std::atoi(fields["cores"].c_str()) > 1) {
+                key += "/" + fields["cores"];
+            }
+            baseline[key] = std::atof(fields["ns_per_instruction"].c_str());
+        }
+    }
+    return true;
+}
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [--trials=N] [--warmup=N] [--engine=switch|threaded|jit]..."
+              << std::endl
+              << "           [--trace] [--bulk] [--parallel[=N]] [--format=json|csv] [--filter=WORKLOAD] [--baseline=FILE [--threshold=PCT]]"
+              << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--trials=") == 0) {
+            options.trials = std::atoi(arg.c_str() + 9);
+        } else if (arg.compare(0, 9, "--warmup=") == 0) {
+            options.warmup = std::atoi(arg.c_str() + 9);
+        } else if (arg == "--engine=switch") {
+            options.engines.push_back(VirtualMachine::Engine::Switch);
+        } else if (arg == "--engine=threaded") {
+            options.engines.push_back(VirtualMachine::Engine::Threaded);
+        } else if (arg == "--engine=jit") {
+            options.engines.push_back(VirtualMachine::Engine::Jit);
+        } else if (arg == "--trace") {
+            options.trace = true;
+        } else if (arg == "--bulk") {
+            options.bulk = true;
+        } else if (arg == "--parallel") {
+            options.parallel = std::max(2u, std::thread::hardware_concurrency());
+        } else if (arg.compare(0, 11, "--parallel=") == 0) {
+            options.parallel = std::atoi(arg.c_str() + 11);
+        } else if (arg == "--format=json" || arg == "--format=csv") {
+            options.csv = arg == "--format=csv";
+        } else if (arg.compare(0, 9, "--filter=") == 0) {
+            options.filter = arg.substr(9);
+        } else if (arg.compare(0, 11, "--baseline=") == 0) {
+            options.baselineFile = arg.substr(11);
+        } else if (arg.compare(0, 12, "--threshold=") == 0) {
+            options.threshold = std::atof(arg.c_str() + 12);
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    // Up to MAX_PARALLEL_CORES stacks fit between the workloads' data and 0xF000
+    options.parallel = std::min(options.parallel, MAX_PARALLEL_CORES);
+    if (options.trials < 1 || options.warmup < 0 || options.parallel < 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (options.engines.empty()) {
+        options.engines = { VirtualMachine::Engine::Switch, VirtualMachine::Engine::Threaded,
+                            VirtualMachine::Engine::Jit };
+    }
+
+    std::map<std::string, double> baseline;
+    if (!options.baselineFile.empty() && !loadBaseline(options.baselineFile, baseline)) {
+        std::cerr << "Error: Could not open baseline " << options.baselineFile << std::endl;
+        return 1;
+    }
+
+    char directoryTemplate[] = "/tmp/emubench.XXXXXX";
+    if (!mkdtemp(directoryTemplate)) {
+        std::cerr << "Error: Could not create a temporary directory" << std::endl;
+        return 1;
+    }
+    std::string directory = directoryTemplate;
+
+    if (options.csv) {
+        std::cout << CSV_HEADER << "\n";
+    }
+
+    int failures = 0;
+    int regressions = 0;
+    std::vector<std::string> generated;
+    std::vector<Result> results;
+    std::vector<Workload> workloads = options.parallel ? parallelWorkloads(options.parallel)
+                                      : options.bulk ? bulkWorkloads() : standardWorkloads();
+    for (const Workload& workload : workloads) {
+        if (!options.filter.empty() && workload.name != options.filter) {
+            continue;
+        }
+        std::string objectFile = assembleWorkload(workload, directory);
+        if (objectFile.empty()) {
+            std::cerr << "Error: Could not assemble " << workload.name << std::endl;
+            failures++;
+            continue;
+        }
+        generated.push_back(objectFile.substr(0, objectFile.size() - 4));
+
+        std::string traceFile = directory + "/trace";
+        // A trace follows one core, so parallel workloads are not traced
+        bool trace = options.trace && workload.cores == 1;
+        for (size_t run = 0; run < options.engines.size() + (trace ? 1 : 0); run++) {
+            bool traced = run == options.engines.size();
+            VirtualMachine::Engine engine = traced ? VirtualMachine::Engine::Switch : options.engines[run];
+            Result result;
+            if (!measure(workload, objectFile, engine, options, result, traced ? traceFile : std::string())) {
+                failures++;
+                continue;
+            }
+            writeResult(std::cout, result, options.csv);
+            results.push_back(result);
+
+            std::string label = result.workload + (result.cores > 1 ? "/" + std::to_string(result.cores) : "");
+            std::cerr << std::left << std::setw(18) << label << std::right
+                      << std::setw(7) << result.size << "  " << std::left << std::setw(9) << result.engine
+                      << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(10) << result.mips() << " MIPS"
+                      << std::setw(9) << result.nsPerInstruction() << " ns/insn";
+            auto previous = baseline.find(result.key());
+            if (previous != baseline.end() && previous->second > 0) {
+                double change = 100.0 * (result.nsPerInstruction() - previous->second) / previous->second;
+                std::cerr << std::showpos << std::setw(9) << change << "%" << std::noshowpos;
+                if (change > options.threshold) {
+                    std::cerr << "  REGRESSION";
+                    regressions++;
+                }
+            }
+            std::cerr << std::endl;
+        }
+    }
+
+    for (const std::string& base : generated) {
+        for (const char* extension : { ".asm", ".obj", ".lst" }) {
+            std::remove((base + extension).c_str());
+        }
+    }
+    std::remove((directory + "/trace").c_str());
+    rmdir(directory.c_str());
+
+    // Block workloads do the work of their loop counterparts in far fewer
+    // instructions, so compare run times rather than ns/insn
+    const std::string suffix = "_block";
+    for (const Result& block : results) {
+        size_t cut = block.workload.size() - std::min(block.workload.size(), suffix.size());
+        if (block.workload.compare(cut, std::string::npos, suffix) != 0) {
+            continue;
+        }
+        for (const Result& loop : results) {
+            if (loop.workload == block.workload.substr(0, cut) && loop.size == block.size &&
+                loop.engine == block.engine && block.runMicros > 0) {
+                std::cerr << std::left << std::setw(18) << loop.workload << std::right
+                          << std::setw(7) << loop.size << "  " << std::left << std::setw(9) << loop.engine
+                          << std::right << std::fixed << std::setprecision(1)
+                          << std::setw(10) << loop.runMicros / block.runMicros << "x faster as a block instruction"
+                          << std::endl;
+            }
+        }
+    }
+
+    // Wall time on one core over wall time on several
+    for (const Result& parallel : results) {
+        for (const Result& single : results) {
+            if (parallel.cores > 1 && single.cores == 1 && single.workload == parallel.workload &&
+                single.size == parallel.size && single.engine == parallel.engine && parallel.runMicros > 0) {
+                std::cerr << std::left << std::setw(18) << parallel.workload << std::right
+                          << std::setw(7) << parallel.size << "  " << std::left << std::setw(9) << parallel.engine
+                          << std::right << std::fixed << std::setprecision(2)
+                          << std::setw(10) << single.runMicros / parallel.runMicros << "x speedup on "
+                          << parallel.cores << " cores" << std::endl;
+            }
+        }
+    }
+
+    if (regressions) {
+        std::cerr << regressions << " result(s) slower than the baseline by more than "
+                  << options.threshold << "%" << std::endl;
+    }
+    return failures ? 1 : (regressions ? 3 : 0);
+}
@@ -0,0 +1,142 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <cstdio>
+#include <cstring>
+#include "../Common.h"
+#include "../ObjectFormat.h"
+
+// Prints an object file in the assembler's listing format. Branch targets
+// get a label line of their own, and words with no valid opcode are shown
+// as data. Relocatable objects (asm -c) show their code as assembled,
+// before the linker has filled in imported addresses. Version 2
+// executables name their labels, show data segments as data whatever the
+// words look like, and summarise zero-filled segments in one line.
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <program.obj>" << std::endl;
+        return 1;
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in) {
+        std::cerr << "Error: Could not open object file " << argv[1] << std::endl;
+        return 1;
+    }
+    std::vector<int32_t> words;
+    int32_t word;
+    std::vector<ExecutableSegment> segments;
+    std::map<int32_t, std::string> names; // Label names by address
+    int32_t entry = 0;
+    char magic[8] = {};
+    in.read(magic, sizeof(magic));
+    in.seekg(0);
+    ObjectHeader header;
+    ExecutableHeader executable;
+    if (std::memcmp(magic, EXECUTABLE_MAGIC, sizeof(magic)) == 0 &&
+        in.read(reinterpret_cast<char*>(&executable), sizeof(executable))) {
+        if (executable.version != EXECUTABLE_VERSION) {
+            std::cerr << "Error: " << argv[1] << " is executable version " << executable.version << std::endl;
+            return 1;
+        }
+        entry = executable.entry;
+        words.resize(executable.storedWords);
+        segments.resize(executable.segmentCount);
+        std::vector<ObjectSymbol> symbols(executable.symbolCount);
+        std::string nameBytes(executable.nameBytes, '\0');
+        in.read(reinterpret_cast<char*>(words.data()), words.size() * sizeof(int32_t));
+        in.read(reinterpret_cast<char*>(segments.data()), segments.size() * sizeof(ExecutableSegment));
+        in.read(reinterpret_cast<char*>(symbols.data()), symbols.size() * sizeof(ObjectSymbol));
+        in.read(&nameBytes[0], nameBytes.size());
+        if (!in) {
+            std::cerr << "Error: " << argv[1] << " is truncated" << std::endl;
+            return 1;
+        }
+        for (const ObjectSymbol& symbol : symbols) {
+            if (!(symbol.flags & SYMBOL_CONSTANT) && symbol.nameOffset < nameBytes.size() &&
+                !names.count(symbol.value)) {
+                names[symbol.value] = nameBytes.c_str() + symbol.nameOffset;
+            }
+        }
+    } else if (in.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+               std::memcmp(header.magic, OBJECT_MAGIC, sizeof(header.magic)) == 0) {
+        words.resize(header.wordCount);
+        in.read(reinterpret_cast<char*>(words.data()), words.size() * sizeof(int32_t));
+    } else {
+        in.clear();
+        in.seekg(0);
+        while (in.read(reinterpret_cast<char*>(&word), sizeof(word))) {
+            words.push_back(word);
+        }
+    }
+
+    // Words in data segments are never instructions
+    std::vector<bool> isData(words.size(), false);
+    for (const ExecutableSegment& segment : segments) {
+        for (uint32_t i = 0; segment.kind == SEGMENT_DATA && i < segment.wordCount; i++) {
+            if (segment.address + i < words.size()) {
+                isData[segment.address + i] = true;
+            }
+        }
+    }
+    auto labelOf = [&](int32_t address) {
+        auto named = names.find(address);
+        if (named != names.end()) {
+            return named->second;
+        }
+        char label[16];
+        std::snprintf(label, sizeof(label), "L%08x", address);
+        return std::string(label);
+    };
+
+    // Labels for every branch target inside the program
+    std::set<int32_t> targets;
+    for (const auto& named : names) {
+        targets.insert(named.first);
+    }
+    for (size_t address = 0; address < words.size(); address++) {
+        int32_t opcode = words[address] & 0xFF;
+        if (!isData[address] && opcode < OPCODE_COUNT && opcodeTable[opcode].operand == OPERAND_TARGET) {
+            int32_t target = static_cast<int32_t>(address) + 1 + (words[address] >> 8);
+            if (target >= 0 && target < static_cast<int32_t>(words.size())) {
+                targets.insert(target);
+            }
+        }
+    }
+
+    if (!segments.empty()) {
+        std::cout << "; entry " << labelOf(entry) << "\n";
+    }
+    char fields[32];
+    for (size_t address = 0; address < words.size(); address++) {
+        int32_t current = static_cast<int32_t>(address);
+        if (targets.count(current)) {
+            std::cout << "\n" << labelOf(current) << ":" << "\n";
+        }
+
+        word = words[address];
+        std::snprintf(fields, sizeof(fields), "%08x %08x    ", current, word);
+        std::string text = isData[address] ? "" : disassemble(word);
+        int32_t opcode = word & 0xFF;
+        if (text.empty()) {
+            text = "data " + std::to_string(word);
+        } else if (opcodeTable[opcode].operand == OPERAND_TARGET) {
+            int32_t target = current + 1 + (word >> 8);
+            text += targets.count(target) ? " ; " + labelOf(target) : " ; outside the program";
+        }
+        std::cout << fields << text << "\n";
+    }
+    for (const ExecutableSegment& segment : segments) {
+        if (segment.kind == SEGMENT_ZERO) {
+            if (targets.count(segment.address)) {
+                std::cout << "\n" << labelOf(segment.address) << ":" << "\n";
+            }
+            std::snprintf(fields, sizeof(fields), "%08x", segment.address);
+            std::cout << fields << " " << segment.wordCount << " zero-filled words\n";
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+#include "AccessVerifier.h"
+#include "VirtualMachine.h"
+#include <algorithm>
+
+namespace {
+
+// Rounds after which a growing SP interval at one address becomes unknown
+const int WIDEN_AFTER = 8;
+
+bool sameValue(bool knownX, int32_t x, bool knownY, int32_t y) {
+    return knownX == knownY && (!knownX || x == y);
+}
+
+// Two's-complement arithmetic, as the VM does it
+int32_t wrap(int64_t value) {
+    return static_cast<int32_t>(static_cast<uint32_t>(value));
+}
+
+} // namespace
+
+AccessVerifier::AccessVerifier(const int32_t* words, int32_t count, int32_t memoryWords)
+    : words(words), count(count), memoryWords(memoryWords),
+      status(count, 0), states(count), visits(count, 0), unsafe(count, 0) {
+}
+
+void AccessVerifier::merge(int32_t address, const State& incoming) {
+    if (address < 0 || address >= count) {
+        return; // Leaving the image; the VM drops its proofs if this runs
+    }
+    State& current = states[address];
+    if (!(status[address] & Reached)) {
+        status[address] |= Reached;
+        current = incoming;
+        worklist.push_back(address);
+        return;
+    }
+
+    State joined = current;
+    if (!sameValue(current.a.known, current.a.value, incoming.a.known, incoming.a.value)) {
+        joined.a.known = false;
+    }
+    if (!sameValue(current.b.known, current.b.value, incoming.b.known, incoming.b.value)) {
+        joined.b.known = false;
+    }
+    if (current.sp.known && incoming.sp.known) {
+        joined.sp.low = std::min(current.sp.low, incoming.sp.low);
+        joined.sp.high = std::max(current.sp.high, incoming.sp.high);
+    } else {
+        joined.sp.known = false;
+    }
+
+    bool spChanged = joined.sp.known != current.sp.known ||
+                     (joined.sp.known && (joined.sp.low != current.sp.low || joined.sp.high != current.sp.high));
+    if (spChanged && ++visits[address] > WIDEN_AFTER) {
+        joined.sp.known = false;
+    }
+
+    if (spChanged || joined.a.known != current.a.known || joined.b.known != current.b.known) {
+        current = joined;
+        worklist.push_back(address);
+    }
+}
+
+bool AccessVerifier::inRange(const Range& sp, int32_t operand) const {
+    return sp.known && sp.low + operand >= 0 && sp.high + operand < memoryWords;
+}
+
+void AccessVerifier::run(int32_t entry, int32_t a, int32_t b, int32_t sp) {
+    const Value unknown = { false, 0 };
+    const Range anywhere = { false, 0, 0 };
+    State start = { { true, a }, { true, b }, { true, sp, sp } };
+    State returned = { unknown, unknown, anywhere };
+    merge(entry, start);
+
+    while (!worklist.empty()) {
+        int32_t pc = worklist.back();
+        worklist.pop_back();
+
+        const State s = states[pc];
+        State next = s;
+        int32_t word = words[pc];
+        int32_t opcode = word & 0xFF;
+        int32_t operand = word >> 8;
+        bool fallsThrough = true;
+
+        switch (opcode) {
+            case OP_LDC:
+                next.b = s.a;
+                next.a.known = true;
+                next.a.value = operand;
+                break;
+            case OP_ADC:
+                next.a.value = wrap(static_cast<int64_t>(s.a.value) + operand);
+                break;
+            case OP_LDL:
+                if (!inRange(s.sp, operand)) {
+                    unsafe[pc] = 1;
+                }
+                next.b = s.a;
+                next.a = unknown;
+                break;
+            case OP_STL:
+                if (!inRange(s.sp, operand)) {
+                    unsafe[pc] = 1;
+                }
+                next.a = s.b;
+                break;
+            case OP_LDNL:
+                next.a = unknown;
+                break;
+            case OP_STNL:
+                break;
+            case OP_ADD:
+            case OP_SUB:
+                next.a.known = s.a.known && s.b.known;
+                next.a.value = wrap(opcode == OP_ADD ? static_cast<int64_t>(s.b.value) + s.a.value
+                                                : static_cast<int64_t>(s.b.value) - s.a.value);
+                break;
+            case OP_SHL:
+            case OP_SHR:
+                next.a = unknown;
+                break;
+            case OP_ADJ:
+                next.sp.low += operand;
+                next.sp.high += operand;
+                break;
+            case OP_A2SP:
+                next.sp.known = s.a.known;
+                next.sp.low = next.sp.high = s.a.value;
+                next.a = s.b;
+                break;
+            case OP_SP2A:
+                next.b = s.a;
+                next.a.known = s.sp.known && s.sp.low == s.sp.high;
+                next.a.value = static_cast<int32_t>(s.sp.low);
+                break;
+            case OP_CALL:
+                next.b = s.a;
+                next.a.known = true;
+                next.a.value = pc + 1;
+                merge(pc + 1 + operand, next);
+                if (pc + 1 < count) {
+                    status[pc + 1] |= ReturnSite;
+                }
+                merge(pc + 1, returned);
+                fallsThrough = false;
+                break;
+            case OP_RETURN:
+                if (s.a.known) {
+                    next.a = s.b;
+                    merge(s.a.value, next);
+                }
+                fallsThrough = false;
+                break;
+            case OP_BRZ:
+            case OP_BRLZ:
+                merge(pc + 1 + operand, next);
+                break;
+            case OP_BR:
+                merge(pc + 1 + operand, next);
+                fallsThrough = false;
+                break;
+            case OP_BCOPY:
+            case OP_BFILL:
+            case OP_BSORT:
+                break; // Always range-checked, so nothing to prove
+            case OP_BCMP:
+            case OP_BSUM:
+            case OP_SPAWN:
+            case OP_JOIN:
+            case OP_CAS:
+                next.a = unknown;
+                break;
+            case OP_FENCE:
+                break;
+            default: // HALT, or a word the VM faults on
+                fallsThrough = false;
+                break;
+        }
+
+        if (fallsThrough) {
+            merge(pc + 1, next);
+        }
+    }
+
+    for (int32_t pc = 0; pc < count; pc++) {
+        int32_t opcode = words[pc] & 0xFF;
+        if ((status[pc] & Reached) && (opcode == OP_LDL || opcode == OP_STL) && !unsafe[pc]) {
+            status[pc] |= Proven;
+        }
+    }
+}
+
+VerifierReport AccessVerifier::report() const {
+    VerifierReport result = { 0, 0, 0 };
+    for (int32_t pc = 0; pc < count; pc++) {
+        if (!(status[pc] & Reached)) {
+            continue;
+        }
+        result.reachable++;
+        int32_t opcode = words[pc] & 0xFF;
+        if (opcode == OP_LDL || opcode == OP_STL) {
+            result.stackAccesses++;
+            if (status[pc] & Proven) {
+                result.proven++;
+            }
+        }
+    }
+    return result;
+}
+
+VerifierReport VirtualMachine::verifyStackAccesses() {
+    AccessVerifier verifier(memory.data(), programSize, static_cast<int32_t>(memory.size()));
+    verifier.run(PC, A, B, SP);
+    verifiedCode = verifier.statuses();
+    decodedValid = false;
+    return verifier.report();
+}
@@ -0,0 +1,76 @@
+#ifndef ACCESS_VERIFIER_H
+#define ACCESS_VERIFIER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Counts from one verifier run
+struct VerifierReport {
+    size_t reachable;      // Instructions reachable from address 0
+    size_t stackAccesses;  // ldl/stl among them
+    size_t proven;         // ldl/stl whose SP + operand is always in range
+};
+
+// Static pass over a loaded image that proves SP-relative accesses in range.
+//
+// Follows control flow from the entry point with the machine's registers,
+// tracking A and B as constants and SP as an interval, so that the usual
+// "ldc top; a2sp; adj -n" prologue pins SP down for the code after it.
+// Loops are widened to an unknown SP after a few rounds, and the return
+// site of every call starts with unknown registers because the callee may
+// leave SP anywhere; accesses in recursive routines therefore stay checked.
+//
+// The result is one status byte per address. A proof only holds while the
+// code runs as analysed, so the VM drops all of them when the guest writes
+// to a reached instruction, executes an unreached one, or returns somewhere
+// other than a return site (see VirtualMachine::executeInstruction).
+class AccessVerifier {
+public:
+    enum : uint8_t {
+        Reached = 1,     // Analysed as an instruction
+        Proven = 2,      // ldl/stl always in range
+        ReturnSite = 4   // Follows a call
+    };
+
+    AccessVerifier(const int32_t* words, int32_t count, int32_t memoryWords);
+
+    // Analyses from 'entry' with the given register values
+    void run(int32_t entry, int32_t a, int32_t b, int32_t sp);
+
+    const std::vector<uint8_t>& statuses() const { return status; }
+    VerifierReport report() const;
+
+private:
+    // A register value: a known constant or anything
+    struct Value {
+        bool known;
+        int32_t value;
+    };
+
+    // SP as the interval [low, high], or anything
+    struct Range {
+        bool known;
+        int64_t low, high;
+    };
+
+    struct State {
+        Value a, b;
+        Range sp;
+    };
+
+    const int32_t* words;
+    int32_t count;
+    int32_t memoryWords;
+
+    std::vector<uint8_t> status;
+    std::vector<State> states;     // Entry state per reached address
+    std::vector<int> visits;
+    std::vector<uint8_t> unsafe;   // ldl/stl seen with an unproven SP
+    std::vector<int32_t> worklist;
+
+    void merge(int32_t address, const State& incoming);
+    bool inRange(const Range& sp, int32_t operand) const;
+};
+
+#endif // ACCESS_VERIFIER_H
@@ -0,0 +1,260 @@
+#include "BatchRunner.h"
+#include "WorkStealingPool.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// Instructions run between timeout checks
+const uint64_t SLICE = 1 << 20;
+
+std::string jsonEscape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            escaped += ' ';
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+bool parseNumber(const std::string& text, long long& value) {
+    char* end = nullptr;
+    value = std::strtoll(text.c_str(), &end, 0);
+    return !text.empty() && *end == '\0';
+}
+
+} // namespace
+
+BatchRunner::BatchRunner(unsigned threadCount, VirtualMachine::Engine engine, std::ostream& out)
+    : threadCount(threadCount), engine(engine), memoryCheck(VirtualMachine::MemoryCheck::None), out(out),
+      defaultBudget(0), defaultTimeoutMs(0), failures(0), totalInstructions(0) {
+}
+
+void BatchRunner::setDefaultBudget(uint64_t budget) {
+    defaultBudget = budget;
+}
+
+void BatchRunner::setDefaultTimeout(uint64_t timeoutMs) {
+    defaultTimeoutMs = timeoutMs;
+}
+
+void BatchRunner::setMemoryCheck(VirtualMachine::MemoryCheck mode) {
+    memoryCheck = mode;
+}
+
+bool BatchRunner::loadManifest(const std::string& manifestFilename) {
+    std::ifstream manifest(manifestFilename);
+    if (!manifest) {
+        std::cerr << "Error: Could not open manifest " << manifestFilename << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(manifest, line)) {
+        lineNumber++;
+        size_t commentPos = line.find('#');
+        if (commentPos != std::string::npos) {
+            line = line.substr(0, commentPos);
+        }
+
+        std::istringstream tokens(line);
+        BatchJob job;
+        if (!(tokens >> job.objectFile)) {
+            continue; // Blank or comment-only line
+        }
+        job.index = jobs.size();
+        job.budget = defaultBudget;
+        job.timeoutMs = defaultTimeoutMs;
+
+        std::string option;
+        while (tokens >> option) {
+            size_t equals = option.find('=');
+            std::string key = option.substr(0, equals);
+            std::string value = equals == std::string::npos ? "" : option.substr(equals + 1);
+            long long number = 0;
+            bool valid = true;
+
+            if (key == "budget" && parseNumber(value, number) && number >= 0) {
+                job.budget = static_cast<uint64_t>(number);
+            } else if (key == "timeout" && parseNumber(value, number) && number >= 0) {
+                job.timeoutMs = static_cast<uint64_t>(number);
+            } else if (key == "dump") {
+                std::istringstream ranges(value);
+                std::string range;
+                while (valid && std::getline(ranges, range, ',')) {
+                    size_t colon = range.find(':');
+                    long long count = 0;
+                    valid = colon != std::string::npos && colon > 0 &&
+                            parseNumber(range.substr(colon + 1), count) && count >= 0;
+                    if (valid) {
+                        // Symbols need the executable, so they are resolved per job
+                        job.dumps.push_back(std::make_pair(range.substr(0, colon), static_cast<int32_t>(count)));
+                    }
+                }
+            } else {
+                valid = false;
+            }
+
+            if (!valid) {
+                std::cerr << "Error (line " << lineNumber << "): Invalid option: " << option << std::endl;
+                return false;
+            }
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+BatchRunner::Image BatchRunner::loadImage(const std::string& objectFile, std::string& error) {
+    {
+        std::lock_guard<std::mutex> lock(imageMutex);
+        auto cached = images.find(objectFile);
+        if (cached != images.end()) {
+            return cached->second;
+        }
+    }
+
+    // Read outside the lock; a racing worker may read the same file once more
+    std::shared_ptr<Program> program(new Program());
+    if (!program->executable.open(objectFile)) {
+        error = program->executable.getError();
+        return Image();
+    }
+    program->words.assign(program->executable.imageWords(), 0);
+    if (!program->executable.readWords(program->words.data())) {
+        error = "Could not read " + objectFile;
+        return Image();
+    }
+
+    std::lock_guard<std::mutex> lock(imageMutex);
+    images[objectFile] = program;
+    return program;
+}
+
+void BatchRunner::runJob(const BatchJob& job, VirtualMachine& vm) {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+
+    std::ostringstream line;
+    line << "{\"job\":" << job.index << ",\"file\":\"" << jsonEscape(job.objectFile) << "\"";
+
+    vm.reset();
+    std::string loadError;
+    Image image = loadImage(job.objectFile, loadError);
+    std::string status;
+
+    // Dump addresses, resolved against this executable's symbols
+    std::vector<int32_t> dumpAddresses;
+    std::string unknown;
+    for (size_t i = 0; image && i < job.dumps.size() && unknown.empty(); i++) {
+        int32_t address = 0;
+        if (image->executable.lookup(job.dumps[i].first, address)) {
+            dumpAddresses.push_back(address);
+        } else {
+            unknown = job.dumps[i].first;
+        }
+    }
+
+    if (!image) {
+        status = "load_error";
+        line << ",\"error\":\"" << jsonEscape(loadError) << "\"";
+    } else if (!vm.loadImage(image->words.data(), image->words.size(), image->executable.getEntry())) {
+        status = "load_error";
+        line << ",\"error\":\"Program is too large for memory\"";
+    } else if (!unknown.empty()) {
+        status = "load_error";
+        line << ",\"error\":\"Unknown symbol " << jsonEscape(unknown) << "\"";
+    } else {
+        uint64_t remaining = job.budget ? job.budget : UINT64_MAX;
+        while (status.empty()) {
+            uint64_t slice = remaining < SLICE ? remaining : SLICE;
+            uint64_t before = vm.getInstructionCount();
+            if (vm.execute(slice)) {
+                status = vm.hasFaulted() ? "error" : "halted";
+                break;
+            }
+            // Engines may overshoot a slice by up to one basic block
+            uint64_t ran = vm.getInstructionCount() - before;
+            remaining = ran < remaining ? remaining - ran : 0;
+            if (job.budget && remaining == 0) {
+                status = "budget";
+            } else if (job.timeoutMs &&
+                       Clock::now() - start >= std::chrono::milliseconds(job.timeoutMs)) {
+                status = "timeout";
+            }
+        }
+
+        line << ",\"instructions\":" << vm.getInstructionCount()
+             << ",\"A\":" << vm.getA() << ",\"B\":" << vm.getB()
+             << ",\"PC\":" << vm.getPC() << ",\"SP\":" << vm.getSP();
+
+        if (!job.dumps.empty()) {
+            line << ",\"memory\":[";
+            for (size_t i = 0; i < job.dumps.size(); i++) {
+                int32_t address = dumpAddresses[i];
+                line << (i ? "," : "") << "{\"address\":" << address << ",\"values\":[";
+                for (int32_t j = 0; j < job.dumps[i].second; j++) {
+                    line << (j ? "," : "") << vm.readMemory(address + j);
+                }
+                line << "]}";
+            }
+            line << "]";
+        }
+        if (vm.hasFaulted()) {
+            line << ",\"error\":\"" << jsonEscape(vm.getError()) << "\"";
+        }
+    }
+
+    long long micros = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+    line << ",\"status\":\"" << status << "\",\"micros\":" << micros << "}\n";
+
+    std::lock_guard<std::mutex> lock(outputMutex);
+    out << line.str();
+    out.flush();
+    if (status != "halted") {
+        failures++;
+    }
+    totalInstructions += vm.getInstructionCount();
+}
+
+size_t BatchRunner::run() {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+
+    failures = 0;
+    totalInstructions = 0;
+
+    WorkStealingPool pool(threadCount);
+    std::vector<std::unique_ptr<VirtualMachine> > machines(pool.size());
+
+    for (const BatchJob& job : jobs) {
+        const BatchJob* jobPtr = &job;
+        pool.submit([this, jobPtr, &machines](unsigned worker) {
+            if (!machines[worker]) {
+                machines[worker].reset(new VirtualMachine());
+                machines[worker]->setVerbose(false);
+                machines[worker]->setEngine(engine);
+                machines[worker]->setMemoryCheck(memoryCheck);
+            }
+            runJob(*jobPtr, *machines[worker]);
+        });
+    }
+    pool.wait();
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cerr << "Batch: " << jobs.size() << " jobs on " << pool.size() << " threads, "
+              << failures << " not halted, " << totalInstructions << " instructions in "
+              << seconds << " s (" << (seconds > 0 ? totalInstructions / seconds / 1e6 : 0.0)
+              << " MIPS), " << pool.stealCount() << " steals" << std::endl;
+    return failures;
+}
@@ -0,0 +1,76 @@
+#ifndef BATCH_RUNNER_H
+#define BATCH_RUNNER_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Executable.h"
+#include "VirtualMachine.h"
+
+// One line of a batch manifest:
+//   <file.obj> [budget=N] [timeout=MS] [dump=WHERE:COUNT[,WHERE:COUNT...]]
+// where WHERE is an address or a symbol of a version 2 executable
+struct BatchJob {
+    size_t index;
+    std::string objectFile;
+    uint64_t budget;     // Instruction budget, 0 for none
+    uint64_t timeoutMs;  // Wall-clock limit, 0 for none
+    std::vector<std::pair<std::string, int32_t> > dumps; // (where, count)
+};
+
+// Runs many independent programs on a work-stealing thread pool.
+//
+// Each worker reuses one VirtualMachine, and object files are read once
+// and shared between jobs that name the same file. Results are written to
+// the output stream as one JSON object per line, in completion order.
+class BatchRunner {
+public:
+    BatchRunner(unsigned threadCount, VirtualMachine::Engine engine, std::ostream& out);
+
+    // Limits for jobs that do not set their own
+    void setDefaultBudget(uint64_t budget);
+    void setDefaultTimeout(uint64_t timeoutMs);
+
+    // Memory protection for every job's VM (default None)
+    void setMemoryCheck(VirtualMachine::MemoryCheck mode);
+
+    // Parses the manifest; returns false (and reports the line) on error
+    bool loadManifest(const std::string& manifestFilename);
+
+    // Runs every job; returns the number that did not halt cleanly
+    size_t run();
+
+private:
+    // An executable read once, with its zero-filled words
+    struct Program {
+        Executable executable;
+        std::vector<int32_t> words;
+    };
+    typedef std::shared_ptr<const Program> Image;
+
+    unsigned threadCount;
+    VirtualMachine::Engine engine;
+    VirtualMachine::MemoryCheck memoryCheck;
+    std::ostream& out;
+    uint64_t defaultBudget;
+    uint64_t defaultTimeoutMs;
+    std::vector<BatchJob> jobs;
+
+    std::mutex imageMutex;
+    std::map<std::string, Image> images;
+
+    std::mutex outputMutex;
+    size_t failures;
+    uint64_t totalInstructions;
+
+    // Returns an empty image and sets error if the file cannot be loaded
+    Image loadImage(const std::string& objectFile, std::string& error);
+    void runJob(const BatchJob& job, VirtualMachine& vm);
+};
+
+#endif // BATCH_RUNNER_H
@@ -0,0 +1,199 @@
+#include "BulkMemory.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BULK_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// The word at which two ranges first differ, compared
+int32_t orderAt(const int32_t* left, const int32_t* right, size_t index) {
+    return left[index] < right[index] ? -1 : 1;
+}
+
+void fillScalar(int32_t* to, int32_t value, size_t count) {
+    std::fill(to, to + count, value);
+}
+
+int32_t compareScalar(const int32_t* left, const int32_t* right, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (left[i] != right[i]) {
+            return orderAt(left, right, i);
+        }
+    }
+    return 0;
+}
+
+// Adds to 'total' unsigned, so that overflow wraps
+int32_t sumScalar(const int32_t* words, size_t count, uint32_t total = 0) {
+    for (size_t i = 0; i < count; i++) {
+        total += static_cast<uint32_t>(words[i]);
+    }
+    return static_cast<int32_t>(total);
+}
+
+#ifdef BULK_HAVE_X86
+
+// SSE2 is part of x86-64, so these need no run-time check
+
+void fillSse2(int32_t* to, int32_t value, size_t count) {
+    __m128i v = _mm_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(to + i), v);
+    }
+    fillScalar(to + i, value, count - i);
+}
+
+int32_t compareSse2(const int32_t* left, const int32_t* right, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(left + i));
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(right + i));
+        unsigned equal = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi32(l, r)));
+        if (equal != 0xFFFF) {
+            return orderAt(left, right, i + __builtin_ctz(~equal) / 4);
+        }
+    }
+    return compareScalar(left + i, right + i, count - i);
+}
+
+int32_t sumSse2(const int32_t* words, size_t count) {
+    __m128i total = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        total = _mm_add_epi32(total, _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + i)));
+    }
+    int32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), total);
+    return sumScalar(words + i, count - i, static_cast<uint32_t>(sumScalar(lanes, 4)));
+}
+
+__attribute__((target("avx2")))
+void fillAvx2(int32_t* to, int32_t value, size_t count) {
+    __m256i v = _mm256_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(to + i), v);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(to + i + 8), v);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(to + i + 16), v);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(to + i + 24), v);
+    }
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(to + i), v);
+    }
+    fillScalar(to + i, value, count - i);
+}
+
+__attribute__((target("avx2")))
+int32_t compareAvx2(const int32_t* left, const int32_t* right, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(left + i));
+        __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(right + i));
+        unsigned equal = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi32(l, r)));
+        if (equal != 0xFFFFFFFFu) {
+            return orderAt(left, right, i + __builtin_ctz(~equal) / 4);
+        }
+    }
+    return compareScalar(left + i, right + i, count - i);
+}
+
+__attribute__((target("avx2")))
+int32_t sumAvx2(const int32_t* words, size_t count) {
+    // Two accumulators hide the latency of the adds
+    __m256i first = _mm256_setzero_si256();
+    __m256i second = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        first = _mm256_add_epi32(first, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i)));
+        second = _mm256_add_epi32(second, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i + 8)));
+    }
+    int32_t lanes[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), _mm256_add_epi32(first, second));
+    return sumScalar(words + i, count - i, static_cast<uint32_t>(sumScalar(lanes, 8)));
+}
+
+#endif // BULK_HAVE_X86
+
+struct Kernels {
+    const char* name;
+    void (*fill)(int32_t*, int32_t, size_t);
+    int32_t (*compare)(const int32_t*, const int32_t*, size_t);
+    int32_t (*sum)(const int32_t*, size_t);
+};
+
+const Kernels& kernels() {
+    static const Kernels selected = []() {
+#ifdef BULK_HAVE_X86
+        if (__builtin_cpu_supports("avx2")) {
+            return Kernels{ "avx2", fillAvx2, compareAvx2, sumAvx2 };
+        }
+        return Kernels{ "sse2", fillSse2, compareSse2, sumSse2 };
+#else
+        return Kernels{ "scalar", fillScalar, compareScalar,
+                        [](const int32_t* words, size_t count) { return sumScalar(words, count); } };
+#endif
+    }();
+    return selected;
+}
+
+// Optimal 19-comparator network for 8 inputs
+const int NETWORK[][2] = {
+    { 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+    { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 },
+    { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },
+    { 2, 4 }, { 3, 5 },
+    { 1, 4 }, { 3, 6 },
+    { 1, 2 }, { 3, 4 }, { 5, 6 }
+};
+const size_t NETWORK_WIDTH = 8;
+
+} // namespace
+
+namespace bulk {
+
+void copy(int32_t* to, const int32_t* from, size_t count) {
+    // The C library already picks the widest moves the CPU has
+    std::memmove(to, from, count * sizeof(int32_t));
+}
+
+void fill(int32_t* to, int32_t value, size_t count) {
+    kernels().fill(to, value, count);
+}
+
+int32_t compare(const int32_t* left, const int32_t* right, size_t count) {
+    return kernels().compare(left, right, count);
+}
+
+int32_t sum(const int32_t* words, size_t count) {
+    return kernels().sum(words, count);
+}
+
+void sort(int32_t* words, size_t count) {
+    if (count > NETWORK_WIDTH) {
+        std::sort(words, words + count);
+        return;
+    }
+    // Pad with the largest word, which sorts to the unused end; the
+    // branch-free min/max pairs compile to conditional moves
+    int32_t lanes[NETWORK_WIDTH];
+    std::fill(lanes, lanes + NETWORK_WIDTH, INT32_MAX);
+    std::copy(words, words + count, lanes);
+    for (const auto& pair : NETWORK) {
+        int32_t low = std::min(lanes[pair[0]], lanes[pair[1]]);
+        int32_t high = std::max(lanes[pair[0]], lanes[pair[1]]);
+        lanes[pair[0]] = low;
+        lanes[pair[1]] = high;
+    }
+    std::copy(lanes, lanes + count, words);
+}
+
+const char* kernelName() {
+    return kernels().name;
+}
+
+} // namespace bulk
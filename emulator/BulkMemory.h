@@ -0,0 +1,34 @@
+#ifndef BULK_MEMORY_H
+#define BULK_MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Kernels behind the block instructions (see Isa.def).
+//
+// On x86-64 the first call picks AVX2 versions if the CPU has AVX2 and
+// SSE2 ones (which every x86-64 CPU has) otherwise; other hosts use plain
+// loops. Ranges are not checked here; the VM checks them first.
+namespace bulk {
+
+// Like memmove: the ranges may overlap
+void copy(int32_t* to, const int32_t* from, size_t count);
+
+void fill(int32_t* to, int32_t value, size_t count);
+
+// 0 if the ranges are equal, else -1 or 1 as the first differing word of
+// 'left' is less or greater than the one in 'right'
+int32_t compare(const int32_t* left, const int32_t* right, size_t count);
+
+// Sum of the words, wrapping at 32 bits
+int32_t sum(const int32_t* words, size_t count);
+
+// Ascending signed order. Up to 8 words go through a sorting network.
+void sort(int32_t* words, size_t count);
+
+// The kernels in use: "avx2", "sse2" or "scalar"
+const char* kernelName();
+
+} // namespace bulk
+
+#endif // BULK_MEMORY_H
@@ -0,0 +1,181 @@
+#include "CoreGroup.h"
+#include <atomic>
+#include <system_error>
+
+CoreGroup::CoreGroup(VirtualMachine& boot, int maxCores)
+    : boot(boot), maxCores(maxCores < 1 ? 1 : maxCores), peak(1) {
+    reports.push_back(CoreReport{ 0, 0, 0, false, false, std::string() });
+    boot.cores = this;
+    boot.coreId = 0;
+}
+
+CoreGroup::~CoreGroup() {
+    collectAll();
+    boot.cores = nullptr;
+}
+
+void CoreGroup::run() {
+    boot.resume();
+    collectAll();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    reports[0] = CoreReport{ 0, boot.getInstructionCount(), boot.getA(), boot.hasFaulted(), false, boot.getError() };
+}
+
+int32_t CoreGroup::spawn(int32_t pc, int32_t sp) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (static_cast<int>(live.size()) + 1 >= maxCores) {
+        return -1;
+    }
+
+    // The new machine's own region is dropped at once for core 0's
+    std::unique_ptr<Core> core(new Core);
+    core->id = static_cast<int32_t>(reports.size());
+    core->halted = false;
+    core->vm.reset(new VirtualMachine(1));
+    VirtualMachine& vm = *core->vm;
+    vm.memory.share(boot.memory);
+    vm.engine = boot.engine;
+    vm.fusionEnabled = boot.fusionEnabled;
+    vm.memoryCheck = boot.memoryCheck;
+    vm.programSize = boot.programSize;
+    vm.entryPoint = vm.PC = pc;
+    vm.SP = sp;
+    vm.cores = this;
+    vm.coreId = core->id;
+
+    Core* started = core.get();
+    try {
+        core->thread = std::thread([this, started]() {
+            started->vm->execute(UINT64_MAX);
+            std::lock_guard<std::mutex> halting(mutex);
+            started->halted = true;
+            coreHalted.notify_all();
+        });
+    } catch (const std::system_error&) {
+        return -1; // No host thread to run it on
+    }
+
+    reports.push_back(CoreReport{ core->id, 0, 0, false, false, std::string() });
+    live[core->id] = std::move(core);
+    if (static_cast<int>(live.size()) + 1 > peak) {
+        peak = static_cast<int>(live.size()) + 1;
+    }
+    return started->id;
+}
+
+bool CoreGroup::join(int32_t caller, int32_t id, int32_t& result, std::string& error) {
+    std::unique_ptr<Core> core;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            auto found = live.find(id);
+            if (found == live.end() || id == caller) {
+                return false;
+            }
+            if (found->second->halted) {
+                core = std::move(found->second);
+                live.erase(found);
+                break;
+            }
+            coreHalted.wait(lock);
+        }
+    }
+
+    // Halted cores no longer touch their machines
+    const VirtualMachine& vm = *core->vm;
+    bool faulted = vm.hasFaulted();
+    if (faulted) {
+        error = vm.getError();
+    } else {
+        result = vm.getA();
+    }
+    collect(std::move(core), true);
+    return !faulted;
+}
+
+void CoreGroup::collect(std::unique_ptr<Core> core, bool joined) {
+    core->thread.join();
+    const VirtualMachine& vm = *core->vm;
+    std::lock_guard<std::mutex> lock(mutex);
+    reports[core->id] = CoreReport{ core->id, vm.getInstructionCount(), vm.getA(), vm.hasFaulted(), joined,
+                                    vm.getError() };
+}
+
+void CoreGroup::collectAll() {
+    // Once every core has halted, none can spawn or join any more
+    std::unique_lock<std::mutex> lock(mutex);
+    coreHalted.wait(lock, [this]() {
+        for (const auto& entry : live) {
+            if (!entry.second->halted) {
+                return false;
+            }
+        }
+        return true;
+    });
+    std::map<int32_t, std::unique_ptr<Core> > halted;
+    halted.swap(live);
+    lock.unlock();
+
+    for (auto& entry : halted) {
+        collect(std::move(entry.second), false);
+    }
+}
+
+void CoreGroup::writeReport(std::ostream& out) const {
+    out << "Cores: " << reports.size() << " ran, at most " << peak << " at once (limit " << maxCores << ")"
+        << std::endl;
+    for (const CoreReport& report : reports) {
+        out << "  Core " << report.id << ": " << report.instructions << " instructions, A = " << report.a;
+        if (report.faulted) {
+            out << ", faulted: " << report.error;
+        }
+        if (report.id != 0 && !report.joined) {
+            out << " (never joined)";
+        }
+        out << std::endl;
+    }
+}
+
+// The core instructions; see Isa.def
+bool VirtualMachine::executeCoreOp(int32_t opcode, int32_t operand, int32_t& a, int32_t b, int32_t sp, int32_t pc) {
+    int64_t size = static_cast<int64_t>(memory.size());
+    switch (opcode) {
+        case OP_SPAWN:
+            a = cores ? cores->spawn(a, b) : -1;
+            return true;
+
+        case OP_JOIN: {
+            int32_t id = a;
+            std::string error;
+            if (!cores || !cores->join(coreId, id, a, error)) {
+                PC = pc;
+                fault(error.empty() ? "Cannot join core " + std::to_string(id) + " at PC " + std::to_string(pc)
+                                    : "Joined core " + std::to_string(id) + " at PC " + std::to_string(pc) +
+                                          ", which faulted: " + error);
+                return false;
+            }
+            return true;
+        }
+
+        case OP_CAS: {
+            int64_t slot = static_cast<int64_t>(sp) + operand;
+            int64_t address = slot < 0 || slot >= size ? slot : a;
+            if (address < 0 || address >= size) {
+                PC = pc;
+                fault("Compare-and-swap out of bounds (address " + std::to_string(address) + ") at PC " +
+                      std::to_string(pc));
+                return false;
+            }
+            int32_t seen = b; // Becomes the old word if it was not b
+            __atomic_compare_exchange_n(&memory[a], &seen, memory[slot], false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+            a = seen;
+            return true;
+        }
+
+        case OP_FENCE:
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return true;
+    }
+    return true;
+}
@@ -0,0 +1,91 @@
+#ifndef CORE_GROUP_H
+#define CORE_GROUP_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "VirtualMachine.h"
+
+// The cores of one guest machine (see the core instructions in Isa.def).
+//
+// Core 0 is the VirtualMachine the program was loaded into. spawn gives
+// every other core a VirtualMachine of its own, with core 0's engine and
+// memory-check mode, whose memory is core 0's (GuestMemory::share) and
+// which runs on a host thread of its own. At most 'maxCores' cores,
+// counting core 0, run or wait to be joined at once; spawn returns -1 when
+// that many exist. A machine outside a CoreGroup has just core 0.
+//
+// Every engine loads and stores a guest word with one aligned 32-bit
+// access, which the host never tears, so ordinary accesses need nothing
+// more to meet the memory model. cas and fence use sequentially consistent
+// host atomics, and spawn and join synchronise through the group's mutex.
+// The machine halts once every core has halted; cores that are never
+// joined are waited for at the end of run().
+class CoreGroup {
+public:
+    struct CoreReport {
+        int32_t id;
+        uint64_t instructions;
+        int32_t a;          // A when the core halted
+        bool faulted;
+        bool joined;
+        std::string error;
+    };
+
+    CoreGroup(VirtualMachine& boot, int maxCores);
+    ~CoreGroup();
+
+    CoreGroup(const CoreGroup&) = delete;
+    CoreGroup& operator=(const CoreGroup&) = delete;
+
+    // Resumes core 0 on the calling thread and returns once every core has
+    // halted
+    void run();
+
+    // One report per core that ran, by core number; complete after run()
+    const std::vector<CoreReport>& getReports() const { return reports; }
+
+    // The most cores that existed at once
+    int getPeakCores() const { return peak; }
+
+    // Per-core instruction counts and outcomes
+    void writeReport(std::ostream& out) const;
+
+private:
+    friend class VirtualMachine;
+
+    struct Core {
+        int32_t id;
+        std::unique_ptr<VirtualMachine> vm;
+        std::thread thread;
+        bool halted;
+    };
+
+    VirtualMachine& boot;
+    int maxCores;
+    std::mutex mutex;
+    std::condition_variable coreHalted;
+    std::map<int32_t, std::unique_ptr<Core> > live; // Spawned and not yet joined
+    std::vector<CoreReport> reports;
+    int peak;
+
+    // Called by the cores' machines (mutex not held). join() returns false
+    // if core 'caller' cannot join 'id', or if 'id' faulted, with 'error'
+    // set to its error.
+    int32_t spawn(int32_t pc, int32_t sp);
+    bool join(int32_t caller, int32_t id, int32_t& result, std::string& error);
+
+    // Waits for 'core' to finish and records it (mutex not held)
+    void collect(std::unique_ptr<Core> core, bool joined);
+
+    // Waits until every spawned core has halted, then collects them all
+    void collectAll();
+};
+
+#endif // CORE_GROUP_H
@@ -0,0 +1,169 @@
+#include "Executable.h"
+#include "VirtualMachine.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Reads exactly 'size' bytes at 'offset'
+bool readFully(int fd, void* target, size_t size, uint64_t offset) {
+    char* to = static_cast<char*>(target);
+    while (size > 0) {
+        ssize_t got = pread(fd, to, size, static_cast<off_t>(offset));
+        if (got <= 0) {
+            return false;
+        }
+        to += got;
+        size -= got;
+        offset += got;
+    }
+    return true;
+}
+
+} // namespace
+
+Executable::Executable()
+    : fd(-1), version(0), entry(0), stored(0), zeroFilled(0), wordsOffset(0) {
+}
+
+Executable::~Executable() {
+    close();
+}
+
+void Executable::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool Executable::fail(const std::string& message) {
+    close();
+    error = message;
+    return false;
+}
+
+bool Executable::open(const std::string& filename) {
+    close();
+    segments.clear();
+    symbols.clear();
+    names.clear();
+    error.clear();
+
+    fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        return fail("Could not open object file " + filename);
+    }
+    uint64_t fileSize = static_cast<uint64_t>(info.st_size);
+
+    ExecutableHeader header;
+    if (fileSize < sizeof(header) || !readFully(fd, &header, sizeof(header), 0) ||
+        std::memcmp(header.magic, EXECUTABLE_MAGIC, sizeof(header.magic)) != 0) {
+        // Version 1: nothing but words
+        version = 1;
+        entry = 0;
+        if (fileSize / sizeof(int32_t) > static_cast<uint64_t>(VirtualMachine::MAX_MEMORY_WORDS)) {
+            return fail(filename + " is too large for guest memory");
+        }
+        stored = static_cast<uint32_t>(fileSize / sizeof(int32_t));
+        zeroFilled = 0;
+        wordsOffset = 0;
+        if (stored > 0) {
+            segments.push_back(ExecutableSegment{ 0, stored, SEGMENT_CODE });
+        }
+        return true;
+    }
+    if (header.version != EXECUTABLE_VERSION) {
+        return fail(filename + " is executable version " + std::to_string(header.version) +
+                    "; this emulator reads version " + std::to_string(EXECUTABLE_VERSION));
+    }
+
+    version = header.version;
+    entry = header.entry;
+    stored = header.storedWords;
+    zeroFilled = header.zeroWords;
+    wordsOffset = sizeof(header);
+    uint64_t image = static_cast<uint64_t>(stored) + zeroFilled;
+    if (image > static_cast<uint64_t>(VirtualMachine::MAX_MEMORY_WORDS)) {
+        return fail(filename + " is malformed or too large for guest memory (" + std::to_string(image) +
+                    " words)");
+    }
+    // Only an empty image may start outside itself, at 0
+    if (entry < 0 || (static_cast<uint64_t>(entry) >= image && entry != 0)) {
+        return fail(filename + " has its entry point (" + std::to_string(entry) + ") outside the image");
+    }
+    uint64_t tableOffset = wordsOffset + static_cast<uint64_t>(stored) * sizeof(int32_t);
+    uint64_t symbolOffset = tableOffset + static_cast<uint64_t>(header.segmentCount) * sizeof(ExecutableSegment);
+    uint64_t nameOffset = symbolOffset + static_cast<uint64_t>(header.symbolCount) * sizeof(ObjectSymbol);
+    if (nameOffset + header.nameBytes > fileSize) {
+        return fail(filename + " is truncated");
+    }
+
+    segments.resize(header.segmentCount);
+    symbols.resize(header.symbolCount);
+    names.resize(header.nameBytes);
+    if (!readFully(fd, segments.data(), segments.size() * sizeof(ExecutableSegment), tableOffset) ||
+        !readFully(fd, symbols.data(), symbols.size() * sizeof(ObjectSymbol), symbolOffset) ||
+        !readFully(fd, &names[0], names.size(), nameOffset)) {
+        return fail("Could not read " + filename);
+    }
+
+    // The segments must tile the image, and every name must end in the table
+    uint64_t next = 0;
+    for (const ExecutableSegment& segment : segments) {
+        if (segment.address != next || segment.kind > SEGMENT_ZERO) {
+            return fail(filename + " has a malformed segment table");
+        }
+        next += segment.wordCount;
+    }
+    if (next != image) {
+        return fail(filename + " has a malformed segment table");
+    }
+    for (const ObjectSymbol& symbol : symbols) {
+        if (symbol.nameOffset >= names.size() || names.find('\0', symbol.nameOffset) == std::string::npos) {
+            return fail(filename + " has a malformed symbol table");
+        }
+    }
+    return true;
+}
+
+bool Executable::readWords(int32_t* target) const {
+    return fd >= 0 && readFully(fd, target, static_cast<size_t>(stored) * sizeof(int32_t), wordsOffset);
+}
+
+bool Executable::findSymbol(std::string_view name, int32_t& value, bool* constant) const {
+    auto nameOf = [&](const ObjectSymbol& symbol) {
+        return std::string_view(names.c_str() + symbol.nameOffset);
+    };
+    auto found = std::lower_bound(symbols.begin(), symbols.end(), name,
+                                  [&](const ObjectSymbol& symbol, std::string_view key) {
+                                      return nameOf(symbol) < key;
+                                  });
+    if (found == symbols.end() || nameOf(*found) != name) {
+        return false;
+    }
+    value = found->value;
+    if (constant) {
+        *constant = (found->flags & SYMBOL_CONSTANT) != 0;
+    }
+    return true;
+}
+
+bool Executable::lookup(std::string_view text, int32_t& value) const {
+    if (findSymbol(text, value)) {
+        return true;
+    }
+    std::string number(text);
+    char* end = nullptr;
+    long parsed = std::strtol(number.c_str(), &end, 0);
+    if (number.empty() || *end != '\0') {
+        return false;
+    }
+    value = static_cast<int32_t>(parsed);
+    return true;
+}
@@ -0,0 +1,64 @@
+#ifndef EXECUTABLE_H
+#define EXECUTABLE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../ObjectFormat.h"
+
+// An executable file of either version (see ObjectFormat.h).
+//
+// open() reads the header and the tables after the words but leaves the
+// words in the file, so that readWords() can put them straight into guest
+// memory with a single read. A version 1 file is all words, starts at
+// address 0 and has one code segment and no symbols.
+class Executable {
+public:
+    Executable();
+    ~Executable();
+
+    Executable(const Executable&) = delete;
+    Executable& operator=(const Executable&) = delete;
+
+    // False if the file cannot be read or is malformed; getError() says why
+    bool open(const std::string& filename);
+
+    // Reads the stored words into 'target', which must have room for
+    // storedWords() of them
+    bool readWords(int32_t* target) const;
+
+    uint32_t getVersion() const { return version; }
+    int32_t getEntry() const { return entry; }
+
+    // Words in the file, and those plus the zero-filled words after them
+    uint32_t storedWords() const { return stored; }
+    uint32_t imageWords() const { return stored + zeroFilled; }
+
+    const std::vector<ExecutableSegment>& getSegments() const { return segments; }
+
+    // The value of the symbol 'name'; false if there is no such symbol
+    bool findSymbol(std::string_view name, int32_t& value, bool* constant = nullptr) const;
+
+    // 'text' as a number (decimal, 0x hex or 0 octal) or a symbol's value
+    bool lookup(std::string_view text, int32_t& value) const;
+
+    const std::string& getError() const { return error; }
+
+private:
+    int fd;
+    uint32_t version;
+    int32_t entry;
+    uint32_t stored;
+    uint32_t zeroFilled;
+    uint64_t wordsOffset;    // Where the stored words start in the file
+    std::vector<ExecutableSegment> segments;
+    std::vector<ObjectSymbol> symbols; // Sorted by name
+    std::string names;
+    std::string error;
+
+    bool fail(const std::string& message);
+    void close();
+};
+
+#endif // EXECUTABLE_H
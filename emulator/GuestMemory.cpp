@@ -0,0 +1,283 @@
+#include "GuestMemory.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if UINTPTR_MAX > 0xFFFFFFFFu
+#define VM_HAVE_GUARD_PAGES 1
+#endif
+
+namespace {
+
+#ifdef VM_HAVE_GUARD_PAGES
+// Inaccessible bytes on each side of a guarded region. A word index is a
+// 32-bit register plus a 24-bit operand, which the compiler may add in
+// 64 bits, so it can reach just over 2^31 words (8 GB) either way.
+const size_t GUARD_BYTES = static_cast<size_t>(9) << 30;
+#endif
+
+thread_local GuardTrap* activeTrap = nullptr;
+struct sigaction previousAction;
+
+} // namespace
+
+GuestMemory::GuestMemory(size_t words)
+    : base(nullptr), words(words), bytes(roundToPages(words)), reservation(nullptr), reservationBytes(0),
+      fileBacked(false), shared(false) {
+    base = allocate(bytes, false, reservation, reservationBytes);
+}
+
+GuestMemory::~GuestMemory() {
+    release();
+}
+
+size_t GuestMemory::pageSize() {
+    static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+size_t GuestMemory::roundToPages(size_t words) {
+    size_t page = pageSize();
+    size_t needed = words * sizeof(int32_t);
+    if (needed == 0) {
+        needed = 1;
+    }
+    return (needed + page - 1) / page * page;
+}
+
+bool GuestMemory::fillsPages(size_t words) {
+    return words > 0 && roundToPages(words) == words * sizeof(int32_t);
+}
+
+int32_t* GuestMemory::allocate(size_t size, bool guarded, char*& newReservation, size_t& newReservationBytes) {
+    newReservation = nullptr;
+    newReservationBytes = 0;
+    if (!guarded) {
+        void* region = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (region == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        return static_cast<int32_t*>(region);
+    }
+
+#ifdef VM_HAVE_GUARD_PAGES
+    // Reserve address space only, then open up the middle
+    size_t total = GUARD_BYTES + size + GUARD_BYTES;
+    void* area = mmap(nullptr, total, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (area == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    char* middle = static_cast<char*>(area) + GUARD_BYTES;
+    if (mmap(middle, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        munmap(area, total);
+        throw std::bad_alloc();
+    }
+    newReservation = static_cast<char*>(area);
+    newReservationBytes = total;
+    return reinterpret_cast<int32_t*>(middle);
+#else
+    throw std::bad_alloc();
+#endif
+}
+
+void GuestMemory::release() {
+    if (shared) {
+        return;
+    }
+    if (reservation) {
+        munmap(reservation, reservationBytes);
+    } else {
+        munmap(base, bytes);
+    }
+}
+
+void GuestMemory::share(GuestMemory& owner) {
+    release();
+    base = owner.base;
+    words = owner.words;
+    bytes = owner.bytes;
+    reservation = owner.reservation;
+    reservationBytes = owner.reservationBytes;
+    fileBacked = owner.fileBacked;
+    shared = true;
+}
+
+void GuestMemory::resize(size_t newWords) {
+    size_t newBytes = roundToPages(newWords);
+    char* newReservation;
+    size_t newReservationBytes;
+    int32_t* region = allocate(newBytes, isGuarded() && fillsPages(newWords), newReservation, newReservationBytes);
+    copyTo(region, (newWords < words ? newWords : words) * sizeof(int32_t));
+    release();
+    base = region;
+    words = newWords;
+    bytes = newBytes;
+    reservation = newReservation;
+    reservationBytes = newReservationBytes;
+    fileBacked = false;
+}
+
+bool GuestMemory::setGuarded(bool enabled) {
+#ifndef VM_HAVE_GUARD_PAGES
+    if (enabled) {
+        return false;
+    }
+#endif
+    if (enabled == isGuarded()) {
+        return true;
+    }
+    if (enabled && !fillsPages(words)) {
+        return false;
+    }
+    char* newReservation;
+    size_t newReservationBytes;
+    int32_t* region = allocate(bytes, enabled, newReservation, newReservationBytes);
+    copyTo(region, bytes);
+    release();
+    base = region;
+    reservation = newReservation;
+    reservationBytes = newReservationBytes;
+    fileBacked = false;
+    return true;
+}
+
+bool GuestMemory::inGuard(const void* address) const {
+    const char* p = static_cast<const char*>(address);
+    return reservation && p >= reservation && p < reservation + reservationBytes;
+}
+
+bool GuestMemory::scanResidency(std::vector<unsigned char>& map) const {
+    map.resize(bytes / pageSize());
+    return mincore(base, bytes, map.data()) == 0;
+}
+
+size_t GuestMemory::residentBytes() const {
+    std::vector<unsigned char> map;
+    if (!scanResidency(map)) {
+        return bytes;
+    }
+    size_t pages = 0;
+    for (unsigned char page : map) {
+        pages += page & 1;
+    }
+    return pages * pageSize();
+}
+
+void GuestMemory::copyTo(int32_t* target, size_t size) const {
+    // Resident file pages may be unmodified page cache, and pages that are
+    // not resident still hold the file's data
+    std::vector<unsigned char> map;
+    if (fileBacked || !scanResidency(map)) {
+        std::memcpy(target, base, size);
+        return;
+    }
+    size_t page = pageSize();
+    const char* from = reinterpret_cast<const char*>(base);
+    char* to = reinterpret_cast<char*>(target);
+    for (size_t offset = 0; offset < size; offset += page) {
+        if (map[offset / page] & 1) {
+            std::memcpy(to + offset, from + offset, page < size - offset ? page : size - offset);
+        }
+    }
+}
+
+void GuestMemory::clear() {
+    void* region = mmap(base, bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    if (region == MAP_FAILED) {
+        std::memset(base, 0, bytes);
+    }
+    fileBacked = false;
+}
+
+void GuestMemory::zeroWords(size_t first, size_t count) {
+    std::vector<unsigned char> map;
+    bool known = !fileBacked && scanResidency(map);
+    size_t page = pageSize();
+    char* start = reinterpret_cast<char*>(base);
+    size_t end = (first + count) * sizeof(int32_t);
+    for (size_t offset = first * sizeof(int32_t); offset < end; ) {
+        size_t pageEnd = std::min(end, (offset / page + 1) * page);
+        if (!known || (map[offset / page] & 1)) {
+            std::memset(start + offset, 0, pageEnd - offset);
+        }
+        offset = pageEnd;
+    }
+}
+
+void GuestMemory::zeroTouched() {
+    // Resident file pages may be unmodified page cache, not private copies
+    if (fileBacked) {
+        clear();
+        return;
+    }
+    if (!scanResidency(residency)) {
+        clear();
+        return;
+    }
+    size_t page = pageSize();
+    char* start = reinterpret_cast<char*>(base);
+    for (size_t i = 0; i < residency.size(); i++) {
+        if (residency[i] & 1) {
+            std::memset(start + i * page, 0, page);
+        }
+    }
+}
+
+bool GuestMemory::mapPrivate(int fd, off_t offset) {
+    void* region = mmap(base, bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_FIXED, fd, offset);
+    if (region == MAP_FAILED) {
+        return false;
+    }
+    fileBacked = true;
+    return true;
+}
+
+GuardTrap::GuardTrap(const GuestMemory& memory) : memory(memory), previous(activeTrap), index(0) {
+    static std::once_flag installed;
+    std::call_once(installed, []() {
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_sigaction = &GuardTrap::onSegv;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &previousAction);
+    });
+    activeTrap = this;
+}
+
+GuardTrap::~GuardTrap() {
+    activeTrap = previous;
+}
+
+void GuardTrap::onSegv(int signal, siginfo_t* info, void* context) {
+    GuardTrap* trap = activeTrap;
+    if (trap && trap->memory.inGuard(info->si_addr)) {
+        std::ptrdiff_t offset = static_cast<const char*>(info->si_addr) -
+                                reinterpret_cast<const char*>(trap->memory.data());
+        trap->index = (offset - (offset < 0 ? static_cast<std::ptrdiff_t>(sizeof(int32_t)) - 1 : 0)) /
+                      static_cast<std::ptrdiff_t>(sizeof(int32_t));
+        activeTrap = trap->previous;
+        siglongjmp(trap->jump, 1);
+    }
+
+    // Not a guest access: hand the signal to whoever had it before us
+    if (previousAction.sa_flags & SA_SIGINFO) {
+        if (previousAction.sa_sigaction) {
+            previousAction.sa_sigaction(signal, info, context);
+            return;
+        }
+    } else if (previousAction.sa_handler != SIG_DFL && previousAction.sa_handler != SIG_IGN) {
+        previousAction.sa_handler(signal);
+        return;
+    }
+    // Default action: restore it and let the faulting instruction re-run
+    std::signal(SIGSEGV, SIG_DFL);
+}
@@ -0,0 +1,142 @@
+#ifndef GUEST_MEMORY_H
+#define GUEST_MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <csetjmp>
+#include <csignal>
+#include <vector>
+#include <sys/types.h>
+
+// Guest RAM as an mmap'd region of 32-bit words.
+//
+// Indexing is as cheap as a std::vector, but because the region comes
+// straight from mmap it can be replaced in place (MAP_FIXED) by a private,
+// copy-on-write mapping of a snapshot file. Only the pages the guest then
+// writes to are copied.
+//
+// The region is reserved with MAP_NORESERVE and the kernel commits a zeroed
+// page the first time it is touched, so a large address space costs only
+// the pages the guest uses. Moving the contents (resize, setGuarded) copies
+// resident pages only.
+//
+// A guarded region sits in the middle of an inaccessible (PROT_NONE)
+// reservation large enough that base[i] faults for every out-of-range 32-bit
+// index i, so unchecked guest accesses cannot reach host memory. A
+// GuardTrap turns those faults into guest errors. Guard pages cannot start
+// part-way through a page, so only a region of whole pages can be guarded.
+class GuestMemory {
+public:
+    explicit GuestMemory(size_t words);
+    ~GuestMemory();
+
+    GuestMemory(const GuestMemory&) = delete;
+    GuestMemory& operator=(const GuestMemory&) = delete;
+
+    int32_t& operator[](std::ptrdiff_t index) { return base[index]; }
+    const int32_t& operator[](std::ptrdiff_t index) const { return base[index]; }
+
+    int32_t* data() { return base; }
+    const int32_t* data() const { return base; }
+    size_t size() const { return words; }
+
+    // Size of the mapping in bytes (the word count rounded up to pages)
+    size_t mappedBytes() const { return bytes; }
+
+    // Bytes of the mapping backed by physical pages
+    size_t residentBytes() const;
+
+    // Grows or shrinks the region, keeping the common prefix. A guarded
+    // region stops being guarded if the new size is not whole pages.
+    void resize(size_t newWords);
+
+    // Zeroes every word by mapping fresh anonymous pages over the region
+    void clear();
+
+    // Zeroes 'count' words from 'first', skipping pages that were never
+    // touched (and so are zero already) rather than committing them
+    void zeroWords(size_t first, size_t count);
+
+    // Zeroes every word by clearing only the pages that are resident, which
+    // stay mapped, so a region reused for many short runs costs neither
+    // page faults nor a pass over untouched pages. Falls back to clear()
+    // while a file is mapped over the region.
+    void zeroTouched();
+
+    // Maps mappedBytes() of 'fd', starting at 'offset', privately over the
+    // region. Writes go to private copies of the touched pages only.
+    bool mapPrivate(int fd, off_t offset);
+
+    // Drops this region and uses the owner's instead, for cores that share
+    // one memory (see CoreGroup.h). The owner must outlive this object and
+    // keep its region where it is, and a shared region must not itself be
+    // resized, cleared or remapped.
+    void share(GuestMemory& owner);
+
+    // Moves the contents into a guarded (or plain) region. Returns false if
+    // guard pages are unavailable on this host or the region is not a whole
+    // number of pages, since words past size() would stay accessible.
+    bool setGuarded(bool enabled);
+    bool isGuarded() const { return reservation != nullptr; }
+
+    // True if 'address' lies in the guard reservation around the region
+    bool inGuard(const void* address) const;
+
+    static size_t pageSize();
+
+private:
+    int32_t* base;
+    size_t words;
+    size_t bytes;
+    char* reservation;       // Start of the guard reservation, or null
+    size_t reservationBytes;
+    bool fileBacked;         // Set by mapPrivate() until the next remap
+    bool shared;             // The region belongs to another GuestMemory
+    std::vector<unsigned char> residency; // Scratch for zeroTouched()
+
+    static size_t roundToPages(size_t words);
+
+    // True if 'words' fill whole pages, so that a guard can follow them
+    static bool fillsPages(size_t words);
+
+    // Fills 'map' with one mincore() byte per page of the region; false
+    // if the kernel cannot say
+    bool scanResidency(std::vector<unsigned char>& map) const;
+
+    // Copies the first 'size' bytes of the region to 'target', skipping
+    // pages that were never touched (and so still read as zero)
+    void copyTo(int32_t* target, size_t size) const;
+
+    // Maps a zeroed region of 'size' bytes, inside a new reservation if
+    // 'guarded'; the previous region is left alone
+    int32_t* allocate(size_t size, bool guarded, char*& newReservation, size_t& newReservationBytes);
+    void release();
+};
+
+// Catches SIGSEGV from a guarded GuestMemory on the current thread while it
+// is alive. The code that creates it must call sigsetjmp(trap.jump, 1)
+// itself; a guard hit then returns there with a non-zero value and
+// faultIndex() set. Frames skipped by the jump are not unwound, so they must
+// not own resources.
+class GuardTrap {
+public:
+    explicit GuardTrap(const GuestMemory& memory);
+    ~GuardTrap();
+
+    GuardTrap(const GuardTrap&) = delete;
+    GuardTrap& operator=(const GuardTrap&) = delete;
+
+    sigjmp_buf jump;
+
+    // Word index of the access that hit the guard
+    std::ptrdiff_t faultIndex() const { return index; }
+
+private:
+    const GuestMemory& memory;
+    GuardTrap* previous;
+    std::ptrdiff_t index;
+
+    static void onSegv(int signal, siginfo_t* info, void* context);
+};
+
+#endif // GUEST_MEMORY_H
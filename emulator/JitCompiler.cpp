@@ -0,0 +1,649 @@
+#include "JitCompiler.h"
+#include <iostream>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define VM_HAVE_JIT 1
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+// Host registers used by generated code
+enum HostRegister {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8 = 8, R9, R10, R11, R12, R13, R14, R15
+};
+
+const int REG_MEMORY = RBX;  // Guest memory base
+const int REG_MASK = RBP;    // JitContext::codeMask
+const int REG_A = R12;
+const int REG_B = R13;
+const int REG_SP = R14;
+const int REG_CONTEXT = R15;
+
+// ModRM /digit extensions
+const int ALU_ADD = 0;
+const int ALU_CMP = 7;
+const int SHIFT_SHL = 4;
+const int SHIFT_SAR = 7;
+
+// Condition codes for Jcc
+const uint8_t CC_AE = 0x3;
+const uint8_t CC_E = 0x4;
+const uint8_t CC_S = 0x8;
+
+const size_t BUFFER_SIZE = 4 << 20;   // 4 MB of generated code
+const int MAX_BLOCK_LENGTH = 256;     // Guest instructions per block
+const size_t MAX_BLOCK_BYTES = MAX_BLOCK_LENGTH * 96 + 256;
+const size_t MAX_FLUSHES = 64;        // Then give up on self-modifying code
+
+const int OFFSET_MEMORY = offsetof(JitContext, memory);
+const int OFFSET_MASK = offsetof(JitContext, codeMask);
+const int OFFSET_NATIVE = offsetof(JitContext, nativeInstructions);
+const int OFFSET_A = offsetof(JitContext, A);
+const int OFFSET_B = offsetof(JitContext, B);
+const int OFFSET_SP = offsetof(JitContext, SP);
+const int OFFSET_WRITTEN = offsetof(JitContext, codeWritten);
+
+// Minimal x86-64 encoder for the handful of instructions the JIT needs
+class Emitter {
+public:
+    explicit Emitter(uint8_t*& cursor) : p(cursor) {}
+
+    void byte(uint8_t value) { *p++ = value; }
+
+    void dword(uint32_t value) {
+        std::memcpy(p, &value, sizeof(value));
+        p += sizeof(value);
+    }
+
+    // mov dst, src (32-bit)
+    void movRR(int dst, int src) {
+        rex(false, src, 0, dst);
+        byte(0x89);
+        modrm(3, src, dst);
+    }
+
+    // mov dst, imm32
+    void movRI(int dst, int32_t imm) {
+        rex(false, 0, 0, dst);
+        byte(0xB8 + (dst & 7));
+        dword(static_cast<uint32_t>(imm));
+    }
+
+    // add/sub/cmp dst, imm32
+    void aluRI(int op, int dst, int32_t imm) {
+        rex(false, 0, 0, dst);
+        byte(0x81);
+        modrm(3, op, dst);
+        dword(static_cast<uint32_t>(imm));
+    }
+
+    void addRR(int dst, int src) { regReg(0x01, dst, src); }
+    void subRR(int dst, int src) { regReg(0x29, dst, src); }
+    void testRR(int dst, int src) { regReg(0x85, dst, src); }
+
+    // shl/sar dst, cl
+    void shiftCL(int op, int dst) {
+        rex(false, 0, 0, dst);
+        byte(0xD3);
+        modrm(3, op, dst);
+    }
+
+    // movsxd rcx, ecx
+    void signExtendRCX() {
+        byte(0x48);
+        byte(0x63);
+        modrm(3, RCX, RCX);
+    }
+
+    // mov dst, [memory + rcx*4]
+    void loadGuest(int dst) { guestAccess(0x8B, dst); }
+
+    // mov [memory + rcx*4], src
+    void storeGuest(int src) { guestAccess(0x89, src); }
+
+    // cmp byte [mask + rcx], 0
+    void testMaskRCX() {
+        byte(0x80);
+        modrm(1, 7, 4);
+        sib(0, RCX, REG_MASK);
+        byte(0);
+        byte(0);
+    }
+
+    // mov dst, [context + offset] (32 or 64-bit)
+    void loadContext(int dst, int offset, bool wide) {
+        rex(wide, dst, 0, REG_CONTEXT);
+        byte(0x8B);
+        modrm(1, dst, REG_CONTEXT);
+        byte(static_cast<uint8_t>(offset));
+    }
+
+    // mov [context + offset], src (32-bit)
+    void storeContext(int offset, int src) {
+        rex(false, src, 0, REG_CONTEXT);
+        byte(0x89);
+        modrm(1, src, REG_CONTEXT);
+        byte(static_cast<uint8_t>(offset));
+    }
+
+    // mov dword [context + offset], imm32
+    void storeContextImm(int offset, int32_t imm) {
+        rex(false, 0, 0, REG_CONTEXT);
+        byte(0xC7);
+        modrm(1, 0, REG_CONTEXT);
+        byte(static_cast<uint8_t>(offset));
+        dword(static_cast<uint32_t>(imm));
+    }
+
+    // add qword [context + offset], imm32
+    void addContext64(int offset, int32_t imm) {
+        rex(true, 0, 0, REG_CONTEXT);
+        byte(0x81);
+        modrm(1, ALU_ADD, REG_CONTEXT);
+        byte(static_cast<uint8_t>(offset));
+        dword(static_cast<uint32_t>(imm));
+    }
+
+    // mov dst, src (64-bit)
+    void movRR64(int dst, int src) {
+        rex(true, src, 0, dst);
+        byte(0x89);
+        modrm(3, src, dst);
+    }
+
+    void push(int reg) {
+        rex(false, 0, 0, reg);
+        byte(0x50 + (reg & 7));
+    }
+
+    void pop(int reg) {
+        rex(false, 0, 0, reg);
+        byte(0x58 + (reg & 7));
+    }
+
+    // jmp reg (64-bit)
+    void jmpR(int reg) {
+        rex(false, 0, 0, reg);
+        byte(0xFF);
+        modrm(3, 4, reg);
+    }
+
+    void ret() { byte(0xC3); }
+
+    // jmp rel32 / jcc rel32; returns the rel32 field for patching
+    uint8_t* jmp32() {
+        byte(0xE9);
+        return rel32();
+    }
+
+    uint8_t* jcc32(uint8_t condition) {
+        byte(0x0F);
+        byte(0x80 | condition);
+        return rel32();
+    }
+
+    uint8_t* position() const { return p; }
+
+private:
+    uint8_t*& p;
+
+    void rex(bool wide, int reg, int index, int base) {
+        uint8_t value = 0x40 | (wide ? 8 : 0) | ((reg >> 3) << 2) |
+                        ((index >> 3) << 1) | (base >> 3);
+        if (value != 0x40) {
+            byte(value);
+        }
+    }
+
+    void modrm(int mod, int reg, int rm) {
+        byte(static_cast<uint8_t>((mod << 6) | ((reg & 7) << 3) | (rm & 7)));
+    }
+
+    void sib(int scale, int index, int base) {
+        byte(static_cast<uint8_t>((scale << 6) | ((index & 7) << 3) | (base & 7)));
+    }
+
+    void regReg(uint8_t opcode, int dst, int src) {
+        rex(false, src, 0, dst);
+        byte(opcode);
+        modrm(3, src, dst);
+    }
+
+    void guestAccess(uint8_t opcode, int reg) {
+        rex(false, reg, RCX, REG_MEMORY);
+        byte(opcode);
+        modrm(0, reg, 4);
+        sib(2, RCX, REG_MEMORY);
+    }
+
+    uint8_t* rel32() {
+        uint8_t* field = p;
+        dword(0);
+        return field;
+    }
+};
+
+// Points a rel32 field at 'target'
+void patchJump(uint8_t* field, const uint8_t* target) {
+    int32_t displacement = static_cast<int32_t>(target - (field + 4));
+    std::memcpy(field, &displacement, sizeof(displacement));
+}
+
+bool isControlTransfer(int32_t opcode) {
+    return opcode >= 0 && opcode < OPCODE_COUNT && opcodeTable[opcode].isBranch && opcode != OP_RETURN;
+}
+
+// Opcodes that end a block and run on the interpreter instead; block
+// instructions spend their time in the bulk kernels anyway, and core
+// instructions in the host's atomics or in CoreGroup
+bool isCompilable(int32_t opcode) {
+    return opcode >= 0 && opcode < OPCODE_COUNT && !isBlockOpcode(opcode) && !isCoreOpcode(opcode) &&
+           opcode != OP_A2SP && opcode != OP_SP2A && opcode != OP_RETURN && opcode != OP_HALT;
+}
+
+} // namespace
+
+JitCompiler::JitCompiler(VirtualMachine& vm)
+    : vm(vm), buffer(nullptr), bufferSize(0), writable(false), cursor(nullptr),
+      codeStart(nullptr), epilogue(nullptr), entry(nullptr),
+      blockCount(0), flushes(0), interpreted(0) {
+    std::memset(&context, 0, sizeof(context));
+
+#ifdef VM_HAVE_JIT
+    void* mapping = mmap(nullptr, BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping != MAP_FAILED) {
+        buffer = static_cast<uint8_t*>(mapping);
+        bufferSize = BUFFER_SIZE;
+        writable = true;
+        emitStubs();
+    }
+#endif
+}
+
+JitCompiler::~JitCompiler() {
+#ifdef VM_HAVE_JIT
+    if (buffer) {
+        munmap(buffer, bufferSize);
+    }
+#endif
+}
+
+bool JitCompiler::available() const {
+    return buffer != nullptr;
+}
+
+bool JitCompiler::setWritable(bool enabled) {
+    if (enabled == writable) {
+        return true;
+    }
+#ifdef VM_HAVE_JIT
+    if (mprotect(buffer, bufferSize, enabled ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) != 0) {
+        return false;
+    }
+#endif
+    writable = enabled;
+    return true;
+}
+
+void JitCompiler::emitStubs() {
+    cursor = buffer;
+    Emitter e(cursor);
+
+    // Entry: int32_t entry(JitContext* context, const uint8_t* block)
+    entry = reinterpret_cast<EntryFunction>(cursor);
+    e.push(RBX);
+    e.push(RBP);
+    e.push(R12);
+    e.push(R13);
+    e.push(R14);
+    e.push(R15);
+    e.movRR64(REG_CONTEXT, RDI);
+    e.loadContext(REG_MEMORY, OFFSET_MEMORY, true);
+    e.loadContext(REG_MASK, OFFSET_MASK, true);
+    e.loadContext(REG_A, OFFSET_A, false);
+    e.loadContext(REG_B, OFFSET_B, false);
+    e.loadContext(REG_SP, OFFSET_SP, false);
+    e.jmpR(RSI);
+
+    // Exit: next guest PC is in eax
+    epilogue = cursor;
+    e.storeContext(OFFSET_A, REG_A);
+    e.storeContext(OFFSET_B, REG_B);
+    e.storeContext(OFFSET_SP, REG_SP);
+    e.pop(R15);
+    e.pop(R14);
+    e.pop(R13);
+    e.pop(R12);
+    e.pop(RBP);
+    e.pop(RBX);
+    e.ret();
+
+    codeStart = cursor;
+}
+
+void JitCompiler::findLeaders() {
+    int32_t size = vm.programSize;
+    leader.assign(size, false);
+    if (size > 0) {
+        leader[0] = true;
+    }
+    for (int32_t pc = 0; pc < size; pc++) {
+        int32_t word = vm.memory[pc];
+        int32_t opcode = word & 0xFF;
+        if (isControlTransfer(opcode)) {
+            int32_t target = pc + 1 + (word >> 8);
+            if (target >= 0 && target < size) {
+                leader[target] = true;
+            }
+        }
+        if ((isControlTransfer(opcode) || !isCompilable(opcode)) && pc + 1 < size) {
+            leader[pc + 1] = true;
+        }
+    }
+}
+
+void JitCompiler::flush() {
+    cursor = codeStart;
+    blockAt.assign(vm.programSize, nullptr);
+    uncompilable.assign(vm.programSize, false);
+    codeMask.assign(vm.programSize + 1, 0);
+    pendingJumps.clear();
+    context.codeMask = codeMask.data();
+    flushes++;
+}
+
+void JitCompiler::emitExit(int32_t target) {
+    Emitter e(cursor);
+    bool inText = target >= 0 && target < vm.programSize;
+
+    if (inText && blockAt[target]) {
+        patchJump(e.jmp32(), blockAt[target]);
+        return;
+    }
+
+    // Not compiled (yet): leave through a stub, and remember the jump so
+    // it can be chained once the target is compiled
+    uint8_t* field = e.jmp32();
+    patchJump(field, e.position());
+    e.movRI(RAX, target);
+    patchJump(e.jmp32(), epilogue);
+    if (inText) {
+        pendingJumps[target].push_back(field);
+    }
+}
+
+uint8_t* JitCompiler::compileBlock(int32_t start) {
+    if (static_cast<size_t>(bufferSize - (cursor - buffer)) < MAX_BLOCK_BYTES) {
+        flush();
+    }
+
+    uint8_t* body = cursor;
+    Emitter e(cursor);
+    int32_t pc = start;
+    int32_t count = 0;
+
+    for (;;) {
+        if (pc >= vm.programSize || (pc > start && leader[pc]) ||
+            count == MAX_BLOCK_LENGTH) {
+            e.addContext64(OFFSET_NATIVE, count);
+            emitExit(pc);
+            break;
+        }
+
+        int32_t word = vm.memory[pc];
+        int32_t opcode = word & 0xFF;
+        int32_t operand = word >> 8;
+
+        if (!isCompilable(opcode)) {
+            if (count == 0) {
+                cursor = body;
+                return nullptr;
+            }
+            e.addContext64(OFFSET_NATIVE, count);
+            emitExit(pc);
+            break;
+        }
+
+        count++;
+        int32_t next = pc + 1;
+        bool endsBlock = false;
+
+        switch (opcode) {
+            case OP_LDC:
+                e.movRR(REG_B, REG_A);
+                e.movRI(REG_A, operand);
+                break;
+
+            case OP_ADC:
+                e.aluRI(ALU_ADD, REG_A, operand);
+                break;
+
+            case OP_LDL:
+            case OP_STL:
+            case OP_LDNL:
+            case OP_STNL:
+                // rcx = sign-extended guest address
+                e.movRR(RCX, (opcode == OP_LDL || opcode == OP_STL) ? REG_SP : REG_A);
+                e.aluRI(ALU_ADD, RCX, operand);
+                e.signExtendRCX();
+                if (opcode == OP_LDL) {
+                    e.movRR(REG_B, REG_A);
+                    e.loadGuest(REG_A);
+                } else if (opcode == OP_LDNL) {
+                    e.loadGuest(REG_A);
+                } else {
+                    if (opcode == OP_STL) {
+                        e.storeGuest(REG_A);
+                        e.movRR(REG_A, REG_B);
+                    } else {
+                        e.storeGuest(REG_B);
+                    }
+                    // Leave native code if the store hit compiled code
+                    e.aluRI(ALU_CMP, RCX, vm.programSize);
+                    uint8_t* outside = e.jcc32(CC_AE);
+                    e.testMaskRCX();
+                    uint8_t* notCode = e.jcc32(CC_E);
+                    e.addContext64(OFFSET_NATIVE, count);
+                    e.storeContextImm(OFFSET_WRITTEN, 1);
+                    e.movRI(RAX, next);
+                    patchJump(e.jmp32(), epilogue);
+                    patchJump(outside, e.position());
+                    patchJump(notCode, e.position());
+                }
+                break;
+
+            case OP_ADD:
+                e.addRR(REG_A, REG_B);
+                break;
+
+            case OP_SUB: // A = B - A
+                e.movRR(RAX, REG_B);
+                e.subRR(RAX, REG_A);
+                e.movRR(REG_A, RAX);
+                break;
+
+            case OP_SHL: // A = B << A
+            case OP_SHR: // A = B >> A (arithmetic)
+                e.movRR(RCX, REG_A);
+                e.movRR(RAX, REG_B);
+                e.shiftCL(opcode == OP_SHL ? SHIFT_SHL : SHIFT_SAR, RAX);
+                e.movRR(REG_A, RAX);
+                break;
+
+            case OP_ADJ:
+                e.aluRI(ALU_ADD, REG_SP, operand);
+                break;
+
+            case OP_CALL:
+                e.movRR(REG_B, REG_A);
+                e.movRI(REG_A, next);
+                e.addContext64(OFFSET_NATIVE, count);
+                emitExit(next + operand);
+                endsBlock = true;
+                break;
+
+            case OP_BRZ:
+            case OP_BRLZ:
+            {
+                e.addContext64(OFFSET_NATIVE, count);
+                e.testRR(REG_A, REG_A);
+                uint8_t* taken = e.jcc32(opcode == OP_BRZ ? CC_E : CC_S);
+                emitExit(next);
+                patchJump(taken, e.position());
+                emitExit(next + operand);
+                endsBlock = true;
+                break;
+            }
+
+            case OP_BR:
+                e.addContext64(OFFSET_NATIVE, count);
+                emitExit(next + operand);
+                endsBlock = true;
+                break;
+        }
+
+        pc = next;
+        if (endsBlock) {
+            break;
+        }
+    }
+
+    for (int32_t i = start; i < start + count; i++) {
+        codeMask[i] = 1;
+    }
+
+    // Chain every exit that was waiting for this block
+    blockAt[start] = body;
+    auto pending = pendingJumps.find(start);
+    if (pending != pendingJumps.end()) {
+        for (uint8_t* field : pending->second) {
+            patchJump(field, body);
+        }
+        pendingJumps.erase(pending);
+    }
+
+    blockCount++;
+    return body;
+}
+
+void JitCompiler::interpretOne() {
+    int32_t word = vm.memory[vm.PC];
+    int32_t opcode = word & 0xFF;
+    int32_t address = -1;
+    if (opcode == OP_STL) {
+        address = vm.SP + (word >> 8);
+    } else if (opcode == OP_STNL) {
+        address = vm.A + (word >> 8);
+    } else if (opcode == OP_CAS) {
+        address = vm.A;
+    }
+    int32_t first = 0, count = 0;
+    bool stores = VirtualMachine::blockStores(opcode, vm.A, vm.B, first, count);
+
+    vm.executeInstruction();
+    interpreted++;
+
+    if (address >= 0 && address < vm.programSize && codeMask[address]) {
+        flush();
+    }
+    if (stores && !vm.faulted) {
+        int32_t end = first + count < vm.programSize ? first + count : vm.programSize;
+        for (int32_t i = first; i < end; i++) {
+            if (codeMask[i]) {
+                flush();
+                break;
+            }
+        }
+    }
+}
+
+void JitCompiler::run() {
+    blockCount = 0;
+    flushes = 0;
+    interpreted = 0;
+    context.nativeInstructions = 0;
+
+    findLeaders();
+    flush();
+    flushes = 0;
+    context.memory = vm.memory.data();
+
+    bool enabled = available();
+
+    while (!vm.halted) {
+        int32_t pc = vm.PC;
+        if (pc < 0 || pc >= (int)vm.memory.size()) {
+            vm.fault("PC out of bounds (" + std::to_string(pc) + ")");
+            break;
+        }
+
+        uint8_t* block = nullptr;
+        if (enabled && pc < vm.programSize && !uncompilable[pc]) {
+            block = blockAt[pc];
+            if (!block && setWritable(true)) {
+                block = compileBlock(pc);
+                uncompilable[pc] = !block;
+            }
+        }
+
+        // Generated code only runs once the buffer is no longer writable
+        if (block && !setWritable(false)) {
+            block = nullptr;
+        }
+        if (enabled && !block && pc < vm.programSize && !uncompilable[pc]) {
+            enabled = false; // The host will not let the buffer change protection
+        }
+
+        if (!block) {
+            interpretOne();
+            continue;
+        }
+
+        context.A = vm.A;
+        context.B = vm.B;
+        context.SP = vm.SP;
+        context.codeWritten = 0;
+        vm.PC = entry(&context, block);
+        vm.A = context.A;
+        vm.B = context.B;
+        vm.SP = context.SP;
+
+        if (context.codeWritten) {
+            flush();
+            if (flushes >= MAX_FLUSHES) {
+                enabled = false; // Keeps rewriting itself; interpret the rest
+            }
+        }
+    }
+}
+
+void VirtualMachine::runJit() {
+    JitCompiler jit(*this);
+    if (!jit.available()) {
+        if (verbose) {
+            std::cerr << "Warning: JIT not available on this host, using the switch engine." << std::endl;
+        }
+        runSwitch(UINT64_MAX);
+        return;
+    }
+
+    jit.run();
+    instructionCount += jit.nativeInstructions();
+    if (!verbose) {
+        return;
+    }
+
+    uint64_t total = jit.nativeInstructions() + jit.interpretedInstructions();
+    double percent = total ? 100.0 * jit.nativeInstructions() / total : 0.0;
+    std::cout << "JIT: " << jit.blocksCompiled() << " blocks compiled, "
+              << jit.nativeInstructions() << " of " << total
+              << " instructions (" << percent << "%) ran natively";
+    if (jit.flushCount()) {
+        std::cout << ", " << jit.flushCount() << " flushes";
+    }
+    std::cout << std::endl;
+}
@@ -0,0 +1,96 @@
+#ifndef JIT_COMPILER_H
+#define JIT_COMPILER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+#include "VirtualMachine.h"
+
+// State shared between the dispatcher and generated code. Generated code
+// addresses these fields by their offsets, so keep the layout in sync with
+// the emitter in JitCompiler.cpp.
+struct JitContext {
+    int32_t* memory;             // Guest memory base
+    const uint8_t* codeMask;     // Non-zero for text words covered by a block
+    uint64_t nativeInstructions; // Guest instructions retired natively
+    int32_t A, B, SP;            // Guest registers (live in host registers
+                                 // while native code runs)
+    int32_t codeWritten;         // Set when native code stored into a block
+};
+
+// Basic-block JIT for x86-64.
+//
+// Blocks start at branch targets (and wherever the dispatcher needs one)
+// and end at the next leader or control transfer. A, B and SP stay in
+// callee-saved host registers; exits to a block that is already compiled
+// are direct jumps, and exits to one that is not yet compiled are patched
+// once it is. a2sp, sp2a, return, HALT and unknown opcodes are never
+// compiled: the block ends before them and the dispatcher steps them with
+// VirtualMachine::executeInstruction(). A store into a compiled word leaves
+// native code right after the store and flushes every block.
+//
+// The code buffer is never writable and executable at once: it is mapped
+// read-write while blocks are emitted and patched, and read-execute while
+// generated code runs.
+class JitCompiler {
+public:
+    explicit JitCompiler(VirtualMachine& vm);
+    ~JitCompiler();
+
+    // False if the host cannot run generated code
+    bool available() const;
+
+    // Runs the VM from its current PC until it halts
+    void run();
+
+    // Statistics for the last run()
+    size_t blocksCompiled() const { return blockCount; }
+    size_t flushCount() const { return flushes; }
+    uint64_t nativeInstructions() const { return context.nativeInstructions; }
+    uint64_t interpretedInstructions() const { return interpreted; }
+
+private:
+    // Signature of the shared entry stub: enters 'block' and returns the
+    // guest PC to continue at
+    typedef int32_t (*EntryFunction)(JitContext* context, const uint8_t* block);
+
+    VirtualMachine& vm;
+    JitContext context;
+
+    uint8_t* buffer;       // Generated code buffer (mmap'd)
+    size_t bufferSize;
+    bool writable;         // The buffer is mapped read-write, not read-execute
+    uint8_t* cursor;       // Next free byte in the buffer
+    uint8_t* codeStart;    // First byte after the entry/exit stubs
+    uint8_t* epilogue;     // Shared exit stub (stores registers, returns)
+    EntryFunction entry;
+
+    std::vector<bool> leader;          // Text words that start a basic block
+    std::vector<uint8_t*> blockAt;     // Native entry per text word, if any
+    std::vector<bool> uncompilable;    // Text words no block can start at
+    std::vector<uint8_t> codeMask;     // See JitContext::codeMask
+    std::unordered_map<int32_t, std::vector<uint8_t*> > pendingJumps;
+
+    size_t blockCount;
+    size_t flushes;
+    uint64_t interpreted;
+
+    // Maps the buffer read-write or read-execute; false if the host refuses
+    bool setWritable(bool enabled);
+
+    void findLeaders();
+    void emitStubs();
+    void flush();
+
+    // Compiles the block starting at pc; nullptr if none can start there
+    uint8_t* compileBlock(int32_t pc);
+
+    // Emits a jump to guest address 'target', chaining if possible
+    void emitExit(int32_t target);
+
+    // Steps one instruction on the reference interpreter
+    void interpretOne();
+};
+
+#endif // JIT_COMPILER_H
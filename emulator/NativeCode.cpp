@@ -0,0 +1,137 @@
+#include "NativeCode.h"
+#include "VirtualMachine.h"
+#include <algorithm>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+NativeLibrary::NativeLibrary() : handle(nullptr), program(nullptr) {
+}
+
+NativeLibrary::~NativeLibrary() {
+    if (handle) {
+        dlclose(handle);
+    }
+}
+
+bool NativeLibrary::open(const std::string& filename) {
+    // dlopen() only searches the library path for names without a slash
+    std::string path = filename.find('/') == std::string::npos ? "./" + filename : filename;
+    handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        error = "Could not load " + filename + ": " + dlerror();
+        return false;
+    }
+    program = static_cast<const NativeProgram*>(dlsym(handle, NATIVE_PROGRAM_SYMBOL));
+    if (!program) {
+        error = filename + " is not a translated program (see aot)";
+        return false;
+    }
+    if (program->abiVersion != NATIVE_ABI_VERSION) {
+        error = filename + " was translated for native ABI version " + std::to_string(program->abiVersion) +
+                "; this emulator runs version " + std::to_string(NATIVE_ABI_VERSION);
+        program = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool VirtualMachine::runNative(const NativeProgram& program) {
+    // The translation only describes the image it was made from
+    if (program.storedWords > memory.size() ||
+        !std::equal(program.words, program.words + program.storedWords, memory.data())) {
+        return false;
+    }
+
+    if (!halted) {
+        NativeState state;
+        state.a = A;
+        state.b = B;
+        state.pc = PC;
+        state.sp = SP;
+        state.memory = memory.data();
+        state.memoryWords = static_cast<uint32_t>(memory.size());
+        state.instructions = 0;
+        state.error[0] = '\0';
+        int32_t exit = program.run(&state);
+
+        A = state.a;
+        B = state.b;
+        PC = state.pc;
+        SP = state.sp;
+        instructionCount += state.instructions;
+        decodedValid = false;
+        verifiedCode.clear();
+        if (exit == NATIVE_HALTED) {
+            halted = true;
+        } else if (exit == NATIVE_FAULTED) {
+            fault(state.error);
+        } else {
+            execute(UINT64_MAX); // Somewhere aot did not translate: carry on interpreting
+        }
+    }
+
+    if (verbose) {
+        std::cout << "--- Program Halted ---" << std::endl;
+        dumpState();
+    }
+    return true;
+}
+
+extern "C" int vm_native_main(int argc, char* argv[], const NativeProgram* program) {
+    size_t memoryWords = 65536;
+    bool stats = false;
+    std::vector<std::pair<int32_t, int32_t> > dumps;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        char* end = nullptr;
+        if (arg.compare(0, 9, "--memory=") == 0) {
+            unsigned long words = std::strtoul(arg.c_str() + 9, &end, 0);
+            if (*end != '\0' || words == 0 || words > static_cast<unsigned long>(VirtualMachine::MAX_MEMORY_WORDS)) {
+                std::cerr << "Error: --memory must be between 1 and " << VirtualMachine::MAX_MEMORY_WORDS
+                          << " words." << std::endl;
+                return 1;
+            }
+            memoryWords = words;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg.compare(0, 7, "--dump=") == 0) {
+            long address = std::strtol(arg.c_str() + 7, &end, 0);
+            long count = *end == ':' ? std::strtol(end + 1, &end, 0) : 0;
+            if (*end != '\0' || count <= 0) {
+                std::cerr << "Error: Cannot dump " << arg.substr(7) << " (expected ADDRESS:COUNT)" << std::endl;
+                return 1;
+            }
+            dumps.push_back(std::make_pair(static_cast<int32_t>(address), static_cast<int32_t>(count)));
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--memory=WORDS] [--stats] [--dump=ADDRESS:COUNT]..." << std::endl;
+            return 1;
+        }
+    }
+
+    // Grow memory by doubling to fit the image, as loading an executable does
+    while (memoryWords < program->imageWords) {
+        memoryWords *= 2;
+    }
+    VirtualMachine vm(static_cast<int>(memoryWords));
+    vm.setVerbose(true);
+    if (!vm.loadImage(program->words, program->storedWords, program->entry)) {
+        return 1;
+    }
+
+    std::cout << "--- Running Program ---" << std::endl;
+    vm.runNative(*program);
+
+    if (stats) {
+        vm.dumpStats();
+    }
+    for (const auto& dump : dumps) {
+        std::cout << "Memory at addresses " << dump.first << "-" << (dump.first + dump.second - 1) << ":" << std::endl;
+        for (int32_t i = 0; i < dump.second; i++) {
+            std::cout << "  addr[" << (dump.first + i) << "]: " << vm.readMemory(dump.first + i) << std::endl;
+        }
+    }
+    return vm.hasFaulted() ? 2 : 0;
+}
@@ -0,0 +1,73 @@
+#ifndef NATIVE_CODE_H
+#define NATIVE_CODE_H
+
+#include <cstdint>
+#include <string>
+
+// Programs translated ahead of time by aot (see translator/Translator.h).
+//
+// aot turns an executable into C++ that includes this header and defines
+// one NativeProgram named NATIVE_PROGRAM_SYMBOL. Built as a shared object
+// it is loaded with NativeLibrary and run by VirtualMachine::runNative();
+// built with VM_NATIVE_MAIN defined and linked with libvm.a it becomes a
+// stand-alone executable whose main() is vm_native_main(). Change
+// NATIVE_ABI_VERSION whenever these structures change.
+
+const uint32_t NATIVE_ABI_VERSION = 1;
+
+#define NATIVE_PROGRAM_SYMBOL "vm_native_program"
+
+// Why run() returned
+enum NativeExit : int32_t {
+    NATIVE_HALTED = 0,   // HALT ran; PC is after it
+    NATIVE_FAULTED = 1,  // 'error' says why; PC is where the interpreter leaves it
+    NATIVE_LEFT_CODE = 2 // PC is not an instruction aot translated; interpret from there
+};
+
+// The registers and memory run() works on. run() adds the instructions
+// it executes to 'instructions'.
+struct NativeState {
+    int32_t a, b, pc, sp;
+    int32_t* memory;
+    uint32_t memoryWords;
+    uint64_t instructions;
+    char error[160];
+};
+
+struct NativeProgram {
+    uint32_t abiVersion;
+    int32_t entry;
+    uint32_t storedWords;  // Words of 'words': addresses [0, storedWords)
+    uint32_t imageWords;   // Those plus the zero-filled words after them
+    const int32_t* words;  // The image it was translated from
+    int32_t (*run)(NativeState* state);
+};
+
+// A shared object built from aot's output
+class NativeLibrary {
+public:
+    NativeLibrary();
+    ~NativeLibrary();
+
+    NativeLibrary(const NativeLibrary&) = delete;
+    NativeLibrary& operator=(const NativeLibrary&) = delete;
+
+    // False if the library cannot be loaded or was built for another ABI;
+    // getError() says why
+    bool open(const std::string& filename);
+
+    const NativeProgram* getProgram() const { return program; }
+    const std::string& getError() const { return error; }
+
+private:
+    void* handle;
+    const NativeProgram* program;
+    std::string error;
+};
+
+// main() of a stand-alone translated program: runs it on a VM of its own
+// and prints the final state like emu, exiting with 2 if it faulted.
+// Defined in libvm.a.
+extern "C" int vm_native_main(int argc, char* argv[], const NativeProgram* program);
+
+#endif // NATIVE_CODE_H
@@ -0,0 +1,296 @@
+#include "Profiler.h"
+#include "../Common.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+
+std::string hexAddress(int32_t address) {
+    std::ostringstream text;
+    text << "0x" << std::hex << std::setw(4) << std::setfill('0') << address;
+    return text.str();
+}
+
+std::string percentOf(uint64_t part, uint64_t whole) {
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(1) << (whole ? 100.0 * part / whole : 0.0) << "%";
+    return text.str();
+}
+
+} // namespace
+
+Profiler::Profiler() : totalInstructions(0) {
+    std::memset(opcodeCounts, 0, sizeof(opcodeCounts));
+}
+
+bool Profiler::loadSymbols(const std::string& listingFilename) {
+    std::ifstream listing(listingFilename);
+    if (!listing) {
+        return false;
+    }
+
+    // Accepts both the "Symbol table:" section and "label:" lines, which
+    // name the address of the next instruction line
+    std::string line;
+    std::vector<std::string> pendingLabels;
+    bool inSymbolTable = false;
+    while (std::getline(listing, line)) {
+        if (line == "Symbol table:") {
+            inSymbolTable = true;
+            continue;
+        }
+
+        std::istringstream fields(line);
+        std::string first, second;
+        if (!(fields >> first)) {
+            continue;
+        }
+
+        if (!inSymbolTable && first.back() == ':' && !(fields >> second)) {
+            pendingLabels.push_back(first.substr(0, first.size() - 1));
+            continue;
+        }
+
+        char* end = nullptr;
+        long address = std::strtol(first.c_str(), &end, 16);
+        if (*end != '\0') {
+            continue;
+        }
+        if (inSymbolTable) {
+            if (fields >> second && !symbols.count(address)) {
+                symbols[address] = second;
+            }
+        } else {
+            for (const auto& label : pendingLabels) {
+                if (!symbols.count(address)) {
+                    symbols[address] = label;
+                }
+            }
+            pendingLabels.clear();
+        }
+    }
+    return true;
+}
+
+std::string Profiler::symbolize(int32_t address) const {
+    auto next = symbols.upper_bound(address);
+    if (next == symbols.begin()) {
+        return hexAddress(address);
+    }
+    --next;
+    int32_t offset = address - next->first;
+    return offset ? next->second + "+" + std::to_string(offset) : next->second;
+}
+
+std::string Profiler::routineName(int32_t address) const {
+    auto symbol = symbols.find(address);
+    return symbol != symbols.end() ? symbol->second : symbolize(address);
+}
+
+std::string Profiler::disassemble(int32_t word) const {
+    std::string text = ::disassemble(word);
+    return text.empty() ? "?? " + hexAddress(word) : text;
+}
+
+void Profiler::run(VirtualMachine& vm) {
+    size_t size = vm.memory.size();
+    pcCounts.assign(size, 0);
+    instructionWords.assign(size, 0);
+    std::memset(opcodeCounts, 0, sizeof(opcodeCounts));
+    branches.clear();
+    inclusive.clear();
+    exclusive.clear();
+    callCounts.clear();
+    totalInstructions = 0;
+    vm.decodedValid = false; // Stores below bypass the threaded engine
+
+    // A guard page hit needs a GuardTrap around execute(); stepping one
+    // instruction at a time checks accesses as Bounds mode does instead
+    VirtualMachine::MemoryCheck memoryCheck = vm.memoryCheck;
+    if (memoryCheck == VirtualMachine::MemoryCheck::Guard) {
+        vm.memoryCheck = VirtualMachine::MemoryCheck::Bounds;
+    }
+
+    callTree.clear();
+    CallNode root = { vm.PC, -1, 0, 1, std::map<int32_t, int>() };
+    callTree.push_back(root);
+    int current = 0;
+    std::vector<Frame> stack;
+    std::map<int32_t, int> activeCalls; // Frames per routine, for recursion
+    activeCalls[root.routine] = 1;
+
+    // Pops the top frame, crediting the routine's inclusive cost once even
+    // when it is recursive
+    auto popFrame = [&]() {
+        const Frame& frame = stack.back();
+        int32_t routine = callTree[current].routine;
+        if (--activeCalls[routine] == 0) {
+            inclusive[routine] += totalInstructions - frame.entryCount;
+        }
+        current = frame.node;
+        stack.pop_back();
+    };
+
+    while (!vm.halted) {
+        int32_t pc = vm.PC;
+        if (pc < 0 || pc >= (int)size) {
+            vm.fault("PC out of bounds (" + std::to_string(pc) + ")");
+            break;
+        }
+
+        int32_t word = vm.memory[pc];
+        int32_t opcode = word & 0xFF;
+        int32_t a = vm.A;
+
+        pcCounts[pc]++;
+        instructionWords[pc] = word;
+        opcodeCounts[opcode]++;
+        totalInstructions++;
+        callTree[current].self++;
+        exclusive[callTree[current].routine]++;
+
+        vm.executeInstruction();
+
+        if (opcode == OP_BRZ || opcode == OP_BRLZ) {
+            bool taken = opcode == OP_BRZ ? a == 0 : a < 0;
+            BranchCounts& counts = branches[pc];
+            (taken ? counts.taken : counts.notTaken)++;
+        } else if (opcode == OP_CALL) {
+            int32_t routine = vm.PC;
+            auto child = callTree[current].children.find(routine);
+            int node;
+            if (child != callTree[current].children.end()) {
+                node = child->second;
+            } else {
+                CallNode callee = { routine, current, 0, 0, std::map<int32_t, int>() };
+                node = static_cast<int>(callTree.size());
+                callTree[current].children[routine] = node;
+                callTree.push_back(callee);
+            }
+            callTree[node].calls++;
+            callCounts[routine]++;
+            activeCalls[routine]++;
+            Frame frame = { current, pc + 1, totalInstructions };
+            stack.push_back(frame);
+            current = node;
+        } else if (opcode == OP_RETURN) {
+            // Unwind to the frame this return lands in; returns that match
+            // no frame (computed jumps) leave the call tree alone
+            size_t match = stack.size();
+            while (match > 0 && stack[match - 1].returnAddress != vm.PC) {
+                match--;
+            }
+            while (match > 0 && stack.size() >= match) {
+                popFrame();
+            }
+        }
+    }
+
+    while (!stack.empty()) {
+        popFrame(); // Halted inside a call
+    }
+    inclusive[root.routine] += totalInstructions;
+    vm.memoryCheck = memoryCheck;
+}
+
+void Profiler::writeReport(std::ostream& out, size_t maxRows) const {
+    out << "--- Profile ---" << std::endl;
+    out << "Instructions executed: " << totalInstructions << std::endl;
+
+    // Hot spots
+    std::vector<std::pair<uint64_t, int32_t> > hot;
+    for (size_t pc = 0; pc < pcCounts.size(); pc++) {
+        if (pcCounts[pc]) {
+            hot.push_back(std::make_pair(pcCounts[pc], static_cast<int32_t>(pc)));
+        }
+    }
+    std::sort(hot.begin(), hot.end(), [](const std::pair<uint64_t, int32_t>& x,
+                                         const std::pair<uint64_t, int32_t>& y) {
+        return x.first != y.first ? x.first > y.first : x.second < y.second;
+    });
+    if (hot.size() > maxRows) {
+        hot.resize(maxRows);
+    }
+
+    out << std::endl << "Hot spots:" << std::endl;
+    out << std::setw(12) << "count" << std::setw(8) << "share" << "  "
+        << std::left << std::setw(8) << "address" << std::setw(24) << "location"
+        << "instruction" << std::right << std::endl;
+    for (const auto& entry : hot) {
+        out << std::setw(12) << entry.first << std::setw(8) << percentOf(entry.first, totalInstructions)
+            << "  " << std::left << std::setw(8) << hexAddress(entry.second)
+            << std::setw(24) << symbolize(entry.second)
+            << disassemble(instructionWords[entry.second]) << std::right << std::endl;
+    }
+
+    // Opcode histogram
+    std::vector<std::pair<uint64_t, int> > opcodes;
+    for (int opcode = 0; opcode < 256; opcode++) {
+        if (opcodeCounts[opcode]) {
+            opcodes.push_back(std::make_pair(opcodeCounts[opcode], opcode));
+        }
+    }
+    std::sort(opcodes.rbegin(), opcodes.rend());
+    out << std::endl << "Opcodes:" << std::endl;
+    for (const auto& entry : opcodes) {
+        std::string mnemonic = mnemonicFor(entry.second);
+        out << "  " << std::left << std::setw(8) << (mnemonic.empty() ? "??" : mnemonic) << std::right
+            << std::setw(12) << entry.first << std::setw(8) << percentOf(entry.first, totalInstructions)
+            << std::endl;
+    }
+
+    // Conditional branches
+    if (!branches.empty()) {
+        out << std::endl << "Conditional branches:" << std::endl;
+        out << "  " << std::left << std::setw(8) << "address" << std::setw(24) << "location" << std::right
+            << std::setw(12) << "taken" << std::setw(12) << "not taken" << std::setw(8) << "taken" << std::endl;
+        for (const auto& entry : branches) {
+            const BranchCounts& counts = entry.second;
+            out << "  " << std::left << std::setw(8) << hexAddress(entry.first)
+                << std::setw(24) << symbolize(entry.first) << std::right
+                << std::setw(12) << counts.taken << std::setw(12) << counts.notTaken
+                << std::setw(8) << percentOf(counts.taken, counts.taken + counts.notTaken) << std::endl;
+        }
+    }
+
+    // Routines, by inclusive cost
+    std::vector<std::pair<uint64_t, int32_t> > routines;
+    for (const auto& entry : inclusive) {
+        routines.push_back(std::make_pair(entry.second, entry.first));
+    }
+    std::sort(routines.rbegin(), routines.rend());
+    out << std::endl << "Routines:" << std::endl;
+    out << "  " << std::left << std::setw(24) << "routine" << std::right << std::setw(10) << "calls"
+        << std::setw(14) << "inclusive" << std::setw(8) << "share"
+        << std::setw(14) << "exclusive" << std::setw(8) << "share" << std::endl;
+    for (const auto& entry : routines) {
+        int32_t routine = entry.second;
+        auto calls = callCounts.find(routine);
+        auto self = exclusive.find(routine);
+        uint64_t selfCount = self != exclusive.end() ? self->second : 0;
+        out << "  " << std::left << std::setw(24) << routineName(routine) << std::right
+            << std::setw(10) << (calls != callCounts.end() ? calls->second : 0)
+            << std::setw(14) << entry.first << std::setw(8) << percentOf(entry.first, totalInstructions)
+            << std::setw(14) << selfCount << std::setw(8) << percentOf(selfCount, totalInstructions)
+            << std::endl;
+    }
+}
+
+void Profiler::writeFoldedStacks(std::ostream& out) const {
+    for (size_t i = 0; i < callTree.size(); i++) {
+        if (!callTree[i].self) {
+            continue;
+        }
+        std::vector<std::string> names;
+        for (int node = static_cast<int>(i); node >= 0; node = callTree[node].parent) {
+            names.push_back(routineName(callTree[node].routine));
+        }
+        for (size_t j = names.size(); j > 0; j--) {
+            out << names[j - 1] << (j > 1 ? ";" : "");
+        }
+        out << " " << callTree[i].self << "\n";
+    }
+}
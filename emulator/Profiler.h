@@ -0,0 +1,75 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "VirtualMachine.h"
+
+// Guest-level instruction profiler.
+//
+// Runs the program on the reference interpreter in its own loop, so the
+// normal engines carry no profiling code at all. Collects per-PC counts,
+// an opcode histogram, branch outcomes and a call tree built from
+// call/return, then reports hot spots symbolized against the labels in an
+// assembler listing (e.g. "inner_loop+3").
+class Profiler {
+public:
+    Profiler();
+
+    // Reads label addresses from a listing written by asm; returns false if
+    // the file cannot be opened
+    bool loadSymbols(const std::string& listingFilename);
+
+    // Runs the VM from its current state until it halts, profiling it
+    void run(VirtualMachine& vm);
+
+    // Human-readable report: hot spots, opcodes, branches, routines
+    void writeReport(std::ostream& out, size_t maxRows = 20) const;
+
+    // One line per call stack ("main;sort;swap 123") for flame graph tools
+    void writeFoldedStacks(std::ostream& out) const;
+
+    // "label+offset" for an address, or the hex address if no label precedes it
+    std::string symbolize(int32_t address) const;
+
+private:
+    struct BranchCounts {
+        uint64_t taken;
+        uint64_t notTaken;
+    };
+
+    // Node of the call tree; the root is the routine execution started in
+    struct CallNode {
+        int32_t routine;      // Entry address
+        int parent;           // Index in callTree, -1 for the root
+        uint64_t self;        // Instructions executed with this node on top
+        uint64_t calls;
+        std::map<int32_t, int> children;
+    };
+
+    // Caller frame kept while a call is active
+    struct Frame {
+        int node;
+        int32_t returnAddress;
+        uint64_t entryCount;  // totalInstructions when the call was made
+    };
+
+    std::map<int32_t, std::string> symbols;
+    std::vector<uint64_t> pcCounts;        // Indexed by address
+    std::vector<int32_t> instructionWords; // Last word executed at each address
+    uint64_t opcodeCounts[256];
+    std::map<int32_t, BranchCounts> branches;
+    std::vector<CallNode> callTree;
+    std::map<int32_t, uint64_t> inclusive; // Per routine, recursion counted once
+    std::map<int32_t, uint64_t> exclusive;
+    std::map<int32_t, uint64_t> callCounts;
+    uint64_t totalInstructions;
+
+    std::string routineName(int32_t address) const;
+    std::string disassemble(int32_t word) const;
+};
+
+#endif // PROFILER_H
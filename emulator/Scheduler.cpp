@@ -0,0 +1,203 @@
+#include "Scheduler.h"
+#include <iomanip>
+
+Scheduler::Scheduler(unsigned threadCount, uint64_t quantum, VirtualMachine::Engine engine)
+    : quantum(quantum ? quantum : 1),
+      // The JIT ignores instruction budgets, so it could never be preempted
+      engine(engine == VirtualMachine::Engine::Jit ? VirtualMachine::Engine::Threaded : engine),
+      stopping(false), pool(threadCount) {
+}
+
+Scheduler::~Scheduler() {
+    stopping = true; // Queued quanta return at once, so the pool can drain
+    pool.wait();
+}
+
+Scheduler::Context& Scheduler::context(ContextId id) const {
+    std::lock_guard<std::mutex> lock(contextsMutex);
+    return *contexts.at(id);
+}
+
+Scheduler::ContextId Scheduler::spawn(const int32_t* image, size_t words, const std::string& name,
+                                      int memoryWords, int32_t entry) {
+    std::unique_ptr<Context> created(new Context(memoryWords));
+    Context& spawned = *created;
+    spawned.name = name;
+    spawned.state = State::Faulted;
+    spawned.lastWorker = -1;
+    spawned.stats = Stats();
+    spawned.vm.setVerbose(false);
+    spawned.vm.setEngine(engine);
+    bool loaded = spawned.vm.loadImage(image, words, entry);
+
+    {
+        std::lock_guard<std::mutex> lock(contextsMutex);
+        spawned.id = contexts.size();
+        contexts.push_back(std::move(created));
+    }
+
+    std::lock_guard<std::mutex> lock(spawned.mutex);
+    if (loaded) {
+        makeRunnable(spawned, false);
+    }
+    return spawned.id;
+}
+
+void Scheduler::makeRunnable(Context& context, bool fromWorker) {
+    context.state = State::Runnable;
+    context.readySince = Clock::now();
+    Context* queued = &context;
+    WorkStealingPool::Task task = [this, queued](unsigned worker) { runQuantum(*queued, worker); };
+    if (fromWorker) {
+        pool.defer(std::move(task));
+    } else {
+        pool.submit(std::move(task));
+    }
+}
+
+void Scheduler::runQuantum(Context& context, unsigned worker) {
+    std::lock_guard<std::mutex> lock(context.mutex);
+    if (stopping) {
+        return;
+    }
+    if (context.condition && !context.condition(context.vm)) {
+        context.state = State::Waiting;
+        return;
+    }
+
+    Clock::time_point start = Clock::now();
+    uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(start - context.readySince).count();
+    Stats& stats = context.stats;
+    stats.latencyNanos += latency;
+    if (latency > stats.maxLatencyNanos) {
+        stats.maxLatencyNanos = latency;
+    }
+    if (context.lastWorker >= 0 && context.lastWorker != static_cast<int>(worker)) {
+        stats.migrations++;
+    }
+    context.lastWorker = static_cast<int>(worker);
+
+    uint64_t before = context.vm.getInstructionCount();
+    bool halted = context.vm.execute(quantum);
+    stats.instructions += context.vm.getInstructionCount() - before;
+    stats.quanta++;
+    stats.runNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+    if (halted) {
+        context.state = context.vm.hasFaulted() ? State::Faulted : State::Halted;
+    } else {
+        makeRunnable(context, true);
+    }
+}
+
+void Scheduler::setWaitCondition(ContextId id, WaitCondition condition) {
+    Context& target = context(id);
+    std::lock_guard<std::mutex> lock(target.mutex);
+    target.condition = std::move(condition);
+    if (target.state == State::Waiting && (!target.condition || target.condition(target.vm))) {
+        makeRunnable(target, false);
+    }
+}
+
+bool Scheduler::wake(ContextId id) {
+    Context& target = context(id);
+    std::lock_guard<std::mutex> lock(target.mutex);
+    if (target.state != State::Halted || !target.vm.wake()) {
+        return false;
+    }
+    makeRunnable(target, false);
+    return true;
+}
+
+void Scheduler::notify(ContextId id) {
+    Context& target = context(id);
+    std::lock_guard<std::mutex> lock(target.mutex);
+    if (target.state == State::Waiting && (!target.condition || target.condition(target.vm))) {
+        makeRunnable(target, false);
+    }
+}
+
+bool Scheduler::post(ContextId id, int32_t address, int32_t value) {
+    Context& target = context(id);
+    std::lock_guard<std::mutex> lock(target.mutex);
+    if (!target.vm.writeMemory(address, value)) {
+        return false;
+    }
+    if (target.state == State::Waiting && (!target.condition || target.condition(target.vm))) {
+        makeRunnable(target, false);
+    }
+    return true;
+}
+
+void Scheduler::waitIdle() {
+    pool.wait();
+}
+
+size_t Scheduler::contextCount() const {
+    std::lock_guard<std::mutex> lock(contextsMutex);
+    return contexts.size();
+}
+
+Scheduler::State Scheduler::state(ContextId id) const {
+    Context& target = context(id);
+    std::lock_guard<std::mutex> lock(target.mutex);
+    return target.state;
+}
+
+Scheduler::Stats Scheduler::stats(ContextId id) const {
+    Context& target = context(id);
+    std::lock_guard<std::mutex> lock(target.mutex);
+    return target.stats;
+}
+
+const VirtualMachine& Scheduler::machine(ContextId id) const {
+    return context(id).vm;
+}
+
+void Scheduler::writeReport(std::ostream& out) const {
+    static const char* const stateNames[] = { "runnable", "halted", "waiting", "faulted" };
+
+    size_t count = contextCount();
+    uint64_t totalInstructions = 0, totalQuanta = 0, totalLatency = 0, maxLatency = 0;
+    uint64_t totalMigrations = 0;
+    double sum = 0, sumOfSquares = 0;
+
+    out << std::left << std::setw(6) << "id" << std::setw(24) << "name" << std::setw(10) << "state"
+        << std::right << std::setw(14) << "instructions" << std::setw(9) << "quanta"
+        << std::setw(11) << "migrations" << std::setw(11) << "run ms"
+        << std::setw(13) << "mean lat us" << std::setw(12) << "max lat us" << std::endl;
+
+    for (ContextId id = 0; id < count; id++) {
+        Context& entry = context(id);
+        std::lock_guard<std::mutex> lock(entry.mutex);
+        const Stats& s = entry.stats;
+        out << std::left << std::setw(6) << id << std::setw(24) << entry.name
+            << std::setw(10) << stateNames[static_cast<int>(entry.state)] << std::right
+            << std::setw(14) << s.instructions << std::setw(9) << s.quanta
+            << std::setw(11) << s.migrations << std::fixed << std::setprecision(2)
+            << std::setw(11) << s.runNanos / 1e6
+            << std::setw(13) << (s.quanta ? s.latencyNanos / 1e3 / s.quanta : 0.0)
+            << std::setw(12) << s.maxLatencyNanos / 1e3 << std::endl;
+
+        totalInstructions += s.instructions;
+        totalQuanta += s.quanta;
+        totalLatency += s.latencyNanos;
+        totalMigrations += s.migrations;
+        if (s.maxLatencyNanos > maxLatency) {
+            maxLatency = s.maxLatencyNanos;
+        }
+        sum += s.runNanos;
+        sumOfSquares += static_cast<double>(s.runNanos) * s.runNanos;
+    }
+
+    // Jain's index over CPU time: 1.0 when every context got the same share
+    double fairness = sumOfSquares > 0 ? sum * sum / (count * sumOfSquares) : 1.0;
+    out << "Scheduler: " << count << " contexts on " << pool.size() << " threads, quantum " << quantum
+        << ", " << totalInstructions << " instructions in " << totalQuanta << " quanta, "
+        << totalMigrations << " migrations, " << pool.stealCount() << " steals" << std::endl;
+    out << std::fixed << std::setprecision(3)
+        << "Fairness (Jain's index over run time): " << fairness
+        << ", latency mean " << (totalQuanta ? totalLatency / 1e3 / totalQuanta : 0.0)
+        << " us, max " << maxLatency / 1e3 << " us" << std::endl;
+    out.unsetf(std::ios::floatfield);
+}
@@ -0,0 +1,114 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "VirtualMachine.h"
+#include "WorkStealingPool.h"
+
+// Cooperative scheduler for many guest programs on a few host threads.
+//
+// Every context owns a VirtualMachine, so it keeps its registers, memory
+// and decoded code between quanta and switching to it allocates nothing.
+// A runnable context is a pool task that runs one quantum and then defers
+// itself behind the other work on its worker, which makes each worker
+// round-robin over its contexts; idle workers steal contexts from busy ones.
+//
+// A context parks when it executes HALT (until wake()) or when its wait
+// condition is false at the start of a quantum (until notify() or post()
+// finds it true). Contexts run as soon as they are spawned or woken;
+// waitIdle() blocks until none is runnable.
+class Scheduler {
+public:
+    typedef size_t ContextId;
+
+    // Checked with the context's VM before each quantum
+    typedef std::function<bool(const VirtualMachine&)> WaitCondition;
+
+    enum class State {
+        Runnable,  // Queued or running
+        Halted,    // Parked on HALT
+        Waiting,   // Parked on its wait condition
+        Faulted    // Stopped on an error; never runs again
+    };
+
+    struct Stats {
+        uint64_t instructions;
+        uint64_t quanta;
+        uint64_t migrations;       // Quanta run on a different worker than the last
+        uint64_t runNanos;         // Time spent executing
+        uint64_t latencyNanos;     // Total time from runnable to running
+        uint64_t maxLatencyNanos;
+    };
+
+    Scheduler(unsigned threadCount, uint64_t quantum, VirtualMachine::Engine engine);
+    ~Scheduler();
+
+    // Creates a context running 'image' from 'entry'
+    ContextId spawn(const int32_t* image, size_t words, const std::string& name,
+                    int memoryWords = 65536, int32_t entry = 0);
+
+    // Parks the context whenever 'condition' is false (null to clear)
+    void setWaitCondition(ContextId id, WaitCondition condition);
+
+    // Continues a context parked on HALT; false if it is not parked there
+    bool wake(ContextId id);
+
+    // Re-checks a waiting context's condition and queues it if now true
+    void notify(ContextId id);
+
+    // Writes a word into a context's memory, then notify()s it
+    bool post(ContextId id, int32_t address, int32_t value);
+
+    // Blocks until no context is runnable
+    void waitIdle();
+
+    size_t contextCount() const;
+    State state(ContextId id) const;
+    Stats stats(ContextId id) const;
+
+    // The context's machine; only safe to use while it is not runnable
+    const VirtualMachine& machine(ContextId id) const;
+
+    // Per-context table plus fairness and latency totals
+    void writeReport(std::ostream& out) const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Context {
+        ContextId id;
+        std::string name;
+        VirtualMachine vm;
+        mutable std::mutex mutex;  // Held while a quantum runs
+        State state;
+        WaitCondition condition;
+        Clock::time_point readySince;
+        int lastWorker;
+        Stats stats;
+
+        explicit Context(int memoryWords) : vm(memoryWords) {}
+    };
+
+    uint64_t quantum;
+    VirtualMachine::Engine engine;
+    std::atomic<bool> stopping;
+    mutable std::mutex contextsMutex;
+    std::vector<std::unique_ptr<Context> > contexts;
+    WorkStealingPool pool; // Last, so its workers stop before contexts go
+
+    Context& context(ContextId id) const;
+
+    // Marks a context runnable and hands it to the pool (mutex held)
+    void makeRunnable(Context& context, bool fromWorker);
+    void runQuantum(Context& context, unsigned worker);
+};
+
+#endif // SCHEDULER_H
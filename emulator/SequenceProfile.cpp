@@ -0,0 +1,111 @@
+#include "SequenceProfile.h"
+#include "../Common.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+namespace {
+
+const int MIN_LENGTH = 2;
+const int MAX_LENGTH = 4; // Must not exceed MAX_FUSED_LENGTH in ThreadedEngine.cpp
+
+// Instructions that can run inline inside a superinstruction
+bool isStraightLine(int32_t opcode) {
+    return opcode >= 0 && opcode < OPCODE_COUNT && !opcodeTable[opcode].isBranch && opcode != OP_HALT &&
+           !isBlockOpcode(opcode) && !isCoreOpcode(opcode);
+}
+
+std::string sequenceName(int32_t opcode) {
+    std::string mnemonic = mnemonicFor(opcode);
+    return mnemonic.empty() ? "op" + std::to_string(opcode) : mnemonic;
+}
+
+} // namespace
+
+void SequenceProfile::record(VirtualMachine& vm) {
+    vm.halted = false;
+    vm.PC = vm.entryPoint;
+    vm.decodedValid = false; // Stores below bypass the threaded engine
+
+    std::vector<int32_t> window; // Opcodes that ran back to back, oldest first
+    int32_t lastPC = -2;
+
+    while (!vm.halted) {
+        int32_t pc = vm.PC;
+        if (pc < 0 || pc >= (int)vm.memory.size()) {
+            vm.fault("PC out of bounds (" + std::to_string(pc) + ")");
+            break;
+        }
+
+        int32_t opcode = vm.memory[pc] & 0xFF;
+        if (pc != lastPC + 1 || pc >= vm.programSize) {
+            window.clear();
+        }
+        if (pc < vm.programSize && opcode < OPCODE_COUNT) {
+            window.push_back(opcode);
+            if ((int)window.size() > MAX_LENGTH) {
+                window.erase(window.begin());
+            }
+
+            // Every suffix of the window ending at this instruction
+            for (int length = MIN_LENGTH; length <= (int)window.size(); length++) {
+                std::vector<int32_t> sequence(window.end() - length, window.end());
+                counts[sequence]++;
+            }
+
+            if (!isStraightLine(opcode)) {
+                window.clear(); // Nothing can be fused across a control transfer
+            }
+        }
+
+        lastPC = pc;
+        vm.executeInstruction();
+    }
+}
+
+bool SequenceProfile::writeFusionTable(const std::string& filename, size_t maxPatterns) const {
+    // Rank by dispatches saved: each run of a length-n sequence saves n-1
+    std::vector<std::pair<uint64_t, const std::vector<int32_t>*> > ranked;
+    for (const auto& entry : counts) {
+        uint64_t saved = entry.second * (entry.first.size() - 1);
+        ranked.push_back(std::make_pair(saved, &entry.first));
+    }
+    std::sort(ranked.begin(), ranked.end(),
+              [](const std::pair<uint64_t, const std::vector<int32_t>*>& x,
+                 const std::pair<uint64_t, const std::vector<int32_t>*>& y) {
+                  return x.first != y.first ? x.first > y.first : *x.second < *y.second;
+              });
+    if (ranked.size() > maxPatterns) {
+        ranked.resize(maxPatterns);
+    }
+
+    // The engine takes the first match, so longer sequences go first
+    std::stable_sort(ranked.begin(), ranked.end(),
+                     [](const std::pair<uint64_t, const std::vector<int32_t>*>& x,
+                        const std::pair<uint64_t, const std::vector<int32_t>*>& y) {
+                         return x.second->size() > y.second->size();
+                     });
+
+    std::ofstream out(filename);
+    if (!out) {
+        std::cerr << "Error: Could not open fusion table for writing: " << filename << std::endl;
+        return false;
+    }
+
+    out << "// Superinstructions for the threaded engine.\n"
+        << "// Generated by: emu --profile-sequences=<this file> <program.obj>...\n"
+        << "// Do not edit by hand; regenerate from a profile of real workloads.\n"
+        << "// FUSEn(name, opcode...) - the last opcode may transfer control.\n";
+    for (const auto& entry : ranked) {
+        const std::vector<int32_t>& sequence = *entry.second;
+        std::string name;
+        std::string opcodes;
+        for (size_t i = 0; i < sequence.size(); i++) {
+            name += (i ? "_" : "") + sequenceName(sequence[i]);
+            opcodes += ", " + std::to_string(sequence[i]);
+        }
+        out << "FUSE" << sequence.size() << "(" << name << opcodes << ")"
+            << " // saves " << entry.first << " dispatches\n";
+    }
+    return true;
+}
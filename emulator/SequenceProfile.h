@@ -0,0 +1,29 @@
+#ifndef SEQUENCE_PROFILE_H
+#define SEQUENCE_PROFILE_H
+
+#include <string>
+#include <map>
+#include <vector>
+#include <cstdint>
+#include "VirtualMachine.h"
+
+// Offline profile of straight-line opcode sequences.
+//
+// Counts every window of 2-4 instructions that ran back to back at
+// consecutive addresses, where only the last one may transfer control.
+// The windows that would save the most dispatches become the
+// superinstructions of the threaded engine (FusionPatterns.def).
+class SequenceProfile {
+public:
+    // Runs the loaded program on the reference interpreter from PC 0,
+    // adding its sequences to the profile
+    void record(VirtualMachine& vm);
+
+    // Writes the best 'maxPatterns' sequences as a FusionPatterns.def table
+    bool writeFusionTable(const std::string& filename, size_t maxPatterns) const;
+
+private:
+    std::map<std::vector<int32_t>, uint64_t> counts;
+};
+
+#endif // SEQUENCE_PROFILE_H
@@ -0,0 +1,187 @@
+#include "Snapshot.h"
+#include "VirtualMachine.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char SNAPSHOT_MAGIC[8] = "VMSNAP"; // Zero-padded; the version field says which layout
+const uint32_t SNAPSHOT_VERSION = 2;
+
+// Writes all of 'buffer' at 'offset'
+bool writeFully(int fd, const void* buffer, size_t length, off_t offset) {
+    const char* bytes = static_cast<const char*>(buffer);
+    while (length > 0) {
+        ssize_t written = pwrite(fd, bytes, length, offset);
+        if (written <= 0) {
+            return false;
+        }
+        bytes += written;
+        length -= written;
+        offset += written;
+    }
+    return true;
+}
+
+bool readFully(int fd, void* buffer, size_t length, off_t offset) {
+    char* bytes = static_cast<char*>(buffer);
+    while (length > 0) {
+        ssize_t got = pread(fd, bytes, length, offset);
+        if (got <= 0) {
+            return false;
+        }
+        bytes += got;
+        length -= got;
+        offset += got;
+    }
+    return true;
+}
+
+// An unnamed file for in-process snapshots
+int createAnonymousFile() {
+#ifdef MFD_CLOEXEC
+    int memfd = memfd_create("vm-snapshot", MFD_CLOEXEC);
+    if (memfd >= 0) {
+        return memfd;
+    }
+#endif
+    char path[] = "/tmp/vm-snapshot-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    return fd;
+}
+
+} // namespace
+
+Snapshot::Snapshot(int fd, const SnapshotHeader& header, const std::string& error)
+    : fd(fd), header(header), error(error) {
+}
+
+Snapshot::~Snapshot() {
+    close(fd);
+}
+
+std::shared_ptr<Snapshot> Snapshot::load(const std::string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    // Nothing in the header is trusted: the memory size and text range
+    // decide what gets mapped and predecoded
+    SnapshotHeader header;
+    struct stat info;
+    std::string error;
+    if (!readFully(fd, &header, sizeof(header), 0) ||
+        std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+        header.version != SNAPSHOT_VERSION || header.dataOffset < sizeof(header) ||
+        header.memoryWords == 0 || header.memoryWords > static_cast<uint32_t>(VirtualMachine::MAX_MEMORY_WORDS) ||
+        header.programSize < 0 || static_cast<uint32_t>(header.programSize) > header.memoryWords ||
+        header.errorBytes > header.dataOffset - sizeof(header) ||
+        fstat(fd, &info) != 0 ||
+        static_cast<uint64_t>(info.st_size) < header.dataOffset + header.memoryWords * sizeof(int32_t)) {
+        close(fd);
+        return nullptr;
+    }
+    error.resize(header.errorBytes);
+    if (!error.empty() && !readFully(fd, &error[0], error.size(), sizeof(header))) {
+        close(fd);
+        return nullptr;
+    }
+    return std::shared_ptr<Snapshot>(new Snapshot(fd, header, error));
+}
+
+bool Snapshot::save(const std::string& filename) const {
+    int out = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        return false;
+    }
+
+    // Copy the whole file (header, padding and image) in large chunks
+    struct stat info;
+    bool ok = fstat(fd, &info) == 0;
+    std::unique_ptr<char[]> chunk(new char[1 << 20]);
+    for (off_t offset = 0; ok && offset < info.st_size; ) {
+        size_t length = static_cast<size_t>(std::min<off_t>(1 << 20, info.st_size - offset));
+        ok = readFully(fd, chunk.get(), length, offset) &&
+             writeFully(out, chunk.get(), length, offset);
+        offset += length;
+    }
+    return close(out) == 0 && ok;
+}
+
+std::shared_ptr<Snapshot> VirtualMachine::takeSnapshot() const {
+    int fd = createAnonymousFile();
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.memoryWords = static_cast<uint32_t>(memory.size());
+    header.dataOffset = GuestMemory::pageSize();
+    header.instructionCount = instructionCount;
+    header.A = A;
+    header.B = B;
+    header.PC = PC;
+    header.SP = SP;
+    header.programSize = programSize;
+    header.halted = halted;
+    header.faulted = faulted;
+    header.entryPoint = entryPoint;
+    header.errorBytes = static_cast<uint32_t>(std::min(errorMessage.size(), header.dataOffset - sizeof(header)));
+
+    // Pad the image to whole pages so the mapping never runs past EOF
+    if (ftruncate(fd, header.dataOffset + memory.mappedBytes()) != 0 ||
+        !writeFully(fd, &header, sizeof(header), 0) ||
+        !writeFully(fd, errorMessage.data(), header.errorBytes, sizeof(header)) ||
+        !writeFully(fd, memory.data(), memory.size() * sizeof(int32_t), header.dataOffset)) {
+        close(fd);
+        return nullptr;
+    }
+    return std::shared_ptr<Snapshot>(new Snapshot(fd, header, errorMessage.substr(0, header.errorBytes)));
+}
+
+bool VirtualMachine::restoreSnapshot(const Snapshot& snapshot) {
+    const SnapshotHeader& header = snapshot.header;
+    if (memory.size() != header.memoryWords) {
+        resizeMemory(header.memoryWords);
+    }
+
+    // Map the image copy-on-write. That needs a page-aligned offset and a
+    // file long enough to back the whole mapping; otherwise copy it in.
+    struct stat info;
+    bool mappable = header.dataOffset % GuestMemory::pageSize() == 0 &&
+                    fstat(snapshot.fd, &info) == 0 &&
+                    static_cast<uint64_t>(info.st_size) >= header.dataOffset + memory.mappedBytes();
+    if (!mappable || !memory.mapPrivate(snapshot.fd, header.dataOffset)) {
+        memory.clear();
+        if (!readFully(snapshot.fd, memory.data(), header.memoryWords * sizeof(int32_t), header.dataOffset)) {
+            return false;
+        }
+    }
+
+    A = header.A;
+    B = header.B;
+    PC = header.PC;
+    SP = header.SP;
+    programSize = header.programSize;
+    verifiedCode.clear();
+    decodedValid = false;
+    entryPoint = header.entryPoint;
+    halted = header.halted != 0;
+    faulted = header.faulted != 0;
+    errorMessage = snapshot.error;
+    instructionCount = header.instructionCount;
+    fusedInstructionCount = 0;
+    fusedPatternHits.clear();
+    return true;
+}
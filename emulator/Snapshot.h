@@ -0,0 +1,57 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// On-disk layout: this header, errorBytes of fault message, then the
+// guest memory image starting at dataOffset (a multiple of the page size,
+// so it can be mmap'd directly).
+struct SnapshotHeader {
+    char magic[8];         // "VMSNAP" and two zero bytes
+    uint32_t version;
+    uint32_t memoryWords;
+    uint64_t dataOffset;
+    uint64_t instructionCount;
+    int32_t A, B, PC, SP;
+    int32_t programSize;
+    uint32_t halted;
+    uint32_t faulted;
+    int32_t entryPoint;
+    uint32_t errorBytes;
+    uint32_t reserved;
+};
+
+// A saved machine state: registers plus a file holding guest memory.
+//
+// Snapshots taken in-process live in an anonymous memfd; loaded ones use
+// the file on disk. Either way VirtualMachine::restoreSnapshot() maps the
+// memory image copy-on-write, so restoring is O(1) and a restored guest
+// only pays for the pages it dirties. Many VMs can share one snapshot.
+class Snapshot {
+public:
+    ~Snapshot();
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    // Opens a snapshot file written by save(); nullptr if it is invalid
+    static std::shared_ptr<Snapshot> load(const std::string& filename);
+
+    // Writes the snapshot to disk so a later emu run can start from it
+    bool save(const std::string& filename) const;
+
+    const SnapshotHeader& getHeader() const { return header; }
+
+private:
+    Snapshot(int fd, const SnapshotHeader& header, const std::string& error);
+
+    int fd;
+    SnapshotHeader header;
+    std::string error; // Why the machine faulted, if it did
+
+    friend class VirtualMachine;
+};
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,679 @@
+#include "VirtualMachine.h"
+#include "AccessVerifier.h"
+#include <atomic>
+#include <iostream>
+
+// Direct-threaded execution engine.
+//
+// The loaded image memory[0, programSize) is decoded once into
+// {handler, operand} records. Every handler ends by jumping straight to the
+// handler of the next record, so there is no central switch and no PC bounds
+// check on sequential flow. Only control transfers (branches, call, return)
+// can leave the decoded range, so they are the only handlers that check it.
+// Code outside the decoded range runs on the reference interpreter.
+//
+// Frequent straight-line sequences are additionally fused into
+// superinstructions (see FusionPatterns.def). A fused record runs every
+// instruction of its sequence but the last inline, then jumps directly to
+// the last instruction's handler. Records inside a sequence keep their own
+// handlers, so branching into the middle of one still works.
+//
+// In Bounds memory-check mode, ldnl/stnl and every ldl/stl the
+// AccessVerifier did not prove safe decode to checked handler variants, so
+// proven stack accesses run exactly as they do unchecked. Fusion is off in
+// that mode because fused sequences inline unchecked accesses.
+//
+// In Guard mode every data access first notes the registers and the
+// instruction count in VirtualMachine::lastAccess, so that a guard fault
+// leaves the machine exactly as Bounds mode would.
+//
+// Block instructions run through VirtualMachine::executeBlock(); a block
+// store into the text range re-decodes the words it covered. The core
+// instructions likewise run through executeCoreOp().
+//
+// Computed goto ("labels as values") is a GCC/Clang extension. Other
+// compilers fall back to the switch engine.
+
+#if defined(__GNUC__)
+#define VM_HAVE_COMPUTED_GOTO 1
+#endif
+
+namespace {
+
+const int MAX_FUSED_LENGTH = 4;
+
+struct FusedPattern {
+    const char* name;
+    int length;
+    int32_t opcodes[MAX_FUSED_LENGTH];
+};
+
+enum FusedPatternIndex {
+#define FUSE2(name, o1, o2) FUSED_##name,
+#define FUSE3(name, o1, o2, o3) FUSED_##name,
+#define FUSE4(name, o1, o2, o3, o4) FUSED_##name,
+#include "FusionPatterns.def"
+#undef FUSE2
+#undef FUSE3
+#undef FUSE4
+    FUSED_PATTERN_COUNT
+};
+
+const FusedPattern fusedPatterns[] = {
+#define FUSE2(name, o1, o2) { #name, 2, { o1, o2 } },
+#define FUSE3(name, o1, o2, o3) { #name, 3, { o1, o2, o3 } },
+#define FUSE4(name, o1, o2, o3, o4) { #name, 4, { o1, o2, o3, o4 } },
+#include "FusionPatterns.def"
+#undef FUSE2
+#undef FUSE3
+#undef FUSE4
+    { nullptr, 0, { 0 } } // Keeps the table non-empty
+};
+
+// Index of the first (longest) pattern matching the words at 'start', or -1
+int matchFusedPattern(const int32_t* memory, int32_t start, int32_t programSize) {
+    for (int p = 0; p < FUSED_PATTERN_COUNT; p++) {
+        const FusedPattern& pattern = fusedPatterns[p];
+        if (start + pattern.length > programSize) {
+            continue;
+        }
+        int i = 0;
+        while (i < pattern.length && (memory[start + i] & 0xFF) == pattern.opcodes[i]) {
+            i++;
+        }
+        if (i == pattern.length) {
+            return p;
+        }
+    }
+    return -1;
+}
+
+} // namespace
+
+void VirtualMachine::runThreaded(uint64_t budget) {
+#ifndef VM_HAVE_COMPUTED_GOTO
+    runSwitch(budget);
+#else
+    // Indexed by opcode: one handler per instruction in Isa.def
+    static const void* const handlers[] = {
+#define INSTRUCTION(NAME, mnemonic, opcode, operand, isBranch) &&op_##NAME,
+#define PSEUDO(NAME, mnemonic, id, operand)
+#include "../Isa.def"
+#undef INSTRUCTION
+#undef PSEUDO
+    };
+    const uint32_t handlerCount = sizeof(handlers) / sizeof(handlers[0]);
+
+    // Bounds-checked ldl, stl, ldnl and stnl
+    static const void* const checkedHandlers[] = {
+        &&op_ldl_checked, &&op_stl_checked, &&op_ldnl_checked, &&op_stnl_checked
+    };
+    const bool checked = memoryCheck == MemoryCheck::Bounds;
+    const bool guarded = memoryCheck == MemoryCheck::Guard;
+
+    // Indexed by FusedPatternIndex
+    static const void* const fusedHandlers[] = {
+#define FUSE2(name, o1, o2) &&fused_##name,
+#define FUSE3(name, o1, o2, o3) &&fused_##name,
+#define FUSE4(name, o1, o2, o3, o4) &&fused_##name,
+#include "FusionPatterns.def"
+#undef FUSE2
+#undef FUSE3
+#undef FUSE4
+        nullptr
+    };
+
+    const void* const invalidHandler = &&op_invalid;
+    const void* const unverifiedHandler = &&op_unverified;
+    const void* const staleHandler = &&op_stale;
+
+    // (Re)decodes memory[index] into its record
+    auto decode = [&](int32_t index) {
+        uint32_t opcode = static_cast<uint32_t>(memory[index]) & 0xFF;
+        DecodedInstruction& record = decoded[index];
+        record.handler = opcode < handlerCount ? handlers[opcode] : invalidHandler;
+        record.operand = memory[index] >> 8;
+        record.opcode = static_cast<int32_t>(opcode);
+        if (checked) {
+            uint8_t status = verifiedCode.empty() ? static_cast<uint8_t>(AccessVerifier::Reached)
+                                                  : verifiedCode[index];
+            if (!status) {
+                record.handler = unverifiedHandler;
+            } else if (opcode >= OP_LDL && opcode <= OP_STNL && !(status & AccessVerifier::Proven)) {
+                record.handler = checkedHandlers[opcode - OP_LDL];
+            }
+        } else if (fusionEnabled) {
+            int pattern = matchFusedPattern(memory.data(), index, programSize);
+            if (pattern >= 0) {
+                record.handler = fusedHandlers[pattern];
+            }
+        }
+    };
+
+    // Forgets the verifier's proofs and decodes everything checked again
+    auto dropProofs = [&]() {
+        verifiedCode.clear();
+        for (int32_t i = 0; i < programSize; i++) {
+            decode(i);
+        }
+    };
+
+    // Re-decodes after a store to 'address' in the text range. Like a block
+    // store, the stored record only gets its operand now and is decoded by
+    // op_stale if it ever runs. Fused handlers before it read that operand,
+    // so they only need matching again, also lazily, if the opcode changed.
+    auto redecode = [&](int32_t address) {
+        if (!verifiedCode.empty() && verifiedCode[address]) {
+            dropProofs(); // Rewrote code the verifier analysed
+            return;
+        }
+        DecodedInstruction& record = decoded[address];
+        int32_t opcode = memory[address] & 0xFF;
+        if (opcode != record.opcode) {
+            for (int32_t i = address - (MAX_FUSED_LENGTH - 1); i < address; i++) {
+                if (i >= 0) {
+                    decoded[i].handler = staleHandler;
+                }
+            }
+        }
+        record.handler = staleHandler;
+        record.operand = memory[address] >> 8;
+        record.opcode = opcode;
+    };
+
+    // Re-decodes after a block store to [first, first + count), which must
+    // overlap the text range. Blocks are often data, so the stored records
+    // only get their operands now (fused handlers read those) and are
+    // decoded by op_stale if they ever run.
+    auto redecodeRange = [&](int32_t first, int32_t count) {
+        int32_t end = first + count < programSize ? first + count : programSize;
+        for (int32_t i = first; i < end && !verifiedCode.empty(); i++) {
+            if (verifiedCode[i]) {
+                dropProofs();
+                return;
+            }
+        }
+        for (int32_t i = first - (MAX_FUSED_LENGTH - 1); i < first; i++) {
+            if (i >= 0) {
+                decode(i);
+            }
+        }
+        for (int32_t i = first; i < end; i++) {
+            decoded[i].handler = staleHandler;
+            decoded[i].operand = memory[i] >> 8;
+            decoded[i].opcode = memory[i] & 0xFF;
+        }
+    };
+
+// True if a guest address falls inside the decoded text range
+#define IN_TEXT(address) \
+    (static_cast<uint32_t>(address) < static_cast<uint32_t>(programSize))
+
+#define IN_MEMORY(address) \
+    (static_cast<uint32_t>(address) < static_cast<uint32_t>(memory.size()))
+
+#define PC_OF(record) static_cast<int32_t>((record) - code)
+
+// Guard mode: notes the machine before the access made by 'at'. The fence
+// keeps the compiler from moving the stores past the access.
+#define NOTE_ACCESS(at)                                          \
+    do {                                                         \
+        if (guarded) {                                           \
+            lastAccess.record = (at);                            \
+            lastAccess.a = a;                                    \
+            lastAccess.b = b;                                    \
+            lastAccess.sp = sp;                                  \
+            lastAccess.executed = executed;                      \
+            std::atomic_signal_fence(std::memory_order_seq_cst); \
+        }                                                        \
+    } while (0)
+
+#define NEXT()                \
+    do {                      \
+        ++executed;           \
+        ++ip;                 \
+        goto *ip->handler;    \
+    } while (0)
+
+// Control transfers are also where the instruction budget is checked;
+// straight-line code between them is bounded by the size of the image.
+#define JUMP(destination)            \
+    do {                             \
+        ++executed;                  \
+        target = (destination);      \
+        if (executed >= budget) {    \
+            goto out_of_budget;      \
+        }                            \
+        if (IN_TEXT(target)) {       \
+            ip = code + target;      \
+            goto *ip->handler;       \
+        }                            \
+        goto leave_text;             \
+    } while (0)
+
+    // Predecode the image unless the last call left it up to date, so that
+    // resuming for another slice costs nothing. The extra sentinel record
+    // catches execution running off the end of the text range.
+    if (!decodedValid || decoded.size() != static_cast<size_t>(programSize) + 1) {
+        decoded.resize(programSize + 1);
+        for (int32_t i = 0; i < programSize; i++) {
+            decode(i);
+        }
+        decoded[programSize].handler = &&op_end;
+        decoded[programSize].operand = 0;
+        decoded[programSize].opcode = -1;
+        decodedValid = true;
+    }
+
+    int32_t* mem = memory.data();
+    const DecodedInstruction* code = decoded.data();
+    const DecodedInstruction* ip = code;
+
+    uint64_t executed = 0;
+    uint64_t interpreted = 0; // Counted by executeInstruction() itself
+    uint64_t fusedExecuted = 0;
+    uint64_t fusedHits[FUSED_PATTERN_COUNT + 1] = {}; // No heap: guard faults skip this frame
+    int32_t badAddress = 0;
+    int32_t blockOpcode = 0;
+    int32_t coreOpcode = 0;
+
+    // Registers live in locals while threaded code runs
+    int32_t a = A, b = B, sp = SP;
+    int32_t target = PC;
+
+    if (!IN_TEXT(target)) {
+        goto leave_text;
+    }
+    ip = code + target;
+    goto *ip->handler;
+
+op_LDC:
+    b = a;
+    a = ip->operand;
+    NEXT();
+
+op_ADC:
+    a = a + ip->operand;
+    NEXT();
+
+op_LDL:
+    NOTE_ACCESS(ip);
+    b = a;
+    a = mem[sp + ip->operand];
+    NEXT();
+
+op_STL: {
+    int32_t address = sp + ip->operand;
+    NOTE_ACCESS(ip);
+    mem[address] = a;
+    a = b;
+    if (IN_TEXT(address)) {
+        redecode(address); // Guest wrote into its own code
+    }
+    NEXT();
+}
+
+op_LDNL:
+    NOTE_ACCESS(ip);
+    a = mem[a + ip->operand];
+    NEXT();
+
+op_STNL: {
+    int32_t address = a + ip->operand;
+    NOTE_ACCESS(ip);
+    mem[address] = b;
+    if (IN_TEXT(address)) {
+        redecode(address);
+    }
+    NEXT();
+}
+
+op_ADD:
+    a = b + a;
+    NEXT();
+
+op_SUB:
+    a = b - a;
+    NEXT();
+
+op_SHL:
+    a = b << a;
+    NEXT();
+
+op_SHR:
+    a = b >> a;
+    NEXT();
+
+op_ADJ:
+    sp = sp + ip->operand;
+    NEXT();
+
+op_A2SP:
+    sp = a;
+    a = b;
+    NEXT();
+
+op_SP2A:
+    b = a;
+    a = sp;
+    NEXT();
+
+op_CALL:
+    b = a;
+    a = PC_OF(ip) + 1;
+    JUMP(PC_OF(ip) + 1 + ip->operand);
+
+op_RETURN: {
+    int32_t returnAddress = a;
+    a = b;
+    if (checked && !verifiedCode.empty() && IN_TEXT(returnAddress) &&
+        !(verifiedCode[returnAddress] & AccessVerifier::ReturnSite)) {
+        dropProofs(); // Not a return the verifier followed
+    }
+    JUMP(returnAddress);
+}
+
+op_BRZ:
+    if (a == 0) {
+        JUMP(PC_OF(ip) + 1 + ip->operand);
+    }
+    NEXT();
+
+op_BRLZ:
+    if (a < 0) {
+        JUMP(PC_OF(ip) + 1 + ip->operand);
+    }
+    NEXT();
+
+op_BR:
+    JUMP(PC_OF(ip) + 1 + ip->operand);
+
+op_HALT:
+    ++executed;
+    A = a; B = b; SP = sp;
+    PC = PC_OF(ip) + 1;
+    halted = true;
+    goto finish;
+
+op_BCOPY:
+    blockOpcode = OP_BCOPY;
+    goto block_instruction;
+
+op_BFILL:
+    blockOpcode = OP_BFILL;
+    goto block_instruction;
+
+op_BCMP:
+    blockOpcode = OP_BCMP;
+    goto block_instruction;
+
+op_BSUM:
+    blockOpcode = OP_BSUM;
+    goto block_instruction;
+
+op_BSORT:
+    blockOpcode = OP_BSORT;
+    goto block_instruction;
+
+block_instruction: {
+    int32_t first = 0, count = 0;
+    bool stores = blockStores(blockOpcode, a, b, first, count);
+    if (!executeBlock(blockOpcode, ip->operand, a, b, sp, PC_OF(ip))) {
+        ++executed;
+        A = a; B = b; SP = sp;
+        goto finish;
+    }
+    if (stores && IN_TEXT(first)) {
+        redecodeRange(first, count);
+    }
+    NEXT();
+}
+
+op_SPAWN:
+    coreOpcode = OP_SPAWN;
+    goto core_instruction;
+
+op_JOIN:
+    coreOpcode = OP_JOIN;
+    goto core_instruction;
+
+op_CAS:
+    coreOpcode = OP_CAS;
+    goto core_instruction;
+
+op_FENCE:
+    coreOpcode = OP_FENCE;
+    goto core_instruction;
+
+core_instruction: {
+    int32_t address = a;
+    if (!executeCoreOp(coreOpcode, ip->operand, a, b, sp, PC_OF(ip))) {
+        ++executed;
+        A = a; B = b; SP = sp;
+        goto finish;
+    }
+    if (coreOpcode == OP_CAS && IN_TEXT(address)) {
+        redecode(address);
+    }
+    NEXT();
+}
+
+op_invalid:
+    // Let the reference interpreter report the bad opcode
+    A = a; B = b; SP = sp;
+    PC = PC_OF(ip);
+    executeInstruction();
+    goto finish;
+
+op_end:
+    target = programSize;
+    goto leave_text;
+
+op_ldl_checked:
+    badAddress = sp + ip->operand;
+    if (!IN_MEMORY(badAddress)) {
+        goto out_of_bounds;
+    }
+    b = a;
+    a = mem[badAddress];
+    NEXT();
+
+op_stl_checked: {
+    int32_t address = sp + ip->operand;
+    if (!IN_MEMORY(address)) {
+        badAddress = address;
+        goto out_of_bounds;
+    }
+    mem[address] = a;
+    a = b;
+    if (IN_TEXT(address)) {
+        redecode(address);
+    }
+    NEXT();
+}
+
+op_ldnl_checked:
+    badAddress = a + ip->operand;
+    if (!IN_MEMORY(badAddress)) {
+        goto out_of_bounds;
+    }
+    a = mem[badAddress];
+    NEXT();
+
+op_stnl_checked: {
+    int32_t address = a + ip->operand;
+    if (!IN_MEMORY(address)) {
+        badAddress = address;
+        goto out_of_bounds;
+    }
+    mem[address] = b;
+    if (IN_TEXT(address)) {
+        redecode(address);
+    }
+    NEXT();
+}
+
+op_stale:
+    // Stored to since it was last decoded
+    decode(PC_OF(ip));
+    goto *ip->handler;
+
+op_unverified:
+    // Code the verifier never reached: its proofs no longer hold
+    dropProofs();
+    goto *ip->handler;
+
+out_of_bounds:
+    ++executed;
+    A = a; B = b; SP = sp;
+    accessAllowed(badAddress, PC_OF(ip), false); // Reports the fault
+    goto finish;
+
+out_of_budget:
+    A = a; B = b; SP = sp;
+    PC = target;
+    goto finish;
+
+// One straight-line instruction at offset k of a fused sequence. A store
+// into a later instruction of the same sequence abandons the fused path so
+// that the rewritten instruction is the one that runs.
+#define FUSED_STEP(opcode, k, length)                                        \
+    do {                                                                     \
+        const int32_t operand_ = ip[k].operand;                              \
+        int32_t address_ = -1;                                               \
+        if ((opcode) >= OP_LDL && (opcode) <= OP_STNL) {                     \
+            NOTE_ACCESS(ip + (k));                                           \
+        }                                                                    \
+        ++executed;                                                          \
+        ++fusedExecuted;                                                     \
+        switch (opcode) {                                                    \
+            case OP_LDC: b = a; a = operand_; break;                         \
+            case OP_ADC: a = a + operand_; break;                            \
+            case OP_LDL: b = a; a = mem[sp + operand_]; break;               \
+            case OP_STL: address_ = sp + operand_; mem[address_] = a; a = b; break; \
+            case OP_LDNL: a = mem[a + operand_]; break;                      \
+            case OP_STNL: address_ = a + operand_; mem[address_] = b; break; \
+            case OP_ADD: a = b + a; break;                                   \
+            case OP_SUB: a = b - a; break;                                   \
+            case OP_SHL: a = b << a; break;                                  \
+            case OP_SHR: a = b >> a; break;                                  \
+            case OP_ADJ: sp = sp + operand_; break;                          \
+            case OP_A2SP: sp = a; a = b; break;                              \
+            case OP_SP2A: b = a; a = sp; break;                              \
+        }                                                                    \
+        if (address_ != -1 && IN_TEXT(address_)) {                           \
+            redecode(address_);                                              \
+            if (address_ > PC_OF(ip) + (k) &&                                \
+                address_ < PC_OF(ip) + (length)) {                           \
+                ip += (k) + 1;                                               \
+                goto *ip->handler;                                           \
+            }                                                                \
+        }                                                                    \
+    } while (0)
+
+// The last instruction of a fused sequence runs through its own handler
+#define FUSED_LAST(opcode, k)      \
+    do {                           \
+        ++fusedExecuted;           \
+        ip += (k);                 \
+        goto *handlers[opcode];    \
+    } while (0)
+
+#define FUSE2(name, o1, o2)                 \
+fused_##name:                               \
+    fusedHits[FUSED_##name]++;              \
+    FUSED_STEP(o1, 0, 2);                   \
+    FUSED_LAST(o2, 1);
+#define FUSE3(name, o1, o2, o3)             \
+fused_##name:                               \
+    fusedHits[FUSED_##name]++;              \
+    FUSED_STEP(o1, 0, 3);                   \
+    FUSED_STEP(o2, 1, 3);                   \
+    FUSED_LAST(o3, 2);
+#define FUSE4(name, o1, o2, o3, o4)         \
+fused_##name:                               \
+    fusedHits[FUSED_##name]++;              \
+    FUSED_STEP(o1, 0, 4);                   \
+    FUSED_STEP(o2, 1, 4);                   \
+    FUSED_STEP(o3, 2, 4);                   \
+    FUSED_LAST(o4, 3);
+#include "FusionPatterns.def"
+#undef FUSE2
+#undef FUSE3
+#undef FUSE4
+#undef FUSED_LAST
+#undef FUSED_STEP
+
+leave_text:
+    // Outside the decoded image: step the reference interpreter until
+    // control comes back into the text range or the machine halts. That
+    // also invalidates any verifier proofs.
+    A = a; B = b; SP = sp;
+    PC = target;
+    lastAccess.record = nullptr;
+    lastAccess.executed = executed;
+    if (!verifiedCode.empty()) {
+        dropProofs();
+    }
+    while (!halted && !IN_TEXT(PC)) {
+        if (executed + interpreted >= budget) {
+            goto finish;
+        }
+        if (PC < 0 || PC >= (int)memory.size()) {
+            fault("PC out of bounds (" + std::to_string(PC) + ")");
+            break;
+        }
+
+        // Stores from here may still land in the text range
+        int32_t word = memory[PC];
+        int32_t opcode = word & 0xFF;
+        int32_t address = -1;
+        if (opcode == OP_STL) {
+            address = SP + (word >> 8);
+        } else if (opcode == OP_STNL) {
+            address = A + (word >> 8);
+        } else if (opcode == OP_CAS) {
+            address = A;
+        }
+        int32_t first = 0, count = 0;
+        bool stores = blockStores(opcode, A, B, first, count);
+
+        executeInstruction();
+        interpreted++;
+
+        if (address != -1 && IN_TEXT(address)) {
+            redecode(address);
+        }
+        if (stores && !faulted && IN_TEXT(first)) {
+            redecodeRange(first, count);
+        }
+    }
+    if (halted) {
+        goto finish;
+    }
+    a = A; b = B; sp = SP;
+    ip = code + PC;
+    goto *ip->handler;
+
+finish:
+    instructionCount += executed;
+    fusedInstructionCount += fusedExecuted;
+    if (fusionEnabled) {
+        if (fusedPatternHits.empty()) {
+            for (int p = 0; p < FUSED_PATTERN_COUNT; p++) {
+                fusedPatternHits.push_back(std::make_pair(fusedPatterns[p].name, 0));
+            }
+        }
+        for (int p = 0; p < FUSED_PATTERN_COUNT; p++) {
+            fusedPatternHits[p].second += fusedHits[p];
+        }
+    }
+
+#undef JUMP
+#undef NEXT
+#undef NOTE_ACCESS
+#undef PC_OF
+#undef IN_TEXT
+#undef IN_MEMORY
+#endif
+}
@@ -0,0 +1,576 @@
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <zlib.h>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const char TRACE_MAGIC[8] = "VMTRACE";
+const uint32_t TRACE_VERSION = 1;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Longest encodings of one record: gap and delta, or gap and two deltas
+const size_t MAX_TRANSFER_BYTES = 5 + 5;
+const size_t MAX_WRITE_BYTES = 5 + 5 + 5;
+
+uint8_t* putVarint(uint8_t* out, uint32_t value) {
+    while (value >= 0x80) {
+        *out++ = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = static_cast<uint8_t>(value);
+    return out;
+}
+
+bool getVarint(const uint8_t*& next, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; next < end && shift < 64; shift += 7) {
+        uint8_t byte = *next++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Small deltas of either sign become small unsigned numbers
+uint32_t zigzag(int32_t value) {
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+int32_t unzigzag(uint64_t encoded) {
+    uint32_t value = static_cast<uint32_t>(encoded);
+    return static_cast<int32_t>((value >> 1) ^ (0u - (value & 1)));
+}
+
+// Wrapping arithmetic for value deltas
+int32_t wrappingSub(int32_t a, int32_t b) {
+    return static_cast<int32_t>(static_cast<uint32_t>(a) - static_cast<uint32_t>(b));
+}
+
+int32_t wrappingAdd(int32_t a, int32_t b) {
+    return static_cast<int32_t>(static_cast<uint32_t>(a) + static_cast<uint32_t>(b));
+}
+
+bool compressTo(const void* data, size_t length, std::vector<uint8_t>& compressed) {
+    // zlib accepts null input only when it is empty
+    static const uint8_t empty = 0;
+    data = length ? data : &empty;
+    uLongf size = compressBound(length);
+    compressed.resize(size);
+    if (compress2(compressed.data(), &size, static_cast<const Bytef*>(data), length, Z_BEST_SPEED) != Z_OK) {
+        return false;
+    }
+    compressed.resize(size);
+    return true;
+}
+
+bool uncompressTo(const std::vector<uint8_t>& compressed, void* data, size_t length) {
+    uLongf size = length;
+    return uncompress(static_cast<Bytef*>(data), &size, compressed.data(), compressed.size()) == Z_OK &&
+           size == length;
+}
+
+bool readAt(std::FILE* in, long offset, void* buffer, size_t length) {
+    return std::fseek(in, offset, SEEK_SET) == 0 && std::fread(buffer, 1, length, in) == length;
+}
+
+} // namespace
+
+TraceRecorder::TraceRecorder(uint32_t checkpointInterval, size_t ringSlots)
+    : checkpointInterval(std::max<uint32_t>(checkpointInterval, 1)), ring(std::max<size_t>(ringSlots, 2)),
+      produced(0), consumed(0), finished(false), writeFailed(false), out(nullptr) {
+    std::memset(&stats, 0, sizeof(stats));
+    // Sized once for a worst-case block, so recording never reallocates
+    for (Block& block : ring) {
+        block.flow.resize(this->checkpointInterval * MAX_TRANSFER_BYTES);
+        block.writes.resize(this->checkpointInterval * MAX_WRITE_BYTES);
+    }
+}
+
+TraceRecorder::~TraceRecorder() {
+    if (out) {
+        std::fclose(out);
+    }
+}
+
+TraceRecorder::Block& TraceRecorder::beginBlock(const VirtualMachine& vm) {
+    Clock::time_point start = Clock::now();
+    std::unique_lock<std::mutex> guard(lock);
+    while (produced - consumed >= ring.size()) {
+        changed.wait(guard);
+    }
+    guard.unlock();
+    stats.stallSeconds += secondsSince(start);
+
+    Block& block = ring[produced % ring.size()];
+    std::memset(&block.header, 0, sizeof(block.header));
+    block.header.firstInstruction = vm.instructionCount;
+    block.header.A = vm.A;
+    block.header.B = vm.B;
+    block.header.PC = vm.PC;
+    block.header.SP = vm.SP;
+    block.flowEnd = block.flow.data();
+    block.writesEnd = block.writes.data();
+    return block;
+}
+
+void TraceRecorder::publishBlock() {
+    std::lock_guard<std::mutex> guard(lock);
+    produced++;
+    changed.notify_all();
+}
+
+void TraceRecorder::writerLoop() {
+    std::vector<uint8_t> flow, writes;
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        while (consumed == produced && !finished) {
+            changed.wait(guard);
+        }
+        if (consumed == produced) {
+            return;
+        }
+        // The producer never touches a published slot until it is consumed
+        Block& block = ring[consumed % ring.size()];
+        guard.unlock();
+
+        Clock::time_point start = Clock::now();
+        TraceBlockHeader& header = block.header;
+        size_t flowLength = block.flowEnd - block.flow.data();
+        size_t writesLength = block.writesEnd - block.writes.data();
+        bool ok = !writeFailed &&
+                  compressTo(block.flow.data(), flowLength, flow) &&
+                  compressTo(block.writes.data(), writesLength, writes);
+        if (ok) {
+            header.flowRawBytes = static_cast<uint32_t>(flowLength);
+            header.flowBytes = static_cast<uint32_t>(flow.size());
+            header.writeRawBytes = static_cast<uint32_t>(writesLength);
+            header.writeBytes = static_cast<uint32_t>(writes.size());
+            ok = std::fwrite(&header, sizeof(header), 1, out) == 1 &&
+                 std::fwrite(flow.data(), 1, flow.size(), out) == flow.size() &&
+                 std::fwrite(writes.data(), 1, writes.size(), out) == writes.size();
+        }
+
+        guard.lock();
+        if (ok) {
+            stats.blocks++;
+            stats.transfers += header.transfers;
+            stats.writes += header.writes;
+            stats.rawBytes += sizeof(header) + flowLength + writesLength;
+            stats.fileBytes += sizeof(header) + flow.size() + writes.size();
+        }
+        writeFailed = writeFailed || !ok;
+        stats.writerSeconds += secondsSince(start);
+        consumed++;
+        changed.notify_all();
+    }
+}
+
+bool TraceRecorder::record(VirtualMachine& vm, const std::string& filename) {
+    Clock::time_point start = Clock::now();
+    std::memset(&stats, 0, sizeof(stats));
+    produced = consumed = 0;
+    finished = false;
+    writeFailed = false;
+    vm.decodedValid = false; // Stores below bypass the threaded engine
+
+    out = std::fopen(filename.c_str(), "wb");
+    if (!out) {
+        return false;
+    }
+
+    // Initial state: registers in the first block, memory here
+    int32_t size = static_cast<int32_t>(vm.memory.size());
+    TraceFileHeader fileHeader;
+    std::memset(&fileHeader, 0, sizeof(fileHeader));
+    std::memcpy(fileHeader.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    fileHeader.version = TRACE_VERSION;
+    fileHeader.memoryWords = static_cast<uint32_t>(size);
+    fileHeader.programSize = vm.programSize;
+    fileHeader.checkpointInterval = checkpointInterval;
+    fileHeader.startInstruction = vm.instructionCount;
+    std::vector<uint8_t> image;
+    if (!compressTo(vm.memory.data(), size * sizeof(int32_t), image)) {
+        return false;
+    }
+    fileHeader.imageBytes = static_cast<uint32_t>(image.size());
+    if (std::fwrite(&fileHeader, sizeof(fileHeader), 1, out) != 1 ||
+        std::fwrite(image.data(), 1, image.size(), out) != image.size()) {
+        return false;
+    }
+    stats.rawBytes = sizeof(fileHeader) + size * sizeof(int32_t);
+    stats.fileBytes = sizeof(fileHeader) + image.size();
+
+    std::thread writer(&TraceRecorder::writerLoop, this);
+
+    // Stepping runs outside execute() and its GuardTrap, so a load that
+    // would hit a guard page is checked as in Bounds mode instead
+    VirtualMachine::MemoryCheck memoryCheck = vm.memoryCheck;
+    if (memoryCheck == VirtualMachine::MemoryCheck::Guard) {
+        vm.memoryCheck = VirtualMachine::MemoryCheck::Bounds;
+    }
+
+    Block* block = &beginBlock(vm);
+    uint64_t blockEnd = vm.instructionCount + checkpointInterval;
+    uint64_t lastTransfer = vm.instructionCount;
+    uint64_t lastWrite = vm.instructionCount;
+    int32_t lastAddress = 0;
+    std::vector<int32_t> oldBlock; // Words a block instruction may overwrite
+
+    auto recordWrite = [&](int32_t address, int32_t oldValue) {
+        uint8_t* end = putVarint(block->writesEnd, static_cast<uint32_t>(vm.instructionCount - lastWrite));
+        end = putVarint(end, zigzag(address - lastAddress));
+        block->writesEnd = putVarint(end, zigzag(wrappingSub(vm.memory[address], oldValue)));
+        lastWrite = vm.instructionCount;
+        lastAddress = address;
+        block->header.writes++;
+    };
+
+    while (!vm.halted) {
+        int32_t pc = vm.PC;
+        if (pc < 0 || pc >= size) {
+            vm.fault("PC out of bounds (" + std::to_string(pc) + ")");
+            break;
+        }
+        if (vm.instructionCount == blockEnd) {
+            block->header.instructions = checkpointInterval;
+            publishBlock();
+            block = &beginBlock(vm);
+            blockEnd = vm.instructionCount + checkpointInterval;
+            lastTransfer = lastWrite = vm.instructionCount;
+            lastAddress = 0;
+        }
+
+        // Stores need the old value for the delta; a store out of range
+        // faults here so that it never reaches host memory
+        int32_t word = vm.memory[pc];
+        int32_t opcode = word & 0xFF;
+        int32_t address = -1;
+        int32_t oldValue = 0;
+        if (opcode == OP_STL || opcode == OP_STNL) {
+            address = (opcode == OP_STL ? vm.SP : vm.A) + (word >> 8);
+            if (address < 0 || address >= size) {
+                vm.fault("Memory access out of bounds (address " + std::to_string(address) +
+                         ") at PC " + std::to_string(pc));
+                break;
+            }
+            oldValue = vm.memory[address];
+        } else if (opcode == OP_CAS && vm.A >= 0 && vm.A < size) {
+            address = vm.A; // Recorded even if the swap fails, like any store of the same value
+            oldValue = vm.memory[address];
+        }
+
+        // A block store is recorded as one write per word it changed, all
+        // at the same instruction; the buffer was sized for one per
+        // instruction, so it grows to fit. executeBlock() faults on a range
+        // outside memory.
+        int32_t first = 0, count = 0;
+        bool blockStore = VirtualMachine::blockStores(opcode, vm.A, vm.B, first, count) &&
+                          first >= 0 && static_cast<int64_t>(first) + count <= size;
+        if (blockStore) {
+            oldBlock.assign(vm.memory.data() + first, vm.memory.data() + first + count);
+            size_t used = block->writesEnd - block->writes.data();
+            size_t needed = used + (checkpointInterval + static_cast<size_t>(count)) * MAX_WRITE_BYTES;
+            if (block->writes.size() < needed) {
+                block->writes.resize(needed);
+                block->writesEnd = block->writes.data() + used;
+            }
+        }
+
+        vm.executeInstruction();
+
+        if (address >= 0 && !vm.faulted) {
+            recordWrite(address, oldValue);
+        }
+        for (int32_t i = 0; blockStore && !vm.faulted && i < count; i++) {
+            if (vm.memory[first + i] != oldBlock[i]) {
+                recordWrite(first + i, oldBlock[i]);
+            }
+        }
+        if (vm.PC != pc + 1) {
+            uint8_t* end = putVarint(block->flowEnd, static_cast<uint32_t>(vm.instructionCount - lastTransfer));
+            block->flowEnd = putVarint(end, zigzag(vm.PC - (pc + 1)));
+            lastTransfer = vm.instructionCount;
+            block->header.transfers++;
+        }
+    }
+    block->header.instructions = static_cast<uint32_t>(vm.instructionCount - block->header.firstInstruction);
+    block->header.last = 1;
+    publishBlock();
+    vm.memoryCheck = memoryCheck;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        finished = true;
+        changed.notify_all();
+    }
+    writer.join();
+
+    stats.instructions = vm.instructionCount - fileHeader.startInstruction;
+    bool ok = !writeFailed && std::fclose(out) == 0;
+    out = nullptr;
+    stats.recordSeconds = secondsSince(start);
+    return ok;
+}
+
+void TraceRecorder::writeReport(std::ostream& out) const {
+    double perInstruction = stats.instructions ? 8.0 * stats.fileBytes / stats.instructions : 0.0;
+    double ratio = stats.fileBytes ? static_cast<double>(stats.rawBytes) / stats.fileBytes : 0.0;
+    double nanos = stats.instructions ? 1e9 * stats.recordSeconds / stats.instructions : 0.0;
+    out << "--- Trace ---" << std::endl
+        << "Instructions:   " << stats.instructions << " in " << stats.blocks << " blocks (checkpoint every "
+        << checkpointInterval << ")" << std::endl
+        << "Events:         " << stats.transfers << " control transfers, " << stats.writes << " stores" << std::endl
+        << std::fixed << std::setprecision(2)
+        << "Trace size:     " << stats.fileBytes << " bytes (" << perInstruction << " bits/instruction, "
+        << ratio << "x compression)" << std::endl
+        << "Recording:      " << 1e3 * stats.recordSeconds << " ms (" << nanos << " ns/instruction), writer "
+        << 1e3 * stats.writerSeconds << " ms, VM stalled " << 1e3 * stats.stallSeconds << " ms" << std::endl;
+    out.unsetf(std::ios::floatfield);
+}
+
+bool TraceReader::open(const std::string& traceFilename) {
+    filename = traceFilename;
+    image.clear();
+    blocks.clear();
+    error.clear();
+
+    std::FILE* in = std::fopen(filename.c_str(), "rb");
+    if (!in) {
+        error = "Could not open trace " + filename;
+        return false;
+    }
+    std::vector<uint8_t> compressed;
+    bool ok = readAt(in, 0, &header, sizeof(header)) &&
+              std::memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0 &&
+              header.version == TRACE_VERSION && header.memoryWords > 0;
+    if (ok) {
+        compressed.resize(header.imageBytes);
+        image.resize(header.memoryWords);
+        ok = std::fread(compressed.data(), 1, compressed.size(), in) == compressed.size() &&
+             uncompressTo(compressed, image.data(), image.size() * sizeof(int32_t));
+    }
+
+    // Index the blocks by skipping over their streams
+    long offset = static_cast<long>(sizeof(header) + header.imageBytes);
+    while (ok) {
+        BlockEntry entry;
+        if (!readAt(in, offset, &entry.header, sizeof(entry.header))) {
+            break;
+        }
+        entry.offset = offset + static_cast<long>(sizeof(entry.header));
+        offset = entry.offset + entry.header.flowBytes + entry.header.writeBytes;
+        blocks.push_back(entry);
+        if (entry.header.last) {
+            break;
+        }
+    }
+    std::fclose(in);
+    if (!ok || blocks.empty()) {
+        error = "Invalid trace file " + filename;
+        return false;
+    }
+    return true;
+}
+
+uint64_t TraceReader::lastInstruction() const {
+    const TraceBlockHeader& last = blocks.back().header;
+    return last.firstInstruction + last.instructions;
+}
+
+size_t TraceReader::blockFor(uint64_t index) const {
+    // The block whose checkpoint is the latest at or before 'index'
+    size_t low = 0, high = blocks.size();
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        if (blocks[middle].header.firstInstruction <= index) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+bool TraceReader::readStream(std::FILE* in, const BlockEntry& block, bool writes, std::vector<uint8_t>& raw) {
+    const TraceBlockHeader& info = block.header;
+    std::vector<uint8_t> compressed(writes ? info.writeBytes : info.flowBytes);
+    raw.resize(writes ? info.writeRawBytes : info.flowRawBytes);
+    long offset = block.offset + (writes ? info.flowBytes : 0);
+    return readAt(in, offset, compressed.data(), compressed.size()) &&
+           uncompressTo(compressed, raw.data(), raw.size());
+}
+
+bool TraceReader::seek(VirtualMachine& vm, uint64_t index) {
+    error.clear();
+    if (index < firstInstruction() || index > lastInstruction()) {
+        error = "Instruction " + std::to_string(index) + " is outside the trace (" +
+                std::to_string(firstInstruction()) + "-" + std::to_string(lastInstruction()) + ")";
+        return false;
+    }
+    std::FILE* in = std::fopen(filename.c_str(), "rb");
+    if (!in) {
+        error = "Could not open trace " + filename;
+        return false;
+    }
+
+    if (vm.memory.size() != image.size()) {
+        vm.resizeMemory(image.size());
+    }
+    std::memcpy(vm.memory.data(), image.data(), image.size() * sizeof(int32_t));
+
+    // Memory at the checkpoint: the image plus every earlier store
+    size_t target = blockFor(index);
+    std::vector<uint8_t> raw;
+    for (size_t i = 0; i < target; i++) {
+        if (!readStream(in, blocks[i], true, raw)) {
+            error = "Corrupt write stream in block " + std::to_string(i);
+            break;
+        }
+        const uint8_t* next = raw.data();
+        const uint8_t* end = next + raw.size();
+        int32_t address = 0;
+        uint64_t gap, addressDelta, valueDelta;
+        for (uint32_t w = 0; w < blocks[i].header.writes; w++) {
+            if (!getVarint(next, end, gap) || !getVarint(next, end, addressDelta) ||
+                !getVarint(next, end, valueDelta)) {
+                error = "Corrupt write stream in block " + std::to_string(i);
+                break;
+            }
+            address += unzigzag(addressDelta);
+            if (address < 0 || address >= static_cast<int32_t>(image.size())) {
+                error = "Corrupt write stream in block " + std::to_string(i);
+                break;
+            }
+            vm.memory[address] = wrappingAdd(vm.memory[address], unzigzag(valueDelta));
+        }
+        if (!error.empty()) {
+            break;
+        }
+    }
+
+    const BlockEntry& block = blocks[target];
+    if (error.empty() && !readStream(in, block, false, raw)) {
+        error = "Corrupt flow stream in block " + std::to_string(target);
+    }
+    std::fclose(in);
+    if (!error.empty()) {
+        return false;
+    }
+
+    vm.A = block.header.A;
+    vm.B = block.header.B;
+    vm.PC = block.header.PC;
+    vm.SP = block.header.SP;
+    vm.programSize = header.programSize;
+    vm.instructionCount = block.header.firstInstruction;
+    vm.halted = false;
+    vm.faulted = false;
+    vm.errorMessage.clear();
+    vm.verifiedCode.clear();
+    vm.decodedValid = false;
+
+    // Re-execute the rest of the way, following the recorded transfers
+    const uint8_t* next = raw.data();
+    const uint8_t* end = next + raw.size();
+    uint64_t gap = 0;
+    uint64_t targetDelta = 0;
+    uint64_t nextTransfer = UINT64_MAX;
+    if (getVarint(next, end, gap) && getVarint(next, end, targetDelta)) {
+        nextTransfer = vm.instructionCount + gap;
+    }
+    // Loads are checked as in Bounds mode, so that a load the recording
+    // faulted on faults here too instead of reading past guest memory
+    VirtualMachine::MemoryCheck memoryCheck = vm.memoryCheck;
+    vm.memoryCheck = VirtualMachine::MemoryCheck::Bounds;
+    int32_t size = static_cast<int32_t>(vm.memory.size());
+    while (vm.instructionCount < index && !vm.halted) {
+        int32_t pc = vm.PC;
+        if (pc < 0 || pc >= size) {
+            vm.fault("PC out of bounds (" + std::to_string(pc) + ")");
+            break;
+        }
+        int32_t word = vm.memory[pc];
+        int32_t opcode = word & 0xFF;
+        if (opcode == OP_STL || opcode == OP_STNL) { // Same rule as the recorder
+            int32_t address = (opcode == OP_STL ? vm.SP : vm.A) + (word >> 8);
+            if (address < 0 || address >= size) {
+                vm.fault("Memory access out of bounds (address " + std::to_string(address) +
+                         ") at PC " + std::to_string(pc));
+                break;
+            }
+        }
+
+        vm.executeInstruction();
+        if (vm.faulted) {
+            break; // Recording stopped here too
+        }
+
+        bool jumped = vm.PC != pc + 1;
+        bool expected = vm.instructionCount == nextTransfer;
+        if (jumped != expected || (jumped && vm.PC - (pc + 1) != unzigzag(targetDelta))) {
+            error = "Replay left the recorded path at instruction " + std::to_string(vm.instructionCount) +
+                    " (PC " + std::to_string(pc) + ")";
+            vm.memoryCheck = memoryCheck;
+            return false;
+        }
+        if (jumped) {
+            nextTransfer = getVarint(next, end, gap) && getVarint(next, end, targetDelta)
+                               ? vm.instructionCount + gap : UINT64_MAX;
+        }
+    }
+    vm.memoryCheck = memoryCheck;
+    return true;
+}
+
+std::vector<TraceReader::Transfer> TraceReader::transfersBefore(uint64_t index, size_t count) {
+    std::vector<Transfer> result;
+    std::FILE* in = std::fopen(filename.c_str(), "rb");
+    if (!in || count == 0) {
+        if (in) {
+            std::fclose(in);
+        }
+        return result;
+    }
+
+    // Walk back block by block until enough transfers are collected
+    std::vector<uint8_t> raw;
+    std::vector<Transfer> blockTransfers;
+    for (size_t i = blockFor(index) + 1; i-- > 0 && result.size() < count; ) {
+        const TraceBlockHeader& info = blocks[i].header;
+        if (!readStream(in, blocks[i], false, raw)) {
+            break;
+        }
+        blockTransfers.clear();
+        const uint8_t* next = raw.data();
+        const uint8_t* end = next + raw.size();
+        uint64_t instruction = info.firstInstruction;
+        int32_t position = info.PC; // Start of the current straight-line run
+        uint64_t gap, targetDelta;
+        for (uint32_t t = 0; t < info.transfers && getVarint(next, end, gap) && getVarint(next, end, targetDelta); t++) {
+            instruction += gap;
+            if (instruction > index) {
+                break;
+            }
+            Transfer transfer;
+            transfer.instruction = instruction;
+            transfer.from = position + static_cast<int32_t>(gap) - 1;
+            transfer.to = transfer.from + 1 + unzigzag(targetDelta);
+            blockTransfers.push_back(transfer);
+            position = transfer.to;
+        }
+        size_t take = std::min(count - result.size(), blockTransfers.size());
+        result.insert(result.begin(), blockTransfers.end() - take, blockTransfers.end());
+    }
+    std::fclose(in);
+    return result;
+}
@@ -0,0 +1,156 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "VirtualMachine.h"
+
+// On-disk layout: this header, the zlib-compressed initial memory image,
+// then a sequence of blocks (TraceBlockHeader, compressed flow stream,
+// compressed write stream) in execution order.
+struct TraceFileHeader {
+    char magic[8];             // "VMTRACE"
+    uint32_t version;
+    uint32_t memoryWords;
+    int32_t programSize;
+    uint32_t checkpointInterval;
+    uint64_t startInstruction; // Instruction count when recording began
+    uint32_t imageBytes;       // Compressed size of the memory image
+    uint32_t reserved;
+};
+
+// One block covers at most checkpointInterval instructions and starts with
+// the registers at that point. Its two streams are delta-encoded varints:
+//   flow:   per control transfer (taken branch, call, return, jump) the
+//           instructions since the previous transfer and target - (pc + 1)
+//   writes: per store the instructions since the previous store, the
+//           address delta and the new value minus the old one
+// Not-taken branches and straight-line code leave no record; the path
+// between two transfers is implied.
+struct TraceBlockHeader {
+    uint64_t firstInstruction; // Instruction count at the checkpoint
+    uint32_t instructions;     // Instructions executed in this block
+    uint32_t last;             // Nonzero for the final block
+    int32_t A, B, PC, SP;      // Registers at the checkpoint
+    uint32_t transfers;
+    uint32_t writes;
+    uint32_t flowBytes, flowRawBytes;
+    uint32_t writeBytes, writeRawBytes;
+};
+
+struct TraceStats {
+    uint64_t instructions;
+    uint64_t transfers;
+    uint64_t writes;
+    uint64_t blocks;
+    uint64_t rawBytes;     // Encoded streams before compression
+    uint64_t fileBytes;
+    double recordSeconds;  // Wall time of record()
+    double writerSeconds;  // Compressing and writing, on the writer thread
+    double stallSeconds;   // Time the VM waited for a free ring slot
+};
+
+// Records an execution trace with low overhead.
+//
+// Like the Profiler it runs the reference interpreter in its own loop, so
+// the engines carry no tracing code. Encoded blocks go into a small ring
+// of reusable buffers; a background thread compresses and writes them,
+// and the VM only waits when the whole ring is still queued.
+class TraceRecorder {
+public:
+    explicit TraceRecorder(uint32_t checkpointInterval = 65536, size_t ringSlots = 4);
+    ~TraceRecorder();
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    // Runs the VM from its current state until it halts, writing the trace
+    // to 'filename'. Returns false if the file could not be written.
+    bool record(VirtualMachine& vm, const std::string& filename);
+
+    const TraceStats& getStats() const { return stats; }
+
+    // Trace size, compression and recording cost
+    void writeReport(std::ostream& out) const;
+
+private:
+    // Stream buffers are preallocated; the End pointers mark what is used
+    struct Block {
+        TraceBlockHeader header;
+        std::vector<uint8_t> flow;
+        std::vector<uint8_t> writes;
+        uint8_t* flowEnd;
+        uint8_t* writesEnd;
+    };
+
+    uint32_t checkpointInterval;
+    std::vector<Block> ring;
+    uint64_t produced;  // Blocks handed to the writer
+    uint64_t consumed;  // Blocks the writer has finished with
+    bool finished;
+    bool writeFailed;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::FILE* out;
+    TraceStats stats;
+
+    // Waits for a free slot and starts a block at the VM's current state
+    Block& beginBlock(const VirtualMachine& vm);
+    void publishBlock();
+    void writerLoop();
+};
+
+// Reconstructs machine state from a trace.
+//
+// seek() starts from the initial image, applies the write streams of every
+// block before the target (no instructions are executed for those), loads
+// the block's register checkpoint and re-executes at most one block,
+// checking each control transfer against the recorded one.
+class TraceReader {
+public:
+    struct Transfer {
+        uint64_t instruction; // Instruction count after the transfer
+        int32_t from;
+        int32_t to;
+    };
+
+    // Reads the header, image and block index; returns false on a bad file
+    bool open(const std::string& filename);
+
+    uint64_t firstInstruction() const { return header.startInstruction; }
+    uint64_t lastInstruction() const;
+    size_t blockCount() const { return blocks.size(); }
+
+    // Puts 'vm' in the state it had after 'index' instructions. Returns
+    // false, with getError() set, if 'index' lies outside the trace or the
+    // replay does not follow the recorded path.
+    bool seek(VirtualMachine& vm, uint64_t index);
+
+    // Up to 'count' control transfers made at or before 'index', oldest first
+    std::vector<Transfer> transfersBefore(uint64_t index, size_t count);
+
+    const std::string& getError() const { return error; }
+
+private:
+    struct BlockEntry {
+        TraceBlockHeader header;
+        long offset; // File offset of the compressed flow stream
+    };
+
+    std::string filename;
+    TraceFileHeader header;
+    std::vector<int32_t> image;
+    std::vector<BlockEntry> blocks;
+    std::string error;
+
+    bool readStream(std::FILE* in, const BlockEntry& block, bool writes, std::vector<uint8_t>& raw);
+    size_t blockFor(uint64_t index) const;
+};
+
+#endif // TRACE_H
@@ -1,54 +1,360 @@
 #include "VirtualMachine.h"
+#include "AccessVerifier.h"
+#include "BulkMemory.h"
+#include "Executable.h"
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <algorithm>
 
-VirtualMachine::VirtualMachine(int memorySize) {
-    memory.resize(memorySize, 0); // Initialize memory to all zeros
+VirtualMachine::VirtualMachine(int memorySize) : memory(memorySize) { // Zero-filled by mmap
     A = B = PC = SP = 0;
     halted = false;
+    faulted = false;
+    engine = Engine::Switch;
+    fusionEnabled = true;
+    verbose = false;
+    memoryCheck = MemoryCheck::None;
+    lastAccess = AccessCheckpoint();
+    decodedValid = false;
+    programSize = 0;
+    entryPoint = 0;
+    cores = nullptr;
+    coreId = 0;
+    instructionCount = 0;
+    fusedInstructionCount = 0;
 }
 
 bool VirtualMachine::loadProgram(const std::string& objectFilename) {
-    // Open the binary object file
-    std::ifstream objFile(objectFilename, std::ios::binary);
-    if (!objFile) {
-        std::cerr << "Error: Could not open object file " << objectFilename << std::endl;
+    Executable program;
+    if (!program.open(objectFilename)) {
+        if (verbose) {
+            std::cerr << "Error: " << program.getError() << std::endl;
+        }
         return false;
     }
+    return loadProgram(program);
+}
 
-    // Read the file word by word into memory
-    int32_t instruction;
-    int address = 0;
-    while (objFile.read(reinterpret_cast<char*>(&instruction), sizeof(instruction))) {
-        if (address >= (int)memory.size()) {
+bool VirtualMachine::loadProgram(const Executable& program) {
+    // Grow memory (by doubling) before reading, so that nothing already
+    // loaded has to be copied
+    size_t words = program.imageWords();
+    if (words > static_cast<size_t>(MAX_MEMORY_WORDS)) {
+        if (verbose) {
+            std::cerr << "Error: Program is larger than " << MAX_MEMORY_WORDS << " words" << std::endl;
+        }
+        return false;
+    }
+    if (words > memory.size()) {
+        if (verbose) {
             std::cerr << "Error: Program is too large for memory. Resizing..." << std::endl;
-            memory.resize(memory.size() * 2);
         }
-        memory[address] = instruction;
-        address++;
+        size_t newSize = std::max<size_t>(memory.size(), 1);
+        while (newSize < words) {
+            newSize *= 2;
+        }
+        newSize = std::min<size_t>(newSize, MAX_MEMORY_WORDS);
+        resizeMemory(newSize);
+    }
+
+    // The stored words go straight into memory with one read
+    if (!program.readWords(memory.data())) {
+        if (verbose) {
+            std::cerr << "Error: Could not read the program's words" << std::endl;
+        }
+        return false;
     }
+    memory.zeroWords(program.storedWords(), words - program.storedWords());
 
-    objFile.close();
-    std::cout << "Loaded " << address << " words into memory." << std::endl;
+    programSize = static_cast<int32_t>(words);
+    entryPoint = PC = program.getEntry();
+    verifiedCode.clear();
+    decodedValid = false;
+    if (verbose) {
+        std::cout << "Loaded " << words << " words into memory." << std::endl;
+    }
     return true;
 }
 
+bool VirtualMachine::loadImage(const int32_t* words, size_t count, int32_t entry) {
+    if (count > memory.size()) {
+        if (verbose) {
+            std::cerr << "Error: Program is too large for memory." << std::endl;
+        }
+        return false;
+    }
+    std::copy(words, words + count, memory.data());
+    programSize = static_cast<int32_t>(count);
+    entryPoint = PC = entry;
+    verifiedCode.clear();
+    decodedValid = false;
+    return true;
+}
+
+void VirtualMachine::reset() {
+    memory.zeroTouched();
+    A = B = PC = SP = 0;
+    halted = false;
+    faulted = false;
+    errorMessage.clear();
+    programSize = 0;
+    entryPoint = 0;
+    verifiedCode.clear();
+    decodedValid = false;
+    instructionCount = 0;
+    fusedInstructionCount = 0;
+    fusedPatternHits.clear();
+}
+
+void VirtualMachine::setRegisters(int32_t a, int32_t b, int32_t pc, int32_t sp) {
+    A = a;
+    B = b;
+    PC = pc;
+    SP = sp;
+    verifiedCode.clear(); // Proofs assumed the registers at verification
+}
+
 void VirtualMachine::run() {
     halted = false;
-    PC = 0; // Execution starts at address 0
+    faulted = false;
+    errorMessage.clear();
+    PC = entryPoint;
+    if (!verifiedCode.empty()) {
+        verifiedCode.clear(); // Proofs assumed the registers at verification
+        decodedValid = false;
+    }
+    instructionCount = 0;
+    fusedInstructionCount = 0;
+    fusedPatternHits.clear();
+
+    resume();
+}
+
+void VirtualMachine::resume() {
+    execute(UINT64_MAX);
+    if (!verbose) {
+        return;
+    }
+
+    std::cout << "--- Program Halted ---" << std::endl;
+    dumpState();
+}
+
+bool VirtualMachine::execute(uint64_t budget) {
+    if (halted || budget == 0) {
+        return halted;
+    }
+
+    if (memoryCheck != MemoryCheck::Guard) {
+        runEngine(budget);
+        return halted;
+    }
+
+    // A guest access that hits a guard page jumps back here
+    GuardTrap trap(memory);
+    lastAccess = AccessCheckpoint();
+    if (sigsetjmp(trap.jump, 1) == 0) {
+        runEngine(budget);
+    } else {
+        // Threaded code notes the machine before each access, so restore
+        // that and count the faulting instruction. The interpreter has
+        // counted it already and advanced PC past it.
+        int32_t pc = PC - 1;
+        instructionCount += lastAccess.executed;
+        if (lastAccess.record) {
+            pc = static_cast<int32_t>(lastAccess.record - decoded.data());
+            A = lastAccess.a;
+            B = lastAccess.b;
+            SP = lastAccess.sp;
+            instructionCount++;
+        }
+        PC = pc;
+        fault("Memory access out of bounds (address " + std::to_string(trap.faultIndex()) +
+              ") at PC " + std::to_string(pc));
+    }
+    return halted;
+}
+
+void VirtualMachine::runEngine(uint64_t budget) {
+    if (memoryCheck != MemoryCheck::Bounds) {
+        verifiedCode.clear(); // Only Bounds mode keeps proofs up to date
+    }
+    bool threaded = engine == Engine::Threaded || (engine == Engine::Jit && memoryCheck != MemoryCheck::None);
+    if (!threaded) {
+        decodedValid = false; // Other engines do not keep the decoded image in step
+    }
+
+    // JIT code indexes its own tables with guest addresses, so checked
+    // modes run it on the threaded engine
+    if (threaded) {
+        runThreaded(budget);
+    } else if (engine == Engine::Jit) {
+        runJit();
+    } else {
+        runSwitch(budget);
+    }
+}
+
+bool VirtualMachine::setMemoryCheck(MemoryCheck mode) {
+    if (!memory.setGuarded(mode == MemoryCheck::Guard)) {
+        memoryCheck = MemoryCheck::Bounds;
+        decodedValid = false;
+        return false;
+    }
+    memoryCheck = mode;
+    decodedValid = false;
+    return true;
+}
+
+void VirtualMachine::resizeMemory(size_t words) {
+    memory.resize(words);
+    if (memoryCheck == MemoryCheck::Guard && !memory.isGuarded()) {
+        memoryCheck = MemoryCheck::Bounds;
+    }
+    decodedValid = false;
+}
+
+bool VirtualMachine::accessAllowed(int32_t address, int32_t pc, bool stackRelative) {
+    if (stackRelative && static_cast<uint32_t>(pc) < verifiedCode.size() &&
+        (verifiedCode[pc] & AccessVerifier::Proven)) {
+        return true;
+    }
+    if (address >= 0 && address < (int)memory.size()) {
+        return true;
+    }
+    PC = pc;
+    fault("Memory access out of bounds (address " + std::to_string(address) +
+          ") at PC " + std::to_string(pc));
+    return false;
+}
+
+void VirtualMachine::noteStore(int32_t address) {
+    if (static_cast<uint32_t>(address) < verifiedCode.size() && verifiedCode[address]) {
+        verifiedCode.clear(); // The guest rewrote code the verifier analysed
+    }
+}
+
+bool VirtualMachine::executeBlock(int32_t opcode, int32_t operand, int32_t& a, int32_t b, int32_t sp, int32_t pc) {
+    int64_t size = static_cast<int64_t>(memory.size());
+    int64_t count = a;
+    auto outOfBounds = [&](int64_t first, int64_t length) {
+        PC = pc;
+        std::string where = length == 1 ? "address " + std::to_string(first)
+                                        : "addresses " + std::to_string(first) + " to " +
+                                              std::to_string(first + length - 1);
+        fault("Block access out of bounds (" + where + ") at PC " + std::to_string(pc));
+        return false;
+    };
+    if (count < 0) {
+        PC = pc;
+        fault("Negative block length " + std::to_string(count) + " at PC " + std::to_string(pc));
+        return false;
+    }
+
+    // bcopy, bfill and bcmp take their third argument from the stack
+    int32_t other = 0;
+    if (opcode == OP_BCOPY || opcode == OP_BFILL || opcode == OP_BCMP) {
+        int64_t slot = static_cast<int64_t>(sp) + operand;
+        if (slot < 0 || slot >= size) {
+            return outOfBounds(slot, 1);
+        }
+        other = memory[slot];
+    }
+    if (count > 0 && (b < 0 || b + count > size)) {
+        return outOfBounds(b, count);
+    }
+    if (count > 0 && (opcode == OP_BCOPY || opcode == OP_BCMP) && (other < 0 || other + count > size)) {
+        return outOfBounds(other, count);
+    }
+
+    int32_t* words = memory.data();
+    switch (opcode) {
+        case OP_BCOPY:
+            bulk::copy(words + b, words + other, count);
+            break;
+        case OP_BFILL:
+            bulk::fill(words + b, other, count);
+            break;
+        case OP_BCMP:
+            a = bulk::compare(words + b, words + other, count);
+            break;
+        case OP_BSUM:
+            a = bulk::sum(words + b, count);
+            break;
+        case OP_BSORT:
+            bulk::sort(words + b, count);
+            break;
+    }
+    return true;
+}
+
+bool VirtualMachine::blockStores(int32_t opcode, int32_t a, int32_t b, int32_t& first, int32_t& count) {
+    if ((opcode != OP_BCOPY && opcode != OP_BFILL && opcode != OP_BSORT) || a <= 0) {
+        return false;
+    }
+    first = b;
+    count = a;
+    return true;
+}
+
+void VirtualMachine::setVerbose(bool enabled) {
+    verbose = enabled;
+}
+
+void VirtualMachine::fault(const std::string& message) {
+    if (verbose) {
+        std::cerr << "Error: " << message << std::endl;
+    }
+    errorMessage = message;
+    faulted = true;
+    halted = true;
+}
+
+void VirtualMachine::setEngine(Engine newEngine) {
+    engine = newEngine;
+}
+
+void VirtualMachine::setFusion(bool enabled) {
+    fusionEnabled = enabled;
+    decodedValid = false;
+}
+
+bool VirtualMachine::wake() {
+    if (faulted) {
+        return false;
+    }
+    halted = false;
+    return true;
+}
 
-    while (!halted) {
+void VirtualMachine::dumpStats() {
+    std::cout << "Instructions executed: " << instructionCount << std::endl;
+    std::cout << "Guest memory: " << memory.residentBytes() / 1024 << " KB resident of "
+              << memory.mappedBytes() / 1024 << " KB reserved" << std::endl;
+    if (fusedPatternHits.empty()) {
+        return;
+    }
+
+    double percent = instructionCount ? 100.0 * fusedInstructionCount / instructionCount : 0.0;
+    std::cout << "Instructions run fused: " << fusedInstructionCount
+              << " (" << percent << "%)" << std::endl;
+    for (const auto& hit : fusedPatternHits) {
+        if (hit.second) {
+            std::cout << "  " << hit.first << ": " << hit.second << std::endl;
+        }
+    }
+}
+
+void VirtualMachine::runSwitch(uint64_t budget) {
+    uint64_t stop = UINT64_MAX - instructionCount > budget ? instructionCount + budget : UINT64_MAX;
+    while (!halted && instructionCount < stop) {
         if (PC < 0 || PC >= (int)memory.size()) {
-            std::cerr << "Error: PC out of bounds (" << PC << ")" << std::endl;
-            halted = true;
+            fault("PC out of bounds (" + std::to_string(PC) + ")");
             break;
         }
         executeInstruction();
     }
-    
-    std::cout << "--- Program Halted ---" << std::endl;
-    dumpState();
 }
 
 void VirtualMachine::dumpState() {
@@ -66,6 +372,7 @@ void VirtualMachine::dumpState() {
 void VirtualMachine::executeInstruction() {
     // 1. Fetch
     int32_t instructionWord = memory[PC];
+    instructionCount++;
 
     // 2. Increment PC (happens *before* execution)
     int32_t old_PC = PC;
@@ -77,106 +384,195 @@ void VirtualMachine::executeInstruction() {
     // Operand is the upper 24 bits (sign-extended)
     int32_t operand = instructionWord >> 8; 
 
+    // Verifier proofs only hold for code reached the way it was analysed
+    bool checked = memoryCheck == MemoryCheck::Bounds;
+    if (checked && !verifiedCode.empty() &&
+        (static_cast<uint32_t>(old_PC) >= verifiedCode.size() || !verifiedCode[old_PC])) {
+        verifiedCode.clear();
+    }
+
     // 4. Execute
     switch (opcode) {
-        case 0:  // ldc
+        case OP_LDC:
             B = A;
             A = operand;
             break;
             
-        case 1:  // adc
+        case OP_ADC:
             A = A + operand;
             break;
 
-        case 2:  // ldl
+        case OP_LDL: {
+            if (checked && !accessAllowed(SP + operand, old_PC, true)) {
+                break;
+            }
+            int32_t value = memory[SP + operand]; // Load first: a guard fault keeps B
             B = A;
-            A = memory[SP + operand];
+            A = value;
             break;
+        }
             
-        case 3:  // stl
+        case OP_STL:
+            if (checked) {
+                if (!accessAllowed(SP + operand, old_PC, true)) {
+                    break;
+                }
+                noteStore(SP + operand);
+            }
             memory[SP + operand] = A;
             A = B;
             break;
         
-        case 4: // ldnl
+        case OP_LDNL:
+            if (checked && !accessAllowed(A + operand, old_PC, false)) {
+                break;
+            }
             A = memory[A + operand];
             break;
 
-        case 5: // stnl
+        case OP_STNL:
+            if (checked) {
+                if (!accessAllowed(A + operand, old_PC, false)) {
+                    break;
+                }
+                noteStore(A + operand);
+            }
             memory[A + operand] = B;
             break;
 
-        case 6:  // add
+        case OP_ADD:
             A = B + A;
             break;
 
-        case 7: // sub
+        case OP_SUB:
             A = B - A;
             break;
         
-        case 8: // shl
+        case OP_SHL:
             A = B << A;
             break;
             
-        case 9: // shr
+        case OP_SHR:
             A = B >> A; // This is an arithmetic shift because B is signed
             break;
 
-        case 10: // adj
+        case OP_ADJ:
             SP = SP + operand;
             break;
             
-        case 11: // a2sp
+        case OP_A2SP:
             SP = A;
             A = B;
             break;
             
-        case 12: // sp2a
+        case OP_SP2A:
             B = A;
             A = SP;
             break;
             
-        case 13: // call
+        case OP_CALL:
             B = A;
             A = PC; // Store return address (PC of *next* instruction) in A
             PC = PC + operand; // Branch to new location
             break;
 
-        case 14: // return
+        case OP_RETURN:
             PC = A;
             A = B;
+            if (checked && !verifiedCode.empty() && static_cast<uint32_t>(PC) < verifiedCode.size() &&
+                !(verifiedCode[PC] & AccessVerifier::ReturnSite)) {
+                verifiedCode.clear(); // Not a return the verifier followed
+            }
             break;
         
-        case 15: // brz
+        case OP_BRZ:
             if (A == 0) {
                 PC = PC + operand;
             }
             break;
             
-        case 16: // brlz
+        case OP_BRLZ:
             if (A < 0) {
                 PC = PC + operand;
             }
             break;
 
-        case 17: // br
+        case OP_BR:
             PC = PC + operand;
             break;
 
-        case 18: // HALT
+        case OP_HALT:
             halted = true;
             break;
+
+        case OP_BCOPY:
+        case OP_BFILL:
+        case OP_BCMP:
+        case OP_BSUM:
+        case OP_BSORT: {
+            int32_t first = 0, count = 0;
+            bool stores = checked && blockStores(opcode, A, B, first, count);
+            if (executeBlock(opcode, operand, A, B, SP, old_PC) && stores) {
+                int64_t end = std::min<int64_t>(static_cast<int64_t>(first) + count, verifiedCode.size());
+                for (int64_t address = first; address < end && !verifiedCode.empty(); address++) {
+                    noteStore(static_cast<int32_t>(address));
+                }
+            }
+            break;
+        }
+
+        case OP_SPAWN:
+        case OP_JOIN:
+        case OP_CAS:
+        case OP_FENCE: {
+            int32_t address = A;
+            if (executeCoreOp(opcode, operand, A, B, SP, old_PC) && checked && opcode == OP_CAS) {
+                noteStore(address);
+            }
+            break;
+        }
             
         default:
-            std::cerr << "Error: Unknown opcode " << (int)opcode 
-                      << " at address " << old_PC << std::endl;
-            halted = true;
+            fault("Unknown opcode " + std::to_string((int)opcode) +
+                  " at address " + std::to_string(old_PC));
             break;
     }
 }
-int32_t VirtualMachine::readMemory(int32_t address) {
+int32_t VirtualMachine::readMemory(int32_t address) const {
     if (address >= 0 && address < (int)memory.size()) {
         return memory[address];
     }
     return 0; // Return 0 for an invalid address
+}
+
+bool VirtualMachine::writeMemory(int32_t address, int32_t value) {
+    if (address < 0 || address >= (int)memory.size()) {
+        return false;
+    }
+    memory[address] = value;
+    if (address < programSize) {
+        decodedValid = false;
+        verifiedCode.clear();
+    }
+    return true;
+}
+
+bool VirtualMachine::readMemory(int32_t address, int32_t* words, size_t count) const {
+    if (address < 0 || static_cast<size_t>(address) > memory.size() || count > memory.size() - address) {
+        return false;
+    }
+    std::copy(memory.data() + address, memory.data() + address + count, words);
+    return true;
+}
+
+bool VirtualMachine::writeMemory(int32_t address, const int32_t* words, size_t count) {
+    if (address < 0 || static_cast<size_t>(address) > memory.size() || count > memory.size() - address) {
+        return false;
+    }
+    std::copy(words, words + count, memory.data() + address);
+    if (count && address < programSize) {
+        decodedValid = false;
+        verifiedCode.clear();
+    }
+    return true;
 }
\ No newline at end of file
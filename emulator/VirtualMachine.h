@@ -3,21 +3,139 @@
 
 #include <string>
 #include <vector>
+#include <utility>
 #include <cstdint>
+#include <memory>
+#include "GuestMemory.h"
+#include "../Common.h"
+
+class CoreGroup;
+class Executable;
+struct NativeProgram;
+class Snapshot;
+struct VerifierReport;
 
 class VirtualMachine {
 public:
+    // Selects how run() executes instructions
+    enum class Engine {
+        Switch,   // Fetch, decode and switch on every step
+        Threaded, // Predecoded image with direct-threaded dispatch
+        Jit       // Basic blocks translated to native x86-64 code
+    };
+
+    // How guest data accesses (ldl, stl, ldnl, stnl) are protected
+    enum class MemoryCheck {
+        None,   // Unchecked; a bad access reaches host memory
+        Bounds, // Checked before every access
+        Guard   // Guard pages around guest memory; faults become guest errors
+    };
+
+    // Largest memory: every address a 24-bit operand can name
+    static constexpr int MAX_MEMORY_WORDS = 1 << 24;
+
     VirtualMachine(int memorySize = 65536); // Default 64k words (256KB)
     
-    // Loads the binary object file into memory
+    // Loads an executable file (either version, see ObjectFormat.h) into
+    // memory and sets PC to its entry point
     bool loadProgram(const std::string& objectFilename);
+    bool loadProgram(const Executable& program);
+
+    // Loads an image that is already in host memory, at address 0, and
+    // sets PC to 'entry'
+    bool loadImage(const int32_t* words, size_t count, int32_t entry = 0);
 
-    // Runs the loaded program
+    // Clears memory, registers and statistics so the instance can be
+    // reused. Only pages the last run touched are zeroed, and they stay
+    // mapped for the next one.
+    void reset();
+
+    // Sets the registers execute() starts from; loading leaves them all 0
+    void setRegisters(int32_t a, int32_t b, int32_t pc, int32_t sp);
+
+    // Runs the loaded program from its entry point
     void run();
 
+    // Continues from the current state until the machine halts, then
+    // prints the final state if verbose (run() without the reset to
+    // address 0)
+    void resume();
+
+    // Runs from the current PC for at most 'budget' more instructions,
+    // without printing anything. Returns true once the machine has halted.
+    // The threaded engine checks the budget at control transfers and may
+    // overshoot by one basic block; the JIT engine ignores it entirely.
+    bool execute(uint64_t budget);
+
+    // Continues like resume(), but in code translated ahead of time by aot
+    // from the loaded image. If the program reaches code aot did not
+    // translate, the current engine carries on from there. Returns false,
+    // running nothing, if 'program' was translated from a different image.
+    // Defined in NativeCode.cpp.
+    bool runNative(const NativeProgram& program);
+
+    // Captures registers and memory. Any number of VMs can restore from
+    // the result; each one shares its pages until it writes to them.
+    // Defined in Snapshot.cpp.
+    std::shared_ptr<Snapshot> takeSnapshot() const;
+    bool restoreSnapshot(const Snapshot& snapshot);
+
+    // Selects the memory protection mode (default None). The switch and
+    // threaded engines check accesses themselves in Bounds mode, and both
+    // checked modes run the JIT as the threaded engine. Returns false, and
+    // uses Bounds instead, if guard pages are not available on this host or
+    // the memory size is not a whole number of pages. Memory resized later
+    // to such a size also falls back to Bounds.
+    bool setMemoryCheck(MemoryCheck mode);
+
+    // Proves which SP-relative accesses of the loaded program stay in range,
+    // so that Bounds mode can skip their checks. Analyses from the current
+    // registers, so call it after loading and before resume() or execute().
+    // Defined in AccessVerifier.cpp.
+    VerifierReport verifyStackAccesses();
+
+    // Enables progress and error messages (default off). A quiet machine
+    // prints nothing unless asked to by dumpState() or dumpStats().
+    void setVerbose(bool enabled);
+
+    // Chooses the execution engine used by run()
+    void setEngine(Engine newEngine);
+
+    // Enables superinstruction fusion in the threaded engine (default on)
+    void setFusion(bool enabled);
+
+    // Prints instruction counts for the last run, including fused ones,
+    // and how much guest memory is resident
+    void dumpStats();
+
+    // Clears a clean HALT so that execute() continues after it. Returns
+    // false if the machine stopped on a fault.
+    bool wake();
+
     // Dumps the state of the machine (registers, memory)
     void dumpState();
-    int32_t readMemory(int32_t address);
+    int32_t readMemory(int32_t address) const;
+    bool writeMemory(int32_t address, int32_t value);
+
+    // Copy 'count' words between guest memory at 'address' and 'words'.
+    // Return false, copying nothing, unless the whole range is in memory.
+    bool readMemory(int32_t address, int32_t* words, size_t count) const;
+    bool writeMemory(int32_t address, const int32_t* words, size_t count);
+
+    // Register and status accessors
+    int32_t getA() const { return A; }
+    int32_t getB() const { return B; }
+    int32_t getPC() const { return PC; }
+    int32_t getSP() const { return SP; }
+    bool isHalted() const { return halted; }
+    bool hasFaulted() const { return faulted; }
+    const std::string& getError() const { return errorMessage; }
+    uint64_t getInstructionCount() const { return instructionCount; }
+
+    // Guest memory backed by physical pages, and the whole address space,
+    // in bytes. Pages are committed when the guest first touches them.
+    size_t getResidentMemory() const { return memory.residentBytes(); }
+    size_t getReservedMemory() const { return memory.mappedBytes(); }
 
 private:
     // Registers
@@ -27,12 +145,105 @@ private:
 
     // Machine state
     bool halted;
+    bool faulted;             // Halted because of an error
+    std::string errorMessage;
+    Engine engine;
+    bool fusionEnabled;
+    bool verbose;
+    MemoryCheck memoryCheck;
+
+    // Statistics for the last run
+    uint64_t instructionCount;
+    uint64_t fusedInstructionCount;
+    std::vector<std::pair<const char*, uint64_t> > fusedPatternHits;
 
     // Main memory
-    std::vector<int32_t> memory;
+    GuestMemory memory;
+
+    // Number of words loaded by loadProgram (the text range)
+    int32_t programSize;
+
+    // Where run() starts: the loaded program's entry point
+    int32_t entryPoint;
+
+    // One predecoded instruction: handler to jump to, its operand and the
+    // opcode the records around it were decoded against
+    struct DecodedInstruction {
+        const void* handler;
+        int32_t operand;
+        int32_t opcode;
+    };
+
+    // Predecoded copy of memory[0, programSize) plus one sentinel entry,
+    // kept between runThreaded() calls while decodedValid is set. Anything
+    // else that can change memory or how it decodes clears the flag.
+    std::vector<DecodedInstruction> decoded;
+    bool decodedValid;
+
+    // Guard mode: the machine just before the last data access made by
+    // threaded code, which a guard fault restores. record is null while
+    // the interpreter runs, since it keeps the registers itself; executed
+    // counts threaded instructions not yet added to instructionCount.
+    struct AccessCheckpoint {
+        const DecodedInstruction* record;
+        int32_t a, b, sp;
+        uint64_t executed;
+    };
+    AccessCheckpoint lastAccess;
+
+    // AccessVerifier statuses per address, empty when nothing is proven
+    std::vector<uint8_t> verifiedCode;
+
+    // The machine's cores if it has more than one (see CoreGroup.h), and
+    // which of them this is
+    CoreGroup* cores;
+    int32_t coreId;
 
     // The fetch-decode-execute cycle
     void executeInstruction();
+
+    // Halts the machine with an error
+    void fault(const std::string& message);
+
+    // Bounds mode: faults at 'pc' unless 'address' is in range or the
+    // verifier proved this stack access safe
+    bool accessAllowed(int32_t address, int32_t pc, bool stackRelative);
+
+    // Bounds mode: drops the verifier's proofs if a store hits code it analysed
+    void noteStore(int32_t address);
+
+    // Runs a block instruction (see Isa.def) at 'pc' on the given registers
+    // and returns false after a fault. Every engine calls this, so the
+    // ranges are checked in every memory-check mode.
+    bool executeBlock(int32_t opcode, int32_t operand, int32_t& a, int32_t b, int32_t sp, int32_t pc);
+
+    // The words 'opcode' stores to with these registers, as [first, first +
+    // count), for engines that track writes into code; false if it stores
+    // nothing
+    static bool blockStores(int32_t opcode, int32_t a, int32_t b, int32_t& first, int32_t& count);
+
+    // Runs a core instruction (see Isa.def) like executeBlock(). join
+    // blocks until the other core halts. Defined in CoreGroup.cpp.
+    bool executeCoreOp(int32_t opcode, int32_t operand, int32_t& a, int32_t b, int32_t sp, int32_t pc);
+
+    // Resizes guest memory, dropping from Guard to Bounds mode if the new
+    // size cannot be guarded (see GuestMemory::setGuarded)
+    void resizeMemory(size_t words);
+
+    // Engine loop for the current engine and memory check mode
+    void runEngine(uint64_t budget);
+
+    // Engine loops used by execute()
+    void runSwitch(uint64_t budget);
+    void runThreaded(uint64_t budget); // Defined in ThreadedEngine.cpp
+    void runJit();                     // Defined in JitCompiler.cpp
+
+    friend class CoreGroup;
+    friend class JitCompiler;
+    friend class SequenceProfile;
+    friend class Profiler;
+    friend class TraceRecorder;
+    friend class TraceReader;
 };
 
-#endif // VIRTUAL_MACHINE_H
\ No newline at end of file
+#endif // VIRTUAL_MACHINE_H
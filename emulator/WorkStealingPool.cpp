@@ -0,0 +1,124 @@
+#include "WorkStealingPool.h"
+
+namespace {
+
+// Index of the pool worker running on this thread, or -1
+thread_local int currentWorker = -1;
+
+} // namespace
+
+WorkStealingPool::WorkStealingPool(unsigned threadCount)
+    : queued(0), unfinished(0), stopping(false), nextQueue(0), steals(0) {
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+    for (unsigned i = 0; i < threadCount; i++) {
+        queues.emplace_back(new Queue);
+    }
+    for (unsigned i = 0; i < threadCount; i++) {
+        workers.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void WorkStealingPool::submit(Task task) {
+    enqueue(std::move(task), false);
+}
+
+void WorkStealingPool::defer(Task task) {
+    enqueue(std::move(task), true);
+}
+
+void WorkStealingPool::enqueue(Task task, bool atFront) {
+    unsigned index = currentWorker >= 0 ? static_cast<unsigned>(currentWorker)
+                                        : nextQueue++ % size();
+    // Count the task before publishing it, so a thief cannot take it first
+    // and drive queued below zero
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        unfinished++;
+        queued++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        if (atFront) {
+            queues[index]->tasks.push_front(std::move(task));
+        } else {
+            queues[index]->tasks.push_back(std::move(task));
+        }
+    }
+    workAvailable.notify_one();
+}
+
+void WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> lock(stateMutex);
+    allDone.wait(lock, [this] { return unfinished == 0; });
+}
+
+bool WorkStealingPool::takeTask(unsigned index, Task& task) {
+    // Own deque first, newest task first
+    {
+        Queue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // Then steal the oldest task of another worker
+    for (unsigned offset = 1; offset < size(); offset++) {
+        Queue& victim = *queues[(index + offset) % size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::workerLoop(unsigned index) {
+    currentWorker = static_cast<int>(index);
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            workAvailable.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0) {
+                return;
+            }
+        }
+
+        Task task;
+        if (!takeTask(index, task)) {
+            std::this_thread::yield(); // Taken by another worker, or not yet pushed
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            queued--;
+        }
+
+        task(index);
+
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (--unfinished == 0) {
+            allDone.notify_all();
+        }
+    }
+}
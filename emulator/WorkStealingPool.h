@@ -0,0 +1,67 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size thread pool with one task deque per worker.
+//
+// A worker takes new work from the back of its own deque and, when that is
+// empty, steals from the front of the other workers' deques. Tasks receive
+// the index of the worker running them so callers can keep per-worker state
+// (such as a reusable VirtualMachine) without locking.
+class WorkStealingPool {
+public:
+    typedef std::function<void(unsigned worker)> Task;
+
+    explicit WorkStealingPool(unsigned threadCount);
+    ~WorkStealingPool();
+
+    // Queues a task. From inside a task it goes to the calling worker's own
+    // deque; otherwise the deques are filled round-robin.
+    void submit(Task task);
+
+    // Like submit(), but queues the task behind everything already queued:
+    // its worker takes it last and thieves take it first. Tasks that requeue
+    // themselves this way share their worker round-robin.
+    void defer(Task task);
+
+    // Blocks until every submitted task has finished
+    void wait();
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+    // Number of tasks a worker took from another worker's deque
+    uint64_t stealCount() const { return steals.load(); }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue> > queues;
+    std::vector<std::thread> workers;
+
+    std::mutex stateMutex;
+    std::condition_variable workAvailable;
+    std::condition_variable allDone;
+    size_t queued;     // Tasks sitting in a deque (guarded by stateMutex)
+    size_t unfinished; // Tasks submitted but not finished (guarded by stateMutex)
+    bool stopping;
+
+    std::atomic<unsigned> nextQueue;
+    std::atomic<uint64_t> steals;
+
+    void enqueue(Task task, bool atFront);
+    void workerLoop(unsigned index);
+    bool takeTask(unsigned index, Task& task);
+};
+
+#endif // WORK_STEALING_POOL_H
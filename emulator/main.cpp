@@ -1,47 +1,445 @@
 #include <iostream>
 #include <string>
+#include <vector>
+#include <thread>
+#include <cstdlib>
+#include <fstream>
 #include "VirtualMachine.h"
+#include "Executable.h"
+#include "SequenceProfile.h"
+#include "BatchRunner.h"
+#include "Snapshot.h"
+#include "Profiler.h"
+#include "AccessVerifier.h"
+#include "Scheduler.h"
+#include "Trace.h"
+#include "CoreGroup.h"
+#include "NativeCode.h"
 
-int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <input.obj>" << std::endl;
+// A range of guest memory to print after the run (--dump)
+struct DumpRange {
+    int32_t address = 0;
+    int32_t count = 0;
+    std::string symbol; // Empty if the address was given as a number
+};
+
+// Runs each program on the reference interpreter and writes the
+// superinstruction table derived from their combined sequence profile
+static int profileSequences(const std::string& tableFile, const std::vector<std::string>& objectFiles) {
+    SequenceProfile profile;
+    for (const auto& objectFile : objectFiles) {
+        VirtualMachine vm;
+        vm.setVerbose(true);
+        if (!vm.loadProgram(objectFile)) {
+            std::cerr << "Failed to load program." << std::endl;
+            return 1;
+        }
+        profile.record(vm);
+    }
+    if (!profile.writeFusionTable(tableFile, 24)) {
         return 1;
     }
+    std::cout << "Fusion table written to " << tableFile << std::endl;
+    return 0;
+}
+
+// Runs 'copies' instances of every program as contexts of one scheduler
+// and reports how they shared the worker threads
+static int schedulePrograms(const std::vector<std::string>& objectFiles, unsigned threads,
+                            uint64_t quantum, unsigned copies, VirtualMachine::Engine engine,
+                            int memoryWords) {
+    Scheduler scheduler(threads, quantum, engine);
+    for (const auto& objectFile : objectFiles) {
+        Executable program;
+        std::vector<int32_t> image;
+        if (program.open(objectFile)) {
+            image.assign(program.imageWords(), 0);
+        }
+        if (!program.getError().empty() || !program.readWords(image.data())) {
+            std::cerr << "Error: " << (program.getError().empty() ? "Could not read " + objectFile : program.getError())
+                      << std::endl;
+            return 1;
+        }
+        for (unsigned copy = 0; copy < copies; copy++) {
+            std::string name = copies > 1 ? objectFile + "#" + std::to_string(copy) : objectFile;
+            scheduler.spawn(image.data(), image.size(), name, memoryWords, program.getEntry());
+        }
+    }
+    scheduler.waitIdle();
+    scheduler.writeReport(std::cout);
+
+    for (Scheduler::ContextId id = 0; id < scheduler.contextCount(); id++) {
+        if (scheduler.state(id) != Scheduler::State::Halted) {
+            return 2;
+        }
+    }
+    return 0;
+}
 
-    std::string objectFile = argv[1];
+// Rebuilds the machine state after 'at' instructions of a recorded trace
+// (the end of the trace if 'at' is 0) and shows how execution got there
+static int replayTrace(const std::string& traceFile, uint64_t at, size_t history, const Profiler& symbols) {
+    TraceReader reader;
+    if (!reader.open(traceFile)) {
+        std::cerr << "Error: " << reader.getError() << std::endl;
+        return 1;
+    }
+    uint64_t index = at == UINT64_MAX ? reader.lastInstruction() : at;
+    std::cout << "Trace covers instructions " << reader.firstInstruction() << "-" << reader.lastInstruction()
+              << " in " << reader.blockCount() << " blocks." << std::endl;
 
     VirtualMachine vm;
-    
-    if (!vm.loadProgram(objectFile)) {
-        std::cerr << "Failed to load program." << std::endl;
+    vm.setVerbose(false);
+    if (!reader.seek(vm, index)) {
+        std::cerr << "Error: " << reader.getError() << std::endl;
         return 1;
     }
+    std::cout << "--- State after instruction " << index << " ---" << std::endl;
+    vm.dumpState();
+    if (vm.hasFaulted()) {
+        std::cout << "Faulted: " << vm.getError() << std::endl;
+    } else if (vm.isHalted()) {
+        std::cout << "Halted." << std::endl;
+    }
+
+    std::vector<TraceReader::Transfer> transfers = reader.transfersBefore(index, history);
+    if (!transfers.empty()) {
+        std::cout << "Last " << transfers.size() << " control transfers:" << std::endl;
+        for (const auto& transfer : transfers) {
+            std::cout << "  " << transfer.instruction << ": " << symbols.symbolize(transfer.from)
+                      << " -> " << symbols.symbolize(transfer.to) << std::endl;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    VirtualMachine::Engine engine = VirtualMachine::Engine::Switch;
+    bool fusion = true;
+    VirtualMachine::MemoryCheck memoryCheck = VirtualMachine::MemoryCheck::None;
+    bool verify = false;
+    bool stats = false;
+    std::string fusionTableFile;
+    std::string manifestFile;
+    bool schedule = false;
+    uint64_t quantum = 10000;
+    unsigned copies = 1;
+    unsigned threads = std::thread::hardware_concurrency();
+    uint64_t budget = 0;
+    uint64_t timeoutMs = 0;
+    std::string saveSnapshotFile;
+    uint64_t snapshotAt = 0;
+    std::string restoreFile;
+    bool profile = false;
+    std::string profileFile;
+    std::string symbolsFile;
+    std::string foldedFile;
+    std::string recordFile;
+    std::string nativeFile;
+    uint32_t checkpointInterval = 65536;
+    int memoryWords = 65536;
+    int coreLimit = 1;
+    std::string replayFile;
+    uint64_t replayAt = UINT64_MAX; // The end of the trace unless --at is given
+    size_t history = 10;
+    std::vector<std::string> dumps;
+    std::vector<std::string> objectFiles;
+    bool badArgument = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--engine=switch") {
+            engine = VirtualMachine::Engine::Switch;
+        } else if (arg == "--engine=threaded") {
+            engine = VirtualMachine::Engine::Threaded;
+        } else if (arg == "--engine=jit") {
+            engine = VirtualMachine::Engine::Jit;
+        } else if (arg == "--memcheck=none") {
+            memoryCheck = VirtualMachine::MemoryCheck::None;
+        } else if (arg == "--memcheck=bounds") {
+            memoryCheck = VirtualMachine::MemoryCheck::Bounds;
+        } else if (arg == "--memcheck=guard") {
+            memoryCheck = VirtualMachine::MemoryCheck::Guard;
+        } else if (arg == "--verify") {
+            verify = true;
+        } else if (arg == "--no-fusion") {
+            fusion = false;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg.compare(0, 20, "--profile-sequences=") == 0) {
+            fusionTableFile = arg.substr(20);
+        } else if (arg == "--batch" && i + 1 < argc) {
+            manifestFile = argv[++i];
+        } else if (arg == "--schedule") {
+            schedule = true;
+        } else if (arg.compare(0, 10, "--quantum=") == 0) {
+            quantum = std::strtoull(arg.c_str() + 10, nullptr, 10);
+        } else if (arg.compare(0, 9, "--copies=") == 0) {
+            copies = static_cast<unsigned>(std::strtoul(arg.c_str() + 9, nullptr, 10));
+        } else if (arg == "-j" && i + 1 < argc) {
+            threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg.compare(0, 9, "--memory=") == 0) {
+            unsigned long words = std::strtoul(arg.c_str() + 9, nullptr, 0);
+            if (words == 0 || words > static_cast<unsigned long>(VirtualMachine::MAX_MEMORY_WORDS)) {
+                std::cerr << "Error: --memory must be between 1 and " << VirtualMachine::MAX_MEMORY_WORDS
+                          << " words." << std::endl;
+                return 1;
+            }
+            memoryWords = static_cast<int>(words);
+        } else if (arg.compare(0, 8, "--cores=") == 0) {
+            unsigned long limit = std::strtoul(arg.c_str() + 8, nullptr, 10);
+            if (limit == 0 || limit > 1024) {
+                std::cerr << "Error: --cores must be between 1 and 1024." << std::endl;
+                return 1;
+            }
+            coreLimit = static_cast<int>(limit);
+        } else if (arg.compare(0, 9, "--budget=") == 0) {
+            budget = std::strtoull(arg.c_str() + 9, nullptr, 10);
+        } else if (arg.compare(0, 10, "--timeout=") == 0) {
+            timeoutMs = std::strtoull(arg.c_str() + 10, nullptr, 10);
+        } else if (arg.compare(0, 16, "--save-snapshot=") == 0) {
+            saveSnapshotFile = arg.substr(16);
+        } else if (arg.compare(0, 14, "--snapshot-at=") == 0) {
+            snapshotAt = std::strtoull(arg.c_str() + 14, nullptr, 10);
+        } else if (arg.compare(0, 10, "--restore=") == 0) {
+            restoreFile = arg.substr(10);
+        } else if (arg == "--profile") {
+            profile = true;
+        } else if (arg.compare(0, 10, "--profile=") == 0) {
+            profile = true;
+            profileFile = arg.substr(10);
+        } else if (arg.compare(0, 10, "--symbols=") == 0) {
+            symbolsFile = arg.substr(10);
+        } else if (arg.compare(0, 9, "--folded=") == 0) {
+            profile = true;
+            foldedFile = arg.substr(9);
+        } else if (arg.compare(0, 9, "--native=") == 0) {
+            nativeFile = arg.substr(9);
+        } else if (arg.compare(0, 9, "--record=") == 0) {
+            recordFile = arg.substr(9);
+        } else if (arg.compare(0, 19, "--checkpoint-every=") == 0) {
+            checkpointInterval = static_cast<uint32_t>(std::strtoul(arg.c_str() + 19, nullptr, 10));
+        } else if (arg.compare(0, 9, "--replay=") == 0) {
+            replayFile = arg.substr(9);
+        } else if (arg.compare(0, 5, "--at=") == 0) {
+            replayAt = std::strtoull(arg.c_str() + 5, nullptr, 10);
+        } else if (arg.compare(0, 10, "--history=") == 0) {
+            history = std::strtoul(arg.c_str() + 10, nullptr, 10);
+        } else if (arg.compare(0, 7, "--dump=") == 0) {
+            dumps.push_back(arg.substr(7));
+        } else if (arg.compare(0, 2, "--") != 0) {
+            objectFiles.push_back(arg);
+        } else {
+            badArgument = true;
+        }
+    }
+
+    if (!fusionTableFile.empty() && !objectFiles.empty() && !badArgument) {
+        return profileSequences(fusionTableFile, objectFiles);
+    }
+
+    if (schedule && !objectFiles.empty() && !badArgument) {
+        return schedulePrograms(objectFiles, threads, quantum, copies, engine, memoryWords);
+    }
+
+    if (!manifestFile.empty() && objectFiles.empty() && !badArgument) {
+        if (engine == VirtualMachine::Engine::Jit) {
+            std::cerr << "Error: Batch mode needs an engine that honours budgets (switch or threaded)." << std::endl;
+            return 1;
+        }
+        BatchRunner batch(threads, engine, std::cout);
+        batch.setMemoryCheck(memoryCheck);
+        batch.setDefaultBudget(budget);
+        batch.setDefaultTimeout(timeoutMs);
+        if (!batch.loadManifest(manifestFile)) {
+            return 1;
+        }
+        return batch.run() == 0 ? 0 : 2;
+    }
+
+    if (!replayFile.empty() && objectFiles.empty() && !badArgument) {
+        Profiler symbols;
+        if (!symbolsFile.empty() && !symbols.loadSymbols(symbolsFile)) {
+            std::cerr << "Error: Could not open listing file " << symbolsFile << std::endl;
+            return 1;
+        }
+        return replayTrace(replayFile, replayAt, history, symbols);
+    }
+
+    bool restoring = !restoreFile.empty();
+    if (objectFiles.size() != (restoring ? 0u : 1u) || badArgument) {
+        std::cerr << "Usage: " << argv[0] << " [--engine=switch|threaded|jit] [--no-fusion] [--stats] [--memory=WORDS]" << std::endl
+                  << "           [--memcheck=none|bounds|guard] [--verify] [--cores=N] [--native=<lib.so>]" << std::endl
+                  << "           [--save-snapshot=<file.snap> [--snapshot-at=N]]" << std::endl
+                  << "           [--record=<file.trace> [--checkpoint-every=N]] [--dump=WHERE:COUNT]... <input.obj>" << std::endl;
+        std::cerr << "       " << argv[0] << " [options] --restore=<file.snap>" << std::endl;
+        std::cerr << "       " << argv[0] << " --profile[=<report.txt>] [--symbols=<input.lst>] [--folded=<stacks.txt>] <input.obj>" << std::endl;
+        std::cerr << "       " << argv[0] << " --replay=<file.trace> [--at=N] [--history=N] [--symbols=<input.lst>]" << std::endl;
+        std::cerr << "       " << argv[0] << " --profile-sequences=<table.def> <input.obj>..." << std::endl;
+        std::cerr << "       " << argv[0] << " --schedule [-j N] [--quantum=N] [--copies=N] [--memory=WORDS] [--engine=switch|threaded] <input.obj>..." << std::endl;
+        std::cerr << "       " << argv[0] << " --batch <manifest.txt> [-j N] [--budget=N] [--timeout=MS] [--engine=switch|threaded]" << std::endl;
+        return 1;
+    }
+    if (coreLimit > 1 && (restoring || !saveSnapshotFile.empty() || !recordFile.empty() || profile)) {
+        // Snapshots, traces and the profiler follow a single core
+        std::cerr << "Error: --cores cannot be combined with --restore, --save-snapshot, --record or --profile."
+                  << std::endl;
+        return 1;
+    }
+    if (!nativeFile.empty() &&
+        (restoring || coreLimit > 1 || !saveSnapshotFile.empty() || !recordFile.empty() || profile)) {
+        // The translation starts from the loaded image and runs one core
+        std::cerr << "Error: --native cannot be combined with --restore, --cores, --save-snapshot, --record or "
+                     "--profile." << std::endl;
+        return 1;
+    }
+
+    VirtualMachine vm(memoryWords);
+    vm.setVerbose(true);
+    vm.setEngine(engine);
+    vm.setFusion(fusion);
+    if (!vm.setMemoryCheck(memoryCheck)) {
+        std::cerr << "Warning: Guard pages are not available here, or --memory is not a whole number of pages; "
+                     "using --memcheck=bounds." << std::endl;
+    }
+
+    Executable program;
+    Profiler profiler;
+    NativeLibrary native;
+    if (!symbolsFile.empty() && !profiler.loadSymbols(symbolsFile)) {
+        std::cerr << "Error: Could not open listing file " << symbolsFile << std::endl;
+        return 1;
+    }
+
+    if (restoring) {
+        // Start from a warmed-up image instead of an object file
+        std::shared_ptr<Snapshot> snapshot = Snapshot::load(restoreFile);
+        if (!snapshot || !vm.restoreSnapshot(*snapshot)) {
+            std::cerr << "Failed to restore snapshot " << restoreFile << std::endl;
+            return 1;
+        }
+        std::cout << "Restored snapshot taken after " << snapshot->getHeader().instructionCount
+                  << " instructions." << std::endl;
+        if (vm.hasFaulted()) {
+            std::cerr << "Error: The snapshot's machine had faulted: " << vm.getError() << std::endl;
+        }
+    } else {
+        std::string objectFile = objectFiles[0];
+
+        if (!program.open(objectFile)) {
+            std::cerr << "Error: " << program.getError() << std::endl;
+            return 1;
+        }
+        if (!vm.loadProgram(program)) {
+            std::cerr << "Failed to load program." << std::endl;
+            return 1;
+        }
+
+        if (!nativeFile.empty() && !native.open(nativeFile)) {
+            std::cerr << "Error: " << native.getError() << std::endl;
+            return 1;
+        }
+
+        if (verify) {
+            VerifierReport report = vm.verifyStackAccesses();
+            std::cout << "Verifier: " << report.proven << " of " << report.stackAccesses
+                      << " stack accesses proven in range (" << report.reachable
+                      << " reachable instructions)." << std::endl;
+        }
+
+        if (!saveSnapshotFile.empty()) {
+            // Run the warm-up prefix, save, then carry on as usual
+            vm.execute(snapshotAt);
+            std::shared_ptr<Snapshot> snapshot = vm.takeSnapshot();
+            if (!snapshot || !snapshot->save(saveSnapshotFile)) {
+                std::cerr << "Failed to save snapshot " << saveSnapshotFile << std::endl;
+                return 1;
+            }
+            std::cout << "Snapshot saved to " << saveSnapshotFile << " after "
+                      << vm.getInstructionCount() << " instructions." << std::endl;
+        }
+
+    }
+
+    // Each WHERE and COUNT is a number or one of the executable's symbols
+    std::vector<DumpRange> ranges;
+    for (const std::string& dump : dumps) {
+        size_t colon = dump.find(':');
+        DumpRange range;
+        if (colon == std::string::npos || !program.lookup(dump.substr(0, colon), range.address) ||
+            !program.lookup(dump.substr(colon + 1), range.count) || range.count <= 0) {
+            std::cerr << "Error: Cannot dump " << dump << " (expected WHERE:COUNT, by number or symbol)" << std::endl;
+            return 1;
+        }
+        int32_t value = 0;
+        if (program.findSymbol(dump.substr(0, colon), value)) {
+            range.symbol = dump.substr(0, colon);
+        }
+        ranges.push_back(range);
+    }
 
     std::cout << "--- Running Program ---" << std::endl;
-    vm.run(); // <-- The program runs and sorts the memory
+    TraceRecorder recorder(checkpointInterval);
+    CoreGroup group(vm, coreLimit);
+    if (!recordFile.empty()) {
+        if (!recorder.record(vm, recordFile)) {
+            std::cerr << "Error: Could not write trace " << recordFile << std::endl;
+            return 1;
+        }
+    } else if (profile) {
+        profiler.run(vm);
+    } else if (coreLimit > 1) {
+        group.run();
+    } else if (native.getProgram()) {
+        if (!vm.runNative(*native.getProgram())) {
+            std::cerr << "Error: " << nativeFile << " was translated from a different program" << std::endl;
+            return 1;
+        }
+    } else {
+        vm.resume(); // <-- The program runs and sorts the memory
+    }
+
+    if (profile) {
+        if (profileFile.empty()) {
+            profiler.writeReport(std::cout);
+        } else {
+            std::ofstream report(profileFile);
+            profiler.writeReport(report);
+        }
+        if (!foldedFile.empty()) {
+            std::ofstream folded(foldedFile);
+            profiler.writeFoldedStacks(folded);
+        }
+    }
 
     std::cout << "--- Program Halted ---" << std::endl;
     vm.dumpState(); // <-- The registers are printed
 
-    // --- VERIFICATION CODE ---
-    
-    std::cout << "--- Verifying Sorted Array in Memory ---" << std::endl;
-    
-    //
-    // !! CRITICAL !!
-    // You MUST update this address in the next step
-    //
-    int32_t array_address = 73; // <-- We will fix this
-    int32_t n = 7;
-
-    std::cout << "Memory at addresses " << array_address 
-              << "-" << (array_address + n - 1) << ":" << std::endl;
-              
-    for (int i = 0; i < n; i++) {
-        // We read the *final* value from memory
-        int32_t value = vm.readMemory(array_address + i); 
-        std::cout << "  addr[" << (array_address + i) << "]: " 
-                  << value << std::endl;
+    if (stats) {
+        vm.dumpStats();
+        if (coreLimit > 1) {
+            group.writeReport(std::cout);
+        }
+    }
+    for (const CoreGroup::CoreReport& report : group.getReports()) {
+        // A joined core's fault is already core 0's
+        if (report.id != 0 && report.faulted && !report.joined) {
+            std::cerr << "Error: Core " << report.id << " faulted: " << report.error << std::endl;
+        }
+    }
+    if (!recordFile.empty()) {
+        recorder.writeReport(std::cout);
+    }
+
+    for (const DumpRange& range : ranges) {
+        std::cout << "Memory at addresses " << range.address << "-" << (range.address + range.count - 1);
+        if (!range.symbol.empty()) {
+            std::cout << " (" << range.symbol << ")";
+        }
+        std::cout << ":" << std::endl;
+        for (int32_t i = 0; i < range.count; i++) {
+            std::cout << "  addr[" << (range.address + i) << "]: " << vm.readMemory(range.address + i) << std::endl;
+        }
     }
 
     return 0;
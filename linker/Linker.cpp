@@ -0,0 +1,190 @@
+#include "Linker.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <unordered_map>
+
+bool Linker::addObject(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        logError("Could not open object file " + filename);
+        return false;
+    }
+
+    ObjectHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, OBJECT_MAGIC, sizeof(header.magic)) != 0) {
+        logError(filename + " is not a relocatable object (assemble it with asm -c)");
+        return false;
+    }
+    if (header.version != OBJECT_VERSION) {
+        logError(filename + " has unsupported object version " + std::to_string(header.version));
+        return false;
+    }
+
+    // The counts decide how much is allocated, so check them against the
+    // file before trusting them
+    in.seekg(0, std::ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+    uint64_t needed = sizeof(header) + static_cast<uint64_t>(header.wordCount) * sizeof(int32_t) +
+                      static_cast<uint64_t>(header.symbolCount) * sizeof(ObjectSymbol) +
+                      static_cast<uint64_t>(header.relocationCount) * sizeof(ObjectRelocation) + header.nameBytes;
+    if (!in || needed > fileSize) {
+        logError(filename + " is truncated");
+        return false;
+    }
+    in.seekg(sizeof(header));
+
+    Module module;
+    module.filename = filename;
+    module.base = 0;
+    module.words.resize(header.wordCount);
+    module.symbols.resize(header.symbolCount);
+    module.relocations.resize(header.relocationCount);
+    module.names.resize(header.nameBytes);
+    in.read(reinterpret_cast<char*>(module.words.data()), module.words.size() * sizeof(int32_t));
+    in.read(reinterpret_cast<char*>(module.symbols.data()), module.symbols.size() * sizeof(ObjectSymbol));
+    in.read(reinterpret_cast<char*>(module.relocations.data()),
+            module.relocations.size() * sizeof(ObjectRelocation));
+    in.read(&module.names[0], module.names.size());
+    if (!in) {
+        logError(filename + " is truncated");
+        return false;
+    }
+
+    // Check every index now so that linking can trust them
+    if (!module.names.empty() && module.names.back() != '\0') {
+        logError(filename + " has a malformed name table");
+        return false;
+    }
+    for (const ObjectSymbol& symbol : module.symbols) {
+        if (symbol.nameOffset >= module.names.size()) {
+            logError(filename + " has a malformed symbol");
+            return false;
+        }
+    }
+    for (const ObjectRelocation& relocation : module.relocations) {
+        if (relocation.address >= module.words.size() || relocation.kind > RELOC_BRANCH ||
+            (relocation.symbol != RELOC_MODULE_BASE && relocation.symbol >= module.symbols.size())) {
+            logError(filename + " has a malformed relocation");
+            return false;
+        }
+    }
+
+    modules.push_back(std::move(module));
+    return true;
+}
+
+bool Linker::link(const std::string& outputFilename, const std::string& mapFilename) {
+    // Layout, then the global namespace of exported symbols
+    struct Global {
+        int32_t value;
+        size_t module;
+    };
+    std::unordered_map<std::string, Global> globals;
+    bool ok = true;
+    int32_t base = 0;
+    for (size_t m = 0; m < modules.size(); m++) {
+        Module& module = modules[m];
+        module.base = base;
+        base += static_cast<int32_t>(module.words.size());
+
+        for (const ObjectSymbol& symbol : module.symbols) {
+            if (!(symbol.flags & SYMBOL_EXPORTED) || (symbol.flags & SYMBOL_IMPORTED)) {
+                continue;
+            }
+            int32_t value = (symbol.flags & SYMBOL_CONSTANT) ? symbol.value : module.base + symbol.value;
+            auto inserted = globals.insert(std::make_pair(std::string(module.name(symbol)), Global{ value, m }));
+            if (!inserted.second) {
+                logError("Duplicate global symbol " + inserted.first->first + " in " +
+                         modules[inserted.first->second.module].filename + " and " + module.filename);
+                ok = false;
+            }
+        }
+    }
+    if (!ok) {
+        return false;
+    }
+
+    std::vector<int32_t> image;
+    image.reserve(base);
+    for (Module& module : modules) {
+        std::set<std::string> undefined; // Reported once per module
+        for (const ObjectRelocation& relocation : module.relocations) {
+            int32_t value = module.base;
+            if (relocation.symbol != RELOC_MODULE_BASE) {
+                const ObjectSymbol& symbol = module.symbols[relocation.symbol];
+                if (symbol.flags & SYMBOL_IMPORTED) {
+                    auto global = globals.find(module.name(symbol));
+                    if (global == globals.end()) {
+                        if (undefined.insert(module.name(symbol)).second) {
+                            logError("Undefined reference to " + std::string(module.name(symbol)) + " in " +
+                                     module.filename);
+                        }
+                        ok = false;
+                        continue;
+                    }
+                    value = global->second.value;
+                } else {
+                    value = (symbol.flags & SYMBOL_CONSTANT) ? symbol.value : module.base + symbol.value;
+                }
+            }
+
+            int32_t& word = module.words[relocation.address];
+            int32_t address = module.base + static_cast<int32_t>(relocation.address);
+            if (relocation.kind == RELOC_WORD) {
+                word += value;
+                continue;
+            }
+            int32_t operand = (word >> 8) + (relocation.kind == RELOC_BRANCH ? value - (address + 1) : value);
+            if (operand < -(1 << 23) || operand >= (1 << 23)) {
+                logError("Relocated operand " + std::to_string(operand) + " at address " +
+                         std::to_string(address) + " does not fit in 24 bits");
+                ok = false;
+            }
+            word = static_cast<int32_t>(static_cast<uint32_t>(operand) << 8) | (word & 0xFF);
+        }
+        image.insert(image.end(), module.words.begin(), module.words.end());
+    }
+    if (!ok) {
+        return false;
+    }
+
+    std::ofstream out(outputFilename, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(image.data()), image.size() * sizeof(int32_t));
+    if (!out) {
+        logError("Could not write " + outputFilename);
+        return false;
+    }
+    return mapFilename.empty() || writeMap(mapFilename);
+}
+
+bool Linker::writeMap(const std::string& mapFilename) const {
+    std::vector<std::pair<int32_t, std::string> > labels;
+    for (const Module& module : modules) {
+        for (const ObjectSymbol& symbol : module.symbols) {
+            if (!(symbol.flags & (SYMBOL_CONSTANT | SYMBOL_IMPORTED))) {
+                labels.push_back(std::make_pair(module.base + symbol.value, std::string(module.name(symbol))));
+            }
+        }
+    }
+    std::sort(labels.begin(), labels.end());
+
+    std::ofstream map(mapFilename);
+    map << "Symbol table:" << "\n" << std::hex << std::setfill('0');
+    for (const auto& label : labels) {
+        map << std::setw(8) << label.first << " " << label.second << "\n";
+    }
+    if (!map) {
+        logError("Could not write " + mapFilename);
+        return false;
+    }
+    return true;
+}
+
+void Linker::logError(const std::string& message) const {
+    std::cerr << "Error: " << message << std::endl;
+}
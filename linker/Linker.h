@@ -0,0 +1,44 @@
+#ifndef LINKER_H
+#define LINKER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../ObjectFormat.h"
+
+// Combines relocatable objects (asm -c) into the flat image that
+// VirtualMachine::loadProgram expects.
+//
+// Modules are placed one after another in the order they were added, so
+// the first one starts at address 0, where execution begins. Exported
+// symbols form one global namespace; every relocation is then resolved
+// against it or against its own module's load address.
+class Linker {
+public:
+    // Reads one object; returns false if it is missing or malformed
+    bool addObject(const std::string& filename);
+
+    // Lays out the modules, applies the relocations and writes the image.
+    // If 'mapFilename' is given, also writes every label's final address
+    // in the listing's "Symbol table:" format (usable with --symbols).
+    bool link(const std::string& outputFilename, const std::string& mapFilename = "");
+
+private:
+    struct Module {
+        std::string filename;
+        std::vector<int32_t> words;
+        std::vector<ObjectSymbol> symbols;
+        std::vector<ObjectRelocation> relocations;
+        std::string names;
+        int32_t base;
+
+        const char* name(const ObjectSymbol& symbol) const { return names.c_str() + symbol.nameOffset; }
+    };
+
+    std::vector<Module> modules;
+
+    bool writeMap(const std::string& mapFilename) const;
+    void logError(const std::string& message) const;
+};
+
+#endif // LINKER_H
@@ -0,0 +1,37 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Linker.h"
+
+int main(int argc, char* argv[]) {
+    std::string outputFile;
+    std::string mapFile;
+    std::vector<std::string> objectFiles;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            outputFile = argv[++i];
+        } else if (arg.compare(0, 6, "--map=") == 0) {
+            mapFile = arg.substr(6);
+        } else {
+            objectFiles.push_back(arg);
+        }
+    }
+    if (outputFile.empty() || objectFiles.empty()) {
+        std::cerr << "Usage: " << argv[0] << " -o <output.obj> [--map=<file>] <module.o>..." << std::endl;
+        return 1;
+    }
+
+    Linker linker;
+    for (const auto& objectFile : objectFiles) {
+        if (!linker.addObject(objectFile)) {
+            return 1;
+        }
+    }
+    if (!linker.link(outputFile, mapFile)) {
+        std::cerr << "Link failed." << std::endl;
+        return 1;
+    }
+    std::cout << "Linked " << objectFiles.size() << " modules into " << outputFile << std::endl;
+    return 0;
+}
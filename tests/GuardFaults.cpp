@@ -0,0 +1,141 @@
+// Checks that a guard-page fault leaves the machine exactly as an explicit
+// bounds check does, on every engine, and that guard mode never lets an
+// out-of-range access through. Run with "make check".
+
+#include "../emulator/VirtualMachine.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+int32_t word(int32_t opcode, int32_t operand = 0) {
+    return static_cast<int32_t>(static_cast<uint32_t>(operand) << 8) | (opcode & 0xFF);
+}
+
+struct Program {
+    const char* name;
+    std::vector<int32_t> text;  // Loaded as the text range
+    std::vector<int32_t> extra; // Written after it, so engines interpret it
+};
+
+const std::vector<Program> programs = {
+    // Straight-line code that faults on its ninth instruction
+    { "straight", {
+        word(OP_LDC, 4000), word(OP_A2SP), word(OP_LDC, 3), word(OP_LDC, 4), word(OP_ADD),
+        word(OP_STL, 1), word(OP_LDL, 1), word(OP_LDC, 70000), word(OP_LDNL, 0), word(OP_HALT) }, {} },
+
+    // A counted loop, then a load below address 0 that changes B on success
+    { "loop", {
+        word(OP_LDC, 4000), word(OP_A2SP), word(OP_LDC, 10), word(OP_STL, 0),
+        word(OP_LDL, 0), word(OP_ADC, -1), word(OP_STL, 0), word(OP_LDL, 0), word(OP_BRZ, 1), word(OP_BR, -6),
+        word(OP_LDL, 0), word(OP_ADC, -100), word(OP_A2SP), word(OP_LDL, 2), word(OP_HALT) }, {} },
+
+    // Faults inside a fused ldl/ldl/sub sequence
+    { "fused", {
+        word(OP_LDC, 4000), word(OP_A2SP), word(OP_LDC, 5), word(OP_STL, 0),
+        word(OP_LDL, 0), word(OP_LDL, -5000), word(OP_SUB), word(OP_HALT) }, {} },
+
+    // Faults in code past the text range, which threaded code interprets
+    { "interpreted", {
+        word(OP_LDC, 4000), word(OP_A2SP), word(OP_LDC, 8), word(OP_STL, 0), word(OP_BR, 0) }, {
+        word(OP_LDL, 0), word(OP_LDC, 99999), word(OP_STNL, 0), word(OP_HALT) } },
+};
+
+struct FaultState {
+    int32_t a, b, pc, sp;
+    uint64_t instructions;
+    bool faulted;
+    std::string error;
+
+    bool operator==(const FaultState& other) const {
+        return a == other.a && b == other.b && pc == other.pc && sp == other.sp &&
+               instructions == other.instructions && faulted == other.faulted && error == other.error;
+    }
+};
+
+std::ostream& operator<<(std::ostream& out, const FaultState& state) {
+    return out << "A=" << state.a << " B=" << state.b << " PC=" << state.pc << " SP=" << state.sp
+               << " instructions=" << state.instructions << " faulted=" << state.faulted
+               << " \"" << state.error << "\"";
+}
+
+FaultState run(const Program& program, VirtualMachine::Engine engine, bool fusion,
+               VirtualMachine::MemoryCheck mode) {
+    VirtualMachine vm;
+    vm.setEngine(engine);
+    vm.setFusion(fusion);
+    vm.setMemoryCheck(mode);
+    vm.loadImage(program.text.data(), program.text.size());
+    if (!program.extra.empty()) {
+        vm.writeMemory(static_cast<int32_t>(program.text.size()), program.extra.data(), program.extra.size());
+    }
+    vm.execute(UINT64_MAX);
+    return FaultState{ vm.getA(), vm.getB(), vm.getPC(), vm.getSP(), vm.getInstructionCount(),
+                       vm.hasFaulted(), vm.getError() };
+}
+
+const char* engineName(VirtualMachine::Engine engine) {
+    switch (engine) {
+        case VirtualMachine::Engine::Switch: return "switch";
+        case VirtualMachine::Engine::Threaded: return "threaded";
+        case VirtualMachine::Engine::Jit: return "jit";
+    }
+    return "?";
+}
+
+// Guard and bounds mode must agree on every program and engine
+int compareModes() {
+    const VirtualMachine::Engine engines[] = {
+        VirtualMachine::Engine::Switch, VirtualMachine::Engine::Threaded, VirtualMachine::Engine::Jit
+    };
+    int failures = 0;
+    for (const Program& program : programs) {
+        for (VirtualMachine::Engine engine : engines) {
+            for (bool fusion : { true, false }) {
+                FaultState bounds = run(program, engine, fusion, VirtualMachine::MemoryCheck::Bounds);
+                FaultState guard = run(program, engine, fusion, VirtualMachine::MemoryCheck::Guard);
+                if (!bounds.faulted || !(guard == bounds)) {
+                    std::cout << "FAIL " << program.name << " on " << engineName(engine)
+                              << (fusion ? "" : " without fusion") << std::endl
+                              << "  bounds: " << bounds << std::endl
+                              << "  guard:  " << guard << std::endl;
+                    failures++;
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+// A load from address size() must fault in guard mode whatever the size
+int checkMemoryEnd() {
+    const size_t page = GuestMemory::pageSize() / sizeof(int32_t);
+    const int sizes[] = { 1000, static_cast<int>(page), static_cast<int>(3 * page + 5) };
+    int failures = 0;
+    for (int size : sizes) {
+        std::vector<int32_t> text = { word(OP_LDC, size), word(OP_LDNL, 0), word(OP_HALT) };
+        VirtualMachine vm(size);
+        bool guarded = vm.setMemoryCheck(VirtualMachine::MemoryCheck::Guard);
+        vm.loadImage(text.data(), text.size());
+        vm.execute(UINT64_MAX);
+        if (!vm.hasFaulted() || vm.getPC() != 1) {
+            std::cout << "FAIL load from address " << size << " of " << size << " words"
+                      << (guarded ? " (guarded)" : " (bounds)") << " did not fault" << std::endl;
+            failures++;
+        }
+    }
+    return failures;
+}
+
+} // namespace
+
+int main() {
+    int failures = compareModes() + checkMemoryEnd();
+    if (failures) {
+        std::cout << failures << " guard fault checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "Guard fault checks passed" << std::endl;
+    return 0;
+}
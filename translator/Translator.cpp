@@ -0,0 +1,454 @@
+#include "Translator.h"
+#include "../Common.h"
+#include "../emulator/Executable.h"
+#include <algorithm>
+#include <cctype>
+#include <vector>
+
+namespace {
+
+int8_t opcodeOf(int32_t word) {
+    return static_cast<int8_t>(word & 0xFF);
+}
+
+int32_t operandOf(int32_t word) {
+    return word >> 8;
+}
+
+// The helpers every translation starts with. Arithmetic wraps at 32 bits
+// and shift counts are taken modulo 32, as on the interpreter's x86 host.
+const char* PRELUDE = R"(
+bool isCode(int32_t address) {
+    return static_cast<uint32_t>(address) < STORED_WORDS && ((CODE[address >> 3] >> (address & 7)) & 1);
+}
+
+int32_t add32(int32_t x, int32_t y) {
+    return static_cast<int32_t>(static_cast<uint32_t>(x) + static_cast<uint32_t>(y));
+}
+
+int32_t sub32(int32_t x, int32_t y) {
+    return static_cast<int32_t>(static_cast<uint32_t>(x) - static_cast<uint32_t>(y));
+}
+
+int32_t shl32(int32_t x, int32_t count) {
+    return static_cast<int32_t>(static_cast<uint32_t>(x) << (count & 31));
+}
+
+int32_t shr32(int32_t x, int32_t count) {
+    return x >> (count & 31);
+}
+
+// A block instruction as VirtualMachine::executeBlock() runs it; false
+// after writing the fault to 'state'. Sets 'wroteCode' if it stored into
+// a translated instruction.
+bool block(int32_t opcode, int32_t operand, int32_t& a, int32_t b, int32_t sp, int32_t pc, NativeState* state,
+           bool& wroteCode) {
+    int32_t* memory = state->memory;
+    int64_t size = state->memoryWords;
+    int64_t count = a;
+    auto outOfBounds = [&](int64_t first, int64_t length) {
+        if (length == 1) {
+            std::snprintf(state->error, sizeof(state->error), "Block access out of bounds (address %lld) at PC %d",
+                          static_cast<long long>(first), pc);
+        } else {
+            std::snprintf(state->error, sizeof(state->error),
+                          "Block access out of bounds (addresses %lld to %lld) at PC %d",
+                          static_cast<long long>(first), static_cast<long long>(first + length - 1), pc);
+        }
+        return false;
+    };
+    if (count < 0) {
+        std::snprintf(state->error, sizeof(state->error), "Negative block length %lld at PC %d",
+                      static_cast<long long>(count), pc);
+        return false;
+    }
+
+    int32_t other = 0;
+    if (opcode == OP_BCOPY || opcode == OP_BFILL || opcode == OP_BCMP) {
+        int64_t slot = static_cast<int64_t>(sp) + operand;
+        if (slot < 0 || slot >= size) {
+            return outOfBounds(slot, 1);
+        }
+        other = memory[slot];
+    }
+    if (count > 0 && (b < 0 || b + count > size)) {
+        return outOfBounds(b, count);
+    }
+    if (count > 0 && (opcode == OP_BCOPY || opcode == OP_BCMP) && (other < 0 || other + count > size)) {
+        return outOfBounds(other, count);
+    }
+    if (opcode == OP_BCOPY || opcode == OP_BFILL || opcode == OP_BSORT) {
+        for (int64_t address = b; address < b + count && address < STORED_WORDS && !wroteCode; address++) {
+            wroteCode = isCode(static_cast<int32_t>(address));
+        }
+    }
+
+    int32_t* first = memory + b;
+    switch (opcode) {
+        case OP_BCOPY:
+            std::memmove(first, memory + other, count * sizeof(int32_t));
+            break;
+        case OP_BFILL:
+            std::fill(first, first + count, other);
+            break;
+        case OP_BCMP: {
+            std::pair<int32_t*, int32_t*> differ = std::mismatch(first, first + count, memory + other);
+            a = differ.first == first + count ? 0 : (*differ.first < *differ.second ? -1 : 1);
+            break;
+        }
+        case OP_BSUM: {
+            uint32_t total = 0;
+            for (int64_t i = 0; i < count; i++) {
+                total += static_cast<uint32_t>(first[i]);
+            }
+            a = static_cast<int32_t>(total);
+            break;
+        }
+        case OP_BSORT:
+            std::sort(first, first + count);
+            break;
+    }
+    return true;
+}
+)";
+
+} // namespace
+
+bool Translator::load(const std::string& objectFilename) {
+    filename = objectFilename;
+    Executable program;
+    if (!program.open(objectFilename)) {
+        error = program.getError();
+        return false;
+    }
+    words.resize(program.storedWords());
+    if (!program.readWords(words.data())) {
+        error = "Could not read " + objectFilename;
+        return false;
+    }
+    imageWords = program.imageWords();
+    entry = program.getEntry();
+
+    std::vector<bool> codeSegments(words.size(), false);
+    for (const ExecutableSegment& segment : program.getSegments()) {
+        for (uint32_t i = 0; segment.kind == SEGMENT_CODE && i < segment.wordCount; i++) {
+            if (segment.address + i < words.size()) {
+                codeSegments[segment.address + i] = true;
+            }
+        }
+    }
+    findCode(program.getVersion() >= 2, codeSegments);
+    return checkStores();
+}
+
+void Translator::findCode(bool fromSegments, const std::vector<bool>& codeSegments) {
+    if (fromSegments) {
+        code = codeSegments;
+    } else {
+        // Follow every static transfer from the entry point
+        code.assign(words.size(), false);
+        std::vector<int64_t> pending(1, entry);
+        while (!pending.empty()) {
+            int64_t pc = pending.back();
+            pending.pop_back();
+            if (pc < 0 || pc >= static_cast<int64_t>(words.size()) || code[pc]) {
+                continue;
+            }
+            code[pc] = true;
+            int8_t opcode = opcodeOf(words[pc]);
+            int64_t target = pc + 1 + operandOf(words[pc]);
+            if (opcode == OP_BR || opcode == OP_BRZ || opcode == OP_BRLZ || opcode == OP_CALL) {
+                pending.push_back(target);
+            }
+            if (opcode != OP_BR && opcode != OP_RETURN && opcode != OP_HALT && opcode >= 0 &&
+                opcode < OPCODE_COUNT) {
+                pending.push_back(pc + 1);
+            }
+        }
+    }
+
+    instructions = std::count(code.begin(), code.end(), true);
+    returnTargets.clear();
+    if (isCode(entry)) {
+        returnTargets.insert(entry);
+    }
+    for (size_t pc = 0; pc < code.size(); pc++) {
+        int8_t opcode = opcodeOf(words[pc]);
+        if (!code[pc]) {
+            continue;
+        }
+        if (opcode == OP_CALL && isCode(pc + 1)) {
+            returnTargets.insert(static_cast<int32_t>(pc + 1));
+        } else if (opcode == OP_LDC && isCode(operandOf(words[pc]))) {
+            returnTargets.insert(operandOf(words[pc]));
+        }
+    }
+}
+
+bool Translator::checkStores() {
+    for (size_t pc = 0; pc + 1 < code.size(); pc++) {
+        if (!code[pc] || !code[pc + 1] || opcodeOf(words[pc]) != OP_LDC || opcodeOf(words[pc + 1]) != OP_STNL) {
+            continue;
+        }
+        int64_t address = static_cast<int64_t>(operandOf(words[pc])) + operandOf(words[pc + 1]);
+        if (isCode(address)) {
+            error = filename + ": the stnl at PC " + std::to_string(pc + 1) + " stores into code at address " +
+                    std::to_string(address) + "; self-modifying programs cannot be translated";
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string Translator::jumpTo(int32_t target) const {
+    if (isCode(target)) {
+        return "goto L" + std::to_string(target) + ";";
+    }
+    return "{ PC = " + std::to_string(target) + "; goto leave; }";
+}
+
+void Translator::writeInstruction(std::ostream& out, int32_t pc) const {
+    int32_t word = words[pc];
+    int8_t opcode = opcodeOf(word);
+    int32_t operand = operandOf(word);
+    std::string k = std::to_string(operand);
+    std::string here = std::to_string(pc);
+    std::string next = std::to_string(pc + 1);
+    bool valid = opcode >= 0 && opcode < OPCODE_COUNT;
+
+    out << "L" << pc << ": // ";
+    if (valid) {
+        out << opcodeTable[opcode].mnemonic << (opcodeTable[opcode].expectsOperand() ? " " + k : "") << "\n";
+    } else {
+        out << "word " << word << "\n";
+    }
+    out << "    ++n;\n";
+
+    // Checks the access to 'at'
+    auto access = [&](const std::string& address) {
+        out << "    at = " << address << ";\n"
+            << "    if (static_cast<uint32_t>(at) >= size) { PC = " << here << "; goto bad_access; }\n";
+    };
+    // After a store into a translated instruction the translation no longer
+    // describes the program, so the VM carries on from the next one
+    std::string leaveIfCode = "{ PC = " + next + "; goto leave; }";
+    bool fallsThrough = true;
+    switch (valid ? opcode : -1) {
+        case OP_LDC:
+            out << "    B = A;\n    A = " << k << ";\n";
+            break;
+        case OP_ADC:
+            out << "    A = add32(A, " << k << ");\n";
+            break;
+        case OP_LDL:
+            access("add32(SP, " + k + ")");
+            out << "    B = A;\n    A = M[at];\n";
+            break;
+        case OP_STL:
+            access("add32(SP, " + k + ")");
+            out << "    M[at] = A;\n    A = B;\n    if (isCode(at)) " << leaveIfCode << "\n";
+            break;
+        case OP_LDNL:
+            access("add32(A, " + k + ")");
+            out << "    A = M[at];\n";
+            break;
+        case OP_STNL:
+            access("add32(A, " + k + ")");
+            out << "    M[at] = B;\n    if (isCode(at)) " << leaveIfCode << "\n";
+            break;
+        case OP_ADD:
+            out << "    A = add32(B, A);\n";
+            break;
+        case OP_SUB:
+            out << "    A = sub32(B, A);\n";
+            break;
+        case OP_SHL:
+            out << "    A = shl32(B, A);\n";
+            break;
+        case OP_SHR:
+            out << "    A = shr32(B, A);\n";
+            break;
+        case OP_ADJ:
+            out << "    SP = add32(SP, " << k << ");\n";
+            break;
+        case OP_A2SP:
+            out << "    SP = A;\n    A = B;\n";
+            break;
+        case OP_SP2A:
+            out << "    B = A;\n    A = SP;\n";
+            break;
+        case OP_CALL:
+            out << "    B = A;\n    A = " << next << ";\n    " << jumpTo(pc + 1 + operand) << "\n";
+            fallsThrough = false;
+            break;
+        case OP_RETURN:
+            out << "    PC = A;\n    A = B;\n    goto dispatch;\n";
+            fallsThrough = false;
+            break;
+        case OP_BRZ:
+            out << "    if (A == 0) " << jumpTo(pc + 1 + operand) << "\n";
+            break;
+        case OP_BRLZ:
+            out << "    if (A < 0) " << jumpTo(pc + 1 + operand) << "\n";
+            break;
+        case OP_BR:
+            out << "    " << jumpTo(pc + 1 + operand) << "\n";
+            fallsThrough = false;
+            break;
+        case OP_HALT:
+            out << "    PC = " << next << ";\n    status = NATIVE_HALTED;\n    goto leave;\n";
+            fallsThrough = false;
+            break;
+        case OP_BCOPY:
+        case OP_BFILL:
+        case OP_BCMP:
+        case OP_BSUM:
+        case OP_BSORT:
+            out << "    wroteCode = false;\n"
+                << "    if (!block(" << static_cast<int>(opcode) << ", " << k << ", A, B, SP, " << here
+                << ", state, wroteCode)) { PC = " << here << "; goto fault; }\n"
+                << "    if (wroteCode) " << leaveIfCode << "\n";
+            break;
+        case OP_SPAWN:
+            out << "    A = -1; // Translated programs run on one core\n";
+            break;
+        case OP_JOIN:
+            out << "    PC = " << here << ";\n"
+                << "    std::snprintf(state->error, sizeof(state->error), \"Cannot join core %d at PC " << here
+                << "\", A);\n"
+                << "    goto fault;\n";
+            fallsThrough = false;
+            break;
+        case OP_CAS:
+            // One core, so nothing else can come between the load and the store
+            out << "    slot = static_cast<int64_t>(SP) + " << k << ";\n"
+                << "    if (slot < 0 || slot >= size || static_cast<uint32_t>(A) >= size) {\n"
+                << "        PC = " << here << ";\n"
+                << "        std::snprintf(state->error, sizeof(state->error), "
+                << "\"Compare-and-swap out of bounds (address %lld) at PC " << here << "\",\n"
+                << "                      slot < 0 || slot >= size ? static_cast<long long>(slot) : A);\n"
+                << "        goto fault;\n"
+                << "    }\n"
+                << "    if (M[A] == B) {\n"
+                << "        at = A;\n"
+                << "        M[at] = M[slot];\n"
+                << "        A = B;\n"
+                << "        if (isCode(at)) " << leaveIfCode << "\n"
+                << "    } else {\n"
+                << "        A = M[A];\n"
+                << "    }\n";
+            break;
+        case OP_FENCE:
+            out << "    // fence: nothing to order on one core\n";
+            break;
+        default:
+            // The interpreter leaves PC after an unknown opcode
+            out << "    PC = " << next << ";\n"
+                << "    std::snprintf(state->error, sizeof(state->error), \"Unknown opcode "
+                << static_cast<int>(opcode) << " at address " << here << "\");\n"
+                << "    goto fault;\n";
+            fallsThrough = false;
+            break;
+    }
+    if (fallsThrough && !isCode(pc + 1)) {
+        out << "    " << jumpTo(pc + 1) << "\n";
+    }
+}
+
+void Translator::write(std::ostream& out) const {
+    out << "// Translated by aot from " << filename << "; do not edit.\n"
+        << "//\n"
+        << "// Build it as a shared object for emu --native, or with -DVM_NATIVE_MAIN\n"
+        << "// and libvm.a as a program of its own; either way with emulator/ on the\n"
+        << "// include path (see NativeCode.h).\n"
+        << "#include <algorithm>\n"
+        << "#include <cstdint>\n"
+        << "#include <cstdio>\n"
+        << "#include <cstring>\n"
+        << "#include <utility>\n"
+        << "#include \"NativeCode.h\"\n"
+        << "\n"
+        << "#pragma GCC diagnostic ignored \"-Wunused-label\"\n"
+        << "\n"
+        << "namespace {\n"
+        << "\n";
+    for (int opcode : { OP_BCOPY, OP_BFILL, OP_BCMP, OP_BSUM, OP_BSORT }) {
+        std::string name = opcodeTable[opcode].mnemonic;
+        std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+        out << "const int32_t OP_" << name << " = " << opcode << ";\n";
+    }
+
+    out << "\nconst uint32_t STORED_WORDS = " << words.size() << ";\n"
+        << "\n// The image this was translated from\n"
+        << "const int32_t WORDS[] = {";
+    for (size_t i = 0; i < std::max<size_t>(words.size(), 1); i++) {
+        out << (i % 8 ? " " : "\n    ") << (i < words.size() ? words[i] : 0) << ",";
+    }
+    out << "\n};\n"
+        << "\n// One bit per word translated as an instruction\n"
+        << "const uint8_t CODE[] = {";
+    for (size_t byte = 0; byte < std::max<size_t>((code.size() + 7) / 8, 1); byte++) {
+        int bits = 0;
+        for (size_t bit = 0; bit < 8 && byte * 8 + bit < code.size(); bit++) {
+            bits |= code[byte * 8 + bit] ? 1 << bit : 0;
+        }
+        out << (byte % 16 ? " " : "\n    ") << bits << ",";
+    }
+    out << "\n};\n"
+        << PRELUDE
+        << "\n"
+        << "int32_t run(NativeState* state) {\n"
+        << "    int32_t A = state->a, B = state->b, PC = state->pc, SP = state->sp;\n"
+        << "    int32_t* const M = state->memory;\n"
+        << "    [[maybe_unused]] const int64_t size = state->memoryWords;\n"
+        << "    uint64_t n = 0;\n"
+        << "    [[maybe_unused]] int32_t at = 0;\n"
+        << "    [[maybe_unused]] int64_t slot = 0;\n"
+        << "    [[maybe_unused]] bool wroteCode = false;\n"
+        << "    int32_t status = NATIVE_LEFT_CODE;\n"
+        << "\n"
+        << "    // Where the computed jumps (return) go; anywhere else is left to the VM\n"
+        << "dispatch:\n"
+        << "    switch (PC) {\n";
+    for (int32_t target : returnTargets) {
+        out << "        case " << target << ": goto L" << target << ";\n";
+    }
+    out << "        default: goto leave;\n"
+        << "    }\n"
+        << "\n";
+
+    for (size_t pc = 0; pc < code.size(); pc++) {
+        if (code[pc]) {
+            writeInstruction(out, static_cast<int32_t>(pc));
+        }
+    }
+
+    out << "\n"
+        << "bad_access:\n"
+        << "    std::snprintf(state->error, sizeof(state->error), \"Memory access out of bounds (address %d) at PC %d\",\n"
+        << "                  at, PC);\n"
+        << "    goto fault;\n"
+
+        << "fault:\n"
+        << "    status = NATIVE_FAULTED;\n"
+        << "leave:\n"
+        << "    state->a = A;\n"
+        << "    state->b = B;\n"
+        << "    state->pc = PC;\n"
+        << "    state->sp = SP;\n"
+        << "    state->instructions += n;\n"
+        << "    return status;\n"
+        << "}\n"
+        << "\n"
+        << "} // namespace\n"
+        << "\n"
+        << "extern \"C\" const NativeProgram vm_native_program = {\n"
+        << "    NATIVE_ABI_VERSION, " << entry << ", STORED_WORDS, " << imageWords << ", WORDS, run\n"
+        << "};\n"
+        << "\n"
+        << "#ifdef VM_NATIVE_MAIN\n"
+        << "int main(int argc, char* argv[]) {\n"
+        << "    return vm_native_main(argc, argv, &vm_native_program);\n"
+        << "}\n"
+        << "#endif\n";
+}
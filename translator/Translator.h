@@ -0,0 +1,63 @@
+#ifndef TRANSLATOR_H
+#define TRANSLATOR_H
+
+#include <cstdint>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+// Translates an executable into C++ ahead of time (see emulator/NativeCode.h
+// for how the result is built and run).
+//
+// Every instruction becomes a labelled statement with the semantics of
+// VirtualMachine::executeInstruction inlined, and br, brz, brlz and call
+// become direct gotos. return, the only computed jump, goes through a
+// switch over the addresses it can be expected to reach: the entry point,
+// the words after every call, and code addresses loaded with ldc. A jump
+// anywhere else leaves the native code, and the VM interprets from there.
+//
+// Version 2 executables say which words are code. In version 1 images the
+// code is what static control flow reaches from the entry point. Every
+// memory access is bounds-checked, with the messages of --memcheck=bounds.
+// A store whose address is known at translation time (ldc then stnl) into
+// code is rejected as self-modifying before anything is written; one only
+// found at run time leaves the native code for the VM after it stores.
+// The program runs as a single core.
+class Translator {
+public:
+    // Reads and analyses the program; false if it cannot be read or
+    // cannot be translated (getError() says why)
+    bool load(const std::string& objectFilename);
+
+    // Writes the translation as one C++ source file
+    void write(std::ostream& out) const;
+
+    // Words translated as instructions
+    size_t instructionCount() const { return instructions; }
+
+    const std::string& getError() const { return error; }
+
+private:
+    std::string filename;
+    std::vector<int32_t> words; // The stored words
+    uint32_t imageWords;        // Those plus the zero-filled words
+    int32_t entry;
+    std::vector<bool> code;     // Per stored word: translated as an instruction
+    std::set<int32_t> returnTargets;
+    size_t instructions;
+    std::string error;
+
+    bool isCode(int64_t address) const {
+        return address >= 0 && address < static_cast<int64_t>(code.size()) && code[address];
+    }
+
+    void findCode(bool fromSegments, const std::vector<bool>& codeSegments);
+    bool checkStores();
+
+    // "goto L<target>;", or leaving for the interpreter if it is not code
+    std::string jumpTo(int32_t target) const;
+    void writeInstruction(std::ostream& out, int32_t pc) const;
+};
+
+#endif // TRANSLATOR_H
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "Translator.h"
+
+// Where this binary lives, which is where make puts libvm.a; emulator/
+// there holds NativeCode.h
+static std::string toolDirectory() {
+    char path[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length <= 0) {
+        return ".";
+    }
+    std::string directory(path, length);
+    return directory.substr(0, directory.rfind('/'));
+}
+
+// Runs the host compiler ($CXX, else c++) with 'arguments' after it
+static bool compile(const std::vector<std::string>& arguments) {
+    const char* compiler = std::getenv("CXX");
+    std::vector<std::string> command(1, compiler && *compiler ? compiler : "c++");
+    command.insert(command.end(), arguments.begin(), arguments.end());
+    std::vector<char*> argv;
+    for (std::string& argument : command) {
+        argv.push_back(&argument[0]);
+    }
+    argv.push_back(nullptr);
+
+    pid_t child = fork();
+    if (child == 0) {
+        execvp(argv[0], argv.data());
+        std::perror(argv[0]);
+        _exit(127);
+    }
+    int status = 0;
+    return child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    enum { BuildProgram, BuildLibrary, SourceOnly } mode = BuildProgram;
+    std::string outputFile;
+    std::string objectFile;
+    bool badArgument = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            outputFile = argv[++i];
+        } else if (arg == "--shared") {
+            mode = BuildLibrary;
+        } else if (arg == "--source") {
+            mode = SourceOnly;
+        } else if (arg.compare(0, 1, "-") != 0 && objectFile.empty()) {
+            objectFile = arg;
+        } else {
+            badArgument = true;
+        }
+    }
+    if (objectFile.empty() || badArgument) {
+        std::cerr << "Usage: " << argv[0] << " [--shared | --source] [-o <output>] <program.obj>" << std::endl;
+        std::cerr << "  Builds a native program (default), a library for emu --native (--shared)" << std::endl
+                  << "  or just the C++ source (--source). $CXX picks the compiler." << std::endl;
+        return 1;
+    }
+    if (outputFile.empty()) {
+        std::string base = objectFile.size() > 4 && objectFile.compare(objectFile.size() - 4, 4, ".obj") == 0
+                               ? objectFile.substr(0, objectFile.size() - 4)
+                               : objectFile + ".native";
+        outputFile = base + (mode == BuildLibrary ? ".so" : mode == SourceOnly ? ".cpp" : "");
+    }
+
+    Translator translator;
+    if (!translator.load(objectFile)) {
+        std::cerr << "Error: " << translator.getError() << std::endl;
+        return 1;
+    }
+
+    // The source goes next to the output while it is compiled
+    std::string sourceFile = mode == SourceOnly ? outputFile : outputFile + ".aot.cpp";
+    std::ofstream source(sourceFile);
+    translator.write(source);
+    source.close();
+    if (!source) {
+        std::cerr << "Error: Could not write " << sourceFile << std::endl;
+        return 1;
+    }
+    std::cout << "Translated " << translator.instructionCount() << " instructions from " << objectFile << std::endl;
+    if (mode == SourceOnly) {
+        std::cout << "Wrote " << outputFile << std::endl;
+        return 0;
+    }
+
+    std::string directory = toolDirectory();
+    std::vector<std::string> arguments = { "-std=c++17", "-O2", "-I" + directory + "/emulator" };
+    if (mode == BuildLibrary) {
+        arguments.insert(arguments.end(), { "-shared", "-fPIC", sourceFile, "-o", outputFile });
+    } else {
+        arguments.insert(arguments.end(), { "-DVM_NATIVE_MAIN", sourceFile, directory + "/libvm.a",
+                                            "-pthread", "-lz", "-ldl", "-o", outputFile });
+    }
+    bool built = compile(arguments);
+    std::remove(sourceFile.c_str());
+    if (!built) {
+        std::cerr << "Error: Could not compile the translation of " << objectFile << std::endl;
+        return 1;
+    }
+    std::cout << "Wrote " << outputFile << std::endl;
+    return 0;
+}